@@ -63,6 +63,8 @@
 #include "reportxml.h"
 #include "reportxml_helper.h"
 #include "xml2json.h"
+#include "listclients.h"
+#include "json.h"
 #include "util_crypt.h"
 
 #include "format.h"
@@ -78,6 +80,10 @@
 
 #define ADMIN_MAX_COMMAND_TABLES        8
 
+#define ADMIN_JSONL_BLKSIZE             4096
+
+#define ADMIN_JSON_EXTRA_HEADERS        "Warning: 299 - \"JSON rendering is experimental\"\r\n"
+
 /* Helper macros */
 #define COMMAND_REQUIRE(client,name,var)                                \
     do {                                                                \
@@ -101,6 +107,7 @@
 #define LISTCLIENTS_RAW_REQUEST             "listclients"
 #define LISTCLIENTS_HTML_REQUEST            "listclients.xsl"
 #define LISTCLIENTS_JSON_REQUEST            "listclients.json"
+#define LISTCLIENTS_JSONL_REQUEST           "listclients.jsonl"
 #define STATS_RAW_REQUEST                   "stats"
 #define STATS_HTML_REQUEST                  "stats.xsl"
 #define STATS_JSON_REQUEST                  "stats.json"
@@ -118,6 +125,9 @@
 #define STREAMLIST_PLAINTEXT_REQUEST        "streamlist.txt"
 #define LISTENSOCKETLIST_RAW_REQUEST        "listensocketlist"
 #define LISTENSOCKETLIST_HTML_REQUEST       "listensocketlist.xsl"
+#define FILESERVESTATS_RAW_REQUEST          "fileservestats"
+#define FILESERVESTATS_JSON_REQUEST         "fileservestats.json"
+#define METRICS_PLAINTEXT_REQUEST           "metrics"
 #define MOVECLIENTS_RAW_REQUEST             "moveclients"
 #define MOVECLIENTS_HTML_REQUEST            "moveclients.xsl"
 #define MOVECLIENTS_JSON_REQUEST            "moveclients.json"
@@ -152,11 +162,16 @@
 #define BUILDM3U_RAW_REQUEST                "buildm3u"
 #define EVENTSTREAM_RAW_REQUEST             "eventfeed"
 
+/* Position in a listing of listeners. Listeners are sorted by connection
+ * id, the cursor is the id of the last listener returned.
+ */
 typedef struct {
-    size_t listeners;
-    size_t tls;
-    size_t ipv6;
-} country_t;
+    bool started;
+    connection_id_t after;
+    /* listeners still to return, or 0 for no limit */
+    size_t limit;
+    bool done;
+} admin_listener_cursor_t;
 
 typedef struct {
     const char *prefix;
@@ -174,6 +189,8 @@ static void command_public_stats        (client_t *client, source_t *source, adm
 static void command_queue_reload        (client_t *client, source_t *source, admin_format_t response);
 static void command_list_mounts         (client_t *client, source_t *source, admin_format_t response);
 static void command_list_listen_sockets (client_t *client, source_t *source, admin_format_t response);
+static void command_fileserve_stats     (client_t *client, source_t *source, admin_format_t response);
+static void command_metrics             (client_t *client, source_t *source, admin_format_t response);
 static void command_move_clients        (client_t *client, source_t *source, admin_format_t response);
 static void command_kill_client         (client_t *client, source_t *source, admin_format_t response);
 static void command_kill_source         (client_t *client, source_t *source, admin_format_t response);
@@ -199,6 +216,7 @@ static const admin_command_handler_t handlers[] = {
     { LISTCLIENTS_RAW_REQUEST,              ADMINTYPE_MOUNT,        ADMIN_FORMAT_RAW,           ADMINSAFE_SAFE,     command_show_listeners, NULL},
     { LISTCLIENTS_HTML_REQUEST,             ADMINTYPE_MOUNT,        ADMIN_FORMAT_HTML,          ADMINSAFE_SAFE,     command_show_listeners, NULL},
     { LISTCLIENTS_JSON_REQUEST,             ADMINTYPE_MOUNT,        ADMIN_FORMAT_JSON,          ADMINSAFE_SAFE,     command_show_listeners, NULL},
+    { LISTCLIENTS_JSONL_REQUEST,            ADMINTYPE_MOUNT,        ADMIN_FORMAT_PLAINTEXT,     ADMINSAFE_SAFE,     command_show_listeners, NULL},
     { STATS_RAW_REQUEST,                    ADMINTYPE_HYBRID,       ADMIN_FORMAT_RAW,           ADMINSAFE_SAFE,     command_stats, NULL},
     { STATS_HTML_REQUEST,                   ADMINTYPE_HYBRID,       ADMIN_FORMAT_HTML,          ADMINSAFE_SAFE,     command_stats, NULL},
     { STATS_JSON_REQUEST,                   ADMINTYPE_HYBRID,       ADMIN_FORMAT_JSON,          ADMINSAFE_SAFE,     command_stats, NULL},
@@ -217,6 +235,9 @@ static const admin_command_handler_t handlers[] = {
     { STREAMLIST_JSON_REQUEST,              ADMINTYPE_GENERAL,      ADMIN_FORMAT_JSON,          ADMINSAFE_SAFE,     command_list_mounts, NULL},
     { LISTENSOCKETLIST_RAW_REQUEST,         ADMINTYPE_GENERAL,      ADMIN_FORMAT_RAW,           ADMINSAFE_SAFE,     command_list_listen_sockets, NULL},
     { LISTENSOCKETLIST_HTML_REQUEST,        ADMINTYPE_GENERAL,      ADMIN_FORMAT_HTML,          ADMINSAFE_SAFE,     command_list_listen_sockets, NULL},
+    { FILESERVESTATS_RAW_REQUEST,           ADMINTYPE_GENERAL,      ADMIN_FORMAT_RAW,           ADMINSAFE_SAFE,     command_fileserve_stats, NULL},
+    { FILESERVESTATS_JSON_REQUEST,          ADMINTYPE_GENERAL,      ADMIN_FORMAT_JSON,          ADMINSAFE_SAFE,     command_fileserve_stats, NULL},
+    { METRICS_PLAINTEXT_REQUEST,            ADMINTYPE_GENERAL,      ADMIN_FORMAT_PLAINTEXT,     ADMINSAFE_SAFE,     command_metrics, NULL},
     { MOVECLIENTS_RAW_REQUEST,              ADMINTYPE_MOUNT,        ADMIN_FORMAT_RAW,           ADMINSAFE_HYBRID,   command_move_clients, NULL},
     { MOVECLIENTS_HTML_REQUEST,             ADMINTYPE_HYBRID,       ADMIN_FORMAT_HTML,          ADMINSAFE_HYBRID,   command_move_clients, NULL},
     { MOVECLIENTS_JSON_REQUEST,             ADMINTYPE_HYBRID,       ADMIN_FORMAT_JSON,          ADMINSAFE_HYBRID,   command_move_clients, NULL},
@@ -598,23 +619,35 @@ xmlDocPtr admin_build_sourcelist(const char *mount, client_t *client, admin_form
     return(doc);
 }
 
-void admin_send_response(xmlDocPtr       doc,
-                         client_t       *client,
-                         admin_format_t  response,
-                         const char     *xslt_template)
+static bool admin_render_response(xmlDocPtr        doc,
+                                  client_t        *client,
+                                  admin_format_t   response,
+                                  const char      *xslt_template,
+                                  stats_page_t    *page,
+                                  icecast_error_id_t *error)
 {
+    memset(page, 0, sizeof(*page));
+    *error = ICECAST_ERROR_GEN_MEMORY_EXHAUSTED;
+
     if (response == ADMIN_FORMAT_RAW || response == ADMIN_FORMAT_JSON) {
 
         if (response == ADMIN_FORMAT_RAW) {
             xmlChar *buff = NULL;
             int len = 0;
             xmlDocDumpMemory(doc, &buff, &len);
-            client_send_buffer(client, 200, "text/xml", "utf-8", (const char *)buff, len, NULL);
+            if (!buff)
+                return false;
+            page->body = malloc(len + 1);
+            if (page->body) {
+                memcpy(page->body, buff, len);
+                page->body[len] = 0;
+                page->len = len;
+            }
             xmlFree(buff);
+            page->mediatype = strdup("text/xml");
         } else {
             xmlNodePtr xmlroot = xmlDocGetRootElement(doc);
             const char *ns;
-            char *json;
 
             if (strcmp((const char *)xmlroot->name, "iceresponse") == 0) {
                 ns = XMLNS_LEGACY_RESPONSE;
@@ -622,16 +655,25 @@ void admin_send_response(xmlDocPtr       doc,
                 ns = XMLNS_LEGACY_STATS;
             }
 
-            json = xml2json_render_doc_simple(doc, ns);
-            client_send_buffer(client, 200, "application/json", "utf-8", json, -1, "Warning: 299 - \"JSON rendering is experimental\"\r\n");
-            free(json);
+            page->body = xml2json_render_doc_simple(doc, ns);
+            if (page->body)
+                page->len = strlen(page->body);
+            page->mediatype = strdup("application/json");
+            page->extra_headers = strdup(ADMIN_JSON_EXTRA_HEADERS);
+        }
+        page->charset = strdup("utf-8");
+        if (!page->body || !page->mediatype || !page->charset || (response == ADMIN_FORMAT_JSON && !page->extra_headers)) {
+            stats_page_clear(page);
+            return false;
         }
+        return true;
     } else if (response == ADMIN_FORMAT_HTML) {
         char *fullpath_xslt_template;
         size_t fullpath_xslt_template_len;
         ice_config_t *config = config_get_config();
         const char *showall;
         const char *mount;
+        bool ret;
 
         fullpath_xslt_template_len = strlen(config->adminroot_dir) + strlen(xslt_template) + strlen(PATH_SEPARATOR) + 1;
         fullpath_xslt_template = malloc(fullpath_xslt_template_len);
@@ -646,15 +688,140 @@ void admin_send_response(xmlDocPtr       doc,
 
         if (showall && util_str_to_bool(showall)) {
             const char *params[] = {"param-has-mount", mount ? "'true'" : NULL, "param-showall", "'true'", NULL};
-            xslt_transform(doc, fullpath_xslt_template, client, 200, NULL, params);
+            ret = xslt_render(doc, fullpath_xslt_template, params, &page->body, &page->len, &page->mediatype, &page->charset, error);
         } else {
             const char *params[] = {"param-has-mount", mount ? "'true'" : NULL, "param-showall", NULL, NULL};
-            xslt_transform(doc, fullpath_xslt_template, client, 200, NULL, params);
+            ret = xslt_render(doc, fullpath_xslt_template, params, &page->body, &page->len, &page->mediatype, &page->charset, error);
         }
         free(fullpath_xslt_template);
+        return ret;
+    }
+
+    return false;
+}
+
+void admin_send_response(xmlDocPtr       doc,
+                         client_t       *client,
+                         admin_format_t  response,
+                         const char     *xslt_template)
+{
+    stats_page_t page;
+    icecast_error_id_t error;
+
+    if (response != ADMIN_FORMAT_RAW && response != ADMIN_FORMAT_JSON && response != ADMIN_FORMAT_HTML)
+        return;
+
+    if (admin_render_response(doc, client, response, xslt_template, &page, &error)) {
+        stats_page_send(client, &page);
+        stats_page_clear(&page);
+    } else {
+        client_send_error_by_id(client, error);
+    }
+}
+
+/* Sends JSON that was rendered without building a XML document first,
+ * takes ownership of json. With a key the page is also stored in the
+ * render cache.
+ */
+static void admin_send_json(client_t *client, char *json, const char *key, uint64_t generation)
+{
+    stats_page_t page;
+
+    memset(&page, 0, sizeof(page));
+    page.body = json;
+    if (page.body)
+        page.len = strlen(page.body);
+    page.mediatype = strdup("application/json");
+    page.charset = strdup("utf-8");
+    page.extra_headers = strdup(ADMIN_JSON_EXTRA_HEADERS);
+
+    if (page.body && page.mediatype && page.charset && page.extra_headers) {
+        stats_page_send(client, &page);
+        if (key)
+            stats_render_cache_store(key, generation, &page);
+    } else {
+        client_send_error_by_id(client, ICECAST_ERROR_GEN_MEMORY_EXHAUSTED);
     }
+    stats_page_clear(&page);
 }
 
+/* Sends the stats, reusing pages rendered for other clients where possible */
+/* with since only the stats changed after it are sent, see stats_get_xml_delta() */
+static void admin_send_stats(client_t *client, unsigned int flags, const char *mount, const uint64_t *since, admin_format_t response)
+{
+    static const char *formats[] = {"admin-raw", "admin-html", "admin-json"};
+    const char *format = NULL;
+    char *fullpath_xslt_template = NULL;
+    char extra[3] = "";
+    char *key = NULL;
+    uint64_t generation = 0;
+    xmlDocPtr doc;
+
+    switch (response) {
+        case ADMIN_FORMAT_RAW: format = formats[0]; break;
+        case ADMIN_FORMAT_HTML: format = formats[1]; break;
+        case ADMIN_FORMAT_JSON: format = formats[2]; break;
+        default: break;
+    }
+
+    /* deltas differ for every client, they are not worth caching */
+    if (format && !since) {
+        if (response == ADMIN_FORMAT_HTML) {
+            ice_config_t *config = config_get_config();
+            size_t len = strlen(config->adminroot_dir) + strlen(STATS_HTML_REQUEST) + strlen(PATH_SEPARATOR) + 1;
+            const char *param;
+
+            fullpath_xslt_template = malloc(len);
+            if (fullpath_xslt_template)
+                snprintf(fullpath_xslt_template, len, "%s%s%s", config->adminroot_dir, PATH_SEPARATOR, STATS_HTML_REQUEST);
+            config_release_config();
+
+            /* the parameters passed to the stylesheet */
+            COMMAND_OPTIONAL(client, "showall", param);
+            extra[0] = (param && util_str_to_bool(param)) ? 'a' : '-';
+            COMMAND_OPTIONAL(client, "mount", param);
+            extra[1] = param ? 'm' : '-';
+        }
+
+        if (response != ADMIN_FORMAT_HTML || fullpath_xslt_template)
+            key = stats_render_cache_key(client, format, fullpath_xslt_template, extra, flags, mount);
+        free(fullpath_xslt_template);
+    }
+
+    if (key && stats_render_cache_send(client, key, &generation)) {
+        free(key);
+        return;
+    }
+
+    /* the stats are the largest document served as JSON, they are
+     * rendered directly */
+    if (response == ADMIN_FORMAT_JSON) {
+        admin_send_json(client, stats_get_json(flags, mount, client, since), key, generation);
+        free(key);
+        return;
+    }
+
+    if (since) {
+        doc = stats_get_xml_delta(flags, mount, client, *since);
+    } else {
+        doc = stats_get_xml(flags, mount, client);
+    }
+    if (key) {
+        stats_page_t page;
+        icecast_error_id_t error;
+
+        if (admin_render_response(doc, client, response, STATS_HTML_REQUEST, &page, &error)) {
+            stats_page_send(client, &page);
+            stats_render_cache_store(key, generation, &page);
+        } else {
+            client_send_error_by_id(client, error);
+        }
+        free(key);
+    } else {
+        admin_send_response(doc, client, response, STATS_HTML_REQUEST);
+    }
+    xmlFreeDoc(doc);
+}
 
 static void admin_send_response_simple(client_t *client, source_t *source, admin_format_t response, const char *message, int success)
 {
@@ -884,12 +1051,131 @@ static void command_move_clients(client_t   *client,
     admin_send_response_simple(client, source, response, buf, 1);
 }
 
-static inline xmlNodePtr __add_listener(client_t        *client,
-                                        xmlNodePtr      parent,
-                                        time_t          now,
-                                        operation_mode  mode)
+static char *admin_listener_strdup(const char *str)
+{
+    return str ? strdup(str) : NULL;
+}
+
+static void admin_listener_copy(listclients_listener_t *listener, client_t *client)
+{
+    connection_t *con = client->con;
+    size_t i;
+
+    memset(listener, 0, sizeof(*listener));
+
+    listener->id = con->id;
+    listener->con_time = con->con_time;
+    listener->ip = admin_listener_strdup(con->ip);
+    listener->useragent = admin_listener_strdup(client_get_header(client, HTTPHEAD_USER_AGENT));
+    listener->referer = admin_listener_strdup(httpp_getvar(client->parser, "referer"));
+    listener->host = admin_listener_strdup(client_get_header(client, HTTPHEAD_HOST));
+    listener->username = admin_listener_strdup(client->username);
+    listener->role = admin_listener_strdup(client->role);
+    if (client->acl)
+        listener->acl = admin_listener_strdup(acl_get_name(client->acl));
+    listener->tls = con->tls;
+    listener->protocol = client_protocol_to_string(client->protocol);
+    listener->latitude = con->geoip.latitude;
+    listener->longitude = con->geoip.longitude;
+    listener->have_latitude = con->geoip.have_latitude;
+    listener->have_longitude = con->geoip.have_longitude;
+    memcpy(listener->iso_3166_1_alpha_2, con->geoip.iso_3166_1_alpha_2, sizeof(listener->iso_3166_1_alpha_2));
+
+    listener->history_fill = client->history.fill;
+    for (i = 0; i < client->history.fill; i++)
+        listener->history[i] = admin_listener_strdup(mount_identifier_get_mount(client->history.history[i]));
+}
+
+/* Sets up a cursor from the after and limit parameters of the request */
+static bool admin_listener_cursor_init(admin_listener_cursor_t *cursor, client_t *client)
+{
+    const char *after = NULL;
+    const char *limit = NULL;
+    char *end;
+
+    memset(cursor, 0, sizeof(*cursor));
+
+    if (!client)
+        return true;
+
+    COMMAND_OPTIONAL(client, "after", after);
+    COMMAND_OPTIONAL(client, "limit", limit);
+
+    if (after) {
+        cursor->after = strtoul(after, &end, 10);
+        if (!*after || *end)
+            return false;
+        cursor->started = true;
+    }
+
+    if (limit) {
+        cursor->limit = strtoul(limit, &end, 10);
+        if (!*limit || *end || !cursor->limit)
+            return false;
+    }
+
+    return true;
+}
+
+/* Copies the next page of at most len listeners and moves the cursor
+ * behind them. Returns the number of listeners copied, 0 at the end.
+ */
+static size_t admin_listener_cursor_next(admin_listener_cursor_t *cursor, source_t *source, listclients_listener_t *listeners, size_t len)
+{
+    avl_node *node, *cur;
+    size_t fill = 0;
+
+    if (cursor->done)
+        return 0;
+
+    if (cursor->limit && cursor->limit < len)
+        len = cursor->limit;
+
+    avl_tree_rlock(source->client_tree);
+    if (cursor->started) {
+        /* find the first client with an id above the cursor */
+        node = NULL;
+        cur = source->client_tree->root->right;
+        while (cur) {
+            client_t *client = cur->key;
+
+            if (client->con->id > cursor->after) {
+                node = cur;
+                cur = cur->left;
+            } else {
+                cur = cur->right;
+            }
+        }
+    } else {
+        node = avl_get_first(source->client_tree);
+    }
+
+    for (; node && fill < len; node = avl_get_next(node))
+        admin_listener_copy(&(listeners[fill++]), node->key);
+    avl_tree_unlock(source->client_tree);
+
+    if (fill) {
+        cursor->started = true;
+        cursor->after = listeners[fill - 1].id;
+    }
+
+    if (cursor->limit) {
+        cursor->limit -= fill;
+        if (!cursor->limit)
+            cursor->done = true;
+    }
+
+    if (fill < len)
+        cursor->done = true;
+
+    return fill;
+}
+
+static inline xmlNodePtr __add_listener(const listclients_listener_t    *listener,
+                                        xmlNodePtr                      parent,
+                                        time_t                          now,
+                                        operation_mode                  mode)
 {
-    const char *tmp;
     xmlNodePtr node;
     char buf[22];
 
@@ -903,60 +1189,53 @@ static inline xmlNodePtr __add_listener(client_t        *client,
         return NULL;
 
     memset(buf, '\000', sizeof(buf));
-    snprintf(buf, sizeof(buf)-1, "%lu", client->con->id);
+    snprintf(buf, sizeof(buf)-1, "%lu", listener->id);
     xmlSetProp(node, XMLSTR("id"), XMLSTR(buf));
     xmlNewTextChild(node, NULL, XMLSTR(mode == OMODE_LEGACY ? "ID" : "id"), XMLSTR(buf));
 
-    xmlNewTextChild(node, NULL, XMLSTR(mode == OMODE_LEGACY ? "IP" : "ip"), XMLSTR(client->con->ip));
+    xmlNewTextChild(node, NULL, XMLSTR(mode == OMODE_LEGACY ? "IP" : "ip"), XMLSTR(listener->ip));
 
-    tmp = httpp_getvar(client->parser, "user-agent");
-    if (tmp)
-        xmlNewTextChild(node, NULL, XMLSTR(mode == OMODE_LEGACY ? "UserAgent" : "useragent"), XMLSTR(tmp));
+    if (listener->useragent)
+        xmlNewTextChild(node, NULL, XMLSTR(mode == OMODE_LEGACY ? "UserAgent" : "useragent"), XMLSTR(listener->useragent));
 
-    tmp = httpp_getvar(client->parser, "referer");
-    if (tmp)
-        xmlNewTextChild(node, NULL, XMLSTR("referer"), XMLSTR(tmp));
+    if (listener->referer)
+        xmlNewTextChild(node, NULL, XMLSTR("referer"), XMLSTR(listener->referer));
 
-    tmp = httpp_getvar(client->parser, "host");
-    if (tmp)
-        xmlNewTextChild(node, NULL, XMLSTR("host"), XMLSTR(tmp));
+    if (listener->host)
+        xmlNewTextChild(node, NULL, XMLSTR("host"), XMLSTR(listener->host));
 
-    snprintf(buf, sizeof(buf), "%lu", (unsigned long)(now - client->con->con_time));
+    snprintf(buf, sizeof(buf), "%lu", (unsigned long)(now - listener->con_time));
     xmlNewTextChild(node, NULL, XMLSTR(mode == OMODE_LEGACY ? "Connected" : "connected"), XMLSTR(buf));
 
-    if (client->username)
-        xmlNewTextChild(node, NULL, XMLSTR("username"), XMLSTR(client->username));
-
-    if (client->role)
-        xmlNewTextChild(node, NULL, XMLSTR("role"), XMLSTR(client->role));
+    if (listener->username)
+        xmlNewTextChild(node, NULL, XMLSTR("username"), XMLSTR(listener->username));
 
-    if (client->acl && acl_get_name(client->acl))
-        xmlNewTextChild(node, NULL, XMLSTR("acl"), XMLSTR(acl_get_name(client->acl)));
+    if (listener->role)
+        xmlNewTextChild(node, NULL, XMLSTR("role"), XMLSTR(listener->role));
 
-    xmlNewTextChild(node, NULL, XMLSTR("tls"), XMLSTR(client->con->tls ? "true" : "false"));
+    if (listener->acl)
+        xmlNewTextChild(node, NULL, XMLSTR("acl"), XMLSTR(listener->acl));
 
-    xmlNewTextChild(node, NULL, XMLSTR("protocol"), XMLSTR(client_protocol_to_string(client->protocol)));
+    xmlNewTextChild(node, NULL, XMLSTR("tls"), XMLSTR(listener->tls ? "true" : "false"));
 
-    if (client->con) {
-        connection_t *con = client->con;
+    xmlNewTextChild(node, NULL, XMLSTR("protocol"), XMLSTR(listener->protocol));
 
-        if (*con->geoip.iso_3166_1_alpha_2 || con->geoip.have_latitude || con->geoip.have_longitude) {
-            xmlNodePtr geoip = xmlNewChild(node, NULL, XMLSTR("geoip"), NULL);
+    if (*listener->iso_3166_1_alpha_2 || listener->have_latitude || listener->have_longitude) {
+        xmlNodePtr geoip = xmlNewChild(node, NULL, XMLSTR("geoip"), NULL);
 
-            if (*con->geoip.iso_3166_1_alpha_2) {
-                xmlNodePtr country = xmlNewChild(geoip, NULL, XMLSTR("country"), NULL);
-                xmlSetProp(country, XMLSTR("iso-alpha-2"), XMLSTR(con->geoip.iso_3166_1_alpha_2));
+        if (*listener->iso_3166_1_alpha_2) {
+            xmlNodePtr country = xmlNewChild(geoip, NULL, XMLSTR("country"), NULL);
+            xmlSetProp(country, XMLSTR("iso-alpha-2"), XMLSTR(listener->iso_3166_1_alpha_2));
+        }
+        if (listener->have_latitude || listener->have_longitude) {
+            xmlNodePtr location = xmlNewChild(geoip, NULL, XMLSTR("location"), NULL);
+            if (listener->have_latitude) {
+                snprintf(buf, sizeof(buf), "%f", listener->latitude);
+                xmlSetProp(location, XMLSTR("latitude"), XMLSTR(buf));
             }
-            if (con->geoip.have_latitude || con->geoip.have_longitude) {
-                xmlNodePtr location = xmlNewChild(geoip, NULL, XMLSTR("location"), NULL);
-                if (con->geoip.have_latitude) {
-                    snprintf(buf, sizeof(buf), "%f", con->geoip.latitude);
-                    xmlSetProp(location, XMLSTR("latitude"), XMLSTR(buf));
-                }
-                if (con->geoip.have_longitude) {
-                    snprintf(buf, sizeof(buf), "%f", con->geoip.longitude);
-                    xmlSetProp(location, XMLSTR("longitude"), XMLSTR(buf));
-                }
+            if (listener->have_longitude) {
+                snprintf(buf, sizeof(buf), "%f", listener->longitude);
+                xmlSetProp(location, XMLSTR("longitude"), XMLSTR(buf));
             }
         }
     }
@@ -965,35 +1244,54 @@ static inline xmlNodePtr __add_listener(client_t        *client,
         xmlNodePtr history = xmlNewChild(node, NULL, XMLSTR("history"), NULL);
         size_t i;
 
-        for (i = 0; i < client->history.fill; i++) {
-            xmlNewTextChild(history, NULL, XMLSTR("mount"), XMLSTR(mount_identifier_get_mount(client->history.history[i])));
+        for (i = 0; i < listener->history_fill; i++) {
+            xmlNewTextChild(history, NULL, XMLSTR("mount"), XMLSTR(listener->history[i]));
         }
     } while (0);
 
     return node;
 }
 
+/* Adds the listeners selected by cursor, a page at a time so client_tree
+ * is never locked while the XML is built.
+ */
+static void admin_add_listeners_to_mount__cursor(source_t                *source,
+                                                 xmlNodePtr              parent,
+                                                 operation_mode          mode,
+                                                 admin_listener_cursor_t *cursor)
+{
+    listclients_listener_t *listeners = malloc(sizeof(*listeners) * LISTCLIENTS_PAGE);
+    time_t now = time(NULL);
+    size_t fill, i;
+
+    if (!listeners)
+        return;
+
+    while ((fill = admin_listener_cursor_next(cursor, source, listeners, LISTCLIENTS_PAGE))) {
+        for (i = 0; i < fill; i++) {
+            __add_listener(&(listeners[i]), parent, now, mode);
+            listclients_listener_clear(&(listeners[i]));
+        }
+    }
+
+    free(listeners);
+}
+
 void admin_add_listeners_to_mount(source_t          *source,
                                   xmlNodePtr        parent,
                                   operation_mode    mode)
 {
-    time_t now = time(NULL);
-    avl_node *client_node;
+    admin_listener_cursor_t cursor;
 
-    avl_tree_rlock(source->client_tree);
-    client_node = avl_get_first(source->client_tree);
-    while(client_node) {
-        __add_listener((client_t *)client_node->key, parent, now, mode);
-        client_node = avl_get_next(client_node);
-    }
-    avl_tree_unlock(source->client_tree);
+    admin_listener_cursor_init(&cursor, NULL);
+    admin_add_listeners_to_mount__cursor(source, parent, mode, &cursor);
 }
 
-static void admin_add_geoip_to_mount__country(source_t          *source,
-                                       xmlNodePtr        parent,
-                                       operation_mode    mode,
-                                       const char        *code,
-                                       country_t         *country)
+static void admin_add_geoip_to_mount__country(source_t                *source,
+                                       xmlNodePtr              parent,
+                                       operation_mode          mode,
+                                       const char              *code,
+                                       listclients_country_t   *country)
 {
     if (country->listeners) {
         xmlNodePtr node = xmlNewChild(parent, NULL, XMLSTR("country"), NULL);
@@ -1013,24 +1311,19 @@ static void admin_add_geoip_to_mount__country(source_t          *source,
     }
 }
 
-void admin_add_geoip_to_mount(source_t          *source,
-                              xmlNodePtr        parent,
-                              operation_mode    mode)
+static void admin_count_geoip(source_t *source, listclients_country_t countries[26][26], listclients_country_t *default_country)
 {
     avl_node *client_node;
-    xmlNodePtr geoip = xmlNewChild(parent, NULL, XMLSTR("geoip"), NULL);
-    country_t countries[26][26];
-    country_t default_country;
 
-    memset(countries, 0, sizeof(countries));
-    memset(&default_country, 0, sizeof(default_country));
+    memset(countries, 0, sizeof(listclients_country_t) * 26 * 26);
+    memset(default_country, 0, sizeof(*default_country));
 
     avl_tree_rlock(source->client_tree);
     client_node = avl_get_first(source->client_tree);
     while(client_node) {
         client_t *client = client_node->key;
         connection_t *con = client->con;
-        country_t *country = &default_country;
+        listclients_country_t *country = default_country;
 
         if (con && *con->geoip.iso_3166_1_alpha_2) {
             const char *iso = client->con->geoip.iso_3166_1_alpha_2;
@@ -1052,6 +1345,17 @@ void admin_add_geoip_to_mount(source_t          *source,
         client_node = avl_get_next(client_node);
     }
     avl_tree_unlock(source->client_tree);
+}
+
+void admin_add_geoip_to_mount(source_t          *source,
+                              xmlNodePtr        parent,
+                              operation_mode    mode)
+{
+    xmlNodePtr geoip = xmlNewChild(parent, NULL, XMLSTR("geoip"), NULL);
+    listclients_country_t countries[26][26];
+    listclients_country_t default_country;
+
+    admin_count_geoip(source, countries, &default_country);
 
     for (size_t idx_a = 0; idx_a < 26; idx_a++) {
         for (size_t idx_b = 0; idx_b < 26; idx_b++) {
@@ -1063,14 +1367,194 @@ void admin_add_geoip_to_mount(source_t          *source,
     admin_add_geoip_to_mount__country(source, geoip, mode, NULL, &default_country);
 }
 
+typedef struct {
+    source_t *source;
+    admin_listener_cursor_t *cursor;
+} admin_listeners_json_t;
+
+static size_t admin_listeners_json_next(void *userdata, listclients_listener_t *listeners, size_t len)
+{
+    admin_listeners_json_t *state = userdata;
+
+    return admin_listener_cursor_next(state->cursor, state->source, listeners, len);
+}
+
+/* Renders the listclients document directly from source->client_tree,
+ * see listclients_json_write_source().
+ */
+static char *admin_render_listeners_json(source_t *source, operation_mode mode, admin_listener_cursor_t *cursor)
+{
+    admin_listeners_json_t state = {source, cursor};
+    json_renderer_t *renderer;
+    listclients_country_t countries[26][26];
+    listclients_country_t default_country;
+
+    renderer = json_renderer_create(JSON_RENDERER_FLAGS_NONE);
+    if (!renderer)
+        return NULL;
+
+    admin_count_geoip(source, countries, &default_country);
+
+    xml2json_render_legacystats_begin(renderer);
+    module_container_write_modulelist_json(global.modulecontainer, renderer);
+    listclients_json_write_source(renderer, source->mount, source->listeners, mode,
+                                  admin_listeners_json_next, &state, countries, &default_country);
+
+    return json_renderer_finish(&renderer);
+}
+
+typedef struct {
+    refbuf_t *head;
+    refbuf_t *cur;
+} admin_jsonl_t;
+
+static void admin_jsonl_append(admin_jsonl_t *jsonl, const char *data, size_t len)
+{
+    while (len) {
+        size_t todo;
+
+        if (!jsonl->cur || jsonl->cur->len == ADMIN_JSONL_BLKSIZE) {
+            refbuf_t *next = refbuf_new(ADMIN_JSONL_BLKSIZE);
+
+            next->len = 0;
+            if (jsonl->cur) {
+                jsonl->cur->next = next;
+            } else {
+                jsonl->head = next;
+            }
+            jsonl->cur = next;
+        }
+
+        todo = ADMIN_JSONL_BLKSIZE - jsonl->cur->len;
+        if (todo > len)
+            todo = len;
+
+        memcpy(jsonl->cur->data + jsonl->cur->len, data, todo);
+        jsonl->cur->len += todo;
+        data += todo;
+        len -= todo;
+    }
+}
+
+/* Renders the next page of the listeners selected by cursor as JSON lines,
+ * one listener object per line in the form used by listclients.json.
+ * client_tree is only locked while the page is copied. Returns NULL at the end.
+ */
+static refbuf_t *admin_render_listeners_jsonl(source_t *source, operation_mode mode, admin_listener_cursor_t *cursor)
+{
+    listclients_listener_t *listeners = malloc(sizeof(*listeners) * LISTCLIENTS_PAGE);
+    admin_jsonl_t jsonl = {NULL, NULL};
+    time_t now = time(NULL);
+    size_t fill, i;
+
+    if (!listeners)
+        return NULL;
+
+    while (!jsonl.head && (fill = admin_listener_cursor_next(cursor, source, listeners, LISTCLIENTS_PAGE))) {
+        for (i = 0; i < fill; i++) {
+            json_renderer_t *renderer = json_renderer_create(JSON_RENDERER_FLAGS_NONE);
+            char *line;
+
+            if (renderer) {
+                listclients_json_write_listener(renderer, &(listeners[i]), now, mode);
+                line = json_renderer_finish(&renderer);
+                if (line) {
+                    admin_jsonl_append(&jsonl, line, strlen(line));
+                    admin_jsonl_append(&jsonl, "\n", 1);
+                    free(line);
+                }
+            }
+            listclients_listener_clear(&(listeners[i]));
+        }
+    }
+
+    free(listeners);
+
+    return jsonl.head;
+}
+
+/* State of a listclients.jsonl response, the pages are rendered by the
+ * file serving thread as the client takes them.
+ */
+typedef struct {
+    char *mount;
+    operation_mode mode;
+    admin_listener_cursor_t cursor;
+} admin_jsonl_producer_t;
+
+static refbuf_t *admin_jsonl_produce(void *arg)
+{
+    admin_jsonl_producer_t *producer = arg;
+    refbuf_t *page = NULL;
+    source_t *source;
+
+    /* the source may be gone by now, that ends the listing */
+    avl_tree_rlock(global.source_tree);
+    source = source_find_mount_raw(producer->mount);
+    if (source)
+        page = admin_render_listeners_jsonl(source, producer->mode, &(producer->cursor));
+    avl_tree_unlock(global.source_tree);
+
+    return page;
+}
+
+static void admin_jsonl_producer_free(void *arg)
+{
+    admin_jsonl_producer_t *producer = arg;
+
+    free(producer->mount);
+    free(producer);
+}
+
 static void command_show_listeners(client_t *client,
                                    source_t *source,
                                    admin_format_t response)
 {
+    admin_listener_cursor_t cursor;
     xmlDocPtr doc;
     xmlNodePtr node, srcnode;
     char buf[22];
 
+    if (!admin_listener_cursor_init(&cursor, client)) {
+        client_send_error_by_id(client, ICECAST_ERROR_ADMIN_MISSING_PARAMETER);
+        return;
+    }
+
+    if (response == ADMIN_FORMAT_JSON) {
+        admin_send_json(client, admin_render_listeners_json(source, client->mode, &cursor), NULL, 0);
+        return;
+    } else if (response == ADMIN_FORMAT_PLAINTEXT) {
+        admin_jsonl_producer_t *producer;
+        ssize_t ret = util_http_build_header(client->refbuf->data,
+                                             PER_CLIENT_REFBUF_SIZE, 0,
+                                             0, 200, NULL,
+                                             "application/jsonl", "utf-8",
+                                             "", NULL, client);
+
+        if (ret == -1 || ret >= PER_CLIENT_REFBUF_SIZE) {
+            ICECAST_LOG_ERROR("Dropping client as we can not build response headers.");
+            client_send_error_by_id(client, ICECAST_ERROR_GEN_HEADER_GEN_FAILED);
+            return;
+        }
+
+        producer = calloc(1, sizeof(*producer));
+        if (producer)
+            producer->mount = strdup(source->mount);
+        if (!producer || !producer->mount) {
+            free(producer);
+            client_send_error_by_id(client, ICECAST_ERROR_GEN_MEMORY_EXHAUSTED);
+            return;
+        }
+        producer->mode = client->mode;
+        producer->cursor = cursor;
+
+        client->refbuf->len = strlen(client->refbuf->data);
+        client->respcode = 200;
+
+        fserve_add_client_producer(client, admin_jsonl_produce, admin_jsonl_producer_free, producer);
+        return;
+    }
+
     doc = xmlNewDoc(XMLSTR("1.0"));
     node = admin_build_rootnode(doc, "icestats");
     srcnode = xmlNewChild(node, NULL, XMLSTR("source"), NULL);
@@ -1082,7 +1566,7 @@ static void command_show_listeners(client_t *client,
     /* BEFORE RELEASE NEXT DOCUMENT #2097: Changed "Listeners" to lower case. */
     xmlNewTextChild(srcnode, NULL, XMLSTR(client->mode == OMODE_LEGACY ? "Listeners" : "listeners"), XMLSTR(buf));
 
-    admin_add_listeners_to_mount(source, srcnode, client->mode);
+    admin_add_listeners_to_mount__cursor(source, srcnode, client->mode, &cursor);
     admin_add_geoip_to_mount(source, srcnode, client->mode);
 
     admin_send_response(doc, client, response,
@@ -1464,11 +1948,22 @@ static void command_stats(client_t *client, source_t *source, admin_format_t res
 {
     unsigned int flags = STATS_XML_FLAG_SHOW_HIDDEN;
     const char *mount = (source) ? source->mount : NULL;
-    xmlDocPtr doc;
     const char *show_listeners;
+    const char *since_param;
+    uint64_t since;
 
     ICECAST_LOG_DEBUG("Stats request, sending xml stats");
 
+    COMMAND_OPTIONAL(client, "since", since_param);
+    if (since_param) {
+        if (!stats_parse_sequence(since_param, &since)) {
+            client_send_error_by_id(client, ICECAST_ERROR_ADMIN_MISSING_PARAMETER);
+            return;
+        }
+        admin_send_stats(client, flags, mount, &since, response);
+        return;
+    }
+
     COMMAND_OPTIONAL(client, "show-listeners", show_listeners);
     if (show_listeners) {
         if (util_str_to_bool(show_listeners))
@@ -1478,18 +1973,14 @@ static void command_stats(client_t *client, source_t *source, admin_format_t res
             flags |= STATS_XML_FLAG_SHOW_LISTENERS;
     }
 
-    doc = stats_get_xml(flags, mount, client);
-    admin_send_response(doc, client, response, STATS_HTML_REQUEST);
-    xmlFreeDoc(doc);
+    admin_send_stats(client, flags, mount, NULL, response);
     return;
 }
 
 static void command_public_stats        (client_t *client, source_t *source, admin_format_t response)
 {
     const char *mount = (source) ? source->mount : NULL;
-    xmlDocPtr doc = stats_get_xml(STATS_XML_FLAG_PUBLIC_VIEW, mount, client);
-    admin_send_response(doc, client, response, STATS_HTML_REQUEST);
-    xmlFreeDoc(doc);
+    admin_send_stats(client, STATS_XML_FLAG_PUBLIC_VIEW, mount, NULL, response);
     return;
 }
 
@@ -1588,6 +2079,8 @@ static void command_list_listen_sockets(client_t *client, source_t *source, admi
         reportxml_helper_add_value_boolean(config, "shoutcast_compat", listener->shoutcast_compat);
         reportxml_helper_add_value_string(config, "shoutcast_mount", listener->shoutcast_mount);
         reportxml_helper_add_value_enum(config, "tlsmode", listensocket_tlsmode_to_string(listener->tls));
+        reportxml_helper_add_value_boolean(config, "tls_session_resumption", listener->tls_session_resumption);
+        reportxml_helper_add_value_boolean(config, "tls_ktls", listener->tls_ktls);
 
         if (listener->authstack) {
             reportxml_node_t * extension = reportxml_node_new(REPORTXML_NODE_TYPE_EXTENSION, NULL, NULL, NULL);
@@ -1655,6 +2148,67 @@ static void command_list_listen_sockets(client_t *client, source_t *source, admi
     refobject_unref(report);
 }
 
+static void command_fileserve_stats(client_t *client, source_t *source, admin_format_t response)
+{
+    reportxml_t *report = client_get_empty_reportxml();
+    fserve_file_stats_t *stats;
+    size_t len, i;
+
+    stats = fserve_get_file_stats(&len);
+
+    for (i = 0; i < len; i++) {
+        reportxml_node_t * incident = client_add_empty_incident(report, "4f37ac74-a69f-497e-885c-d8e1febba878", NULL, NULL);
+        reportxml_node_t * resource = reportxml_node_new(REPORTXML_NODE_TYPE_RESOURCE, NULL, NULL, NULL);
+
+        reportxml_node_set_attribute(resource, "type", "result");
+        reportxml_node_add_child(incident, resource);
+        refobject_unref(incident);
+
+        reportxml_helper_add_value_string(resource, "path", stats[i].path);
+        reportxml_helper_add_value_int(resource, "requests", stats[i].requests);
+        reportxml_helper_add_value_int(resource, "requests_sendfile", stats[i].requests_sendfile);
+        reportxml_helper_add_value_int(resource, "requests_cache", stats[i].requests_cache);
+        reportxml_helper_add_value_int(resource, "requests_read", stats[i].requests_read);
+        reportxml_helper_add_value_int(resource, "bytes", stats[i].bytes);
+        reportxml_helper_add_value_int(resource, "syscalls", stats[i].syscalls);
+
+        refobject_unref(resource);
+    }
+
+    fserve_free_file_stats(stats, len);
+
+    client_send_reportxml(client, report, DOCUMENT_DOMAIN_ADMIN, NULL, response, 200, NULL);
+    refobject_unref(report);
+}
+
+/* The stats in OpenMetrics text format, for scraping by Prometheus and
+ * friends. Rendered straight from the stats without building a document.
+ */
+static void command_metrics(client_t *client, source_t *source, admin_format_t response)
+{
+    ssize_t ret;
+
+    ICECAST_LOG_DEBUG("Metrics request");
+
+    ret = util_http_build_header(client->refbuf->data,
+                                 PER_CLIENT_REFBUF_SIZE, 0,
+                                 0, 200, NULL,
+                                 "application/openmetrics-text; version=1.0.0", "utf-8",
+                                 "", NULL, client);
+
+    if (ret == -1 || ret >= PER_CLIENT_REFBUF_SIZE) {
+        ICECAST_LOG_ERROR("Dropping client as we can not build response headers.");
+        client_send_error_by_id(client, ICECAST_ERROR_GEN_HEADER_GEN_FAILED);
+        return;
+    }
+
+    client->refbuf->len = strlen (client->refbuf->data);
+    client->respcode = 200;
+
+    client->refbuf->next = stats_get_metrics();
+    fserve_add_client (client, NULL);
+}
+
 static void command_updatemetadata(client_t *client,
                                    source_t *source,
                                    admin_format_t response)
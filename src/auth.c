@@ -115,7 +115,7 @@ static auth_client *auth_client_setup (client_t *client)
         if (client->username || client->password)
             break;
 
-        header = httpp_getvar(client->parser, "authorization");
+        header = client_get_header(client, HTTPHEAD_AUTHORIZATION);
 
         if (header == NULL)
             break;
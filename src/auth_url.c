@@ -373,7 +373,7 @@ static string_renderer_t * url_add_params(auth_client *auth_user, bool is_remove
     string_renderer_add_kv_with_options(renderer, "pass", client->password, STRING_RENDERER_ENCODING_PLAIN, false, false);
     string_renderer_add_kv_with_options(renderer, "ip", client->con->ip, STRING_RENDERER_ENCODING_PLAIN, false, false);
 
-    agent = httpp_getvar(client->parser, "user-agent");
+    agent = client_get_header(client, HTTPHEAD_USER_AGENT);
     string_renderer_add_kv_with_options(renderer, "agent", agent ? agent : "-", STRING_RENDERER_ENCODING_PLAIN, false, false);
 
     if (!is_remove) {
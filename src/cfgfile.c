@@ -49,6 +49,7 @@
 /* for config_reread_config() */
 #include "yp.h"
 #include "fserve.h"
+#include "fanout.h"
 #include "stats.h"
 #include "connection.h"
 #include "main.h"
@@ -73,8 +74,23 @@
 #define CONFIG_DEFAULT_BODY_SIZE_LIMIT  (4*1024)
 #define CONFIG_MIN_BODY_SIZE_LIMIT      ( 1*1024)
 #define CONFIG_MAX_BODY_SIZE_LIMIT      (64*1024)
+#define CONFIG_DEFAULT_HEADER_SIZE_LIMIT (16*1024)
+#define CONFIG_MIN_HEADER_SIZE_LIMIT    ( 4*1024)
+#define CONFIG_MAX_HEADER_SIZE_LIMIT    (256*1024)
 #define CONFIG_DEFAULT_BURST_SIZE       (64*1024)
 #define CONFIG_DEFAULT_THREADPOOL_SIZE  4
+#define CONFIG_DEFAULT_LISTENER_THREADS 1
+#define CONFIG_MAX_LISTENER_THREADS     64
+#define CONFIG_DEFAULT_FILESERVE_THREADS 1
+#define CONFIG_MAX_FILESERVE_THREADS    64
+#define CONFIG_DEFAULT_CONNECTION_THREADS 1
+#define CONFIG_DEFAULT_HANDLER_THREADS  4
+#define CONFIG_MAX_QUEUE_THREADS        64
+#define CONFIG_DEFAULT_FILESERVE_CACHE_SIZE 0
+#define CONFIG_MAX_FILESERVE_CACHE_SIZE (1024*1024*1024)
+#define CONFIG_DEFAULT_FILESERVE_CACHE_FILE_SIZE (1024*1024)
+#define CONFIG_DEFAULT_XSLT_CACHE_SIZE 16
+#define CONFIG_MAX_XSLT_CACHE_SIZE      4096
 #define CONFIG_DEFAULT_CLIENT_TIMEOUT   30
 #define CONFIG_RANGE_CLIENT_TIMEOUT     2, 600
 #define CONFIG_MAX_CLIENT_TIMEOUT       600
@@ -108,6 +124,9 @@
 #define CONFIG_DEFAULT_RELAY_SERVER     "127.0.0.1"
 #define CONFIG_DEFAULT_RELAY_PORT       80
 #define CONFIG_DEFAULT_RELAY_MOUNT      "/"
+#define CONFIG_DEFAULT_TLS_SESSION_CACHE_SIZE   20480
+#define CONFIG_DEFAULT_TLS_SESSION_TIMEOUT      3600
+#define CONFIG_DEFAULT_TLS_TICKET_KEY_ROTATION  3600
 #define CONFIG_DEFAULT_CIPHER_LIST      "ECDHE-ECDSA-CHACHA20-POLY1305:" \
                                         "ECDHE-RSA-CHACHA20-POLY1305:" \
                                         "ECDHE-ECDSA-AES128-GCM-SHA256:" \
@@ -276,6 +295,19 @@ static fallback_override_t config_str_to_fallback_override_t(ice_config_t *confi
     }
 }
 
+static listener_io_t config_str_to_listener_io(ice_config_t *configuration, xmlNodePtr node, const char *str)
+{
+    if (!str || !*str || strcasecmp(str, "poll") == 0) {
+        return LISTENER_IO_POLL;
+    } else if (strcasecmp(str, "epoll") == 0) {
+        return LISTENER_IO_EPOLL;
+    } else {
+        __found_bad_tag(configuration, node, BTR_INVALID, str);
+        ICECAST_LOG_ERROR("Unknown listener I/O mode \"%s\", falling back to poll.", str);
+        return LISTENER_IO_POLL;
+    }
+}
+
 static interpolation_t config_str_to_interpolation_t(ice_config_t *configuration, xmlNodePtr node, const char *str)
 {
     if (!str || !*str || strcmp(str, "default") == 0) {
@@ -1028,6 +1060,9 @@ void config_reread_config(void)
         connection_reread_config(config);
         yp_recheck_config(config);
         fserve_recheck_mime_types(config);
+        fserve_recheck_cache(config);
+        fserve_set_threads(config->fileserve_threads);
+        fanout_set_threads(config->listener_threads);
         stats_global(config);
         config_release_config();
         slave_update_all_mounts();
@@ -1187,6 +1222,8 @@ static void _set_defaults(ice_config_t *configuration)
         ->queue_size_limit = CONFIG_DEFAULT_QUEUE_SIZE_LIMIT;
     configuration
         ->body_size_limit = CONFIG_DEFAULT_BODY_SIZE_LIMIT;
+    configuration
+        ->header_size_limit = CONFIG_DEFAULT_HEADER_SIZE_LIMIT;
     configuration
         ->client_timeout = CONFIG_DEFAULT_CLIENT_TIMEOUT;
     configuration
@@ -1254,8 +1291,30 @@ static void _set_defaults(ice_config_t *configuration)
     /* default to a typical prebuffer size used by clients */
     configuration
         ->burst_size = CONFIG_DEFAULT_BURST_SIZE;
+    configuration
+        ->listener_threads = CONFIG_DEFAULT_LISTENER_THREADS;
+    configuration
+        ->listener_io = LISTENER_IO_POLL;
+    configuration
+        ->fileserve_threads = CONFIG_DEFAULT_FILESERVE_THREADS;
+    configuration
+        ->connection_threads = CONFIG_DEFAULT_CONNECTION_THREADS;
+    configuration
+        ->handler_threads = CONFIG_DEFAULT_HANDLER_THREADS;
+    configuration
+        ->fileserve_cache_size = CONFIG_DEFAULT_FILESERVE_CACHE_SIZE;
+    configuration
+        ->fileserve_cache_file_size = CONFIG_DEFAULT_FILESERVE_CACHE_FILE_SIZE;
+    configuration
+        ->xslt_cache_size = CONFIG_DEFAULT_XSLT_CACHE_SIZE;
     configuration->tls_context
         .cipher_list = (char *) xmlCharStrdup(CONFIG_DEFAULT_CIPHER_LIST);
+    configuration->tls_context
+        .session_cache_size = CONFIG_DEFAULT_TLS_SESSION_CACHE_SIZE;
+    configuration->tls_context
+        .session_timeout = CONFIG_DEFAULT_TLS_SESSION_TIMEOUT;
+    configuration->tls_context
+        .ticket_key_rotation = CONFIG_DEFAULT_TLS_TICKET_KEY_ROTATION;
 }
 
 static inline void __check_hostname(ice_config_t *configuration)
@@ -1536,6 +1595,8 @@ static void _parse_limits(xmlDocPtr     doc,
             __read_int(configuration, doc, node, &configuration->source_limit, 1, CONFIG_MAX_SOURCE_LIMIT);
         } else if (xmlStrcmp(node->name, XMLSTR("bodysize")) == 0) {
             __read_int(configuration, doc, node, &configuration->body_size_limit, CONFIG_MIN_BODY_SIZE_LIMIT, CONFIG_MAX_BODY_SIZE_LIMIT);
+        } else if (xmlStrcmp(node->name, XMLSTR("headersize")) == 0) {
+            __read_int(configuration, doc, node, &configuration->header_size_limit, CONFIG_MIN_HEADER_SIZE_LIMIT, CONFIG_MAX_HEADER_SIZE_LIMIT);
         } else if (xmlStrcmp(node->name, XMLSTR("queue-size")) == 0) {
             __read_unsigned_int(configuration, doc, node, &configuration->queue_size_limit, 1, CONFIG_MAX_QUEUE_SIZE_LIMIT);
         } else if (xmlStrcmp(node->name, XMLSTR("client-timeout")) == 0) {
@@ -1557,6 +1618,25 @@ static void _parse_limits(xmlDocPtr     doc,
                 xmlFree(tmp);
         } else if (xmlStrcmp(node->name, XMLSTR("burst-size")) == 0) {
             __read_unsigned_int(configuration, doc, node, &configuration->burst_size, 0, CONFIG_MAX_QUEUE_SIZE_LIMIT);
+        } else if (xmlStrcmp(node->name, XMLSTR("listener-threads")) == 0) {
+            __read_unsigned_int(configuration, doc, node, &configuration->listener_threads, 0, CONFIG_MAX_LISTENER_THREADS);
+        } else if (xmlStrcmp(node->name, XMLSTR("listener-io")) == 0) {
+            tmp = (char *)xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
+            configuration->listener_io = config_str_to_listener_io(configuration, node, tmp);
+            if (tmp)
+                xmlFree(tmp);
+        } else if (xmlStrcmp(node->name, XMLSTR("fileserve-threads")) == 0) {
+            __read_unsigned_int(configuration, doc, node, &configuration->fileserve_threads, 0, CONFIG_MAX_FILESERVE_THREADS);
+        } else if (xmlStrcmp(node->name, XMLSTR("connection-threads")) == 0) {
+            __read_unsigned_int(configuration, doc, node, &configuration->connection_threads, 0, CONFIG_MAX_QUEUE_THREADS);
+        } else if (xmlStrcmp(node->name, XMLSTR("handler-threads")) == 0) {
+            __read_unsigned_int(configuration, doc, node, &configuration->handler_threads, 0, CONFIG_MAX_QUEUE_THREADS);
+        } else if (xmlStrcmp(node->name, XMLSTR("fileserve-cache-size")) == 0) {
+            __read_unsigned_int(configuration, doc, node, &configuration->fileserve_cache_size, 0, CONFIG_MAX_FILESERVE_CACHE_SIZE);
+        } else if (xmlStrcmp(node->name, XMLSTR("fileserve-cache-file-size")) == 0) {
+            __read_unsigned_int(configuration, doc, node, &configuration->fileserve_cache_file_size, 1, CONFIG_MAX_FILESERVE_CACHE_SIZE);
+        } else if (xmlStrcmp(node->name, XMLSTR("xslt-cache-size")) == 0) {
+            __read_unsigned_int(configuration, doc, node, &configuration->xslt_cache_size, 0, CONFIG_MAX_XSLT_CACHE_SIZE);
         } else {
             __found_bad_tag(configuration, node, BTR_UNKNOWN, NULL);
         }
@@ -2311,6 +2391,8 @@ static void _parse_listen_socket(xmlDocPtr      doc,
     if (listener == NULL)
         return;
     listener->port = 8000;
+    listener->tls_session_resumption = 1;
+    listener->tls_ktls = 1;
 
     listener->id  = (char *)xmlGetProp(node, XMLSTR("id"));
 
@@ -2348,6 +2430,16 @@ static void _parse_listen_socket(xmlDocPtr      doc,
             listener->tls = str_to_tlsmode(tmp);
             if(tmp)
                 xmlFree(tmp);
+        } else if (xmlStrcmp(node->name, XMLSTR("tls-session-resumption")) == 0) {
+            tmp = (char *)xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
+            listener->tls_session_resumption = util_str_to_bool(tmp);
+            if(tmp)
+                xmlFree(tmp);
+        } else if (xmlStrcmp(node->name, XMLSTR("tls-ktls")) == 0) {
+            tmp = (char *)xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
+            listener->tls_ktls = util_str_to_bool(tmp);
+            if(tmp)
+                xmlFree(tmp);
         } else if (xmlStrcmp(node->name, XMLSTR("shoutcast-compat")) == 0) {
             tmp = (char *)xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
             listener->shoutcast_compat = util_str_to_bool(tmp);
@@ -2367,6 +2459,8 @@ static void _parse_listen_socket(xmlDocPtr      doc,
             __read_int(configuration, doc, node, &listener->so_sndbuf, RANGE_SNDBUF);
         } else if (xmlStrcmp(node->name, XMLSTR("listen-backlog")) == 0) {
             __read_int(configuration, doc, node, &listener->listen_backlog, 1, 128);
+        } else if (xmlStrcmp(node->name, XMLSTR("accept-threads")) == 0) {
+            __read_int(configuration, doc, node, &listener->accept_threads, 1, 64);
         } else if (xmlStrcmp(node->name, XMLSTR("authentication")) == 0) {
             _parse_authentication_node(configuration, node, &(listener->authstack));
         } else if (xmlStrcmp(node->name, XMLSTR("http-headers")) == 0) {
@@ -2385,6 +2479,8 @@ static void _parse_listen_socket(xmlDocPtr      doc,
         listener_t *sc_port = calloc(1, sizeof(listener_t));
         sc_port->port = listener->port+1;
         sc_port->shoutcast_compat = 1;
+        sc_port->tls_session_resumption = listener->tls_session_resumption;
+        sc_port->tls_ktls = listener->tls_ktls;
         sc_port->shoutcast_mount = (char*)xmlStrdup(XMLSTR(listener->shoutcast_mount));
         if (listener->bind_address)
             sc_port->bind_address = (char*)xmlStrdup(XMLSTR(listener->bind_address));
@@ -2928,6 +3024,12 @@ static void _parse_tls_context(xmlDocPtr       doc,
             if (context->cipher_list)
                 xmlFree(context->cipher_list);
             context->cipher_list = (char *)xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
+        } else if (xmlStrcmp(node->name, XMLSTR("tls-session-cache-size")) == 0) {
+            __read_int(configuration, doc, node, &context->session_cache_size, 0, 1048576);
+        } else if (xmlStrcmp(node->name, XMLSTR("tls-session-timeout")) == 0) {
+            __read_int(configuration, doc, node, &context->session_timeout, 60, 86400);
+        } else if (xmlStrcmp(node->name, XMLSTR("tls-ticket-key-rotation")) == 0) {
+            __read_int(configuration, doc, node, &context->ticket_key_rotation, 0, 86400);
         } else {
             __found_bad_tag(configuration, node, BTR_UNKNOWN, NULL);
         }
@@ -3219,6 +3321,7 @@ listener_t *config_copy_listener_one(const listener_t *listener) {
     n->port = listener->port;
     n->so_sndbuf = listener->so_sndbuf;
     n->listen_backlog = listener->listen_backlog;
+    n->accept_threads = listener->accept_threads;
     n->type = listener->type;
     n->id = (char*)xmlStrdup(XMLSTR(listener->id));
     if (listener->on_behalf_of) {
@@ -3228,6 +3331,8 @@ listener_t *config_copy_listener_one(const listener_t *listener) {
     n->shoutcast_compat = listener->shoutcast_compat;
     n->shoutcast_mount = (char*)xmlStrdup(XMLSTR(listener->shoutcast_mount));
     n->tls = listener->tls;
+    n->tls_session_resumption = listener->tls_session_resumption;
+    n->tls_ktls = listener->tls_ktls;
 
     if (listener->authstack) {
         auth_stack_addref(n->authstack = listener->authstack);
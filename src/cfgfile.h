@@ -88,6 +88,13 @@ typedef enum {
     INTERPOLATION_UUID
 } interpolation_t;
 
+typedef enum {
+    /* wait for the source and retry busy listeners on a short timer */
+    LISTENER_IO_POLL = 0,
+    /* only service listeners once their socket is writable */
+    LISTENER_IO_EPOLL
+} listener_io_t;
+
 typedef struct _mount_proxy {
     /* The mountpoint this proxy is used for */
     char *mountname;
@@ -193,10 +200,16 @@ typedef struct _listener_t {
     int port;
     int so_sndbuf;
     int listen_backlog;
+    /* number of SO_REUSEPORT sockets with their own accept thread */
+    int accept_threads;
     char *bind_address;
     int shoutcast_compat;
     char *shoutcast_mount;
     tlsmode_t tls;
+    /* allow resuming TLS sessions created on this socket */
+    int tls_session_resumption;
+    /* hand the record layer to the kernel where supported */
+    int tls_ktls;
     auth_stack_t *authstack;
     /* additional HTTP headers */
     ice_config_http_header_t *http_headers;
@@ -206,6 +219,9 @@ typedef struct _config_tls_context {
     char *cert_file;
     char *key_file;
     char *cipher_list;
+    int session_cache_size;
+    int session_timeout;
+    int ticket_key_rotation;
 } config_tls_context_t;
 
 typedef struct {
@@ -253,8 +269,17 @@ struct ice_config_tag {
     int client_limit;
     int source_limit;
     int body_size_limit;
+    int header_size_limit;
     unsigned int queue_size_limit;
     unsigned int burst_size;
+    unsigned int listener_threads;
+    listener_io_t listener_io;
+    unsigned int fileserve_threads;
+    unsigned int connection_threads;
+    unsigned int handler_threads;
+    unsigned int fileserve_cache_size;
+    unsigned int fileserve_cache_file_size;
+    unsigned int xslt_cache_size;
     int client_timeout;
     int header_timeout;
     int source_timeout;
@@ -133,10 +133,51 @@ void client_shutdown(void)
     avl_tree_free(global_client_list, NULL);
 }
 
+/* set up the per request state of a client, taking over refbuf if given */
+static void client_init_request(client_t *client, connection_t *con, http_parser_t *parser, refbuf_t *refbuf)
+{
+    client->con = con;
+    client->parser = parser;
+    client->protocol = ICECAST_PROTOCOL_HTTP;
+    client->request_body_length = 0;
+    client->request_body_read = 0;
+    client->admin_command = ADMIN_COMMAND_ERROR;
+    client->refbuf = refbuf ? refbuf : refbuf_new (PER_CLIENT_REFBUF_SIZE);
+    client->refbuf->len = 0; /* force reader code to ignore buffer contents */
+    client->pos = 0;
+    client->write_to_client = format_generic_write_to_client;
+    navigation_history_init(&(client->history));
+}
+
+/* release everything the client holds for its current request, except for
+ * the connection, parser and refbuf */
+static void client_clear_request(client_t *client)
+{
+    if (client->encoding)
+        httpp_encoding_release(client->encoding);
+
+    /* we need to free client specific format data (if any) */
+    if (client->free_client_data)
+        client->free_client_data(client);
+
+    igloo_ro_unref(&(client->handler_module));
+    free(client->handler_function);
+    free(client->uri);
+    free(client->username);
+    free(client->password);
+    free(client->role);
+    acl_release(client->acl);
+    navigation_history_clear(&(client->history));
+
+    free(client->request_known);
+    client->request_known = NULL;
+    client->request_known_valid = 0;
+}
+
 /* create a client_t with the provided connection and parser details. Return
  * 0 on success, -1 if server limit has been reached.  In either case a
- * client_t is returned just in case a message needs to be returned. Should
- * be called with global lock held.
+ * client_t is returned just in case a message needs to be returned. Takes
+ * the global lock only for the client count.
  */
 int client_create(client_t **c_ptr, connection_t *con, http_parser_t *parser)
 {
@@ -144,33 +185,27 @@ int client_create(client_t **c_ptr, connection_t *con, http_parser_t *parser)
     client_t        *client = (client_t *) calloc(1, sizeof(client_t));
     const listener_t *listener_real, *listener_effective;
     int              ret    = -1;
+    int              clients;
 
     if (client == NULL)
         abort();
 
     config = config_get_config();
 
-    global.clients++;
-    if (config->client_limit < global.clients) {
-        ICECAST_LOG_WARN("Server's configured global client limit reached (%d of %d), rejecting client", global.clients, config->client_limit);
+    global_lock();
+    clients = ++global.clients;
+    stats_event_args (NULL, "clients", "%d", clients);
+    global_unlock();
+
+    if (config->client_limit < clients) {
+        ICECAST_LOG_WARN("Server's configured global client limit reached (%d of %d), rejecting client", clients, config->client_limit);
     } else {
         ret = 0;
     }
 
     config_release_config ();
 
-    stats_event_args (NULL, "clients", "%d", global.clients);
-    client->con = con;
-    client->parser = parser;
-    client->protocol = ICECAST_PROTOCOL_HTTP;
-    client->request_body_length = 0;
-    client->request_body_read = 0;
-    client->admin_command = ADMIN_COMMAND_ERROR;
-    client->refbuf = refbuf_new (PER_CLIENT_REFBUF_SIZE);
-    client->refbuf->len = 0; /* force reader code to ignore buffer contents */
-    client->pos = 0;
-    client->write_to_client = format_generic_write_to_client;
-    navigation_history_init(&(client->history));
+    client_init_request(client, con, parser, NULL);
     *c_ptr = client;
 
     avl_tree_wlock(global_client_list);
@@ -183,7 +218,7 @@ int client_create(client_t **c_ptr, connection_t *con, http_parser_t *parser)
             client, con, (long long unsigned int)con->id, con->sock,
             con->listensocket_real, con->listensocket_real ? listener_real->id : NULL,
             con->listensocket_effective, con->listensocket_effective ? listener_effective->id : NULL,
-            global.clients, config->client_limit
+            clients, config->client_limit
             );
     listensocket_release_listener(con->listensocket_effective);
     listensocket_release_listener(con->listensocket_real);
@@ -240,6 +275,8 @@ void client_complete(client_t *client)
 
 static inline void client_reuseconnection(client_t *client) {
     connection_t *con;
+    http_parser_t *parser;
+    refbuf_t *refbuf;
     reuse_t reuse;
 
     if (!client)
@@ -249,7 +286,7 @@ static inline void client_reuseconnection(client_t *client) {
     reuse = client->reuse;
 
     if (reuse == ICECAST_REUSE_UPGRADETLS) {
-        http_parser_t *parser = client->parser;
+        parser = client->parser;
 
         httpp_deletevar(parser, "upgrade");
         client->reuse = ICECAST_REUSE_CLOSE;
@@ -267,37 +304,43 @@ static inline void client_reuseconnection(client_t *client) {
         return;
     }
 
-    ICECAST_LOG_DEBUG("Reusing connection %p (connection ID: %llu, sock=%R) of old client %p", con, (long long unsigned int)con->id, con->sock, client);
-    con = connection_create(con->sock, con->listensocket_real, con->listensocket_effective, strdup(con->ip));
-    client->con->sock = SOCK_ERROR;
-
-    /* handle to keep the TLS connection */
-    if (client->con->tls) {
-        /* AHhhggrr.. That pain....
-         * stealing TLS state...
-         */
-        con->tls  = client->con->tls;
-        con->read = client->con->read;
-        con->send = client->con->send;
-        client->con->tls  = NULL;
-        client->con->read = NULL;
-        client->con->send = NULL;
-    }
+    /* the buffer can only be kept if nobody else is using it */
+    refbuf = client->refbuf;
+    if (refbuf && (refbuf_get_count(refbuf) != 1 || refbuf->next || refbuf->associated))
+        client_set_queue(client, NULL);
+
+    /* the auth thread calls client_destroy() again when it is done */
+    if (auth_release_client(client))
+        return;
+
+    if (client->respcode)
+        logging_access(client);
+
+    ICECAST_LOG_DEBUG("Reusing connection %p (connection ID: %llu, sock=%R) of client %p", con, (long long unsigned int)con->id, con->sock, client);
 
-    if (client->con->readbufferlen) {
-        /* Aend... moorre paaiin.
-         * stealing putback buffer.
-         */
-        con->readbuffer = client->con->readbuffer;
-        con->readbufferlen = client->con->readbufferlen;
-        client->con->readbuffer = NULL;
-        client->con->readbufferlen = 0;
+    parser = client->parser;
+    refbuf = client->refbuf;
+    if (refbuf && refbuf_resize(refbuf, PER_CLIENT_REFBUF_SIZE) != 0) {
+        refbuf_release(refbuf);
+        refbuf = NULL;
     }
 
-    client->reuse = ICECAST_REUSE_CLOSE;
+    /* reset the client in place, keeping its connection, parser and buffer */
+    client_clear_request(client);
+    memset(client, 0, sizeof(*client));
+    connection_reuse(con);
+    client_init_request(client, con, NULL, refbuf);
 
-    client_destroy(client);
-    connection_queue(con);
+    avl_tree_wlock(global_client_list);
+    avl_insert(global_client_list, client);
+    avl_tree_unlock(global_client_list);
+
+    fastevent_emit(FASTEVENT_TYPE_CLIENT_CREATE, FASTEVENT_FLAG_MODIFICATION_ALLOWED, FASTEVENT_DATATYPE_CLIENT, client);
+
+    httpp_clear(parser);
+    httpp_initialize(parser, NULL);
+
+    connection_queue_keepalive(client, parser);
 }
 
 void client_destroy(client_t *client)
@@ -344,26 +387,13 @@ void client_destroy(client_t *client)
         connection_close(client->con);
     if (client->parser)
         httpp_destroy(client->parser);
-    if (client->encoding)
-        httpp_encoding_release(client->encoding);
 
     global_lock();
     global.clients--;
     stats_event_args(NULL, "clients", "%d", global.clients);
     global_unlock();
 
-    /* we need to free client specific format data (if any) */
-    if (client->free_client_data)
-        client->free_client_data(client);
-
-    igloo_ro_unref(&(client->handler_module));
-    free(client->handler_function);
-    free(client->uri);
-    free(client->username);
-    free(client->password);
-    free(client->role);
-    acl_release(client->acl);
-    navigation_history_clear(&(client->history));
+    client_clear_request(client);
 
     free(client);
 }
@@ -607,13 +637,9 @@ void client_send_buffer(client_t *client, int status, const char *mediatype, con
         client_send_error_by_id(client, ICECAST_ERROR_GEN_HEADER_GEN_FAILED);
         return;
     } else if (buf_len < (ret + buf_len_ours)) {
-        void *new_data;
         buf_len = buf_len_ours + ret + 64;
-        new_data = realloc(client->refbuf->data, buf_len);
-        if (new_data) {
+        if (refbuf_resize(client->refbuf, buf_len) == 0) {
             ICECAST_LOG_DEBUG("Client buffer reallocation succeeded.");
-            client->refbuf->data = new_data;
-            client->refbuf->len = buf_len;
             ret = util_http_build_header(client->refbuf->data, buf_len, 0,
                     0, status, NULL,
                     mediatype, charset,
@@ -889,6 +915,30 @@ int client_send_bytes(client_t *client, const void *buf, unsigned len)
     return ret;
 }
 
+/* gathered version of client_send_bytes() */
+ssize_t client_send_iov(client_t *client, const struct iovec *iov, size_t count)
+{
+    ssize_t ret = connection_send_iov(client->con, iov, count);
+    ssize_t done = 0;
+    size_t i;
+
+    if (client->con->error)
+        ICECAST_LOG_DEBUG("Client connection died");
+
+    for (i = 0; i < count; i++) {
+        ssize_t seg = ret;
+
+        if (ret > 0)
+            seg = (size_t)(ret - done) < iov[i].iov_len ? ret - done : (ssize_t)iov[i].iov_len;
+        fastevent_emit(FASTEVENT_TYPE_CLIENT_WRITE, FASTEVENT_FLAG_NONE, FASTEVENT_DATATYPE_OBRD, client, iov[i].iov_base, iov[i].iov_len, seg);
+        if (seg <= 0 || (size_t)seg < iov[i].iov_len)
+            break;
+        done += seg;
+    }
+
+    return ret;
+}
+
 void client_set_queue(client_t *client, refbuf_t *refbuf)
 {
     refbuf_t *to_release = client->refbuf;
@@ -1084,6 +1134,64 @@ client_slurp_result_t client_body_skip(client_t *client)
     }
 }
 
+/* Copies the values of the well-known headers into one small allocation.
+ * The head is 1.5 to 16 KiB and would otherwise be kept for the whole life
+ * of the client.
+ */
+void client_set_request_head(client_t *client, refbuf_t *buffer, httphead_t *head)
+{
+    const char *values[HTTPHEAD_KNOWN_COUNT];
+    unsigned int valid = 0;
+    size_t len = 0;
+    size_t i;
+
+    free(client->request_known);
+    client->request_known = NULL;
+    client->request_known_valid = 0;
+
+    for (i = 0; i < HTTPHEAD_KNOWN_COUNT; i++) {
+        if (!httphead_get_known(head, buffer->data, i, &(values[i])))
+            continue;
+        valid |= 1U << i;
+        if (values[i])
+            len += strlen(values[i]) + 1;
+    }
+
+    if (len)
+        client->request_known = malloc(len);
+
+    if (!len || client->request_known) {
+        len = 0;
+        for (i = 0; i < HTTPHEAD_KNOWN_COUNT; i++) {
+            client->request_known_offset[i] = 0;
+            if (!(valid & (1U << i)) || !values[i])
+                continue;
+            client->request_known_offset[i] = len + 1;
+            strcpy(client->request_known + len, values[i]);
+            len += strlen(values[i]) + 1;
+        }
+        client->request_known_valid = valid;
+    }
+
+    refbuf_release(buffer);
+    httphead_clear(head);
+}
+
+/* Gets one of the well-known request headers without a lookup in the parser.
+ * Falls back to the parser for clients without a request head and for
+ * headers sent more than once.
+ */
+const char *client_get_header(client_t *client, httphead_known_t id)
+{
+    if (id >= 0 && id < HTTPHEAD_KNOWN_COUNT && (client->request_known_valid & (1U << id))) {
+        if (!client->request_known_offset[id])
+            return NULL;
+        return client->request_known + client->request_known_offset[id] - 1;
+    }
+
+    return httpp_getvar(client->parser, httphead_known_name(id));
+}
+
 ssize_t client_get_baseurl(client_t *client, listensocket_t *listensocket, char *buf, size_t len, const char *user, const char *pw, const char *prefix, const char *suffix0, const char *suffix1)
 {
     const listener_t *listener = NULL;
@@ -1108,7 +1216,7 @@ ssize_t client_get_baseurl(client_t *client, listensocket_t *listensocket, char
         suffix1 = "";
 
     if (client) {
-        host = httpp_getvar(client->parser, "host");
+        host = client_get_header(client, HTTPHEAD_HOST);
 
         /* at least a couple of players (fb2k/winamp) are reported to send a
          * host header but without the port number. So if we are missing the
@@ -19,6 +19,8 @@
 #ifndef __CLIENT_H__
 #define __CLIENT_H__
 
+#include <stdbool.h>
+
 #include "common/httpp/httpp.h"
 #include "common/httpp/encoding.h"
 
@@ -27,6 +29,7 @@
 #include "errors.h"
 #include "refbuf.h"
 #include "module.h"
+#include "httphead.h"
 
 #define CLIENT_DEFAULT_REPORT_XSL_HTML                  "report-html.xsl"
 #define CLIENT_DEFAULT_REPORT_XSL_PLAINTEXT             "report-plaintext.xsl"
@@ -73,6 +76,15 @@ struct _client_tag {
     /* the client's http headers */
     http_parser_t *parser;
 
+    /* values of the well-known request headers copied out of the request
+     * head, so the head does not stay allocated (see client_get_header()).
+     * Offset + 1 into request_known per header, 0 if it was not sent. Only
+     * headers with their bit in request_known_valid are answered from here.
+     */
+    char *request_known;
+    size_t request_known_offset[HTTPHEAD_KNOWN_COUNT];
+    unsigned int request_known_valid;
+
     /* Transfer Encoding if any */
     httpp_encoding_t *encoding;
 
@@ -127,6 +139,12 @@ struct _client_tag {
     /* position in first buffer */
     unsigned int pos;
 
+    /* source is waiting for the socket to become writable (epoll mode) */
+    bool wait_writable;
+
+    /* next listener waiting to be taken over by a source, see source_add_pending() */
+    client_t *pending_next;
+
     /* auth used for this client */
     auth_t *auth;
 
@@ -169,12 +187,17 @@ reportxml_t *client_get_empty_reportxml(void);
 reportxml_node_t *client_add_empty_incident(reportxml_t *report, const char *state_definition, const char *state_akindof, const char *state_text);
 admin_format_t client_get_admin_format_by_content_negotiation(client_t *client);
 int client_send_bytes (client_t *client, const void *buf, unsigned len);
+struct iovec;
+ssize_t client_send_iov(client_t *client, const struct iovec *iov, size_t count);
 int client_read_bytes (client_t *client, void *buf, unsigned len);
 void client_set_queue (client_t *client, refbuf_t *refbuf);
 ssize_t client_body_read(client_t *client, void *buf, size_t len);
 int client_body_eof(client_t *client);
 client_slurp_result_t client_body_slurp(client_t *client, void *buf, size_t *len);
 client_slurp_result_t client_body_skip(client_t *client);
+/* keeps the well-known headers of a terminated head, then releases buffer and clears head */
+void client_set_request_head(client_t *client, refbuf_t *buffer, httphead_t *head);
+const char *client_get_header(client_t *client, httphead_known_t id);
 ssize_t client_get_baseurl(client_t *client, listensocket_t *listensocket, char *buf, size_t len, const char *user, const char *pw, const char *prefix, const char *suffix0, const char *suffix1);
 
 #endif  /* __CLIENT_H__ */
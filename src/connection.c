@@ -22,6 +22,8 @@
 #include <stdbool.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
 #ifdef HAVE_POLL
 #include <poll.h>
 #endif
@@ -33,6 +35,14 @@
 #else
 #include <winsock2.h>
 #endif
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include "common/thread/thread.h"
 #include "common/avl/avl.h"
@@ -61,6 +71,7 @@
 #include "tls.h"
 #include "acl.h"
 #include "refobject.h"
+#include "httphead.h"
 #include "listensocket.h"
 #include "fastevent.h"
 #include "navigation.h"
@@ -82,32 +93,102 @@
    Icecast auth style uses HTTP and Basic Authorization.
 */
 
+#ifdef HAVE_SYS_EPOLL_H
+#define CLIENT_QUEUE_USE_EPOLL
+#define CLIENT_QUEUE_EPOLL_EVENTS   64
+/* in seconds, deadlines further away share slots with closer ones */
+#define CLIENT_QUEUE_WHEEL_SIZE     64
+#endif
+
+#define CLIENT_QUEUE_MAX_THREADS    64
+
 typedef struct client_queue_tag {
     client_t *client;
+    /* request head received so far, offset bytes of headbuf_size are used */
+    refbuf_t *headbuf;
+    size_t headbuf_size;
     int offset;
+    httphead_t head;
     int shoutcast;
     char *shoutcast_mount;
     char *bodybuffer;
     size_t bodybufferlen;
     int tried_body;
     bool ready;
+    /* cleared parser of a kept alive connection to parse the request into */
+    http_parser_t *parser;
     struct client_queue_tag *next;
+#ifdef CLIENT_QUEUE_USE_EPOLL
+    /* when the entry gives up waiting for data, and its place in the
+     * timeout wheel of the queue while it waits */
+    time_t deadline;
+    size_t wheel_slot;
+    struct client_queue_tag *wheel_prev;
+    struct client_queue_tag *wheel_next;
+#endif
 } client_queue_entry_t;
 
 typedef struct {
     client_queue_entry_t *head;
     client_queue_entry_t **tail;
-    mutex_t mutex;
-    cond_t cond;
-    thread_type *thread;
+    /* plain pthread so pool threads can check length under the mutex
+     * it is changed under before they wait */
+    pthread_mutex_t mutex;
+    /* signalled when an entry is added, and on shutdown */
+    pthread_cond_t cond;
+    /* Queues not using epoll can be served by a pool of threads. Each
+     * client only has one entry in one queue at a time, so its requests
+     * are still handled in order. */
+    thread_type *threads[CLIENT_QUEUE_MAX_THREADS];
+    size_t threads_len;
     bool running;
+    /* entries in head, guarded by mutex */
+    size_t length;
+    /* histograms, depth is guarded by mutex, service by stats_lock */
+    uint64_t depth[CONNECTION_QUEUE_BUCKETS];
+    uint64_t depth_sum;
+    spin_t stats_lock;
+    uint64_t service[CONNECTION_QUEUE_BUCKETS];
+    uint64_t service_sum;
 #ifdef HAVE_POLL
     struct pollfd *pollfds;
     size_t pollfds_len;
 #endif
+#ifdef CLIENT_QUEUE_USE_EPOLL
+    /* Queues waiting for data from their clients are woken by epoll.
+     * Other threads add to head under mutex and write to wake_fd, the
+     * rest is only used by the queue's own thread.
+     */
+    int epoll_fd;
+    int wake_fd[2];
+    /* entries to try now, and the ones that made progress last time */
+    client_queue_entry_t *ready_head;
+    client_queue_entry_t **ready_tail;
+    client_queue_entry_t *retry_head;
+    client_queue_entry_t **retry_tail;
+    /* entries waiting in epoll_fd, by deadline with one slot per second */
+    client_queue_entry_t *wheel[CLIENT_QUEUE_WHEEL_SIZE];
+    time_t wheel_time;
+    /* entries taken from head the thread is not done with yet, and their
+     * number as last seen under mutex */
+    size_t held;
+    size_t held_published;
+#endif
 } client_queue_t;
 
 #define QUEUE_READY_TIMEOUT 50
+/* in milliseconds, longest time an idle queue thread sleeps */
+#define QUEUE_WAIT_TIMEOUT  1000
+/* first size of the buffer for a request head, fits most requests and is
+ * a size of the refbuf pool. It is grown up to <headersize>. */
+#define REQUEST_HEAD_SIZE   1536
+
+const uint64_t connection_queue_depth_bounds[CONNECTION_QUEUE_BUCKETS - 1] = {
+    0, 1, 2, 4, 8, 16, 32, 64, 128, 256, 512
+};
+const uint64_t connection_queue_service_bounds[CONNECTION_QUEUE_BUCKETS - 1] = {
+    100, 250, 1000, 2500, 10000, 25000, 100000, 250000, 1000000, 2500000, 10000000
+};
 
 static spin_t _connection_lock; // protects _current_id
 static volatile connection_id_t _current_id = 0;
@@ -136,30 +217,123 @@ static void client_queue_init(client_queue_t *queue)
 {
     memset(queue, 0, sizeof(*queue));
     queue->tail = &(queue->head);
-    thread_mutex_create(&(queue->mutex));
-    thread_cond_create(&(queue->cond));
+    pthread_mutex_init(&(queue->mutex), NULL);
+    pthread_cond_init(&(queue->cond), NULL);
+    thread_spin_create(&(queue->stats_lock));
+#ifdef CLIENT_QUEUE_USE_EPOLL
+    queue->epoll_fd = -1;
+    queue->wake_fd[0] = queue->wake_fd[1] = -1;
+    queue->ready_tail = &(queue->ready_head);
+    queue->retry_tail = &(queue->retry_head);
+#endif
 }
 
+#ifdef CLIENT_QUEUE_USE_EPOLL
+static inline void client_queue_wake(client_queue_t *queue)
+{
+    static const char c = 0;
+
+    /* a full pipe wakes the thread just as well */
+    if (write(queue->wake_fd[1], &c, 1) < 0 && errno != EAGAIN)
+        ICECAST_LOG_ERROR("Can not wake queue thread: %s", strerror(errno));
+}
+
+/* Lets the queue wait for data from its clients with epoll rather than
+ * poll(), the queue keeps working the old way if this fails.
+ */
+static void client_queue_use_epoll(client_queue_t *queue)
+{
+    struct epoll_event ev;
+    int i;
+
+    queue->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (queue->epoll_fd < 0) {
+        ICECAST_LOG_WARN("Can not create epoll instance for client queue, falling back to poll: %s", strerror(errno));
+        return;
+    }
+
+    if (pipe(queue->wake_fd) == 0) {
+        for (i = 0; i < 2; i++) {
+            fcntl(queue->wake_fd[i], F_SETFL, fcntl(queue->wake_fd[i], F_GETFL) | O_NONBLOCK);
+            fcntl(queue->wake_fd[i], F_SETFD, FD_CLOEXEC);
+        }
+
+        /* entries are never NULL, so NULL stands for the wake pipe */
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        if (epoll_ctl(queue->epoll_fd, EPOLL_CTL_ADD, queue->wake_fd[0], &ev) == 0) {
+            queue->wheel_time = time(NULL);
+            return;
+        }
+        close(queue->wake_fd[0]);
+        close(queue->wake_fd[1]);
+        queue->wake_fd[0] = queue->wake_fd[1] = -1;
+    }
+
+    ICECAST_LOG_WARN("Can not set up wake up of client queue, falling back to poll: %s", strerror(errno));
+    close(queue->epoll_fd);
+    queue->epoll_fd = -1;
+}
+#endif
+
 static void client_queue_destroy(client_queue_t *queue)
 {
-    if (queue->thread) {
+    size_t i;
+
+    if (queue->threads_len) {
+        pthread_mutex_lock(&(queue->mutex));
         queue->running = false;
-        thread_cond_broadcast(&(queue->cond));
-        thread_join(queue->thread);
+        pthread_cond_broadcast(&(queue->cond));
+        pthread_mutex_unlock(&(queue->mutex));
+#ifdef CLIENT_QUEUE_USE_EPOLL
+        if (queue->epoll_fd >= 0)
+            client_queue_wake(queue);
+#endif
+        for (i = 0; i < queue->threads_len; i++)
+            thread_join(queue->threads[i]);
+        queue->threads_len = 0;
     }
-    thread_cond_destroy(&(queue->cond));
-    thread_mutex_destroy(&(queue->mutex));
+    thread_spin_destroy(&(queue->stats_lock));
+    pthread_cond_destroy(&(queue->cond));
+    pthread_mutex_destroy(&(queue->mutex));
 #ifdef HAVE_POLL
     free(queue->pollfds);
 #endif
+#ifdef CLIENT_QUEUE_USE_EPOLL
+    if (queue->epoll_fd >= 0) {
+        close(queue->epoll_fd);
+        close(queue->wake_fd[0]);
+        close(queue->wake_fd[1]);
+    }
+#endif
 }
 
-static void client_queue_start_thread(client_queue_t *queue, const char *name, void *(*func)(client_queue_t *))
+/* threads of 0 starts one per CPU */
+static void client_queue_start_threads(client_queue_t *queue, const char *name, void *(*func)(client_queue_t *), unsigned int threads)
 {
-    if (queue->thread)
+    if (queue->threads_len)
         return;
+
+    if (threads == 0) {
+#if defined(_SC_NPROCESSORS_ONLN)
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (unsigned int)cpus : 1;
+#else
+        threads = 1;
+#endif
+    }
+    if (threads > CLIENT_QUEUE_MAX_THREADS)
+        threads = CLIENT_QUEUE_MAX_THREADS;
+
     queue->running = true;
-    queue->thread = thread_create(name, (void*(*)(void*))func, queue, THREAD_ATTACHED);
+    for (; queue->threads_len < threads; queue->threads_len++) {
+        thread_type *thread = thread_create(name, (void*(*)(void*))func, queue, THREAD_ATTACHED);
+        if (!thread)
+            break;
+        queue->threads[queue->threads_len] = thread;
+    }
+
+    ICECAST_LOG_INFO("Started %zu thread(s) for %s", queue->threads_len, name);
 }
 
 static inline bool client_queue_running(client_queue_t *queue)
@@ -167,25 +341,92 @@ static inline bool client_queue_running(client_queue_t *queue)
     return queue->running;
 }
 
+static inline size_t client_queue_bucket(const uint64_t *bounds, uint64_t value)
+{
+    size_t i;
+
+    for (i = 0; i < (CONNECTION_QUEUE_BUCKETS - 1); i++) {
+        if (value <= bounds[i])
+            return i;
+    }
+
+    return CONNECTION_QUEUE_BUCKETS - 1;
+}
+
+/* records the time a thread spent on one visit of a client since start */
+static void client_queue_service_done(client_queue_t *queue, uint64_t start)
+{
+    uint64_t used = util_time_monotonic_usec() - start;
+    size_t bucket = client_queue_bucket(connection_queue_service_bounds, used);
+
+    thread_spin_lock(&(queue->stats_lock));
+    queue->service[bucket]++;
+    queue->service_sum += used;
+    thread_spin_unlock(&(queue->stats_lock));
+}
+
 static void client_queue_add(client_queue_t *queue, client_queue_entry_t *entry)
 {
-    thread_mutex_lock(&(queue->mutex));
+    size_t depth;
+#ifdef CLIENT_QUEUE_USE_EPOLL
+    bool wake;
+#endif
+
+    pthread_mutex_lock(&(queue->mutex));
+#ifdef CLIENT_QUEUE_USE_EPOLL
+    /* the thread takes all entries at once, so it only needs to be woken
+     * for the first one */
+    wake = queue->epoll_fd >= 0 && queue->head == NULL;
+#endif
     *(queue->tail) = entry;
     queue->tail = &(entry->next);
-    thread_mutex_unlock(&(queue->mutex));
-    thread_cond_broadcast(&(queue->cond));
+    queue->length++;
+    depth = queue->length;
+#ifdef CLIENT_QUEUE_USE_EPOLL
+    depth += queue->held_published;
+#endif
+    queue->depth[client_queue_bucket(connection_queue_depth_bounds, depth)]++;
+    queue->depth_sum += depth;
+    pthread_mutex_unlock(&(queue->mutex));
+#ifdef CLIENT_QUEUE_USE_EPOLL
+    if (wake)
+        client_queue_wake(queue);
+#endif
+    /* one entry needs one thread of the pool */
+    pthread_cond_signal(&(queue->cond));
 }
 
+/* Waits up to QUEUE_WAIT_TIMEOUT for the queue to get entries. The length
+ * is checked under the mutex entries are added under, so a signal can not
+ * get lost in between.
+ */
 static void client_queue_wait(client_queue_t *queue)
 {
-    thread_cond_wait(&(queue->cond));
+    struct timespec deadline;
+
+    pthread_mutex_lock(&(queue->mutex));
+    if (!queue->length && queue->running) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += QUEUE_WAIT_TIMEOUT / 1000;
+        deadline.tv_nsec += (long)(QUEUE_WAIT_TIMEOUT % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        while (!queue->length && queue->running) {
+            if (pthread_cond_timedwait(&(queue->cond), &(queue->mutex), &deadline) == ETIMEDOUT)
+                break;
+        }
+    }
+    pthread_mutex_unlock(&(queue->mutex));
 }
 
 static client_queue_entry_t * client_queue_shift(client_queue_t *queue, client_queue_entry_t *stop)
 {
     client_queue_entry_t *ret;
 
-    thread_mutex_lock(&(queue->mutex));
+    pthread_mutex_lock(&(queue->mutex));
     ret = queue->head;
     if (ret) {
         if (ret == stop) {
@@ -196,13 +437,172 @@ static client_queue_entry_t * client_queue_shift(client_queue_t *queue, client_q
                 queue->tail = &(queue->head);
             }
             ret->next = NULL;
+            queue->length--;
         }
     }
-    thread_mutex_unlock(&(queue->mutex));
+    pthread_mutex_unlock(&(queue->mutex));
 
     return ret;
 }
 
+#ifdef CLIENT_QUEUE_USE_EPOLL
+static inline void client_queue_ready_append(client_queue_t *queue, client_queue_entry_t *entry)
+{
+    entry->next = NULL;
+    *(queue->ready_tail) = entry;
+    queue->ready_tail = &(entry->next);
+}
+
+static void client_queue_wheel_insert(client_queue_t *queue, client_queue_entry_t *entry)
+{
+    time_t deadline = entry->deadline;
+
+    /* slots up to wheel_time have been expired already */
+    if (deadline <= queue->wheel_time)
+        deadline = queue->wheel_time + 1;
+
+    entry->wheel_slot = (size_t)deadline % CLIENT_QUEUE_WHEEL_SIZE;
+    entry->wheel_prev = NULL;
+    entry->wheel_next = queue->wheel[entry->wheel_slot];
+    if (entry->wheel_next)
+        entry->wheel_next->wheel_prev = entry;
+    queue->wheel[entry->wheel_slot] = entry;
+}
+
+/* stops waiting for entry and moves it to the ready list */
+static void client_queue_wheel_take(client_queue_t *queue, client_queue_entry_t *entry)
+{
+    if (entry->wheel_prev) {
+        entry->wheel_prev->wheel_next = entry->wheel_next;
+    } else {
+        queue->wheel[entry->wheel_slot] = entry->wheel_next;
+    }
+    if (entry->wheel_next)
+        entry->wheel_next->wheel_prev = entry->wheel_prev;
+
+    /* whoever gets the entry next may close the socket or hand it to
+     * another queue, so it must be gone from epoll_fd by then */
+    epoll_ctl(queue->epoll_fd, EPOLL_CTL_DEL, entry->client->con->sock, NULL);
+    client_queue_ready_append(queue, entry);
+}
+
+/* Puts an entry the queue's thread could not finish back into the queue.
+ * Entries that made progress are tried again on the next round as more
+ * data may be buffered by the connection, the others wait for their socket
+ * or their deadline.
+ */
+static void client_queue_requeue(client_queue_t *queue, client_queue_entry_t *entry, bool progress, time_t deadline, client_queue_entry_t **stop)
+{
+    if (queue->epoll_fd >= 0) {
+        struct epoll_event ev;
+
+        if (!progress) {
+            ev.events = EPOLLIN;
+            ev.data.ptr = entry;
+            if (epoll_ctl(queue->epoll_fd, EPOLL_CTL_ADD, entry->client->con->sock, &ev) == 0) {
+                entry->deadline = deadline;
+                client_queue_wheel_insert(queue, entry);
+                queue->held++;
+                return;
+            }
+            ICECAST_LOG_ERROR("Can not watch socket of client %p: %s", entry->client, strerror(errno));
+        }
+
+        entry->next = NULL;
+        *(queue->retry_tail) = entry;
+        queue->retry_tail = &(entry->next);
+        queue->held++;
+        return;
+    }
+
+    client_queue_add(queue, entry);
+    if (!*stop)
+        *stop = entry;
+}
+
+static bool client_queue_check_ready_epoll(client_queue_t *queue, int timeout)
+{
+    struct epoll_event events[CLIENT_QUEUE_EPOLL_EVENTS];
+    client_queue_entry_t *entry;
+    time_t now;
+    int count;
+    int i;
+
+    if (queue->retry_head) {
+        *(queue->ready_tail) = queue->retry_head;
+        queue->ready_tail = queue->retry_tail;
+        queue->retry_head = NULL;
+        queue->retry_tail = &(queue->retry_head);
+    }
+
+    count = epoll_wait(queue->epoll_fd, events, CLIENT_QUEUE_EPOLL_EVENTS, queue->ready_head ? 0 : timeout);
+    for (i = 0; i < count; i++) {
+        entry = events[i].data.ptr;
+        if (entry) {
+            client_queue_wheel_take(queue, entry);
+        } else {
+            char buf[64];
+
+            while (read(queue->wake_fd[0], buf, sizeof(buf)) > 0);
+        }
+    }
+
+    /* new entries are tried right away */
+    pthread_mutex_lock(&(queue->mutex));
+    if (queue->head) {
+        *(queue->ready_tail) = queue->head;
+        queue->ready_tail = queue->tail;
+        queue->head = NULL;
+        queue->tail = &(queue->head);
+        queue->held += queue->length;
+        queue->length = 0;
+    }
+    queue->held_published = queue->held;
+    pthread_mutex_unlock(&(queue->mutex));
+
+    now = time(NULL);
+    if ((now - queue->wheel_time) > CLIENT_QUEUE_WHEEL_SIZE)
+        queue->wheel_time = now - CLIENT_QUEUE_WHEEL_SIZE;
+    while (queue->wheel_time < now) {
+        client_queue_entry_t *next;
+
+        queue->wheel_time++;
+        for (entry = queue->wheel[(size_t)queue->wheel_time % CLIENT_QUEUE_WHEEL_SIZE]; entry; entry = next) {
+            next = entry->wheel_next;
+            if (entry->deadline <= now)
+                client_queue_wheel_take(queue, entry);
+        }
+    }
+
+    return queue->ready_head != NULL;
+}
+
+static client_queue_entry_t * client_queue_shift_ready_epoll(client_queue_t *queue)
+{
+    client_queue_entry_t *ret = queue->ready_head;
+
+    if (ret) {
+        queue->ready_head = ret->next;
+        if (!queue->ready_head)
+            queue->ready_tail = &(queue->ready_head);
+        ret->next = NULL;
+        queue->held--;
+    }
+
+    return ret;
+}
+#else
+static void client_queue_requeue(client_queue_t *queue, client_queue_entry_t *entry, bool progress, time_t deadline, client_queue_entry_t **stop)
+{
+    (void)progress;
+    (void)deadline;
+
+    client_queue_add(queue, entry);
+    if (!*stop)
+        *stop = entry;
+}
+#endif
+
 static bool client_queue_check_ready(client_queue_t *queue, int timeout, time_t connection_timeout)
 {
     if (!queue->head)
@@ -215,7 +615,7 @@ static bool client_queue_check_ready(client_queue_t *queue, int timeout, time_t
         size_t i;
         client_queue_entry_t *cur;
 
-        thread_mutex_lock(&(queue->mutex));
+        pthread_mutex_lock(&(queue->mutex));
         for (cur = queue->head; cur; cur = cur->next) {
             count++;
             if (cur->client->con->con_time <= connection_timeout) {
@@ -234,7 +634,7 @@ static bool client_queue_check_ready(client_queue_t *queue, int timeout, time_t
             } else {
                 ICECAST_LOG_ERROR("Allocation of queue->pollfds failed. BAD.");
                 queue->pollfds_len = 0;
-                thread_mutex_unlock(&(queue->mutex));
+                pthread_mutex_unlock(&(queue->mutex));
                 return false;
             }
         } else {
@@ -245,7 +645,7 @@ static bool client_queue_check_ready(client_queue_t *queue, int timeout, time_t
             queue->pollfds[i].fd = cur->client->con->sock;
             queue->pollfds[i].events = POLLIN;
         }
-        thread_mutex_unlock(&(queue->mutex));
+        pthread_mutex_unlock(&(queue->mutex));
 
         if (had_timeout)
             return true;
@@ -253,7 +653,7 @@ static bool client_queue_check_ready(client_queue_t *queue, int timeout, time_t
         if (poll(queue->pollfds, count, timeout) < 1)
             return false;
 
-        thread_mutex_lock(&(queue->mutex));
+        pthread_mutex_lock(&(queue->mutex));
         for (cur = queue->head; cur; cur = cur->next) {
             for (i = 0; i < count; i++) {
                 if (queue->pollfds[i].fd == cur->client->con->sock) {
@@ -263,7 +663,7 @@ static bool client_queue_check_ready(client_queue_t *queue, int timeout, time_t
                 }
             }
         }
-        thread_mutex_unlock(&(queue->mutex));
+        pthread_mutex_unlock(&(queue->mutex));
     }
 #endif
 
@@ -272,12 +672,23 @@ static bool client_queue_check_ready(client_queue_t *queue, int timeout, time_t
 
 static bool client_queue_check_ready_wait(client_queue_t *queue, int timeout, int connection_timeout)
 {
+#ifdef CLIENT_QUEUE_USE_EPOLL
+    if (queue->epoll_fd >= 0) {
+        /* the wheel is expired once per second, so that is as long as
+         * there is to wait for anything but sockets and new entries */
+        while (queue->running) {
+            if (client_queue_check_ready_epoll(queue, 1000))
+                return true;
+        }
+        return false;
+    }
+#endif
+
     while (queue->running) {
         if (client_queue_check_ready(queue, timeout, time(NULL) - connection_timeout))
             return true;
 
-        if (!queue->head)
-            thread_cond_wait(&(queue->cond));
+        client_queue_wait(queue);
     }
 
     return false;
@@ -285,6 +696,10 @@ static bool client_queue_check_ready_wait(client_queue_t *queue, int timeout, in
 
 static client_queue_entry_t * client_queue_shift_ready(client_queue_t *queue, client_queue_entry_t *stop)
 {
+#ifdef CLIENT_QUEUE_USE_EPOLL
+    if (queue->epoll_fd >= 0)
+        return client_queue_shift_ready_epoll(queue);
+#endif
 #ifdef HAVE_POLL
     client_queue_entry_t *cur;
     client_queue_entry_t *last = NULL;
@@ -292,7 +707,7 @@ static client_queue_entry_t * client_queue_shift_ready(client_queue_t *queue, cl
     if (!queue->head)
         return NULL;
 
-    thread_mutex_lock(&(queue->mutex));
+    pthread_mutex_lock(&(queue->mutex));
     for (cur = queue->head; cur && cur != stop; cur = cur->next) {
         if (cur->ready) {
             // use this one.
@@ -310,12 +725,13 @@ static client_queue_entry_t * client_queue_shift_ready(client_queue_t *queue, cl
             }
 
             cur->next = NULL;
-            thread_mutex_unlock(&(queue->mutex));
+            queue->length--;
+            pthread_mutex_unlock(&(queue->mutex));
             return cur;
         }
         last = cur;
     }
-    thread_mutex_unlock(&(queue->mutex));
+    pthread_mutex_unlock(&(queue->mutex));
     return NULL;
 #else
     /* just return any */
@@ -323,6 +739,17 @@ static client_queue_entry_t * client_queue_shift_ready(client_queue_t *queue, cl
 #endif
 }
 
+/* The body queue tries all its entries on every round if it can not tell
+ * which sockets are ready */
+static inline client_queue_entry_t * client_queue_shift_body(client_queue_t *queue, client_queue_entry_t *stop)
+{
+#ifdef CLIENT_QUEUE_USE_EPOLL
+    if (queue->epoll_fd >= 0)
+        return client_queue_shift_ready_epoll(queue);
+#endif
+    return client_queue_shift(queue, stop);
+}
+
 void connection_initialize(void)
 {
     if (_initialized)
@@ -335,6 +762,11 @@ void connection_initialize(void)
     client_queue_init(&_connection_queue);
     client_queue_init(&_body_queue);
     client_queue_init(&_handle_queue);
+#ifdef CLIENT_QUEUE_USE_EPOLL
+    /* connection and handle queue are fed by other threads only */
+    client_queue_use_epoll(&_request_queue);
+    client_queue_use_epoll(&_body_queue);
+#endif
 
     _initialized = 1;
 }
@@ -365,6 +797,52 @@ void connection_reread_config(ice_config_t *config)
     listensocket_container_configure_and_setup(global.listensockets, config);
 }
 
+bool connection_get_queue_depth(size_t index, const char **name, size_t *depth)
+{
+    static const char *names[] = {"request", "connection", "body", "handle"};
+    client_queue_t *queues[] = {&_request_queue, &_connection_queue, &_body_queue, &_handle_queue};
+    client_queue_t *queue;
+
+    if (!_initialized || index >= (sizeof(queues)/sizeof(*queues)))
+        return false;
+
+    queue = queues[index];
+    pthread_mutex_lock(&(queue->mutex));
+    *depth = queue->length;
+#ifdef CLIENT_QUEUE_USE_EPOLL
+    *depth += queue->held_published;
+#endif
+    pthread_mutex_unlock(&(queue->mutex));
+    *name = names[index];
+
+    return true;
+}
+
+bool connection_get_queue_stats(size_t index, connection_queue_stats_t *stats)
+{
+    client_queue_t *queues[] = {&_request_queue, &_connection_queue, &_body_queue, &_handle_queue};
+    client_queue_t *queue;
+    size_t depth;
+
+    if (!connection_get_queue_depth(index, &(stats->name), &depth))
+        return false;
+
+    queue = queues[index];
+    pthread_mutex_lock(&(queue->mutex));
+    memcpy(stats->depth, queue->depth, sizeof(stats->depth));
+    stats->depth_sum = queue->depth_sum;
+    pthread_mutex_unlock(&(queue->mutex));
+
+    thread_spin_lock(&(queue->stats_lock));
+    memcpy(stats->service, queue->service, sizeof(stats->service));
+    stats->service_sum = queue->service_sum;
+    thread_spin_unlock(&(queue->stats_lock));
+
+    stats->threads = queue->threads_len;
+
+    return true;
+}
+
 static connection_id_t _next_connection_id(void)
 {
     connection_id_t id;
@@ -381,6 +859,7 @@ static connection_id_t _next_connection_id(void)
 static void get_tls_certificate(ice_config_t *config)
 {
     const char *keyfile;
+    tls_ctx_t *old = tls_ctx;
 
     tls_ok = false;
 
@@ -388,13 +867,20 @@ static void get_tls_certificate(ice_config_t *config)
     if (!keyfile)
         keyfile = config->tls_context.cert_file;
 
-    tls_ctx_unref(tls_ctx);
     tls_ctx = tls_ctx_new(config->tls_context.cert_file, keyfile, config->tls_context.cipher_list);
     if (!tls_ctx) {
+        tls_ctx_unref(old);
         ICECAST_LOG_INFO("No TLS capability on any configured ports");
         return;
     }
 
+    tls_ctx_set_session_cache(tls_ctx, config->tls_context.session_cache_size,
+                              config->tls_context.session_timeout,
+                              config->tls_context.ticket_key_rotation);
+    /* clients resuming with a ticket from before the reload skip the full handshake */
+    tls_ctx_take_ticket_keys(tls_ctx, old);
+    tls_ctx_unref(old);
+
     tls_ok = true;
 }
 
@@ -418,9 +904,22 @@ static int connection_read_tls(connection_t *con, void *buf, size_t len)
     return bytes;
 }
 
+static int connection_send(connection_t *con, const void *buf, size_t len);
+
 static int connection_send_tls(connection_t *con, const void *buf, size_t len)
 {
-    ssize_t bytes = tls_write(con->tls, buf, len);
+    ssize_t bytes;
+
+    /* With kTLS the kernel encrypts, so the plain send(), writev() and
+     * sendfile() paths can be used. Reads still need the TLS library for
+     * non application data records. */
+    if (tls_ktls_send(con->tls)) {
+        ICECAST_LOG_DEBUG("Connection %llu uses kernel TLS for sending", (long long unsigned int)con->id);
+        con->send = connection_send;
+        return connection_send(con, buf, len);
+    }
+
+    bytes = tls_write(con->tls, buf, len);
 
     if (bytes < 0) {
         con->error = 1;
@@ -508,6 +1007,8 @@ connection_t *connection_create(sock_t sock, listensocket_t *listensocket_real,
 void connection_uses_tls(connection_t *con)
 {
 #ifdef ICECAST_CAP_TLS
+    const listener_t *listener;
+
     if (con->tls)
         return;
 
@@ -523,6 +1024,19 @@ void connection_uses_tls(connection_t *con)
     con->tls = tls_new(tls_ctx);
     tls_set_incoming(con->tls);
     tls_set_socket(con->tls, con->sock);
+
+    listener = listensocket_get_listener(con->listensocket_effective);
+    if (listener) {
+        char id[128];
+
+        if (listener->id) {
+            snprintf(id, sizeof(id), "id:%s", listener->id);
+        } else {
+            snprintf(id, sizeof(id), "port:%s:%d", listener->bind_address ? listener->bind_address : "", listener->port);
+        }
+        tls_set_session_options(con->tls, id, listener->tls_session_resumption, listener->tls_ktls);
+    }
+    listensocket_release_listener(con->listensocket_effective);
 #endif
 }
 
@@ -535,6 +1049,82 @@ ssize_t connection_send_bytes(connection_t *con, const void *buf, size_t len)
     return ret;
 }
 
+ssize_t connection_send_iov(connection_t *con, const struct iovec *iov, size_t count)
+{
+    ssize_t done = 0;
+    size_t i;
+
+#if defined(HAVE_SYS_UIO_H) && defined(HAVE_WRITEV)
+    /* plain sockets take the whole list with a single call */
+    if (con->send == connection_send && count > 1) {
+        ssize_t ret = writev(con->sock, iov, count);
+
+        if (ret < 0) {
+            if (!sock_recoverable(sock_error()))
+                con->error = 1;
+        } else {
+            con->sent_bytes += ret;
+        }
+
+        for (i = 0; i < count; i++) {
+            ssize_t seg = ret;
+
+            if (ret > 0)
+                seg = (size_t)(ret - done) < iov[i].iov_len ? ret - done : (ssize_t)iov[i].iov_len;
+            fastevent_emit(FASTEVENT_TYPE_CONNECTION_WRITE, FASTEVENT_FLAG_MODIFICATION_ALLOWED, FASTEVENT_DATATYPE_OBRD, con, iov[i].iov_base, iov[i].iov_len, seg);
+            if (seg <= 0 || (size_t)seg < iov[i].iov_len)
+                break;
+            done += seg;
+        }
+
+        return ret;
+    }
+#endif
+
+    /* TLS or no writev(), send one buffer after the other */
+    for (i = 0; i < count; i++) {
+        ssize_t ret = connection_send_bytes(con, iov[i].iov_base, iov[i].iov_len);
+
+        if (ret < 0)
+            return done ? done : ret;
+        done += ret;
+        if ((size_t)ret < iov[i].iov_len)
+            break;
+    }
+
+    return done;
+}
+
+bool connection_can_sendfile(connection_t *con)
+{
+#if defined(HAVE_SYS_SENDFILE_H) && defined(HAVE_SENDFILE)
+    return con->send == connection_send;
+#else
+    (void)con;
+    return false;
+#endif
+}
+
+ssize_t connection_sendfile(connection_t *con, int fd, off_t *offset, size_t len)
+{
+#if defined(HAVE_SYS_SENDFILE_H) && defined(HAVE_SENDFILE)
+    ssize_t ret = sendfile(con->sock, fd, offset, len);
+
+    if (ret < 0) {
+        if (!sock_recoverable(sock_error()))
+            con->error = 1;
+    } else {
+        con->sent_bytes += ret;
+    }
+
+    return ret;
+#else
+    (void)fd, (void)offset, (void)len;
+    con->error = 1;
+    return -1;
+#endif
+}
+
 static inline ssize_t connection_read_bytes_real(connection_t *con, void *buf, size_t len)
 {
     ssize_t done = 0;
@@ -616,12 +1206,43 @@ int connection_read_put_back(connection_t *con, const void *buf, size_t len)
     }
 }
 
+/* makes room to receive more of the request head, returns false if the
+ * head would be larger than limit */
+static bool request_head_reserve(client_queue_entry_t *node, size_t limit)
+{
+    size_t size;
+
+    if (!node->headbuf) {
+        node->headbuf = refbuf_new(REQUEST_HEAD_SIZE);
+        node->headbuf_size = REQUEST_HEAD_SIZE;
+    }
+
+    /* one byte is kept for the \0 */
+    if ((size_t)node->offset + 1 < node->headbuf_size)
+        return true;
+
+    if (node->headbuf_size >= limit)
+        return false;
+
+    size = node->headbuf_size * 2;
+    if (size > limit)
+        size = limit;
+
+    /* refbuf_resize() keeps len bytes of the old data */
+    node->headbuf->len = node->offset;
+    if (refbuf_resize(node->headbuf, size) != 0)
+        return false;
+    node->headbuf_size = size;
+
+    return true;
+}
+
 /* run along queue checking for any data that has come in or a timeout */
-static bool process_request_queue_one (client_queue_entry_t *node, time_t timeout)
+static bool process_request_queue_one (client_queue_entry_t *node, time_t timeout, size_t head_limit)
 {
     client_t *client = node->client;
-    int len = PER_CLIENT_REFBUF_SIZE - 1 - node->offset;
-    char *buf = client->refbuf->data + node->offset;
+    char *data;
+    int len;
 
     ICECAST_LOG_DDEBUG("Checking on client %p", client);
 
@@ -634,70 +1255,64 @@ static bool process_request_queue_one (client_queue_entry_t *node, time_t timeou
         }
     }
 
-    if (len > 0) {
-        if (client->con->con_time <= timeout) {
-            ICECAST_LOG_DEBUG("Timeout on client %p (connection ID: %llu, sock=%R)", client, (long long unsigned int)client->con->id, client->con->sock);
-            client_destroy(client);
-            free_client_node(node);
-            return true;
-        } else {
-            len = client_read_bytes(client, buf, len);
-        }
+    if (!request_head_reserve(node, head_limit)) {
+        ICECAST_LOG_INFO("Request head of client %p is larger than %zu bytes, dropping (connection ID: %llu)", client, head_limit, (long long unsigned int)client->con->id);
+        client_destroy(client);
+        free_client_node(node);
+        return true;
     }
 
+    if (client->con->con_time <= timeout) {
+        ICECAST_LOG_DEBUG("Timeout on client %p (connection ID: %llu, sock=%R)", client, (long long unsigned int)client->con->id, client->con->sock);
+        client_destroy(client);
+        free_client_node(node);
+        return true;
+    }
+
+    data = node->headbuf->data;
+    len = client_read_bytes(client, data + node->offset, node->headbuf_size - 1 - node->offset);
+
     if (len > 0 || node->shoutcast > 1) {
-        ssize_t stream_offset = -1;
-        int pass_it = 1;
-        char *ptr;
+        httphead_scan_result_t res;
 
         if (len < 0 && node->shoutcast > 1)
             len = 0;
 
-        /* handle \n, \r\n and nsvcap which for some strange reason has
-         * EOL as \r\r\n */
         node->offset += len;
-        client->refbuf->data[node->offset] = '\000';
-        do {
-            if (node->shoutcast == 1) {
-                /* password line */
-                if (strstr (client->refbuf->data, "\r\r\n") != NULL)
-                    break;
-                if (strstr (client->refbuf->data, "\r\n") != NULL)
-                    break;
-                if (strstr (client->refbuf->data, "\n") != NULL)
-                    break;
-            }
-            /* stream_offset refers to the start of any data sent after the
-             * http style headers, we don't want to lose those */
-            ptr = strstr(client->refbuf->data, "\r\r\n\r\r\n");
-            if (ptr) {
-                stream_offset = (ptr+6) - client->refbuf->data;
-                break;
-            }
-            ptr = strstr(client->refbuf->data, "\r\n\r\n");
-            if (ptr) {
-                stream_offset = (ptr+4) - client->refbuf->data;
-                break;
-            }
-            ptr = strstr(client->refbuf->data, "\n\n");
-            if (ptr) {
-                stream_offset = (ptr+2) - client->refbuf->data;
-                break;
-            }
-            pass_it = 0;
-        } while (0);
+        data[node->offset] = '\000';
 
-        ICECAST_LOG_DDEBUG("pass_it=%i, len=%i", pass_it, (int)len);
-        ICECAST_LOG_DDEBUG("Client %p has buffer: %H", client, client->refbuf->data);
-
-        if (pass_it) {
-            if (stream_offset != -1) {
-                connection_read_put_back(client->con, client->refbuf->data + stream_offset, node->offset - stream_offset);
-                node->offset = stream_offset;
-            }
+        if (node->shoutcast == 1) {
+            /* password line, ended by \n, \r\n or \r\r\n */
+            if (memchr(data, '\n', node->offset) == NULL)
+                return false;
             client_queue_add(&_connection_queue, node);
             return true;
         }
+
+        /* only the newly received data is scanned */
+        res = httphead_scan(&(node->head), data, node->offset);
+        ICECAST_LOG_DDEBUG("scan result=%i, len=%i", (int)res, (int)len);
+        ICECAST_LOG_DDEBUG("Client %p has buffer: %H", client, data);
+
+        if (res == HTTPHEAD_SCAN_MORE)
+            return false;
+
+        if (res == HTTPHEAD_SCAN_ERROR) {
+            ICECAST_LOG_DEBUG("Malformed request head from client %p (connection ID: %llu)", client, (long long unsigned int)client->con->id);
+            client_destroy(client);
+            free_client_node(node);
+            return true;
+        }
+
+        /* anything after the head is the start of the body or stream, we
+         * don't want to lose it */
+        if ((size_t)node->offset > node->head.end) {
+            connection_read_put_back(client->con, data + node->head.end, node->offset - node->head.end);
+            node->offset = node->head.end;
+            data[node->offset] = '\000';
+        }
+        client_queue_add(&_connection_queue, node);
+        return true;
     } else if (len == 0 || client->con->error) {
         client_destroy(client);
         free_client_node(node);
@@ -714,22 +1329,27 @@ static void * process_request_queue (client_queue_t *queue)
         client_queue_entry_t *node;
         ice_config_t *config;
         int timeout;
+        size_t head_limit;
         time_t now;
 
         config = config_get_config();
         timeout = config->header_timeout;
+        head_limit = config->header_size_limit;
         config_release_config();
 
         client_queue_check_ready_wait(queue, QUEUE_READY_TIMEOUT, timeout);
 
         now = time(NULL);
         while ((node = client_queue_shift_ready(queue, stop))) {
-            if (process_request_queue_one(node, now - timeout))
+            int offset = node->offset;
+            uint64_t start = util_time_monotonic_usec();
+            bool done = process_request_queue_one(node, now - timeout, head_limit);
+
+            client_queue_service_done(queue, start);
+            if (done)
                 continue;
 
-            client_queue_add(queue, node);
-            if (!stop)
-                stop = node;
+            client_queue_requeue(queue, node, node->offset != offset, node->client->con->con_time + timeout, &stop);
         }
     }
 
@@ -784,6 +1404,7 @@ static void * process_request_body_queue (client_queue_t *queue)
         ice_config_t *config;
         int timeout;
         size_t body_size_limit;
+        time_t now;
 
         ICECAST_LOG_DDEBUG("Processing body queue.");
 
@@ -794,20 +1415,22 @@ static void * process_request_body_queue (client_queue_t *queue)
 
         client_queue_check_ready_wait(queue, QUEUE_READY_TIMEOUT, timeout);
 
-        while ((node = client_queue_shift(queue, stop))) {
+        now = time(NULL);
+        while ((node = client_queue_shift_body(queue, stop))) {
             client_t *client = node->client;
+            size_t body_read = client->request_body_read;
+            uint64_t start = util_time_monotonic_usec();
             client_slurp_result_t res;
 
             node->tried_body = 1;
 
             ICECAST_LOG_DEBUG("Got client %p in body queue.", client);
 
-            res = process_request_body_queue_one(node, timeout, body_size_limit);
+            res = process_request_body_queue_one(node, now - timeout, body_size_limit);
+            client_queue_service_done(queue, start);
 
             if (res == CLIENT_SLURP_NEEDS_MORE_DATA) {
-                client_queue_add(queue, node);
-                if (!stop)
-                    stop = node;
+                client_queue_requeue(queue, node, client->request_body_read != body_read, client->con->con_time + timeout, &stop);
             } else {
                 ICECAST_LOG_DEBUG("Putting client %p back in connection queue.", client);
 
@@ -824,6 +1447,7 @@ static client_queue_entry_t *create_client_node(client_t *client)
 {
     client_queue_entry_t *node = calloc (1, sizeof (client_queue_entry_t));
     const listener_t *listener;
+    bool use_tls = false;
 
     if (!node)
         return NULL;
@@ -837,18 +1461,27 @@ static client_queue_entry_t *create_client_node(client_t *client)
             node->shoutcast = 1;
         client->con->tlsmode = listener->tls;
         if (listener->tls == ICECAST_TLSMODE_RFC2818 && tls_ok)
-            connection_uses_tls(client->con);
+            use_tls = true;
         if (listener->shoutcast_mount)
             node->shoutcast_mount = strdup(listener->shoutcast_mount);
     }
 
     listensocket_release_listener(client->con->listensocket_effective);
 
+    /* looks up the listener again for the session options */
+    if (use_tls)
+        connection_uses_tls(client->con);
+
     return node;
 }
 
 static void free_client_node(client_queue_entry_t *node)
 {
+    if (node->parser)
+        httpp_destroy(node->parser);
+    if (node->headbuf)
+        refbuf_release(node->headbuf);
+    httphead_clear(&(node->head));
     free(node->shoutcast_mount);
     free(node->bodybuffer);
     free(node);
@@ -859,27 +1492,19 @@ void connection_queue(connection_t *con)
     client_queue_entry_t *node;
     client_t *client = NULL;
 
-    global_lock();
     if (client_create(&client, con, NULL) < 0) {
-        global_unlock();
         client_send_error_by_id(client, ICECAST_ERROR_GEN_CLIENT_LIMIT);
         /* don't be too eager as this is an imposed hard limit */
         thread_sleep(400000);
         return;
     }
 
-    /* setup client for reading incoming http */
-    client->refbuf->data[PER_CLIENT_REFBUF_SIZE-1] = '\000';
-
     if (sock_set_blocking(client->con->sock, 0) || sock_set_nodelay(client->con->sock)) {
-        global_unlock();
         ICECAST_LOG_WARN("Failed to set tcp options on client connection, dropping");
         client_destroy(client);
         return;
     }
     node = create_client_node(client);
-    global_unlock();
-
     if (node == NULL) {
         client_destroy(client);
         return;
@@ -889,25 +1514,71 @@ void connection_queue(connection_t *con)
     stats_event_inc(NULL, "connections");
 }
 
+void connection_queue_keepalive(client_t *client, http_parser_t *parser)
+{
+    client_queue_entry_t *node = create_client_node(client);
+
+    if (node == NULL) {
+        httpp_destroy(parser);
+        client_destroy(client);
+        return;
+    }
+
+    node->parser = parser;
+    stats_event_inc(NULL, "connections");
+
+    /* a pipelined request may already be waiting in the putback buffer,
+     * which polling the socket would not tell us about */
+    if (client->con->readbufferlen) {
+        ice_config_t *config;
+        int timeout;
+        size_t head_limit;
+
+        config = config_get_config();
+        timeout = config->header_timeout;
+        head_limit = config->header_size_limit;
+        config_release_config();
+
+        if (process_request_queue_one(node, time(NULL) - timeout, head_limit))
+            return;
+    }
+
+    client_queue_add(&_request_queue, node);
+}
+
+void connection_reuse(connection_t *con)
+{
+    con->id = _next_connection_id();
+    con->con_time = time(NULL);
+    con->discon_time = 0;
+    con->sent_bytes = 0;
+}
+
 void connection_accept_loop(void)
 {
     ice_config_t *config;
+    unsigned int connection_threads, handler_threads;
 
     config = config_get_config();
     get_tls_certificate(config);
+    connection_threads = config->connection_threads;
+    handler_threads = config->handler_threads;
     config_release_config();
 
-    client_queue_start_thread(&_request_queue, "Request Queue", process_request_queue);
-    client_queue_start_thread(&_connection_queue, "Con Queue", _handle_connection);
-    client_queue_start_thread(&_body_queue, "Body Queue", process_request_body_queue);
-    client_queue_start_thread(&_handle_queue, "Client Handler", handle_client_worker);
+    /* the queues waiting for data keep their state in a single thread,
+     * they do not block on anything but their sockets */
+    client_queue_start_threads(&_request_queue, "Request Queue", process_request_queue, 1);
+    client_queue_start_threads(&_connection_queue, "Con Queue", _handle_connection, connection_threads);
+    client_queue_start_threads(&_body_queue, "Body Queue", process_request_body_queue, 1);
+    client_queue_start_threads(&_handle_queue, "Client Handler", handle_client_worker, handler_threads);
 
     while (global.running == ICECAST_RUNNING) {
-        connection_t *con = listensocket_container_accept(global.listensockets, 800);
+        connection_t *cons[LISTENSOCKET_ACCEPT_BATCH];
+        size_t i, len;
 
-        if (con) {
-            connection_queue(con);
-        }
+        len = listensocket_container_accept(global.listensockets, 800, cons, LISTENSOCKET_ACCEPT_BATCH);
+        for (i = 0; i < len; i++)
+            connection_queue(cons[i]);
     }
     ICECAST_LOG_INFO("No longer running. Shutting down...");
 
@@ -1023,20 +1694,21 @@ static void _handle_shoutcast_compatible(client_queue_entry_t *node)
 
     if (node->shoutcast == 1)
     {
+        char *data = node->headbuf->data;
         char *ptr, *headers;
 
-        ICECAST_LOG_DDEBUG("Client %p has buffer: %H", client, client->refbuf->data);
+        ICECAST_LOG_DDEBUG("Client %p has buffer: %H", client, data);
 
         /* Get rid of trailing \r\n or \n after password */
-        ptr = strstr(client->refbuf->data, "\r\r\n");
+        ptr = strstr(data, "\r\r\n");
         if (ptr) {
             headers = ptr+3;
         } else {
-            ptr = strstr(client->refbuf->data, "\r\n");
+            ptr = strstr(data, "\r\n");
             if (ptr) {
                 headers = ptr+2;
             } else {
-                ptr = strstr(client->refbuf->data, "\n");
+                ptr = strstr(data, "\n");
                 if (ptr)
                     headers = ptr+1;
             }
@@ -1049,13 +1721,14 @@ static void _handle_shoutcast_compatible(client_queue_entry_t *node)
         }
         *ptr = '\0';
 
-        client->password = strdup(client->refbuf->data);
+        client->password = strdup(data);
         config = config_get_config();
         client->username = strdup(config->shoutcast_user);
         config_release_config();
-        node->offset -= (headers - client->refbuf->data);
-        memmove(client->refbuf->data, headers, node->offset+1);
+        node->offset -= (headers - data);
+        memmove(data, headers, node->offset+1);
         node->shoutcast = 2;
+        httphead_init(&(node->head), HTTPHEAD_FLAG_NO_REQUEST_LINE);
         /* we've checked the password, now send it back for reading headers */
         client_queue_add(&_request_queue, node);
         ICECAST_LOG_DDEBUG("Client %p re-added to request queue", client);
@@ -1074,7 +1747,7 @@ static void _handle_shoutcast_compatible(client_queue_entry_t *node)
     http_compliant_len = 20 + strlen(shoutcast_mount) + node->offset;
     http_compliant = (char *)calloc(1, http_compliant_len);
     snprintf(http_compliant, http_compliant_len,
-            "SOURCE %s HTTP/1.0\r\n%s", shoutcast_mount, client->refbuf->data);
+            "SOURCE %s HTTP/1.0\r\n%s", shoutcast_mount, node->headbuf->data);
     config_release_config();
 
     parser = httpp_create_parser();
@@ -1132,9 +1805,17 @@ static int _need_body(client_queue_entry_t *node)
  */
 static void * _handle_connection(client_queue_t *queue)
 {
+    uint64_t start = 0;
+
     while (client_queue_running(queue)) {
         client_queue_entry_t *node;
 
+        /* the client of the last round is done with, however it left */
+        if (start) {
+            client_queue_service_done(queue, start);
+            start = 0;
+        }
+
         node = client_queue_shift(&_connection_queue, NULL);
         if (node) {
             client_t *client = node->client;
@@ -1142,6 +1823,8 @@ static void * _handle_connection(client_queue_t *queue)
             const char *rawuri;
             int already_parsed = 0;
 
+            start = util_time_monotonic_usec();
+
             /* Check for special shoutcast compatability processing */
             if (node->shoutcast) {
                 _handle_shoutcast_compatible (node);
@@ -1153,14 +1836,26 @@ static void * _handle_connection(client_queue_t *queue)
             if (client->parser) {
                 already_parsed = 1;
                 parser = client->parser;
+            } else if (node->parser) {
+                parser = node->parser;
+                node->parser = NULL;
+                client->parser = parser;
             } else {
                 parser = httpp_create_parser();
                 httpp_initialize(parser, NULL);
                 client->parser = parser;
             }
-            if ((already_parsed || httpp_parse (parser, client->refbuf->data, node->offset)) && !client->con->error) {
+            if ((already_parsed || (node->headbuf && httpp_parse(parser, node->headbuf->data + node->head.start, node->offset - node->head.start))) && !client->con->error) {
                 client->refbuf->len = 0;
 
+                /* httpp has its own copy now, only the well-known headers
+                 * are kept with the client for fast lookups */
+                if (!already_parsed && node->headbuf) {
+                    httphead_terminate(&(node->head), node->headbuf->data);
+                    client_set_request_head(client, node->headbuf, &(node->head));
+                    node->headbuf = NULL;
+                }
+
                 /* early check if we need more data */
                 client_complete(client);
                 if (_need_body(node)) {
@@ -1222,9 +1917,12 @@ static void * handle_client_worker(client_queue_t *queue)
         client_queue_entry_t *node = client_queue_shift(queue, NULL);
         if (node) {
             client_t *client = node->client;
+            uint64_t start = util_time_monotonic_usec();
+
             free_client_node(node);
 
             connection_handle_client(client);
+            client_queue_service_done(queue, start);
         } else {
             client_queue_wait(queue);
         }
@@ -15,6 +15,9 @@
 #define __CONNECTION_H__
 
 #include <sys/types.h>
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
 #include <time.h>
 #include <stdbool.h>
 
@@ -24,6 +27,7 @@
 #include "compat.h"
 #include "common/thread/thread.h"
 #include "common/net/sock.h"
+#include "common/httpp/httpp.h"
 
 typedef unsigned long connection_id_t;
 
@@ -85,9 +89,52 @@ connection_t *connection_create(sock_t sock, listensocket_t *listensocket_real,
 int connection_complete_source(source_t *source, int response);
 void connection_queue(connection_t *con);
 void connection_queue_client(client_t *client);
+/* Queue a client for the next request on its kept alive connection, parsed
+ * into parser. A request already read ahead is handled right away.
+ */
+void connection_queue_keepalive(client_t *client, http_parser_t *parser);
+/* Reset the per request state of a kept alive connection. */
+void connection_reuse(connection_t *con);
 void connection_uses_tls(connection_t *con);
+/* Number of clients in each stage new connections go through, for index 0
+ * and up until false is returned.
+ */
+bool connection_get_queue_depth(size_t index, const char **name, size_t *depth);
+
+/* Histograms of the number of clients in a stage, sampled whenever one is
+ * added, and of the time in microseconds a thread of the stage spent on a
+ * client per visit. Counts are per bucket, not cumulative. The bounds are
+ * inclusive, the last bucket has none.
+ */
+#define CONNECTION_QUEUE_BUCKETS    12
+
+typedef struct {
+    const char *name;
+    size_t threads;
+    uint64_t depth[CONNECTION_QUEUE_BUCKETS];
+    uint64_t depth_sum;
+    uint64_t service[CONNECTION_QUEUE_BUCKETS];
+    uint64_t service_sum;
+} connection_queue_stats_t;
+
+extern const uint64_t connection_queue_depth_bounds[CONNECTION_QUEUE_BUCKETS - 1];
+extern const uint64_t connection_queue_service_bounds[CONNECTION_QUEUE_BUCKETS - 1];
+
+bool connection_get_queue_stats(size_t index, connection_queue_stats_t *stats);
 
 ssize_t connection_send_bytes(connection_t *con, const void *buf, size_t len);
+/* Send the buffers of iov in order, stopping at the first short write.
+ * Returns the number of bytes sent or -1 if nothing could be sent.
+ */
+ssize_t connection_send_iov(connection_t *con, const struct iovec *iov, size_t count);
+/* Whether connection_sendfile() can be used on con, that is the platform
+ * supports it and the connection is not encrypted.
+ */
+bool connection_can_sendfile(connection_t *con);
+/* Send up to len bytes of fd starting at *offset, *offset is advanced by
+ * the number of bytes sent. Returns that number, 0 at end of file or -1.
+ */
+ssize_t connection_sendfile(connection_t *con, int fd, off_t *offset, size_t len);
 ssize_t connection_read_bytes(connection_t *con, void *buf, size_t len);
 int connection_read_put_back(connection_t *con, const void *buf, size_t len);
 
@@ -44,7 +44,7 @@
 
 static bool _handle_resources(client_t *client, char **uri)
 {
-    const char *http_host = httpp_getvar(client->parser, "host");
+    const char *http_host = client_get_header(client, HTTPHEAD_HOST);
     char *serverhost = NULL;
     int   serverport = 0;
     char *vhost = NULL;
@@ -351,10 +351,8 @@ static void __add_listener_to_source(source_t *source, client_t *client)
     client->refbuf->len = PER_CLIENT_REFBUF_SIZE;
     memset(client->refbuf->data, 0, PER_CLIENT_REFBUF_SIZE);
 
-    /* lets add the client to the active list */
-    avl_tree_wlock(source->pending_tree);
-    avl_insert(source->pending_tree, client);
-    avl_tree_unlock(source->pending_tree);
+    /* lets hand the client over to the source thread */
+    source_add_pending(source, client);
 
     if (source->running == 0 && source->on_demand) {
         /* enable on-demand relay to start, wake up the slave thread */
@@ -368,6 +366,7 @@ static void __add_listener_to_source(source_t *source, client_t *client)
 static inline ssize_t __count_user_role_on_mount (source_t *source, client_t *client) {
     ssize_t ret = 0;
     avl_node *node;
+    client_t *existing;
 
     avl_tree_rlock(source->client_tree);
     node = avl_get_first(source->client_tree);
@@ -381,21 +380,17 @@ static inline ssize_t __count_user_role_on_mount (source_t *source, client_t *cl
         }
         node = avl_get_next(node);
     }
-    avl_tree_unlock(source->client_tree);
 
-    avl_tree_rlock(source->pending_tree);
-    node = avl_get_first(source->pending_tree);
-    while (node) {
-        client_t *existing_client = (client_t *)node->key;
-        if (existing_client->username && client->username &&
-            strcmp(existing_client->username, client->username) == 0 &&
-            existing_client->role && client->role &&
-            strcmp(existing_client->role, client->role) == 0){
+    /* pending clients are only taken off while holding the write lock */
+    for (existing = source_get_pending(source); existing; existing = existing->pending_next) {
+        if (existing->username && client->username &&
+            strcmp(existing->username, client->username) == 0 &&
+            existing->role && client->role &&
+            strcmp(existing->role, client->role) == 0){
             ret++;
         }
-        node = avl_get_next(node);
     }
-    avl_tree_unlock(source->pending_tree);
+    avl_tree_unlock(source->client_tree);
     return ret;
 }
 
@@ -515,7 +515,7 @@ void event_emit_va(const char *trigger, ...) {
         extra_add(event, EVENT_EXTRA_KEY_CONNECTION_IP, client->con->ip);
         extra_add(event, EVENT_EXTRA_KEY_CLIENT_ROLE, client->role);
         extra_add(event, EVENT_EXTRA_KEY_CLIENT_USERNAME, client->username);
-        extra_add(event, EVENT_EXTRA_KEY_CLIENT_USERAGENT, httpp_getvar(client->parser, "user-agent"));
+        extra_add(event, EVENT_EXTRA_KEY_CLIENT_USERAGENT, client_get_header(client, HTTPHEAD_USER_AGENT));
     }
 
     event_emit(event);
@@ -0,0 +1,252 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ *
+ * Copyright 2000-2004, Jack Moffitt <jack@xiph.org,
+ *                      Michael Smith <msmith@xiph.org>,
+ *                      oddsock <oddsock@xiph.org>,
+ *                      Karl Heyes <karl@xiph.org>
+ *                      and others (see AUTHORS for details).
+ */
+
+/* fanout.c
+ **
+ ** shared worker pool used to send stream data to listeners in parallel
+ **
+ ** A source thread splits its listeners into shards and hands them to
+ ** fanout_run(). The calling thread works on its own batch too and waits
+ ** for the rest, so all queue handling stays with the source thread.
+ **
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "common/thread/thread.h"
+
+#include "refbuf.h"
+#include "fanout.h"
+
+#define CATMODULE "fanout"
+
+#include "logging.h"
+
+/* upper bound on pool size, also used for the "one per CPU" setting */
+#define FANOUT_MAX_THREADS      64
+
+typedef struct fanout_batch_tag {
+    fanout_job_t job;
+    void **args;
+    size_t count;
+    size_t next;    /* next job to hand out */
+    size_t done;    /* number of jobs completed */
+    struct fanout_batch_tag *link;
+} fanout_batch_t;
+
+/* plain pthread so workers and callers can check for work and for done jobs
+ * under the same mutex that guards them before they wait */
+static pthread_mutex_t fanout_mutex;
+/* signalled when a batch is queued, and on shutdown */
+static pthread_cond_t fanout_work_cond;
+/* signalled when the last job of a batch completed */
+static pthread_cond_t fanout_done_cond;
+static fanout_batch_t *fanout_batches;
+static thread_type *fanout_workers[FANOUT_MAX_THREADS];
+static size_t fanout_workers_len;
+static volatile size_t fanout_threads = 1;
+static bool fanout_running;
+static bool fanout_inited;
+
+/* take the next job of batch, or of the first batch waiting if batch is NULL.
+ * Must be called with fanout_mutex held.
+ */
+static fanout_batch_t *fanout_claim(fanout_batch_t *batch, size_t *idx)
+{
+    fanout_batch_t **prev = &fanout_batches;
+
+    if (batch == NULL) {
+        batch = fanout_batches;
+    } else {
+        while (*prev && *prev != batch)
+            prev = &((*prev)->link);
+    }
+
+    if (batch == NULL || batch->next == batch->count)
+        return NULL;
+
+    *idx = batch->next++;
+
+    /* last job handed out, nobody else needs to find this batch */
+    if (batch->next == batch->count && *prev == batch)
+        *prev = batch->link;
+
+    return batch;
+}
+
+static void fanout_complete(fanout_batch_t *batch)
+{
+    pthread_mutex_lock(&fanout_mutex);
+    batch->done++;
+    if (batch->done == batch->count)
+        pthread_cond_broadcast(&fanout_done_cond);
+    pthread_mutex_unlock(&fanout_mutex);
+}
+
+static void *fanout_worker(void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&fanout_mutex);
+    while (fanout_running) {
+        fanout_batch_t *batch;
+        size_t idx;
+
+        batch = fanout_claim(NULL, &idx);
+        if (batch == NULL) {
+            pthread_cond_wait(&fanout_work_cond, &fanout_mutex);
+            continue;
+        }
+
+        pthread_mutex_unlock(&fanout_mutex);
+        batch->job(batch->args[idx]);
+        fanout_complete(batch);
+        pthread_mutex_lock(&fanout_mutex);
+    }
+    pthread_mutex_unlock(&fanout_mutex);
+
+    return NULL;
+}
+
+void fanout_initialize(void)
+{
+    if (fanout_inited)
+        return;
+
+    pthread_mutex_init(&fanout_mutex, NULL);
+    pthread_cond_init(&fanout_work_cond, NULL);
+    pthread_cond_init(&fanout_done_cond, NULL);
+    fanout_batches = NULL;
+    fanout_workers_len = 0;
+    fanout_threads = 1;
+    fanout_running = true;
+    fanout_inited = true;
+}
+
+void fanout_shutdown(void)
+{
+    size_t i;
+
+    if (!fanout_inited)
+        return;
+
+    pthread_mutex_lock(&fanout_mutex);
+    fanout_running = false;
+    fanout_threads = 1;
+    pthread_cond_broadcast(&fanout_work_cond);
+    pthread_mutex_unlock(&fanout_mutex);
+
+    for (i = 0; i < fanout_workers_len; i++)
+        thread_join(fanout_workers[i]);
+    fanout_workers_len = 0;
+
+    pthread_cond_destroy(&fanout_done_cond);
+    pthread_cond_destroy(&fanout_work_cond);
+    pthread_mutex_destroy(&fanout_mutex);
+    fanout_inited = false;
+}
+
+void fanout_set_threads(unsigned int threads)
+{
+    if (!fanout_inited)
+        return;
+
+    if (threads == 0) {
+#if defined(_SC_NPROCESSORS_ONLN)
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (unsigned int)cpus : 1;
+#else
+        threads = 1;
+#endif
+    }
+    if (threads > FANOUT_MAX_THREADS)
+        threads = FANOUT_MAX_THREADS;
+
+#ifndef REFBUF_THREADSAFE
+    /* stream buffers can only be shared by one thread at a time */
+    if (threads > 1) {
+        ICECAST_LOG_WARN("No atomic operations available, listener fan-out is limited to one thread.");
+        threads = 1;
+    }
+#endif
+
+    pthread_mutex_lock(&fanout_mutex);
+    /* The pool only grows, surplus workers stay idle after a reload that
+     * lowered the setting. The caller counts as one thread.
+     */
+    while (fanout_running && (fanout_workers_len + 1) < threads) {
+        thread_type *thread = thread_create("Listener Fan-out", fanout_worker, NULL, THREAD_ATTACHED);
+        if (thread == NULL) {
+            ICECAST_LOG_ERROR("Can not start fan-out worker, continuing with %zu threads.", fanout_workers_len + 1);
+            threads = fanout_workers_len + 1;
+            break;
+        }
+        fanout_workers[fanout_workers_len++] = thread;
+    }
+    fanout_threads = threads;
+    pthread_mutex_unlock(&fanout_mutex);
+
+    ICECAST_LOG_INFO("Listener fan-out uses %u thread(s).", threads);
+}
+
+size_t fanout_get_threads(void)
+{
+    return fanout_threads;
+}
+
+void fanout_run(fanout_job_t job, void **args, size_t count)
+{
+    fanout_batch_t batch;
+    size_t idx;
+
+    if (count == 0)
+        return;
+
+    if (count == 1 || fanout_threads < 2) {
+        for (idx = 0; idx < count; idx++)
+            job(args[idx]);
+        return;
+    }
+
+    batch.job = job;
+    batch.args = args;
+    batch.count = count;
+    batch.next = 0;
+    batch.done = 0;
+
+    pthread_mutex_lock(&fanout_mutex);
+    batch.link = fanout_batches;
+    fanout_batches = &batch;
+    pthread_cond_broadcast(&fanout_work_cond);
+
+    /* work on our own batch until all of it is handed out */
+    while (fanout_claim(&batch, &idx)) {
+        pthread_mutex_unlock(&fanout_mutex);
+        job(args[idx]);
+        pthread_mutex_lock(&fanout_mutex);
+        batch.done++;
+    }
+
+    /* and wait for the jobs still running on workers */
+    while (batch.done != batch.count)
+        pthread_cond_wait(&fanout_done_cond, &fanout_mutex);
+    pthread_mutex_unlock(&fanout_mutex);
+}
@@ -0,0 +1,40 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ *
+ * Copyright 2000-2004, Jack Moffitt <jack@xiph.org,
+ *                      Michael Smith <msmith@xiph.org>,
+ *                      oddsock <oddsock@xiph.org>,
+ *                      Karl Heyes <karl@xiph.org>
+ *                      and others (see AUTHORS for details).
+ */
+
+/* fanout.h
+**
+** shared worker pool used to send stream data to listeners in parallel
+**
+*/
+#ifndef __FANOUT_H__
+#define __FANOUT_H__
+
+#include <stddef.h>
+
+typedef void (*fanout_job_t)(void *arg);
+
+void fanout_initialize(void);
+void fanout_shutdown(void);
+
+/* Set the number of threads used for a fan-out, including the calling
+ * thread. 0 selects one thread per online CPU, 1 disables the pool.
+ */
+void fanout_set_threads(unsigned int threads);
+size_t fanout_get_threads(void);
+
+/* Run job(args[i]) for all i < count and return once all jobs completed.
+ * The calling thread takes part in the work, so this never blocks on an
+ * idle or shut down pool.
+ */
+void fanout_run(fanout_job_t job, void **args, size_t count);
+
+#endif  /* __FANOUT_H__ */
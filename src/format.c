@@ -39,6 +39,7 @@
 #include "source.h"
 #include "format.h"
 #include "global.h"
+#include "fserve.h"
 
 #include "format_ogg.h"
 #include "format_mp3.h"
@@ -155,14 +156,33 @@ static void find_client_start(source_t *source, client_t *client)
 }
 
 
-static int get_file_data(FILE *intro, client_t *client)
+static int get_file_data(source_t *source, client_t *client)
 {
     refbuf_t *refbuf = client->refbuf;
+    FILE *intro;
     size_t bytes;
 
-    if (intro == NULL || fseek (intro, client->intro_offset, SEEK_SET) < 0)
+    /* the file position is shared by all listeners of this source, and a
+     * reload may close intro_file and replace intro_map, so both are only
+     * looked at under the lock. Reading the cached copy is a memcpy(), so
+     * the lock is held only briefly in that case. */
+    thread_mutex_lock(&source->intro_lock);
+    intro = source->intro_file;
+    if (intro == NULL) {
+        thread_mutex_unlock(&source->intro_lock);
         return 0;
-    bytes = fread (refbuf->data, 1, 4096, intro);
+    }
+
+    if (source->intro_map) {
+        bytes = fserve_map_read(source->intro_map, client->intro_offset, refbuf->data, 4096);
+    } else {
+        if (fseek (intro, client->intro_offset, SEEK_SET) < 0) {
+            thread_mutex_unlock(&source->intro_lock);
+            return 0;
+        }
+        bytes = fread (refbuf->data, 1, 4096, intro);
+    }
+    thread_mutex_unlock(&source->intro_lock);
     if (bytes == 0)
         return 0;
 
@@ -195,7 +215,7 @@ int format_check_file_buffer (source_t *source, client_t *client)
     }
     if (client->pos == refbuf->len)
     {
-        if (get_file_data (source->intro_file, client))
+        if (get_file_data (source, client))
         {
             client->pos = 0;
             client->intro_offset += refbuf->len;
@@ -255,17 +275,49 @@ int format_check_http_buffer(source_t *source, client_t *client)
 }
 
 
+/* Write as much of the clients data as possible with one call. Clients
+ * reading the stream queue get the following blocks of the queue gathered
+ * in, the written blocks are then left the same way format_advance_queue()
+ * would do it. Other buffer chains are owned by their links and are left
+ * to the check_buffer callback.
+ */
 int format_generic_write_to_client(client_t *client)
 {
+    struct iovec iov[FORMAT_IOV_MAX];
+    refbuf_t *from[FORMAT_IOV_MAX];
     refbuf_t *refbuf = client->refbuf;
-    int ret;
-    const char *buf = refbuf->data + client->pos;
-    unsigned int len = refbuf->len - client->pos;
+    unsigned int pos = client->pos;
+    size_t count = 0, total = 0, i;
+    ssize_t ret;
+
+    while (refbuf && count < FORMAT_IOV_MAX && total < FORMAT_IOV_BYTES) {
+        if (pos < refbuf->len) {
+            iov[count].iov_base = refbuf->data + pos;
+            iov[count].iov_len = refbuf->len - pos;
+            from[count] = refbuf;
+            total += iov[count].iov_len;
+            count++;
+        }
+        if (client->check_buffer != format_advance_queue)
+            break;
+        refbuf = refbuf->next;
+        pos = 0;
+    }
+
+    if (count == 0)
+        return 0;
 
-    ret = client_send_bytes(client, buf, len);
+    ret = client_send_iov(client, iov, count);
 
-    if (ret > 0)
-        client->pos += ret;
+    total = ret > 0 ? ret : 0;
+    for (i = 0; i < count && total; i++) {
+        size_t done = total < iov[i].iov_len ? total : iov[i].iov_len;
+
+        if (from[i] != client->refbuf)
+            client_set_queue(client, from[i]);
+        client->pos += done;
+        total -= done;
+    }
 
     return ret;
 }
@@ -334,50 +386,16 @@ static inline const char *__find_bitrate(const http_var_t *var)
     return NULL;
 }
 
-static int format_prepare_headers (source_t *source, client_t *client)
+/* Renders the headers taken from the source headers and the mount,
+ * returns the number of bytes written or -1 if they do not fit.
+ */
+static ssize_t format_render_source_headers(source_t *source, char *ptr, size_t remaining)
 {
-    size_t remaining;
-    char *ptr;
+    ssize_t done = 0;
     int bytes;
     int bitrate_filtered = 0;
     avl_node *node;
 
-    remaining = client->refbuf->len;
-    ptr = client->refbuf->data;
-    client->respcode = 200;
-
-    bytes = util_http_build_header(ptr, remaining, 0, 0, 200, NULL, source->format->contenttype, NULL, NULL, source, client);
-    if (bytes <= 0) {
-        ICECAST_LOG_ERROR("Dropping client as we can not build response headers.");
-        client->respcode = 500;
-        return -1;
-    } else if (((size_t)bytes + (size_t)1024U) >= remaining) { /* we don't know yet how much to follow but want at least 1kB free space */
-        void *new_ptr = realloc(ptr, bytes + 1024);
-        if (new_ptr) {
-            ICECAST_LOG_DEBUG("Client buffer reallocation succeeded.");
-            client->refbuf->data = ptr = new_ptr;
-            client->refbuf->len = remaining = bytes + 1024;
-            bytes = util_http_build_header(ptr, remaining, 0, 0, 200, NULL, source->format->contenttype, NULL, NULL, source, client);
-            if (bytes <= 0 || (size_t)bytes >= remaining) {
-                ICECAST_LOG_ERROR("Dropping client as we can not build response headers.");
-                client->respcode = 500;
-                return -1;
-            }
-        } else {
-            ICECAST_LOG_ERROR("Client buffer reallocation failed. Dropping client.");
-            client->respcode = 500;
-            return -1;
-        }
-    }
-
-    if (bytes <= 0 || (size_t)bytes >= remaining) {
-        ICECAST_LOG_ERROR("Can not allocate headers for client %p", client);
-        client->respcode = 500;
-        return -1;
-    }
-    remaining -= bytes;
-    ptr += bytes;
-
     /* iterate through source http headers and send to client */
     avl_tree_rlock(source->parser->vars);
     node = avl_get_first(source->parser->vars);
@@ -444,28 +462,127 @@ static int format_prepare_headers (source_t *source, client_t *client)
 
         if (bytes < 0 || (size_t)bytes >= remaining) {
             avl_tree_unlock(source->parser->vars);
-            ICECAST_LOG_ERROR("Can not allocate headers for client %p", client);
-            client->respcode = 500;
             return -1;
         }
 
         remaining -= bytes;
         ptr += bytes;
+        done += bytes;
         if (next)
             node = avl_get_next(node);
     }
     avl_tree_unlock(source->parser->vars);
 
-    bytes = snprintf(ptr, remaining, "\r\n");
-    if (bytes <= 0 || (size_t)bytes >= remaining) {
+    return done;
+}
+
+/* The headers taken from the source headers and the mount are the same
+ * for all listeners. They are rendered once and kept in the source until
+ * source_update_settings() or source_clear_source() drop them.
+ */
+static refbuf_t *format_get_source_headers(source_t *source)
+{
+    refbuf_t *headers;
+    unsigned int generation;
+    size_t len;
+
+    thread_mutex_lock(&source->lock);
+    headers = source->listener_headers;
+    if (headers)
+        refbuf_addref(headers);
+    generation = source->listener_headers_generation;
+    thread_mutex_unlock(&source->lock);
+
+    if (headers)
+        return headers;
+
+    for (len = 1024; len <= FORMAT_SOURCE_HEADERS_MAX; len *= 2) {
+        ssize_t bytes;
+
+        headers = refbuf_new(len);
+        bytes = format_render_source_headers(source, headers->data, len);
+        if (bytes >= 0) {
+            headers->len = bytes;
+            break;
+        }
+        refbuf_release(headers);
+        headers = NULL;
+    }
+
+    if (!headers)
+        return NULL;
+
+    /* keep it unless it was dropped meanwhile, it may be outdated then */
+    thread_mutex_lock(&source->lock);
+    if (!source->listener_headers && generation == source->listener_headers_generation) {
+        refbuf_addref(headers);
+        source->listener_headers = headers;
+    }
+    thread_mutex_unlock(&source->lock);
+
+    return headers;
+}
+
+static int format_prepare_headers (source_t *source, client_t *client)
+{
+    size_t remaining;
+    size_t needed;
+    char *ptr;
+    int bytes;
+    refbuf_t *headers;
+
+    client->respcode = 200;
+
+    headers = format_get_source_headers(source);
+    if (!headers) {
         ICECAST_LOG_ERROR("Can not allocate headers for client %p", client);
         client->respcode = 500;
         return -1;
     }
-    remaining -= bytes;
+
+    remaining = client->refbuf->len;
+    ptr = client->refbuf->data;
+
+    bytes = util_http_build_header(ptr, remaining, 0, 0, 200, NULL, source->format->contenttype, NULL, NULL, source, client);
+    if (bytes <= 0) {
+        ICECAST_LOG_ERROR("Dropping client as we can not build response headers.");
+        refbuf_release(headers);
+        client->respcode = 500;
+        return -1;
+    }
+
+    /* the format may add some more */
+    needed = (size_t)bytes + headers->len + 2 + FORMAT_HEADERS_SPARE;
+    if (needed > remaining) {
+        if (refbuf_resize(client->refbuf, needed) == 0) {
+            ICECAST_LOG_DEBUG("Client buffer reallocation succeeded.");
+            ptr = client->refbuf->data;
+            remaining = client->refbuf->len;
+            bytes = util_http_build_header(ptr, remaining, 0, 0, 200, NULL, source->format->contenttype, NULL, NULL, source, client);
+            needed = (size_t)bytes + headers->len + 2 + FORMAT_HEADERS_SPARE;
+            if (bytes <= 0 || needed > remaining) {
+                ICECAST_LOG_ERROR("Dropping client as we can not build response headers.");
+                refbuf_release(headers);
+                client->respcode = 500;
+                return -1;
+            }
+        } else {
+            ICECAST_LOG_ERROR("Client buffer reallocation failed. Dropping client.");
+            refbuf_release(headers);
+            client->respcode = 500;
+            return -1;
+        }
+    }
     ptr += bytes;
 
-    client->refbuf->len -= remaining;
+    memcpy(ptr, headers->data, headers->len);
+    ptr += headers->len;
+    refbuf_release(headers);
+
+    memcpy(ptr, "\r\n", 2);
+    ptr += 2;
+
+    client->refbuf->len = ptr - client->refbuf->data;
     if (source->format->create_client_data)
         if (source->format->create_client_data (source, client) < 0) {
             ICECAST_LOG_ERROR("Client format header generation failed. "
@@ -65,6 +65,15 @@ format_type_t format_get_type(const char *contenttype);
 char *format_get_mimetype(format_type_t type);
 int format_get_plugin(format_type_t type, source_t *source);
 
+/* limits of a single gathered write to a client */
+#define FORMAT_IOV_MAX      16
+#define FORMAT_IOV_BYTES    16384
+
+/* free space left after the listener response headers for create_client_data() */
+#define FORMAT_HEADERS_SPARE        1024
+/* largest block of headers taken from the source headers */
+#define FORMAT_SOURCE_HEADERS_MAX   65536
+
 int format_generic_write_to_client (client_t *client);
 int format_advance_queue (source_t *source, client_t *client);
 int format_check_http_buffer (source_t *source, client_t *client);
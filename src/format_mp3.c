@@ -360,136 +360,159 @@ static void mp3_set_title(source_t *source)
 }
 
 
-/* send the appropriate metadata, and return the number of bytes written
- * which is 0 or greater.  Check the client in_metadata value afterwards
- * to see if all metadata has been sent
+/* select the metadata to send after the data of the block associated
+ * belongs to. If there is a change in metadata then send it else send a
+ * single zero value byte in its place.
  */
-static int send_stream_metadata (client_t *client, refbuf_t *associated)
+static void get_stream_metadata(refbuf_t *associated, refbuf_t *last, int offset, char **metadata, unsigned int *meta_len)
 {
-    int ret = 0;
-    char *metadata;
-    int meta_len;
-    mp3_client_data *client_mp3 = client->format_data;
-
-    /* If there is a change in metadata then send it else
-     * send a single zero value byte in its place
-     */
-    if (associated && associated != client_mp3->associated)
+    if (associated && associated != last)
     {
-        metadata = associated->data + client_mp3->metadata_offset;
-        meta_len = associated->len - client_mp3->metadata_offset;
+        *metadata = associated->data + offset;
+        *meta_len = associated->len - offset;
     }
-    else
+    else if (associated)
     {
-        if (associated)
-        {
-            metadata = "\0";
-            meta_len = 1;
-        }
-        else
-        {
-            char *meta = "\001StreamTitle='';";
-            metadata = meta + client_mp3->metadata_offset;
-            meta_len = 17 - client_mp3->metadata_offset;
-        }
+        *metadata = "\0";
+        *meta_len = 1;
     }
-    ret = client_send_bytes(client, metadata, meta_len);
-
-    if (ret == meta_len)
+    else
     {
-        client_mp3->associated = associated;
-        client_mp3->metadata_offset = 0;
-        client_mp3->in_metadata = 0;
-        client_mp3->since_meta_block = 0;
-        return ret;
+        char *meta = "\001StreamTitle='';";
+        *metadata = meta + offset;
+        *meta_len = 17 - offset;
     }
-    if (ret > 0)
-        client_mp3->metadata_offset += ret;
-    else
-        ret = 0;
-    client_mp3->in_metadata = 1;
-
-    return ret;
 }
 
 
 /* Handler for writing mp3 data to a client, taking into account whether
- * client has requested shoutcast style metadata updates
+ * client has requested shoutcast style metadata updates.
+ *
+ * The data and metadata blocks up to the next few intervals, following the
+ * queue if the client reads it, are gathered and written with a single call.
+ * Afterwards the client state is moved forward by what was actually written.
+ * The metadata sent at an interval is the one associated with the block of
+ * the data following it.
  */
 static int format_mp3_write_buf_to_client(client_t *client)
 {
-    int ret, written = 0;
     mp3_client_data *client_mp3 = client->format_data;
+    struct iovec iov[FORMAT_IOV_MAX];
+    refbuf_t *from[FORMAT_IOV_MAX];  /* block of the data, or the metadata */
+    bool is_metadata[FORMAT_IOV_MAX];
+    bool follow_queue = client->check_buffer == format_advance_queue;
     refbuf_t *refbuf = client->refbuf;
-    char *buf = refbuf->data + client->pos;
-    unsigned int len = refbuf->len - client->pos;
-
-    do
+    unsigned int pos = client->pos;
+    unsigned int since_meta_block = client_mp3->since_meta_block;
+    int in_metadata = client_mp3->in_metadata;
+    int metadata_offset = client_mp3->metadata_offset;
+    refbuf_t *last_associated = client_mp3->associated;
+    size_t count = 0, total = 0, i;
+    ssize_t ret;
+
+    while (refbuf && count < FORMAT_IOV_MAX && total < FORMAT_IOV_BYTES)
     {
-        /* send any unwritten metadata to the client */
-        if (client_mp3->in_metadata)
-        {
-            refbuf_t *associated = refbuf->associated;
-            ret = send_stream_metadata(client, associated);
+        char *buf;
+        unsigned int len;
 
-            if (client_mp3->in_metadata)
+        if (in_metadata && pos == refbuf->len)
+        {
+            /* the metadata is taken from the block the following data
+             * comes from, no matter how the writes were split up */
+            if (!follow_queue || refbuf->next == NULL)
                 break;
-            written += ret;
+            refbuf = refbuf->next;
+            pos = 0;
         }
-        /* see if we need to send the current metadata to the client */
-        if (client_mp3->interval)
+
+        if (in_metadata)
         {
-            unsigned int remaining = client_mp3->interval -
-                client_mp3->since_meta_block;
+            get_stream_metadata(refbuf->associated, last_associated, metadata_offset, &buf, &len);
+            from[count] = refbuf->associated;
+            is_metadata[count] = true;
+            last_associated = refbuf->associated;
+            in_metadata = 0;
+            metadata_offset = 0;
+            since_meta_block = 0;
+        }
+        else
+        {
+            if (pos == refbuf->len)
+            {
+                if (!follow_queue)
+                    break;
+                refbuf = refbuf->next;
+                pos = 0;
+                continue;
+            }
 
+            buf = refbuf->data + pos;
+            len = refbuf->len - pos;
             /* leading up to sending the metadata block */
-            if (remaining <= len)
+            if (client_mp3->interval && (client_mp3->interval - since_meta_block) <= len)
             {
-                /* send any mp3 before the metadata block */
-                if (remaining)
-                {
-                    ret = client_send_bytes (client, buf, remaining);
-
-                    if (ret > 0)
-                    {
-                        client_mp3->since_meta_block += ret;
-                        client->pos += ret;
-                    }
-                    if (ret < (int)remaining)
-                        break;
-                    written += ret;
-                }
-                ret = send_stream_metadata (client, refbuf->associated);
-                if (client_mp3->in_metadata)
-                    break;
-                written += ret;
-                buf += remaining;
-                len -= remaining;
-                /* limit how much mp3 we send if using small intervals */
-                if (len > client_mp3->interval)
-                    len = client_mp3->interval;
+                len = client_mp3->interval - since_meta_block;
+                in_metadata = 1;
             }
+            from[count] = refbuf;
+            is_metadata[count] = false;
+            pos += len;
+            since_meta_block += len;
         }
-        /* write any mp3, maybe after the metadata block */
-        if (len)
-        {
-            ret = client_send_bytes (client, buf, len);
 
-            if (ret > 0)
+        if (len == 0)
+            continue;
+
+        iov[count].iov_base = buf;
+        iov[count].iov_len = len;
+        total += len;
+        count++;
+    }
+
+    if (count == 0)
+        return 0;
+
+    ret = client_send_iov(client, iov, count);
+
+    total = ret > 0 ? ret : 0;
+    for (i = 0; i < count; i++)
+    {
+        size_t done = total < iov[i].iov_len ? total : iov[i].iov_len;
+
+        if (is_metadata[i])
+        {
+            if (done == iov[i].iov_len)
             {
-                client_mp3->since_meta_block += ret;
-                client->pos += ret;
+                client_mp3->associated = from[i];
+                client_mp3->metadata_offset = 0;
+                client_mp3->in_metadata = 0;
+                client_mp3->since_meta_block = 0;
             }
-            if (ret < (int)len)
+            else
+            {
+                client_mp3->metadata_offset += done;
+                client_mp3->in_metadata = 1;
                 break;
-            written += ret;
+            }
         }
-        ret = 0;
-    } while (0);
+        else
+        {
+            if (done == 0)
+                break;
+            if (from[i] != client->refbuf)
+                client_set_queue(client, from[i]);
+            client->pos += done;
+            client_mp3->since_meta_block += done;
+            if (done < iov[i].iov_len)
+                break;
+            /* the metadata follows right after this */
+            if (client_mp3->interval && client_mp3->since_meta_block == client_mp3->interval)
+                client_mp3->in_metadata = 1;
+        }
+        total -= done;
+    }
 
-    if (ret > 0)
-        written += ret;
-    return written;
+    return ret > 0 ? ret : 0;
 }
 
 static void format_mp3_free_plugin(format_plugin_t *self)
@@ -714,7 +737,7 @@ static int format_mp3_create_client_data(source_t *source, client_t *client)
     mp3_state *source_mp3 = source->format->_state;
     const char *metadata;
     /* the +-2 is for overwriting the last set of \r\n */
-    unsigned remaining = 4096 - client->refbuf->len + 2;
+    unsigned remaining = FORMAT_HEADERS_SPARE + 2;
     char *ptr = client->refbuf->data + client->refbuf->len - 2;
     int bytes;
     const char *useragent;
@@ -724,7 +747,7 @@ static int format_mp3_create_client_data(source_t *source, client_t *client)
 
     /* hack for flash player, it wants a length.  It has also been reported that the useragent
      * appears as MSIE if run in internet explorer */
-    useragent = httpp_getvar (client->parser, "user-agent");
+    useragent = client_get_header(client, HTTPHEAD_USER_AGENT);
     if (httpp_getvar(client->parser, "x-flash-version") ||
             (useragent && strstr(useragent, "MSIE")))
     {
@@ -735,7 +758,7 @@ static int format_mp3_create_client_data(source_t *source, client_t *client)
 
     client->format_data = client_mp3;
     client->free_client_data = free_mp3_client_data;
-    metadata = httpp_getvar(client->parser, "icy-metadata");
+    metadata = client_get_header(client, HTTPHEAD_ICY_METADATA);
     if (metadata && atoi(metadata))
     {
         if (source_mp3->interval >= 0)
@@ -757,7 +780,7 @@ static int format_mp3_create_client_data(source_t *source, client_t *client)
     remaining -= bytes;
     ptr += bytes;
 
-    client->refbuf->len = 4096 - remaining;
+    client->refbuf->len = ptr - client->refbuf->data;
 
     return 0;
 }
@@ -18,13 +18,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <errno.h>
 
 #ifdef HAVE_POLL
 #include <poll.h>
 #endif
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
 
 #ifndef _WIN32
 #include <unistd.h>
@@ -43,6 +48,8 @@
 #include "common/httpp/httpp.h"
 #include "common/net/sock.h"
 
+#include <igloo/prng.h>
+
 #include "fserve.h"
 #include "compat.h"
 #include "connection.h"
@@ -55,31 +62,112 @@
 #include "logging.h"
 #include "cfgfile.h"
 #include "util.h"
+#include "util_http.h"
+#include "util_string.h"
 #include "admin.h"
 
 #undef CATMODULE
 #define CATMODULE "fserve"
 
 #define BUFSIZE 4096
+/* bytes handed to the kernel per call for the sendfile and cache methods */
+#define FSERVE_DIRECT_CHUNK     (64*1024)
+/* number of files per file counters are kept for */
+#define FSERVE_FILE_STATS_MAX   256
+/* random bytes in a multipart/byteranges boundary */
+#define FSERVE_BOUNDARY_BYTES   12
+
+/* ms a worker waits for its sockets to become writable */
+#define FSERVE_WAIT             200
+
+#ifdef HAVE_SYS_EPOLL_H
+#define FSERVE_USE_EPOLL
+#define FSERVE_EPOLL_EVENTS     64
+#endif
+
+typedef enum {
+    /* the client can take more data right away */
+    FSERVE_CLIENT_MORE,
+    /* wait for the socket to become writable again */
+    FSERVE_CLIENT_BLOCKED,
+    /* finished or failed, remove the client */
+    FSERVE_CLIENT_DONE
+} fserve_client_state_t;
+
+/* A file serving thread. Clients are handed over through pending_list,
+ * all other members are only used by the thread itself.
+ */
+typedef struct {
+    /* guarded by pending_lock */
+    fserve_t *pending_list;
+    unsigned int load;
+    int running;
+
+    /* doubly linked through next and prev */
+    fserve_t *active_list;
+    /* clients to send to, linked through ready_next */
+    fserve_t *ready_list;
+    unsigned int clients;
+    /* clients removed since the last hand-off, to update load */
+    unsigned int removed;
+} fserve_worker_t;
+
+/* socket readiness state, local to a worker thread */
+typedef struct {
+#ifdef FSERVE_USE_EPOLL
+    int epoll_fd;
+#endif
+#ifdef HAVE_POLL
+    struct pollfd *ufds;
+#else
+    fd_set fds;
+    sock_t fd_max;
+#endif
+    int client_tree_changed;
+} fserve_io_t;
+
+struct fserve_map_tag {
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    time_t mtime;
+    off_t size;
+    /* a copy on the heap, not a mapping of the file: a file truncated
+     * while mapped would raise SIGBUS on the next access */
+    char *data;
+    /* the cache holds one reference while the map is in map_tree */
+    unsigned int refcount;
+    uint64_t last_used;
+};
+
+typedef struct {
+    fserve_file_stats_t stats;
+    uint64_t last_used;
+} file_stats_entry_t;
 
 static volatile int __inited = 0;
 
-static fserve_t *active_list = NULL;
-static fserve_t *pending_list = NULL;
+static fserve_worker_t fserve_workers[FSERVE_MAX_WORKERS];
+/* number of workers new clients are spread across */
+static unsigned int fserve_threads = 1;
 
 static spin_t pending_lock;
 static avl_tree *mimetypes = NULL;
 
-static volatile int run_fserv = 0;
-static unsigned int fserve_clients;
-static int client_tree_changed = 0;
+/* file cache, guarded by map_lock */
+static mutex_t map_lock;
+static avl_tree *map_tree;
+static size_t map_bytes;
+static size_t map_limit;
+static size_t map_file_limit;
+static uint64_t map_tick;
 
-#ifdef HAVE_POLL
-static struct pollfd *ufds = NULL;
-#else
-static fd_set fds;
-static sock_t fd_max = SOCK_ERROR;
-#endif
+/* per file counters, guarded by file_stats_lock */
+static mutex_t file_stats_lock;
+static avl_tree *file_stats;
+static uint64_t file_stats_tick;
+
+static volatile int run_fserv = 0;
 
 typedef struct {
     char *ext;
@@ -88,6 +176,13 @@ typedef struct {
 
 static void fserve_client_destroy(fserve_t *fclient);
 static int _delete_mapping(void *mapping);
+static int _compare_maps(void *arg, void *a, void *b);
+static int _compare_file_stats(void *arg, void *a, void *b);
+static int _free_file_stats(void *key);
+static void fserve_map_evict(size_t needed);
+static void fserve_count_file(fserve_t *fclient);
+static int fserve_add_file(client_t *client, FILE *file, fserve_map_t *map, fserve_method_t method, off_t offset, off_t end, fserve_part_t *parts, size_t parts_len, char *path);
+static void fserve_free_parts(fserve_part_t *parts, size_t len);
 static void *fserv_thread_function(void *arg);
 
 void fserve_initialize(void)
@@ -95,247 +190,488 @@ void fserve_initialize(void)
     ice_config_t *config = config_get_config();
 
     mimetypes = NULL;
-    active_list = NULL;
-    pending_list = NULL;
+    memset(fserve_workers, 0, sizeof(fserve_workers));
+    fserve_threads = 1;
     thread_spin_create (&pending_lock);
+    thread_mutex_create(&map_lock);
+    map_tree = avl_tree_new(_compare_maps, NULL);
+    map_bytes = 0;
+    thread_mutex_create(&file_stats_lock);
+    file_stats = avl_tree_new(_compare_file_stats, NULL);
 
     fserve_recheck_mime_types (config);
+    fserve_recheck_cache (config);
+    run_fserv = 1;
+    fserve_set_threads (config->fileserve_threads);
     config_release_config();
 
     __inited = 1;
 
     stats_event (NULL, "file_connections", "0");
+    stats_event (NULL, "file_cache_hits", "0");
+    stats_event (NULL, "file_cache_misses", "0");
+    stats_event (NULL, "file_not_modified", "0");
     ICECAST_LOG_INFO("file serving started");
 }
 
 void fserve_shutdown(void)
 {
+    size_t i;
+    int busy;
+
     if (!__inited)
         return;
 
     thread_spin_lock (&pending_lock);
     run_fserv = 0;
-    while (pending_list)
+    for (i = 0; i < FSERVE_MAX_WORKERS; i++)
     {
-        fserve_t *to_go = (fserve_t *)pending_list;
-        pending_list = to_go->next;
+        while (fserve_workers[i].pending_list)
+        {
+            fserve_t *to_go = fserve_workers[i].pending_list;
+            fserve_workers[i].pending_list = to_go->next;
 
-        fserve_client_destroy (to_go);
-    }
-    while (active_list)
-    {
-        fserve_t *to_go = active_list;
-        active_list = to_go->next;
-        fserve_client_destroy (to_go);
+            fserve_client_destroy (to_go);
+        }
     }
+    thread_spin_unlock (&pending_lock);
 
+    /* the workers drop their active clients and exit */
+    do {
+        busy = 0;
+        thread_spin_lock (&pending_lock);
+        for (i = 0; i < FSERVE_MAX_WORKERS; i++)
+            busy |= fserve_workers[i].running;
+        thread_spin_unlock (&pending_lock);
+        if (busy)
+            thread_sleep (10000);
+    } while (busy);
+
+    thread_spin_lock (&pending_lock);
     if (mimetypes)
         avl_tree_free (mimetypes, _delete_mapping);
 
     thread_spin_unlock (&pending_lock);
     thread_spin_destroy (&pending_lock);
+
+    /* sources may still hold maps and the file serving thread may still
+     * count a client, so the locks stay around */
+    thread_mutex_lock(&map_lock);
+    map_limit = 0;
+    fserve_map_evict(0);
+    thread_mutex_unlock(&map_lock);
+
+    thread_mutex_lock(&file_stats_lock);
+    avl_tree_free(file_stats, _free_file_stats);
+    file_stats = NULL;
+    thread_mutex_unlock(&file_stats_lock);
+
     ICECAST_LOG_INFO("file serving stopped");
 }
 
+void fserve_set_threads(unsigned int threads)
+{
+    if (threads == 0) {
+#if defined(_SC_NPROCESSORS_ONLN)
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (unsigned int)cpus : 1;
+#else
+        threads = 1;
+#endif
+    }
+    if (threads > FSERVE_MAX_WORKERS)
+        threads = FSERVE_MAX_WORKERS;
+
+    /* workers left out by a lower setting finish their clients and exit */
+    thread_spin_lock (&pending_lock);
+    fserve_threads = threads;
+    thread_spin_unlock (&pending_lock);
+
+    ICECAST_LOG_INFO("File serving uses up to %u thread(s).", threads);
+}
+
+static inline void fserve_worker_set_ready(fserve_worker_t *worker, fserve_t *fclient)
+{
+    if (fclient->ready)
+        return;
+
+    fclient->ready = 1;
+    fclient->ready_next = worker->ready_list;
+    worker->ready_list = fclient;
+}
+
+static void fserve_worker_activate(fserve_worker_t *worker, fserve_io_t *io, fserve_t *fclient)
+{
+    fclient->prev = NULL;
+    fclient->next = worker->active_list;
+    if (worker->active_list)
+        worker->active_list->prev = fclient;
+    worker->active_list = fclient;
+    worker->clients++;
+    io->client_tree_changed = 1;
+
+#ifdef FSERVE_USE_EPOLL
+    if (io->epoll_fd >= 0) {
+        struct epoll_event ev;
+
+        ev.events = EPOLLOUT|EPOLLET;
+        ev.data.ptr = fclient;
+        if (epoll_ctl(io->epoll_fd, EPOLL_CTL_ADD, fclient->client->con->sock, &ev) != 0) {
+            ICECAST_LOG_ERROR("Can not watch socket of client %p: %s", fclient->client, strerror(errno));
+            fclient->client->con->error = 1;
+        }
+    }
+#endif
+
+    /* the socket is most likely writable, do not wait to find out */
+    fserve_worker_set_ready(worker, fclient);
+}
+
+static void fserve_worker_remove(fserve_worker_t *worker, fserve_io_t *io, fserve_t *fclient)
+{
+#ifdef FSERVE_USE_EPOLL
+    /* callbacks keep the socket open, it must not report to us any more */
+    if (io->epoll_fd >= 0)
+        epoll_ctl(io->epoll_fd, EPOLL_CTL_DEL, fclient->client->con->sock, NULL);
+#endif
+
+    if (fclient->prev)
+        fclient->prev->next = fclient->next;
+    else
+        worker->active_list = fclient->next;
+    if (fclient->next)
+        fclient->next->prev = fclient->prev;
+
+    worker->clients--;
+    worker->removed++;
+    io->client_tree_changed = 1;
+
+    fserve_client_destroy (fclient);
+}
+
+/* Take over the clients handed to worker and report the ones it removed.
+ * This is the only place a worker synchronises with the rest of the server.
+ * Returns 1 to carry on, 0 if the worker has nothing left to do and -1 if
+ * file serving shuts down.
+ */
+static int fserve_worker_handoff(fserve_worker_t *worker, fserve_io_t *io)
+{
+    fserve_t *fclient;
+
+    if (worker->pending_list == NULL && worker->removed == 0 && worker->clients && run_fserv)
+        return 1;
+
+    thread_spin_lock (&pending_lock);
+    if (!run_fserv)
+    {
+        thread_spin_unlock (&pending_lock);
+        return -1;
+    }
+    worker->load -= worker->removed;
+    worker->removed = 0;
+    fclient = worker->pending_list;
+    worker->pending_list = NULL;
+    if (fclient == NULL && worker->clients == 0)
+    {
+        /* fserve_add_pending() starts a new thread when needed */
+        worker->running = 0;
+        thread_spin_unlock (&pending_lock);
+        return 0;
+    }
+    thread_spin_unlock (&pending_lock);
+
+    while (fclient)
+    {
+        fserve_t *to_move = fclient;
+        fclient = fclient->next;
+        fserve_worker_activate(worker, io, to_move);
+    }
+
+    return 1;
+}
+
 #ifdef HAVE_POLL
-int fserve_client_waiting (void)
+static void fserve_worker_poll(fserve_worker_t *worker, fserve_io_t *io, int timeout)
 {
     fserve_t *fclient;
     unsigned int i = 0;
 
     /* only rebuild ufds if there are clients added/removed */
-    if (client_tree_changed) {
-        struct pollfd *ufds_new = realloc(ufds, fserve_clients * sizeof(struct pollfd));
-        /* REVIEW: If we can not allocate new ufds, keep old ones for now. */
-        if (ufds_new || fserve_clients == 0) {
-            ufds = ufds_new;
-            client_tree_changed = 0;
-            fclient = active_list;
-            while (fclient)
-            {
-                ufds[i].fd = fclient->client->con->sock;
-                ufds[i].events = POLLOUT;
-                ufds[i].revents = 0;
-                fclient = fclient->next;
-                i++;
-            }
+    if (io->client_tree_changed) {
+        struct pollfd *ufds_new = realloc(io->ufds, worker->clients * sizeof(struct pollfd));
+
+        if (ufds_new == NULL) {
+            /* try again next time, just visit everyone until then */
+            for (fclient = worker->active_list; fclient; fclient = fclient->next)
+                fserve_worker_set_ready(worker, fclient);
+            return;
+        }
+        io->ufds = ufds_new;
+        io->client_tree_changed = 0;
+        for (fclient = worker->active_list; fclient; fclient = fclient->next, i++)
+        {
+            io->ufds[i].fd = fclient->client->con->sock;
+            io->ufds[i].events = POLLOUT;
+            io->ufds[i].revents = 0;
         }
     }
 
-    if (!ufds) {
-        thread_spin_lock (&pending_lock);
-        run_fserv = 0;
-        thread_spin_unlock (&pending_lock);
-        return -1;
-    } else if (poll(ufds, fserve_clients, 200) > 0) {
+    if (poll(io->ufds, worker->clients, timeout) > 0) {
         /* mark any clients that are ready */
-        fclient = active_list;
-        for (i=0; i<fserve_clients; i++)
+        fclient = worker->active_list;
+        for (i = 0; i < worker->clients; i++, fclient = fclient->next)
         {
-            if (ufds[i].revents & (POLLOUT|POLLHUP|POLLERR))
-            fclient->ready = 1;
-            fclient = fclient->next;
+            if (io->ufds[i].revents & (POLLOUT|POLLHUP|POLLERR))
+                fserve_worker_set_ready(worker, fclient);
         }
-        return 1;
     }
-
-    return 0;
 }
 #else
-int fserve_client_waiting(void)
+static void fserve_worker_poll(fserve_worker_t *worker, fserve_io_t *io, int timeout)
 {
     fserve_t *fclient;
     fd_set realfds;
+    struct timeval tv;
 
     /* only rebuild fds if there are clients added/removed */
-    if (client_tree_changed) {
-        client_tree_changed = 0;
-        FD_ZERO(&fds);
-        fd_max = SOCK_ERROR;
-        fclient = active_list;
-        while (fclient) {
-            FD_SET(fclient->client->con->sock, &fds);
-            if (fclient->client->con->sock > fd_max || fd_max == SOCK_ERROR)
-                fd_max = fclient->client->con->sock;
-            fclient = fclient->next;
+    if (io->client_tree_changed) {
+        io->client_tree_changed = 0;
+        FD_ZERO(&io->fds);
+        io->fd_max = SOCK_ERROR;
+        for (fclient = worker->active_list; fclient; fclient = fclient->next) {
+            FD_SET(fclient->client->con->sock, &io->fds);
+            if (fclient->client->con->sock > io->fd_max || io->fd_max == SOCK_ERROR)
+                io->fd_max = fclient->client->con->sock;
         }
     }
-    /* hack for windows, select needs at least 1 descriptor */
-    if (fd_max == SOCK_ERROR)
-    {
-        thread_spin_lock (&pending_lock);
-        run_fserv = 0;
-        thread_spin_unlock (&pending_lock);
-        return -1;
-    }
-    else
+
+    tv.tv_sec = 0;
+    tv.tv_usec = timeout * 1000;
+    /* make a duplicate of the set so we do not have to rebuild it
+     * each time around */
+    memcpy(&realfds, &io->fds, sizeof(fd_set));
+    if (select(io->fd_max+1, NULL, &realfds, NULL, &tv) > 0)
     {
-        struct timeval tv;
-        tv.tv_sec = 0;
-        tv.tv_usec = 200000;
-        /* make a duplicate of the set so we do not have to rebuild it
-         * each time around */
-        memcpy(&realfds, &fds, sizeof(fd_set));
-        if(select(fd_max+1, NULL, &realfds, NULL, &tv) > 0)
+        /* mark any clients that are ready */
+        for (fclient = worker->active_list; fclient; fclient = fclient->next)
         {
-            /* mark any clients that are ready */
-            fclient = active_list;
-            while (fclient)
-            {
-                if (FD_ISSET (fclient->client->con->sock, &realfds))
-                    fclient->ready = 1;
-                fclient = fclient->next;
-            }
-            return 1;
+            if (FD_ISSET (fclient->client->con->sock, &realfds))
+                fserve_worker_set_ready(worker, fclient);
         }
     }
-    return 0;
 }
 #endif
 
-static int wait_for_fds(void)
+/* put the clients whose sockets became writable on the ready list */
+static void fserve_worker_wait(fserve_worker_t *worker, fserve_io_t *io)
 {
-    fserve_t *fclient;
+    int timeout = worker->ready_list ? 0 : FSERVE_WAIT;
+
+#ifdef FSERVE_USE_EPOLL
+    if (io->epoll_fd >= 0) {
+        struct epoll_event events[FSERVE_EPOLL_EVENTS];
+        int ret = epoll_wait(io->epoll_fd, events, FSERVE_EPOLL_EVENTS, timeout);
+        int i;
+
+        if (ret >= 0 || errno == EINTR) {
+            for (i = 0; i < ret; i++)
+                fserve_worker_set_ready(worker, events[i].data.ptr);
+            return;
+        }
+
+        ICECAST_LOG_ERROR("Waiting for file serving clients failed, falling back to poll: %s", strerror(errno));
+        close(io->epoll_fd);
+        io->epoll_fd = -1;
+        io->client_tree_changed = 1;
+    }
+#endif
+
+    fserve_worker_poll(worker, io, timeout);
+}
+
+/* switch to the next range of a multipart/byteranges body, its head is put
+ * into the client buffer */
+static bool fserve_next_part(fserve_t *fclient)
+{
+    client_t *client = fclient->client;
+    fserve_part_t *part;
+    size_t len;
+
+    if (fclient->part >= fclient->parts_len)
+        return false;
+
+    part = &fclient->parts[fclient->part++];
+    len = strlen(part->head);
+    memcpy(client->refbuf->data, part->head, len);
+    client->refbuf->len = (unsigned int)len;
+    client->pos = 0;
+    fclient->offset = part->start;
+    fclient->end = part->end;
+
+    if (fclient->method == FSERVE_METHOD_READ && fclient->offset < fclient->end) {
+        if (fseeko(fclient->file, fclient->offset, SEEK_SET) != 0)
+            client->con->error = 1;
+        fclient->syscalls++;
+    }
+
+    return true;
+}
+
+/* send the next part of the body for the sendfile and cache methods */
+static fserve_client_state_t fserve_send_direct(fserve_t *fclient)
+{
+    client_t *client = fclient->client;
+    size_t len = FSERVE_DIRECT_CHUNK;
+    ssize_t ret;
+
+    if ((fclient->end - fclient->offset) < (off_t)len)
+        len = (size_t)(fclient->end - fclient->offset);
+
+    if (fclient->method == FSERVE_METHOD_CACHE) {
+        ret = client_send_bytes(client, (const char *)fclient->map->data + fclient->offset, len);
+        if (ret > 0)
+            fclient->offset += ret;
+    } else {
+        ret = connection_sendfile(client->con, fileno(fclient->file), &fclient->offset, len);
+        /* the file got shorter since we sent the headers */
+        if (ret == 0)
+            client->con->error = 1;
+    }
+    fclient->syscalls++;
+
+    if (client->con->error)
+        return FSERVE_CLIENT_DONE;
+
+    if (fclient->offset >= fclient->end)
+        return fclient->part < fclient->parts_len ? FSERVE_CLIENT_MORE : FSERVE_CLIENT_DONE;
+
+    return ret < (ssize_t)len ? FSERVE_CLIENT_BLOCKED : FSERVE_CLIENT_MORE;
+}
+
+static fserve_client_state_t fserve_send(fserve_t *fclient)
+{
+    client_t *client = fclient->client;
+    refbuf_t *refbuf = client->refbuf;
+    size_t bytes;
     int ret;
 
-    while (run_fserv)
+    if (client->pos == refbuf->len && fclient->offset < fclient->end)
     {
-        /* add any new clients here */
-        if (pending_list)
+        /* headers are out, the body goes without a copy */
+        if (fclient->method != FSERVE_METHOD_READ)
+            return fserve_send_direct(fclient);
+
+        /* Grab a new chunk */
+        bytes = BUFSIZE;
+        if ((fclient->end - fclient->offset) < (off_t)bytes)
+            bytes = (size_t)(fclient->end - fclient->offset);
+        bytes = fread (refbuf->data, 1, bytes, fclient->file);
+        fclient->syscalls++;
+        if (bytes == 0)
         {
-            thread_spin_lock (&pending_lock);
-
-            fclient = (fserve_t*)pending_list;
-            while (fclient)
-            {
-                fserve_t *to_move = fclient;
-                fclient = fclient->next;
-                to_move->next = active_list;
-                active_list = to_move;
-                client_tree_changed = 1;
-                fserve_clients++;
-            }
-            pending_list = NULL;
-            thread_spin_unlock(&pending_lock);
+            /* the file got shorter since we sent the headers */
+            client->con->error = 1;
+            return FSERVE_CLIENT_DONE;
         }
-        /* drop out of here if someone is ready */
-        ret = fserve_client_waiting();
-        if (ret)
-            return ret;
+        fclient->offset += bytes;
+        refbuf->len = (unsigned int)bytes;
+        client->pos = 0;
     }
-    return -1;
+    else if (client->pos == refbuf->len && !fserve_next_part(fclient))
+    {
+        if (refbuf->next == NULL && fclient->producer)
+            refbuf->next = fclient->producer(fclient->producer_arg);
+        if (refbuf->next == NULL)
+            return FSERVE_CLIENT_DONE;
+        refbuf = refbuf->next;
+        client->refbuf->next = NULL;
+        refbuf_release (client->refbuf);
+        client->refbuf = refbuf;
+        client->pos = 0;
+    }
+
+    if (client->con->error)
+        return FSERVE_CLIENT_DONE;
+
+    /* Now try and send current chunk. */
+    refbuf = client->refbuf;
+    bytes = refbuf->len - client->pos;
+    ret = format_generic_write_to_client (client);
+    fclient->syscalls++;
+
+    if (client->con->error)
+        return FSERVE_CLIENT_DONE;
+
+    return (ret < 0 || (size_t)ret < bytes) ? FSERVE_CLIENT_BLOCKED : FSERVE_CLIENT_MORE;
 }
 
 static void *fserv_thread_function(void *arg)
 {
-    fserve_t *fclient, **trail;
-    size_t bytes;
+    fserve_worker_t *worker = arg;
+    fserve_io_t io;
+    int ret;
 
-    (void)arg;
+    memset(&io, 0, sizeof(io));
+#ifdef FSERVE_USE_EPOLL
+    io.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (io.epoll_fd < 0)
+        ICECAST_LOG_WARN("Can not create epoll instance for file serving, falling back to poll: %s", strerror(errno));
+#endif
+#ifndef HAVE_POLL
+    io.fd_max = SOCK_ERROR;
+#endif
 
-    while (1)
+    while ((ret = fserve_worker_handoff(worker, &io)) > 0)
     {
-        if (wait_for_fds() < 0)
-            break;
+        fserve_t *ready;
 
-        fclient = active_list;
-        trail = &active_list;
+        fserve_worker_wait(worker, &io);
 
-        while (fclient)
+        /* give every ready client one turn, the ones that can take more
+         * go round again after checking for new clients */
+        ready = worker->ready_list;
+        worker->ready_list = NULL;
+        while (ready)
         {
-            /* process this client, if it is ready */
-            if (fclient->ready)
-            {
-                client_t *client = fclient->client;
-                refbuf_t *refbuf = client->refbuf;
-                fclient->ready = 0;
-                if (client->pos == refbuf->len)
-                {
-                    /* Grab a new chunk */
-                    if (fclient->file)
-                        bytes = fread (refbuf->data, 1, BUFSIZE, fclient->file);
-                    else
-                        bytes = 0;
-                    if (bytes == 0)
-                    {
-                        if (refbuf->next == NULL)
-                        {
-                            fserve_t *to_go = fclient;
-                            fclient = fclient->next;
-                            *trail = fclient;
-                            fserve_client_destroy (to_go);
-                            fserve_clients--;
-                            client_tree_changed = 1;
-                            continue;
-                        }
-                        refbuf = refbuf->next;
-                        client->refbuf->next = NULL;
-                        refbuf_release (client->refbuf);
-                        client->refbuf = refbuf;
-                        bytes = refbuf->len;
-                    }
-                    refbuf->len = (unsigned int)bytes;
-                    client->pos = 0;
-                }
-
-                /* Now try and send current chunk. */
-                format_generic_write_to_client (client);
-
-                if (client->con->error)
-                {
-                    fserve_t *to_go = fclient;
-                    fclient = fclient->next;
-                    *trail = fclient;
-                    fserve_clients--;
-                    fserve_client_destroy (to_go);
-                    client_tree_changed = 1;
-                    continue;
-                }
+            fserve_t *fclient = ready;
+
+            ready = fclient->ready_next;
+            fclient->ready = 0;
+
+            switch (fserve_send(fclient)) {
+                case FSERVE_CLIENT_MORE:
+                    fserve_worker_set_ready(worker, fclient);
+                    break;
+                case FSERVE_CLIENT_BLOCKED:
+                    break;
+                case FSERVE_CLIENT_DONE:
+                    fserve_worker_remove(worker, &io, fclient);
+                    break;
             }
-            trail = &fclient->next;
-            fclient = fclient->next;
         }
     }
+
+    if (ret < 0)
+    {
+        /* shutting down, nobody hands us new clients any more */
+        worker->ready_list = NULL;
+        while (worker->active_list)
+            fserve_worker_remove(worker, &io, worker->active_list);
+        thread_spin_lock (&pending_lock);
+        worker->load = 0;
+        worker->removed = 0;
+        worker->running = 0;
+        thread_spin_unlock (&pending_lock);
+    }
+
+#ifdef FSERVE_USE_EPOLL
+    if (io.epoll_fd >= 0)
+        close(io.epoll_fd);
+#endif
+#ifdef HAVE_POLL
+    free(io.ufds);
+#endif
+
     ICECAST_LOG_DEBUG("fserve handler exit");
     return NULL;
 }
@@ -385,8 +721,16 @@ static void fserve_client_destroy(fserve_t *fclient)
 {
     if (fclient)
     {
+        fserve_count_file(fclient);
+        free(fclient->path);
+
         if (fclient->file)
             fclose (fclient->file);
+        if (fclient->map)
+            fserve_map_release(fclient->map);
+        fserve_free_parts(fclient->parts, fclient->parts_len);
+        if (fclient->producer_free)
+            fclient->producer_free(fclient->producer_arg);
 
         if (fclient->callback)
             fclient->callback (fclient->client, fclient->arg);
@@ -398,6 +742,90 @@ static void fserve_client_destroy(fserve_t *fclient)
 }
 
 
+/* checks If-None-Match, or If-Modified-Since if there is no If-None-Match */
+static bool fserve_not_modified(client_t *client, const char *etag, time_t mtime)
+{
+    const char *value = httpp_getvar(client->parser, "if-none-match");
+    time_t since;
+
+    if (value)
+        return util_http_etag_match(value, etag, true);
+
+    value = httpp_getvar(client->parser, "if-modified-since");
+    if (value && util_http_date_parse(value, &since))
+        return mtime <= since;
+
+    return false;
+}
+
+/* If-Range holds either our entity tag or the exact modification time */
+static bool fserve_if_range(client_t *client, const char *etag, time_t mtime)
+{
+    const char *value = httpp_getvar(client->parser, "if-range");
+    time_t date;
+
+    if (value == NULL)
+        return true;
+
+    if (value[0] == '"' || strncmp(value, "W/", 2) == 0)
+        return util_http_etag_match(value, etag, false);
+
+    return util_http_date_parse(value, &date) && date == mtime;
+}
+
+static void fserve_free_parts(fserve_part_t *parts, size_t len)
+{
+    size_t i;
+
+    if (parts == NULL)
+        return;
+
+    for (i = 0; i < len; i++)
+        free(parts[i].head);
+    free(parts);
+}
+
+/* Sets up the parts of a multipart/byteranges body, one per range and one
+ * for the closing boundary. Returns the length of the body or -1.
+ */
+static off_t fserve_build_parts(fserve_part_t **parts_out, const util_http_range_t *ranges, size_t count, off_t size, const char *type, const char *boundary)
+{
+    fserve_part_t *parts = calloc(count + 1, sizeof(fserve_part_t));
+    char head[512];
+    off_t total = 0;
+    size_t i;
+    int ret;
+
+    if (parts == NULL)
+        return -1;
+
+    for (i = 0; i <= count; i++) {
+        if (i < count) {
+            parts[i].start = ranges[i].start;
+            parts[i].end = ranges[i].end + 1;
+            ret = snprintf(head, sizeof(head),
+                "\r\n--%s\r\n"
+                "Content-Type: %s\r\n"
+                "Content-Range: bytes %llu-%llu/%llu\r\n\r\n",
+                boundary, type,
+                (long long unsigned int)ranges[i].start,
+                (long long unsigned int)ranges[i].end,
+                (long long unsigned int)size);
+        } else {
+            ret = snprintf(head, sizeof(head), "\r\n--%s--\r\n", boundary);
+        }
+
+        if (ret < 0 || (size_t)ret >= sizeof(head) || (parts[i].head = strdup(head)) == NULL) {
+            fserve_free_parts(parts, count + 1);
+            return -1;
+        }
+        total += ret + (parts[i].end - parts[i].start);
+    }
+
+    *parts_out = parts;
+    return total;
+}
+
 /* client has requested a file, so check for it and send the file.  Do not
  * refer to the client_t afterwards.  return 0 for success, -1 on error.
  */
@@ -406,16 +834,25 @@ int fserve_client_create (client_t *httpclient)
     int bytes;
     struct stat file_buf;
     const char *range = NULL;
+    util_http_range_t ranges[UTIL_HTTP_RANGE_MAX];
+    size_t ranges_len = 0;
     off_t new_content_len = 0;
-    off_t rangenumber = 0, content_length;
-    int rangeproblem = 0;
+    off_t offset = 0, end = 0, content_length;
+    fserve_part_t *parts = NULL;
+    size_t parts_len = 0;
+    char etag[64];
+    char last_modified[UTIL_HTTP_DATE_LEN];
+    char *type = NULL;
+    char *boundary = NULL;
     int ret = 0;
     char *fullpath;
     int m3u_requested = 0, m3u_file_available = 1;
     const char * xslt_playlist_requested = NULL;
     int xslt_playlist_file_available = 1;
     ice_config_t *config;
-    FILE *file;
+    FILE *file = NULL;
+    fserve_map_t *map = NULL;
+    fserve_method_t method;
 
     fullpath = util_get_path_from_normalised_uri(httpclient->uri);
     ICECAST_LOG_INFO("checking for file %H (%H)", httpclient->uri, fullpath);
@@ -504,115 +941,180 @@ int fserve_client_create (client_t *httpclient)
         return -1;
     }
 
-    file = fopen (fullpath, "rb");
-    if (file == NULL)
+    /* validators are derived from the stat() above, a changed file gets
+     * a new ETag */
+    snprintf(etag, sizeof(etag), "\"%llx-%llx-%llx\"",
+             (long long unsigned int)file_buf.st_ino,
+             (long long unsigned int)file_buf.st_size,
+             (long long unsigned int)file_buf.st_mtime);
+    util_http_date_format(last_modified, sizeof(last_modified), file_buf.st_mtime);
+
+    if (fserve_not_modified(httpclient, etag, file_buf.st_mtime))
     {
-        ICECAST_LOG_WARN("Problem accessing file \"%H\"", fullpath);
-        client_send_error_by_id(httpclient, ICECAST_ERROR_FSERV_FILE_NOT_READABLE);
+        httpclient->respcode = 304;
+        bytes = util_http_build_header (httpclient->refbuf->data, BUFSIZE, 0,
+                                        1, 304, NULL,
+                                        NULL, NULL,
+                                        NULL, NULL, httpclient);
+        if (bytes == -1 || bytes >= (BUFSIZE - 512)) { /* we want at least 512 bytes left */
+            ICECAST_LOG_ERROR("Dropping client as we can not build response headers.");
+            client_send_error_by_id(httpclient, ICECAST_ERROR_GEN_HEADER_GEN_FAILED);
+            goto drop;
+        }
+        bytes += snprintf (httpclient->refbuf->data + bytes, BUFSIZE - bytes,
+            "ETag: %s\r\n"
+            "Last-Modified: %s\r\n\r\n",
+            etag, last_modified);
+        httpclient->refbuf->len = bytes;
+        httpclient->pos = 0;
+
+        stats_event_inc (NULL, "file_connections");
+        stats_event_inc (NULL, "file_not_modified");
         free (fullpath);
-        return -1;
+        fserve_add_client (httpclient, NULL);
+        return 0;
     }
-    free (fullpath);
-
-    content_length = file_buf.st_size;
-    range = httpp_getvar (httpclient->parser, "range");
 
-    /* full http range handling is currently not done but we deal with the common case */
-    if (range != NULL) {
-        ret = 0;
-        if (strncasecmp (range, "bytes=", 6) == 0) {
-            long long unsigned int in = 0;
+    /* plain connections get the body by sendfile(), others from the file
+     * cache if the file can be kept there */
+    if (connection_can_sendfile(httpclient->con)) {
+        method = FSERVE_METHOD_SENDFILE;
+    } else if ((map = fserve_map_get(fullpath, &file_buf)) != NULL) {
+        method = FSERVE_METHOD_CACHE;
+    } else {
+        method = FSERVE_METHOD_READ;
+    }
 
-            ret = sscanf(range+6, "%llu-", &in);
-            rangenumber = in;
+    if (map == NULL) {
+        file = fopen (fullpath, "rb");
+        if (file == NULL)
+        {
+            ICECAST_LOG_WARN("Problem accessing file \"%H\"", fullpath);
+            client_send_error_by_id(httpclient, ICECAST_ERROR_FSERV_FILE_NOT_READABLE);
+            free (fullpath);
+            return -1;
         }
+    }
 
-        if (ret != 1) {
-            /* format not correct, so lets just assume
-               we start from the beginning */
-            rangeproblem = 1;
-        }
-        if (rangenumber < 0) {
-            rangeproblem = 1;
-        }
-        if (!rangeproblem) {
-            ret = fseeko (file, rangenumber, SEEK_SET);
-            if (ret != -1) {
-                new_content_len = content_length - rangenumber;
-                if (new_content_len < 0) {
-                    rangeproblem = 1;
-                }
-            }
-            else {
-                rangeproblem = 1;
-            }
-            if (!rangeproblem) {
-                off_t endpos = rangenumber+new_content_len-1;
-                char *type;
-
-                if (endpos < 0) {
-                    endpos = 0;
-                }
-                httpclient->respcode = 206;
-                type = fserve_content_type(httpclient->uri);
-                bytes = util_http_build_header (httpclient->refbuf->data, BUFSIZE, 0,
-                                                0, 206, NULL,
-                                                type, NULL,
-                                                NULL, NULL, httpclient);
-                if (bytes == -1 || bytes >= (BUFSIZE - 512)) { /* we want at least 512 bytes left */
-                    ICECAST_LOG_ERROR("Dropping client as we can not build response headers.");
-                    client_send_error_by_id(httpclient, ICECAST_ERROR_GEN_HEADER_GEN_FAILED);
-                    return -1;
-                }
-                bytes += snprintf (httpclient->refbuf->data + bytes, BUFSIZE - bytes,
-                    "Accept-Ranges: bytes\r\n"
-                    "Content-Length: %llu\r\n"
-                    "Content-Range: bytes %llu" \
-                    "-%llu/%llu\r\n\r\n",
-                    (long long unsigned int)new_content_len,
-                    (long long unsigned int)rangenumber,
-                    (long long unsigned int)endpos,
-                    (long long unsigned int)content_length);
-                free (type);
-            }
-            else {
-                goto fail;
+    content_length = file_buf.st_size;
+    range = client_get_header(httpclient, HTTPHEAD_RANGE);
+
+    /* a Range that does not match If-Range gets the full file */
+    if (range != NULL && !fserve_if_range(httpclient, etag, file_buf.st_mtime))
+        range = NULL;
+
+    switch (util_http_range_parse(range, content_length, ranges, &ranges_len, UTIL_HTTP_RANGE_MAX)) {
+        case UTIL_HTTP_RANGE_UNSATISFIABLE:
+            /* RFC 7233 section 4.4: tell the client the current length */
+            httpclient->respcode = 416;
+            bytes = util_http_build_header (httpclient->refbuf->data, BUFSIZE, 0,
+                                            1, 416, NULL,
+                                            NULL, NULL,
+                                            NULL, NULL, httpclient);
+            if (bytes == -1 || bytes >= (BUFSIZE - 512)) { /* we want at least 512 bytes left */
+                ICECAST_LOG_ERROR("Dropping client as we can not build response headers.");
+                client_send_error_by_id(httpclient, ICECAST_ERROR_GEN_HEADER_GEN_FAILED);
+                goto drop;
             }
+            bytes += snprintf (httpclient->refbuf->data + bytes, BUFSIZE - bytes,
+                "Accept-Ranges: bytes\r\n"
+                "Content-Range: bytes */%llu\r\n"
+                "Content-Length: 0\r\n\r\n",
+                (long long unsigned int)content_length);
+            httpclient->refbuf->len = bytes;
+            httpclient->pos = 0;
+
+            if (file)
+                fclose (file);
+            if (map)
+                fserve_map_release (map);
+            free (fullpath);
+            stats_event_inc (NULL, "file_connections");
+            fserve_add_client (httpclient, NULL);
+            return 0;
+        case UTIL_HTTP_RANGE_OK:
+            httpclient->respcode = 206;
+            break;
+        case UTIL_HTTP_RANGE_NONE:
+        default:
+            httpclient->respcode = 200;
+            break;
+    }
+
+    type = fserve_content_type(httpclient->uri);
+
+    if (ranges_len > 1) {
+        unsigned char raw[FSERVE_BOUNDARY_BYTES];
+
+        if (igloo_prng_read(igloo_instance, raw, sizeof(raw), igloo_PRNG_FLAG_NONE) != (ssize_t)sizeof(raw) ||
+            (boundary = util_bin_to_hex(raw, sizeof(raw))) == NULL ||
+            (new_content_len = fserve_build_parts(&parts, ranges, ranges_len, content_length, type, boundary)) < 0) {
+            ICECAST_LOG_ERROR("Dropping client as we can not build the multipart response.");
+            client_send_error_by_id(httpclient, ICECAST_ERROR_GEN_MEMORY_EXHAUSTED);
+            goto drop;
         }
-        else {
+        parts_len = ranges_len + 1;
+    } else if (ranges_len == 1) {
+        offset = ranges[0].start;
+        end = ranges[0].end + 1;
+        new_content_len = end - offset;
+        if (file && fseeko (file, offset, SEEK_SET) != 0)
             goto fail;
-        }
+    } else {
+        end = new_content_len = content_length;
     }
-    else {
-        char *type = fserve_content_type(httpclient->uri);
-        httpclient->respcode = 200;
-        bytes = util_http_build_header (httpclient->refbuf->data, BUFSIZE, 0,
-                                        0, 200, NULL,
-                                        type, NULL,
-                                        NULL, NULL, httpclient);
-        if (bytes == -1 || bytes >= (BUFSIZE - 512)) { /* we want at least 512 bytes left */
-            ICECAST_LOG_ERROR("Dropping client as we can not build response headers.");
-            client_send_error_by_id(httpclient, ICECAST_ERROR_GEN_HEADER_GEN_FAILED);
-            fclose(file);
-            return -1;
-        }
+
+    bytes = util_http_build_header (httpclient->refbuf->data, BUFSIZE, 0,
+                                    1, httpclient->respcode, NULL,
+                                    boundary ? NULL : type, NULL,
+                                    NULL, NULL, httpclient);
+    if (bytes == -1 || bytes >= (BUFSIZE - 512)) { /* we want at least 512 bytes left */
+        ICECAST_LOG_ERROR("Dropping client as we can not build response headers.");
+        client_send_error_by_id(httpclient, ICECAST_ERROR_GEN_HEADER_GEN_FAILED);
+        goto drop;
+    }
+    bytes += snprintf (httpclient->refbuf->data + bytes, BUFSIZE - bytes,
+        "Accept-Ranges: bytes\r\n"
+        "ETag: %s\r\n"
+        "Last-Modified: %s\r\n"
+        "Content-Length: %llu\r\n",
+        etag, last_modified,
+        (long long unsigned int)new_content_len);
+    if (boundary) {
         bytes += snprintf (httpclient->refbuf->data + bytes, BUFSIZE - bytes,
-            "Accept-Ranges: bytes\r\n"
-            "Content-Length: %llu\r\n\r\n",
+            "Content-Type: multipart/byteranges; boundary=%s\r\n\r\n",
+            boundary);
+    } else if (ranges_len == 1) {
+        bytes += snprintf (httpclient->refbuf->data + bytes, BUFSIZE - bytes,
+            "Content-Range: bytes %llu-%llu/%llu\r\n\r\n",
+            (long long unsigned int)offset,
+            (long long unsigned int)(end - 1),
             (long long unsigned int)content_length);
-        free (type);
+    } else {
+        bytes += snprintf (httpclient->refbuf->data + bytes, BUFSIZE - bytes, "\r\n");
     }
     httpclient->refbuf->len = bytes;
     httpclient->pos = 0;
 
+    free (type);
+    free (boundary);
+
     stats_event_inc (NULL, "file_connections");
-    fserve_add_client (httpclient, file);
+    fserve_add_file (httpclient, file, map, method, offset, end, parts, parts_len, fullpath);
 
     return 0;
 
 fail:
-    fclose (file);
     client_send_error_by_id(httpclient, ICECAST_ERROR_FSERV_REQUEST_RANGE_NOT_SATISFIABLE);
+drop:
+    if (file)
+        fclose (file);
+    if (map)
+        fserve_map_release (map);
+    fserve_free_parts (parts, parts_len);
+    free (type);
+    free (boundary);
+    free (fullpath);
     return -1;
 }
 
@@ -622,23 +1124,42 @@ fail:
  */
 static void fserve_add_pending (fserve_t *fclient)
 {
+    fserve_worker_t *worker;
+    unsigned int i;
+
     thread_spin_lock (&pending_lock);
-    fclient->next = (fserve_t *)pending_list;
-    pending_list = fclient;
     if (run_fserv == 0)
     {
-        run_fserv = 1;
-        ICECAST_LOG_DEBUG("fserve handler waking up");
-        thread_create("File Serving", fserv_thread_function, NULL, THREAD_DETACHED);
+        thread_spin_unlock (&pending_lock);
+        fserve_client_destroy (fclient);
+        return;
+    }
+
+    /* hand the client to the worker with the fewest clients */
+    worker = &fserve_workers[0];
+    for (i = 1; i < fserve_threads; i++)
+    {
+        if (fserve_workers[i].load < worker->load)
+            worker = &fserve_workers[i];
+    }
+    fclient->next = worker->pending_list;
+    worker->pending_list = fclient;
+    worker->load++;
+    if (worker->running == 0)
+    {
+        worker->running = 1;
+        ICECAST_LOG_DEBUG("fserve handler %u waking up", (unsigned int)(worker - fserve_workers));
+        thread_create("File Serving", fserv_thread_function, worker, THREAD_DETACHED);
     }
     thread_spin_unlock (&pending_lock);
 }
 
 
-/* Add client to fserve thread, client needs to have refbuf set and filled
- * but may provide a NULL file if no data needs to be read
+/* Add client with the body to send from file or map. The body is the range
+ * from offset up to end followed by the given parts. parts and path are taken
+ * over, path is used for the per file counters.
  */
-int fserve_add_client (client_t *client, FILE *file)
+static int fserve_add_file(client_t *client, FILE *file, fserve_map_t *map, fserve_method_t method, off_t offset, off_t end, fserve_part_t *parts, size_t parts_len, char *path)
 {
     fserve_t *fclient = calloc (1, sizeof(fserve_t));
 
@@ -646,9 +1167,22 @@ int fserve_add_client (client_t *client, FILE *file)
     if (fclient == NULL)
     {
         client_send_error_by_id(client, ICECAST_ERROR_GEN_MEMORY_EXHAUSTED);
+        if (file)
+            fclose(file);
+        if (map)
+            fserve_map_release(map);
+        fserve_free_parts(parts, parts_len);
+        free(path);
         return -1;
     }
     fclient->file = file;
+    fclient->map = map;
+    fclient->method = method;
+    fclient->offset = offset;
+    fclient->end = end;
+    fclient->parts = parts;
+    fclient->parts_len = parts_len;
+    fclient->path = path;
     fclient->client = client;
     fclient->ready = 0;
     fserve_add_pending (fclient);
@@ -656,6 +1190,45 @@ int fserve_add_client (client_t *client, FILE *file)
     return 0;
 }
 
+/* Add client to fserve thread, client needs to have refbuf set and filled
+ * but may provide a NULL file if no data needs to be read
+ */
+int fserve_add_client (client_t *client, FILE *file)
+{
+    struct stat st;
+    off_t offset = 0, end = 0;
+
+    /* send the rest of the file from where it is positioned */
+    if (file && fstat(fileno(file), &st) == 0 && (offset = ftello(file)) >= 0) {
+        end = st.st_size;
+    } else {
+        offset = 0;
+    }
+
+    return fserve_add_file(client, file, NULL, FSERVE_METHOD_READ, offset, end, NULL, 0, NULL);
+}
+
+int fserve_add_client_producer(client_t *client, fserve_producer_t producer, void (*producer_free)(void *), void *arg)
+{
+    fserve_t *fclient = calloc(1, sizeof(fserve_t));
+
+    ICECAST_LOG_DEBUG("Adding client %p to file serving engine", client);
+    if (fclient == NULL)
+    {
+        client_send_error_by_id(client, ICECAST_ERROR_GEN_MEMORY_EXHAUSTED);
+        if (producer_free)
+            producer_free(arg);
+        return -1;
+    }
+    fclient->client = client;
+    fclient->ready = 0;
+    fclient->producer = producer;
+    fclient->producer_free = producer_free;
+    fclient->producer_arg = arg;
+    fserve_add_pending(fclient);
+
+    return 0;
+}
 
 /* add client to file serving engine, but just write out the buffer contents,
  * then pass the client to the callback with the provided arg
@@ -766,3 +1339,365 @@ void fserve_recheck_mime_types(ice_config_t *config)
     thread_spin_unlock (&pending_lock);
 }
 
+
+/* ---[ file cache ]--- */
+
+static int _compare_maps(void *arg, void *a, void *b)
+{
+    (void)arg;
+    return strcmp(
+            ((fserve_map_t *)a)->path,
+            ((fserve_map_t *)b)->path);
+}
+
+static void fserve_map_free(fserve_map_t *map)
+{
+    free(map->data);
+    free(map->path);
+    free(map);
+}
+
+/* take map out of the cache, must be called with map_lock held */
+static void fserve_map_uncache(fserve_map_t *map)
+{
+    avl_delete(map_tree, map, NULL);
+    map_bytes -= map->size;
+    if (--map->refcount == 0)
+        fserve_map_free(map);
+}
+
+/* drop the least recently used maps until needed more bytes fit, must be
+ * called with map_lock held. Maps still in use stay valid for their users.
+ */
+static void fserve_map_evict(size_t needed)
+{
+    while (map_tree->length && (map_bytes + needed) > map_limit) {
+        fserve_map_t *oldest = NULL;
+        avl_node *node;
+
+        for (node = avl_get_first(map_tree); node; node = avl_get_next(node)) {
+            fserve_map_t *map = node->key;
+            if (oldest == NULL || map->last_used < oldest->last_used)
+                oldest = map;
+        }
+
+        ICECAST_LOG_DEBUG("Dropping \"%H\" from file cache", oldest->path);
+        fserve_map_uncache(oldest);
+    }
+}
+
+static void fserve_map_update_stats(size_t files, size_t bytes)
+{
+    stats_event_args(NULL, "file_cache_files", "%zu", files);
+    stats_event_args(NULL, "file_cache_bytes", "%zu", bytes);
+}
+
+static inline bool fserve_map_matches(const fserve_map_t *map, const struct stat *st)
+{
+    return map->dev == st->st_dev && map->ino == st->st_ino &&
+        map->mtime == st->st_mtime && map->size == st->st_size;
+}
+
+void fserve_recheck_cache(ice_config_t *config)
+{
+    size_t files, bytes;
+
+    thread_mutex_lock(&map_lock);
+    map_limit = config->fileserve_cache_size;
+    map_file_limit = config->fileserve_cache_file_size;
+    fserve_map_evict(0);
+    files = map_tree->length;
+    bytes = map_bytes;
+    thread_mutex_unlock(&map_lock);
+
+    fserve_map_update_stats(files, bytes);
+}
+
+fserve_map_t *fserve_map_get(const char *path, const struct stat *st)
+{
+    fserve_map_t search, *map;
+    struct stat file_buf;
+    void *result;
+    char *data;
+    size_t have;
+    bool suitable;
+    size_t files, bytes;
+    int fd;
+
+    if (path == NULL)
+        return NULL;
+
+    if (st == NULL) {
+        if (stat(path, &file_buf) != 0)
+            return NULL;
+        st = &file_buf;
+    }
+
+    search.path = (char *)path;
+
+    thread_mutex_lock(&map_lock);
+    if (map_limit && avl_get_by_key(map_tree, &search, &result) == 0) {
+        map = result;
+        if (fserve_map_matches(map, st)) {
+            map->refcount++;
+            map->last_used = ++map_tick;
+            thread_mutex_unlock(&map_lock);
+            stats_event_inc(NULL, "file_cache_hits");
+            return map;
+        }
+        /* changed on disk, users of the old map keep it until they are done */
+        fserve_map_uncache(map);
+    }
+    suitable = map_limit && S_ISREG(st->st_mode) && st->st_size > 0 &&
+        (uintmax_t)st->st_size <= map_file_limit && (uintmax_t)st->st_size <= map_limit;
+    thread_mutex_unlock(&map_lock);
+
+    if (!suitable)
+        return NULL;
+
+    stats_event_inc(NULL, "file_cache_misses");
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    /* make sure we cache what the caller has seen */
+    if (fstat(fd, &file_buf) != 0 || file_buf.st_dev != st->st_dev || file_buf.st_ino != st->st_ino ||
+        file_buf.st_mtime != st->st_mtime || file_buf.st_size != st->st_size) {
+        close(fd);
+        return NULL;
+    }
+    data = malloc(st->st_size);
+    if (data == NULL) {
+        close(fd);
+        return NULL;
+    }
+    for (have = 0; have < (size_t)st->st_size; ) {
+        ssize_t ret = read(fd, data + have, (size_t)st->st_size - have);
+
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            break;
+        have += ret;
+    }
+    close(fd);
+    /* read error, or the file got shorter while we were reading it */
+    if (have != (size_t)st->st_size) {
+        ICECAST_LOG_WARN("Can not read \"%H\" into the file cache", path);
+        free(data);
+        return NULL;
+    }
+
+    map = calloc(1, sizeof(*map));
+    if (map)
+        map->path = strdup(path);
+    if (map == NULL || map->path == NULL) {
+        free(map);
+        free(data);
+        return NULL;
+    }
+    map->dev = st->st_dev;
+    map->ino = st->st_ino;
+    map->mtime = st->st_mtime;
+    map->size = st->st_size;
+    map->data = data;
+    map->refcount = 1;
+
+    thread_mutex_lock(&map_lock);
+    if (avl_get_by_key(map_tree, &search, &result) == 0) {
+        fserve_map_t *other = result;
+
+        /* someone else was faster */
+        if (fserve_map_matches(other, st)) {
+            other->refcount++;
+            other->last_used = ++map_tick;
+            thread_mutex_unlock(&map_lock);
+            fserve_map_free(map);
+            return other;
+        }
+        fserve_map_uncache(other);
+    }
+    if (map_limit && (size_t)map->size <= map_limit) {
+        fserve_map_evict(map->size);
+        map->refcount++;
+        map->last_used = ++map_tick;
+        map_bytes += map->size;
+        avl_insert(map_tree, map);
+        ICECAST_LOG_DEBUG("Added \"%H\" to file cache, %zu bytes in use", path, map_bytes);
+    }
+    files = map_tree->length;
+    bytes = map_bytes;
+    thread_mutex_unlock(&map_lock);
+
+    fserve_map_update_stats(files, bytes);
+
+    return map;
+}
+
+void fserve_map_release(fserve_map_t *map)
+{
+    bool last;
+
+    if (map == NULL)
+        return;
+
+    thread_mutex_lock(&map_lock);
+    last = --map->refcount == 0;
+    thread_mutex_unlock(&map_lock);
+
+    if (last)
+        fserve_map_free(map);
+}
+
+off_t fserve_map_size(const fserve_map_t *map)
+{
+    return map->size;
+}
+
+size_t fserve_map_read(const fserve_map_t *map, off_t offset, void *buf, size_t len)
+{
+    if (offset < 0 || offset >= map->size)
+        return 0;
+
+    if ((map->size - offset) < (off_t)len)
+        len = (size_t)(map->size - offset);
+
+    memcpy(buf, map->data + offset, len);
+
+    return len;
+}
+
+/* ---[ per file counters ]--- */
+
+static int _compare_file_stats(void *arg, void *a, void *b)
+{
+    (void)arg;
+    return strcmp(
+            ((file_stats_entry_t *)a)->stats.path,
+            ((file_stats_entry_t *)b)->stats.path);
+}
+
+static int _free_file_stats(void *key)
+{
+    file_stats_entry_t *entry = key;
+
+    free(entry->stats.path);
+    free(entry);
+
+    return 1;
+}
+
+/* add the counters of a finished transfer to the ones of its file */
+static void fserve_count_file(fserve_t *fclient)
+{
+    file_stats_entry_t search, *entry = NULL;
+    void *result;
+
+    if (fclient->path == NULL || fclient->client == NULL)
+        return;
+
+    search.stats.path = fclient->path;
+
+    thread_mutex_lock(&file_stats_lock);
+    if (file_stats == NULL) {
+        thread_mutex_unlock(&file_stats_lock);
+        return;
+    }
+
+    if (avl_get_by_key(file_stats, &search, &result) == 0) {
+        entry = result;
+    } else {
+        /* keep the table bounded, forget about the file served longest ago */
+        if (file_stats->length >= FSERVE_FILE_STATS_MAX) {
+            file_stats_entry_t *oldest = NULL;
+            avl_node *node;
+
+            for (node = avl_get_first(file_stats); node; node = avl_get_next(node)) {
+                file_stats_entry_t *cur = node->key;
+                if (oldest == NULL || cur->last_used < oldest->last_used)
+                    oldest = cur;
+            }
+            avl_delete(file_stats, oldest, _free_file_stats);
+        }
+
+        entry = calloc(1, sizeof(*entry));
+        if (entry) {
+            entry->stats.path = fclient->path;
+            fclient->path = NULL;
+            avl_insert(file_stats, entry);
+        }
+    }
+
+    if (entry) {
+        entry->last_used = ++file_stats_tick;
+        entry->stats.requests++;
+        switch (fclient->method) {
+            case FSERVE_METHOD_SENDFILE:
+                entry->stats.requests_sendfile++;
+                break;
+            case FSERVE_METHOD_CACHE:
+                entry->stats.requests_cache++;
+                break;
+            case FSERVE_METHOD_READ:
+                entry->stats.requests_read++;
+                break;
+        }
+        entry->stats.bytes += fclient->client->con->sent_bytes;
+        entry->stats.syscalls += fclient->syscalls;
+    }
+    thread_mutex_unlock(&file_stats_lock);
+}
+
+unsigned int fserve_get_worker_clients(unsigned int *clients, unsigned int len)
+{
+    unsigned int i;
+
+    thread_spin_lock (&pending_lock);
+    if (len > fserve_threads)
+        len = fserve_threads;
+    for (i = 0; i < len; i++)
+        clients[i] = fserve_workers[i].load;
+    thread_spin_unlock (&pending_lock);
+
+    return len;
+}
+
+fserve_file_stats_t *fserve_get_file_stats(size_t *len)
+{
+    fserve_file_stats_t *ret = NULL;
+    avl_node *node;
+    size_t i = 0;
+
+    *len = 0;
+
+    thread_mutex_lock(&file_stats_lock);
+    if (file_stats && file_stats->length)
+        ret = calloc(file_stats->length, sizeof(*ret));
+    if (ret) {
+        for (node = avl_get_first(file_stats); node; node = avl_get_next(node)) {
+            const file_stats_entry_t *entry = node->key;
+
+            ret[i] = entry->stats;
+            ret[i].path = strdup(entry->stats.path);
+            if (ret[i].path)
+                i++;
+        }
+    }
+    thread_mutex_unlock(&file_stats_lock);
+
+    *len = i;
+
+    return ret;
+}
+
+void fserve_free_file_stats(fserve_file_stats_t *stats, size_t len)
+{
+    size_t i;
+
+    if (stats == NULL)
+        return;
+
+    for (i = 0; i < len; i++)
+        free(stats[i].path);
+    free(stats);
+}
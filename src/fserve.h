@@ -15,29 +15,110 @@
 #define __FSERVE_H__
 
 #include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "icecasttypes.h"
+#include "refbuf.h"
+
+/* upper bound on the number of file serving threads */
+#define FSERVE_MAX_WORKERS      64
 
 typedef void (*fserve_callback_t)(client_t *, void *);
+/* returns the next buffers of a body that is produced while it is sent,
+ * NULL at its end */
+typedef refbuf_t *(*fserve_producer_t)(void *);
+
+typedef enum {
+    /* read() into the client buffer and send from there */
+    FSERVE_METHOD_READ = 0,
+    /* sendfile() straight from the file, plain connections only */
+    FSERVE_METHOD_SENDFILE,
+    /* send from the copy in the file cache */
+    FSERVE_METHOD_CACHE
+} fserve_method_t;
+
+/* one range of a multipart/byteranges body */
+typedef struct {
+    /* boundary and part headers sent before the range, the last entry
+     * only carries the closing boundary */
+    char *head;
+    off_t start;
+    off_t end;
+} fserve_part_t;
 
 typedef struct _fserve_t
 {
     client_t *client;
 
     FILE *file;
+    fserve_map_t *map;
+    fserve_method_t method;
+    /* body still to send for the direct methods, end is exclusive */
+    off_t offset;
+    off_t end;
+    /* further ranges of a multipart/byteranges response */
+    fserve_part_t *parts;
+    size_t parts_len;
+    size_t part;
+    /* file name used for the per file counters, NULL if not counted */
+    char *path;
+    uint64_t syscalls;
     int ready;
     void (*callback)(client_t *, void *);
     void *arg;
+    fserve_producer_t producer;
+    void (*producer_free)(void *);
+    void *producer_arg;
     struct _fserve_t *next;
+    /* used by the file serving thread the client is assigned to */
+    struct _fserve_t *prev;
+    struct _fserve_t *ready_next;
 } fserve_t;
 
+/* counters kept per served file, see fserve_get_file_stats() */
+typedef struct {
+    char *path;
+    uint64_t requests;
+    uint64_t requests_sendfile;
+    uint64_t requests_cache;
+    uint64_t requests_read;
+    uint64_t bytes;
+    uint64_t syscalls;
+} fserve_file_stats_t;
+
 void fserve_initialize(void);
 void fserve_shutdown(void);
 int fserve_client_create(client_t *httpclient);
 int fserve_add_client (client_t *client, FILE *file);
 void fserve_add_client_callback (client_t *client, fserve_callback_t callback, void *arg);
+/* like fserve_add_client() without a file, but once the buffers of the
+ * client are sent more are asked for from producer. producer_free is called
+ * with arg when the client is done.
+ */
+int fserve_add_client_producer(client_t *client, fserve_producer_t producer, void (*producer_free)(void *), void *arg);
 char *fserve_content_type (const char *path);
 void fserve_recheck_mime_types (ice_config_t *config);
+void fserve_recheck_cache (ice_config_t *config);
+void fserve_set_threads (unsigned int threads);
+/* copies the number of clients of each file serving thread, up to len of
+ * them, returns the number copied */
+unsigned int fserve_get_worker_clients(unsigned int *clients, unsigned int len);
+
+/* Get a reference to the cached mapping of path. st may be passed if the
+ * caller already has stat()ed the file. Returns NULL if the cache is
+ * disabled or the file is not suitable.
+ */
+fserve_map_t *fserve_map_get(const char *path, const struct stat *st);
+void fserve_map_release(fserve_map_t *map);
+off_t fserve_map_size(const fserve_map_t *map);
+/* copy up to len bytes at offset out of map, returns the number copied */
+size_t fserve_map_read(const fserve_map_t *map, off_t offset, void *buf, size_t len);
+
+/* returns a copy of the per file counters, free with fserve_free_file_stats() */
+fserve_file_stats_t *fserve_get_file_stats(size_t *len);
+void fserve_free_file_stats(fserve_file_stats_t *stats, size_t len);
 
 
 #endif
@@ -0,0 +1,270 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "httphead.h"
+
+#define FIELDS_INITIAL  16
+
+static const struct {
+    const char *name;
+    size_t len;
+} known_names[HTTPHEAD_KNOWN_COUNT] = {
+    [HTTPHEAD_HOST]             = {"host", 4},
+    [HTTPHEAD_USER_AGENT]       = {"user-agent", 10},
+    [HTTPHEAD_RANGE]            = {"range", 5},
+    [HTTPHEAD_ICY_METADATA]     = {"icy-metadata", 12},
+    [HTTPHEAD_AUTHORIZATION]    = {"authorization", 13}
+};
+
+static inline bool is_ows(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+/* token characters of RFC 7230 section 3.2.6 */
+static inline bool is_tchar(unsigned char c)
+{
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))
+        return true;
+    return c && strchr("!#$%&'*+-.^_`|~", c) != NULL;
+}
+
+void httphead_init(httphead_t *head, unsigned int flags)
+{
+    httphead_clear(head);
+    head->flags = flags;
+}
+
+void httphead_clear(httphead_t *head)
+{
+    free(head->fields);
+    memset(head, 0, sizeof(*head));
+    head->state = HTTPHEAD_SCAN_MORE;
+}
+
+static void index_known(httphead_t *head, const char *name, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < HTTPHEAD_KNOWN_COUNT; i++) {
+        if (known_names[i].len != len || strncasecmp(known_names[i].name, name, len) != 0)
+            continue;
+
+        if (head->known[i]) {
+            head->known_repeated |= 1U << i;
+        } else {
+            head->known[i] = head->fields_len;
+        }
+        return;
+    }
+}
+
+static httphead_scan_result_t scan_field(httphead_t *head, char *buffer, size_t line, size_t end)
+{
+    httphead_field_t *field;
+    const char *colon = memchr(buffer + line, ':', end - line);
+    size_t value;
+
+    head->fold = 0;
+
+    /* lines that are not fields are ignored */
+    if (!colon)
+        return HTTPHEAD_SCAN_MORE;
+
+    /* this also rejects whitespace between name and colon as
+     * RFC 7230 section 3.2.4 requires */
+    if (colon == buffer + line)
+        return HTTPHEAD_SCAN_ERROR;
+    for (value = line; value < (size_t)(colon - buffer); value++)
+        if (!is_tchar(buffer[value]))
+            return HTTPHEAD_SCAN_ERROR;
+
+    if (head->fields_len == head->fields_alloc) {
+        size_t alloc = head->fields_alloc ? head->fields_alloc * 2 : FIELDS_INITIAL;
+        httphead_field_t *fields;
+
+        if (head->fields_alloc >= HTTPHEAD_MAX_FIELDS)
+            return HTTPHEAD_SCAN_ERROR;
+        if (alloc > HTTPHEAD_MAX_FIELDS)
+            alloc = HTTPHEAD_MAX_FIELDS;
+
+        fields = realloc(head->fields, alloc * sizeof(*fields));
+        if (!fields)
+            return HTTPHEAD_SCAN_ERROR;
+        head->fields = fields;
+        head->fields_alloc = alloc;
+    }
+
+    value = colon - buffer + 1;
+    while (value < end && is_ows(buffer[value]))
+        value++;
+    while (end > value && is_ows(buffer[end - 1]))
+        end--;
+
+    field = &(head->fields[head->fields_len++]);
+    field->name.offset = line;
+    field->name.len = colon - buffer - line;
+    field->value.offset = value;
+    field->value.len = end - value;
+
+    head->fold = head->fields_len;
+    index_known(head, buffer + line, field->name.len);
+
+    return HTTPHEAD_SCAN_MORE;
+}
+
+/* obsolete line folding, the continuation is joined to the value of the
+ * previous field by spaces */
+static httphead_scan_result_t scan_fold(httphead_t *head, char *buffer, size_t line, size_t end)
+{
+    httphead_field_t *field;
+    size_t i;
+
+    if (!head->fold)
+        return HTTPHEAD_SCAN_ERROR;
+
+    field = &(head->fields[head->fold - 1]);
+
+    while (line < end && is_ows(buffer[line]))
+        line++;
+    while (end > line && is_ows(buffer[end - 1]))
+        end--;
+
+    if (line == end)
+        return HTTPHEAD_SCAN_MORE;
+
+    if (field->value.len) {
+        for (i = field->value.offset + field->value.len; i < line; i++)
+            buffer[i] = ' ';
+    } else {
+        field->value.offset = line;
+    }
+    field->value.len = end - field->value.offset;
+
+    return HTTPHEAD_SCAN_MORE;
+}
+
+static httphead_scan_result_t scan_line(httphead_t *head, char *buffer, size_t line, size_t eol)
+{
+    bool want_request_line = !(head->flags & HTTPHEAD_FLAG_NO_REQUEST_LINE) && !head->request_line.len;
+    size_t end = eol;
+
+    /* lines end in \n, \r\n and, as sent by nsvcap, \r\r\n */
+    while (end > line && buffer[end - 1] == '\r')
+        end--;
+
+    if (end == line) {
+        /* RFC 7230 section 3.5: ignore empty lines before the request line */
+        if (want_request_line) {
+            head->start = eol + 1;
+            return HTTPHEAD_SCAN_MORE;
+        }
+        head->end = eol + 1;
+        return HTTPHEAD_SCAN_DONE;
+    }
+
+    if (want_request_line) {
+        head->request_line.offset = line;
+        head->request_line.len = end - line;
+        return HTTPHEAD_SCAN_MORE;
+    }
+
+    if (is_ows(buffer[line]))
+        return scan_fold(head, buffer, line, end);
+
+    return scan_field(head, buffer, line, end);
+}
+
+httphead_scan_result_t httphead_scan(httphead_t *head, char *buffer, size_t len)
+{
+    while (head->state == HTTPHEAD_SCAN_MORE && head->pos < len) {
+        const char *nl = memchr(buffer + head->pos, '\n', len - head->pos);
+        size_t eol = nl ? (size_t)(nl - buffer) : len;
+
+        /* a \0 would end the head early for anyone treating it as string */
+        if (memchr(buffer + head->pos, 0, eol - head->pos)) {
+            head->state = HTTPHEAD_SCAN_ERROR;
+            break;
+        }
+
+        if (!nl) {
+            head->pos = len;
+            break;
+        }
+
+        head->pos = eol + 1;
+        head->state = scan_line(head, buffer, head->line, eol);
+        head->line = head->pos;
+    }
+
+    return head->state;
+}
+
+void httphead_terminate(httphead_t *head, char *buffer)
+{
+    size_t i;
+
+    if (head->state != HTTPHEAD_SCAN_DONE || head->terminated)
+        return;
+
+    if (head->request_line.len)
+        buffer[head->request_line.offset + head->request_line.len] = 0;
+
+    for (i = 0; i < head->fields_len; i++) {
+        const httphead_field_t *field = &(head->fields[i]);
+
+        buffer[field->name.offset + field->name.len] = 0;
+        buffer[field->value.offset + field->value.len] = 0;
+    }
+
+    head->terminated = true;
+}
+
+const char *httphead_known_name(httphead_known_t id)
+{
+    if (id < 0 || id >= HTTPHEAD_KNOWN_COUNT)
+        return NULL;
+    return known_names[id].name;
+}
+
+bool httphead_get_known(const httphead_t *head, const char *buffer, httphead_known_t id, const char **value)
+{
+    if (!head->terminated || id < 0 || id >= HTTPHEAD_KNOWN_COUNT || (head->known_repeated & (1U << id)))
+        return false;
+
+    if (head->known[id]) {
+        *value = buffer + head->fields[head->known[id] - 1].value.offset;
+    } else {
+        *value = NULL;
+    }
+
+    return true;
+}
+
+const char *httphead_get(const httphead_t *head, const char *buffer, const char *name)
+{
+    size_t i;
+
+    if (!head->terminated)
+        return NULL;
+
+    for (i = 0; i < head->fields_len; i++) {
+        const httphead_field_t *field = &(head->fields[i]);
+
+        if (strcasecmp(buffer + field->name.offset, name) == 0)
+            return buffer + field->value.offset;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,114 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ */
+
+/* functions defined in here scan the head of an HTTP request (request line
+ * and header fields) as it is received. Nothing is copied: all results are
+ * spans (offset and length) into the caller's receive buffer, so the buffer
+ * may be moved or grown between calls. Only depends on the standard C
+ * runtime.
+ */
+
+#ifndef __HTTPHEAD_H__
+#define __HTTPHEAD_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* upper limit of header fields in one request head */
+#define HTTPHEAD_MAX_FIELDS     256
+
+/* the head has no request line, e.g. the headers sent by a shoutcast
+ * source after its password line */
+#define HTTPHEAD_FLAG_NO_REQUEST_LINE   0x0001U
+
+/* headers looked up on hot paths, these are indexed while scanning */
+typedef enum {
+    HTTPHEAD_HOST = 0,
+    HTTPHEAD_USER_AGENT,
+    HTTPHEAD_RANGE,
+    HTTPHEAD_ICY_METADATA,
+    HTTPHEAD_AUTHORIZATION,
+    HTTPHEAD_KNOWN_COUNT
+} httphead_known_t;
+
+typedef enum {
+    /* the head is malformed, or too many fields */
+    HTTPHEAD_SCAN_ERROR = -1,
+    /* all data so far has been consumed, call again with more */
+    HTTPHEAD_SCAN_MORE = 0,
+    /* the empty line ending the head was found */
+    HTTPHEAD_SCAN_DONE = 1
+} httphead_scan_result_t;
+
+typedef struct {
+    size_t offset;
+    size_t len;
+} httphead_span_t;
+
+typedef struct {
+    httphead_span_t name;
+    httphead_span_t value;
+} httphead_field_t;
+
+typedef struct {
+    unsigned int flags;
+    httphead_scan_result_t state;
+
+    /* scanner position: everything before pos has been looked at, the
+     * current line starts at line */
+    size_t pos;
+    size_t line;
+
+    /* start of the request line (after any leading empty lines), and
+     * the end of the head including the final empty line */
+    size_t start;
+    size_t end;
+    httphead_span_t request_line;
+
+    httphead_field_t *fields;
+    size_t fields_len;
+    size_t fields_alloc;
+    /* field a continuation line is appended to, index + 1 */
+    size_t fold;
+
+    /* index + 1 into fields, 0 if the header was not sent */
+    size_t known[HTTPHEAD_KNOWN_COUNT];
+    /* bit per known header that was sent more than once */
+    unsigned int known_repeated;
+
+    /* values have been terminated in the buffer by httphead_terminate() */
+    bool terminated;
+} httphead_t;
+
+/* head must be zeroed or have been used before */
+void httphead_init(httphead_t *head, unsigned int flags);
+void httphead_clear(httphead_t *head);
+
+/* Scans buffer[head->pos..len). The caller appends received data to the
+ * same buffer (which may have been reallocated) and calls again while
+ * HTTPHEAD_SCAN_MORE is returned. Obsolete line folding is replaced by
+ * spaces in the buffer as RFC 7230 section 3.2.4 allows.
+ */
+httphead_scan_result_t httphead_scan(httphead_t *head, char *buffer, size_t len);
+
+/* Replaces the end of every name and value in buffer with a \0 so they can
+ * be used as strings. Only call after the raw head is no longer needed.
+ */
+void httphead_terminate(httphead_t *head, char *buffer);
+
+const char *httphead_known_name(httphead_known_t id);
+
+/* Gets a known header of a terminated head. Returns false if the header
+ * was sent more than once and the caller should decide by other means,
+ * otherwise *value is set to the value or NULL if not sent.
+ */
+bool httphead_get_known(const httphead_t *head, const char *buffer, httphead_known_t id, const char **value);
+
+/* Finds any header of a terminated head by its case insensitive name,
+ * first one wins */
+const char *httphead_get(const httphead_t *head, const char *buffer, const char *name);
+
+#endif  /* __HTTPHEAD_H__ */
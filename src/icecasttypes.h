@@ -38,6 +38,10 @@ typedef struct _client_tag client_t;
 
 typedef struct source_tag source_t;
 
+/* ---[ fserve.[ch] ]--- */
+
+typedef struct fserve_map_tag fserve_map_t;
+
 /* ---[ admin.[ch] ]--- */
 
 /* Command IDs */
@@ -62,6 +62,10 @@ static int allocate_buffer(json_renderer_t *renderer, size_t needed)
         if (want < 512)
             want = 512;
 
+        /* grow geometrically so large documents are not copied over and over */
+        if (want < renderer->bufferlen * 2)
+            want = renderer->bufferlen * 2;
+
         n = realloc(renderer->buffer, want);
 
         if (!n)
@@ -0,0 +1,248 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ */
+
+/* This file contains the JSON rendering of listclients. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "listclients.h"
+
+void listclients_listener_clear(listclients_listener_t *listener)
+{
+    size_t i;
+
+    free(listener->ip);
+    free(listener->useragent);
+    free(listener->referer);
+    free(listener->host);
+    free(listener->username);
+    free(listener->role);
+    free(listener->acl);
+    for (i = 0; i < listener->history_fill; i++)
+        free(listener->history[i]);
+}
+
+static inline void __write_json_string(json_renderer_t *renderer, const char *key, const char *value)
+{
+    json_renderer_write_key(renderer, key, JSON_RENDERER_FLAGS_NONE);
+    json_renderer_write_string(renderer, value, JSON_RENDERER_FLAGS_NONE);
+}
+
+/* Writes the generic xml2json form of a node without attributes holding
+ * one text child.
+ */
+static inline void __write_json_generic_element(json_renderer_t *renderer, const char *name, const char *text)
+{
+    json_renderer_begin(renderer, JSON_ELEMENT_TYPE_ARRAY);
+    json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
+    __write_json_string(renderer, "type", "element");
+    __write_json_string(renderer, "name", name);
+    json_renderer_write_key(renderer, "ns", JSON_RENDERER_FLAGS_NONE);
+    json_renderer_write_null(renderer);
+    json_renderer_end(renderer);
+    if (text) {
+        json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
+        json_renderer_end(renderer);
+        json_renderer_begin(renderer, JSON_ELEMENT_TYPE_ARRAY);
+        json_renderer_begin(renderer, JSON_ELEMENT_TYPE_ARRAY);
+        json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
+        __write_json_string(renderer, "type", "text");
+        __write_json_string(renderer, "text", text);
+        json_renderer_write_key(renderer, "ns", JSON_RENDERER_FLAGS_NONE);
+        json_renderer_write_null(renderer);
+        json_renderer_end(renderer);
+        json_renderer_end(renderer);
+        json_renderer_end(renderer);
+    }
+    json_renderer_end(renderer);
+}
+
+/* Writes a listener just like xml2json renders the node built by __add_listener() in admin.c */
+void listclients_json_write_listener(json_renderer_t *renderer, const listclients_listener_t *listener, time_t now, operation_mode mode)
+{
+    char buf[22];
+
+    json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
+
+    snprintf(buf, sizeof(buf), "%lu", listener->id);
+    __write_json_string(renderer, mode == OMODE_LEGACY ? "ID" : "id", buf);
+
+    if (listener->ip)
+        __write_json_string(renderer, mode == OMODE_LEGACY ? "IP" : "ip", listener->ip);
+
+    if (listener->useragent)
+        __write_json_string(renderer, mode == OMODE_LEGACY ? "UserAgent" : "useragent", listener->useragent);
+
+    if (listener->referer)
+        __write_json_string(renderer, "referer", listener->referer);
+
+    if (listener->host)
+        __write_json_string(renderer, "host", listener->host);
+
+    if (mode == OMODE_LEGACY) {
+        snprintf(buf, sizeof(buf), "%lu", (unsigned long)(now - listener->con_time));
+        __write_json_string(renderer, "Connected", buf);
+    } else {
+        json_renderer_write_key(renderer, "connected", JSON_RENDERER_FLAGS_NONE);
+        json_renderer_write_int(renderer, (unsigned long)(now - listener->con_time));
+    }
+
+    if (listener->username)
+        __write_json_string(renderer, "username", listener->username);
+
+    if (listener->role)
+        __write_json_string(renderer, "role", listener->role);
+
+    if (listener->acl)
+        __write_json_string(renderer, "acl", listener->acl);
+
+    __write_json_string(renderer, "tls", listener->tls ? "true" : "false");
+
+    __write_json_string(renderer, "protocol", listener->protocol);
+
+    if (*listener->iso_3166_1_alpha_2 || listener->have_latitude || listener->have_longitude) {
+        json_renderer_write_key(renderer, "geoip", JSON_RENDERER_FLAGS_NONE);
+        json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
+
+        json_renderer_write_key(renderer, "country", JSON_RENDERER_FLAGS_NONE);
+        json_renderer_begin(renderer, JSON_ELEMENT_TYPE_ARRAY);
+        if (*listener->iso_3166_1_alpha_2) {
+            json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
+            __write_json_string(renderer, "iso-alpha-2", listener->iso_3166_1_alpha_2);
+            json_renderer_end(renderer);
+        }
+        json_renderer_end(renderer);
+
+        json_renderer_write_key(renderer, "location", JSON_RENDERER_FLAGS_NONE);
+        json_renderer_begin(renderer, JSON_ELEMENT_TYPE_ARRAY);
+        if (listener->have_latitude || listener->have_longitude) {
+            json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
+            if (listener->have_latitude) {
+                snprintf(buf, sizeof(buf), "%f", listener->latitude);
+                __write_json_string(renderer, "latitude", buf);
+            }
+            if (listener->have_longitude) {
+                snprintf(buf, sizeof(buf), "%f", listener->longitude);
+                __write_json_string(renderer, "longitude", buf);
+            }
+            json_renderer_end(renderer);
+        }
+        json_renderer_end(renderer);
+
+        json_renderer_end(renderer);
+    }
+
+    /* xml2json has no rule for <history>, keep its generic rendering */
+    json_renderer_write_key(renderer, "unhandled-child", JSON_RENDERER_FLAGS_NONE);
+    json_renderer_begin(renderer, JSON_ELEMENT_TYPE_ARRAY);
+    json_renderer_begin(renderer, JSON_ELEMENT_TYPE_ARRAY);
+    json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
+    __write_json_string(renderer, "type", "element");
+    __write_json_string(renderer, "name", "history");
+    json_renderer_write_key(renderer, "ns", JSON_RENDERER_FLAGS_NONE);
+    json_renderer_write_null(renderer);
+    json_renderer_end(renderer);
+    if (listener->history_fill) {
+        size_t i;
+
+        json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
+        json_renderer_end(renderer);
+        json_renderer_begin(renderer, JSON_ELEMENT_TYPE_ARRAY);
+        for (i = 0; i < listener->history_fill; i++) {
+            __write_json_generic_element(renderer, "mount", listener->history[i]);
+        }
+        json_renderer_end(renderer);
+    }
+    json_renderer_end(renderer);
+    json_renderer_end(renderer);
+
+    json_renderer_end(renderer);
+}
+
+static void listclients_json_write_country(json_renderer_t *renderer, const char *code, listclients_country_t *country)
+{
+    if (country->listeners) {
+        json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
+        if (code)
+            __write_json_string(renderer, "iso-alpha-2", code);
+        json_renderer_write_key(renderer, "listeners", JSON_RENDERER_FLAGS_NONE);
+        json_renderer_write_int(renderer, country->listeners);
+        json_renderer_write_key(renderer, "tls", JSON_RENDERER_FLAGS_NONE);
+        json_renderer_write_int(renderer, country->tls);
+        json_renderer_write_key(renderer, "ipv6", JSON_RENDERER_FLAGS_NONE);
+        json_renderer_write_int(renderer, country->ipv6);
+        json_renderer_end(renderer);
+    }
+}
+
+void listclients_json_write_source(json_renderer_t         *renderer,
+                                   const char              *mount,
+                                   unsigned long           listeners,
+                                   operation_mode          mode,
+                                   listclients_next_t      next,
+                                   void                    *userdata,
+                                   listclients_country_t   countries[26][26],
+                                   listclients_country_t   *default_country)
+{
+    listclients_listener_t *page = malloc(sizeof(*page) * LISTCLIENTS_PAGE);
+    time_t now = time(NULL);
+    bool first = true;
+    size_t fill, i;
+    char buf[22];
+
+    json_renderer_write_key(renderer, "source", JSON_RENDERER_FLAGS_NONE);
+    json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
+    json_renderer_write_key(renderer, mount, JSON_RENDERER_FLAGS_NONE);
+    json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
+
+    if (mode == OMODE_LEGACY) {
+        snprintf(buf, sizeof(buf), "%lu", listeners);
+        __write_json_string(renderer, "Listeners", buf);
+    } else {
+        json_renderer_write_key(renderer, "listeners", JSON_RENDERER_FLAGS_NONE);
+        json_renderer_write_int(renderer, listeners);
+    }
+
+    while (page && (fill = next(userdata, page, LISTCLIENTS_PAGE))) {
+        if (first) {
+            json_renderer_write_key(renderer, "listener", JSON_RENDERER_FLAGS_NONE);
+            json_renderer_begin(renderer, JSON_ELEMENT_TYPE_ARRAY);
+            first = false;
+        }
+        for (i = 0; i < fill; i++) {
+            listclients_json_write_listener(renderer, &(page[i]), now, mode);
+            listclients_listener_clear(&(page[i]));
+        }
+    }
+    if (!first)
+        json_renderer_end(renderer);
+    free(page);
+
+    json_renderer_write_key(renderer, "geoip", JSON_RENDERER_FLAGS_NONE);
+    json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
+    json_renderer_write_key(renderer, "country", JSON_RENDERER_FLAGS_NONE);
+    json_renderer_begin(renderer, JSON_ELEMENT_TYPE_ARRAY);
+    for (size_t idx_a = 0; idx_a < 26; idx_a++) {
+        for (size_t idx_b = 0; idx_b < 26; idx_b++) {
+            const char code[3] = {idx_a + 'a', idx_b + 'a', 0};
+            listclients_json_write_country(renderer, code, &(countries[idx_a][idx_b]));
+        }
+    }
+    listclients_json_write_country(renderer, NULL, default_country);
+    json_renderer_end(renderer);
+    json_renderer_write_key(renderer, "location", JSON_RENDERER_FLAGS_NONE);
+    json_renderer_begin(renderer, JSON_ELEMENT_TYPE_ARRAY);
+    json_renderer_end(renderer);
+    json_renderer_end(renderer);
+
+    json_renderer_end(renderer);
+    json_renderer_end(renderer);
+}
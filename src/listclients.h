@@ -0,0 +1,78 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ */
+
+/* This file contains the JSON rendering of listclients. */
+
+#ifndef __LISTCLIENTS_H__
+#define __LISTCLIENTS_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "icecasttypes.h"
+#include "navigation.h"
+#include "json.h"
+
+/* number of listeners copied per client_tree lock */
+#define LISTCLIENTS_PAGE            256
+
+typedef struct {
+    size_t listeners;
+    size_t tls;
+    size_t ipv6;
+} listclients_country_t;
+
+/* The fields of a listener shown by listclients. They are copied while
+ * client_tree is locked so the rendering can happen without the lock.
+ * All strings but protocol are owned by the listener.
+ */
+typedef struct {
+    unsigned long id;
+    time_t con_time;
+    char *ip;
+    char *useragent;
+    char *referer;
+    char *host;
+    char *username;
+    char *role;
+    char *acl;
+    bool tls;
+    const char *protocol;
+    double latitude;
+    double longitude;
+    bool have_latitude;
+    bool have_longitude;
+    char iso_3166_1_alpha_2[3];
+    size_t history_fill;
+    char *history[MAX_NAVIGATION_HISTORY_SIZE];
+} listclients_listener_t;
+
+/* Fills listeners with the next page of at most len listeners and returns
+ * how many it filled, 0 at the end.
+ */
+typedef size_t (*listclients_next_t)(void *userdata, listclients_listener_t *listeners, size_t len);
+
+void listclients_listener_clear(listclients_listener_t *listener);
+
+/* These write the same JSON xml2json_render_doc_simple() returns for the
+ * document built by command_show_listeners() but skip the XML tree, which
+ * is most of the work for mounts with many listeners.
+ * listclients_json_write_source() writes the source with the listeners
+ * returned by next into the object begun by
+ * xml2json_render_legacystats_begin(), clearing each after it is written.
+ */
+void listclients_json_write_listener(json_renderer_t *renderer, const listclients_listener_t *listener, time_t now, operation_mode mode);
+void listclients_json_write_source(json_renderer_t         *renderer,
+                                   const char              *mount,
+                                   unsigned long           listeners,
+                                   operation_mode          mode,
+                                   listclients_next_t      next,
+                                   void                    *userdata,
+                                   listclients_country_t   countries[26][26],
+                                   listclients_country_t   *default_country);
+
+#endif
@@ -22,6 +22,17 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
+
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+
+#if defined(HAVE_POLL) && defined(SO_REUSEPORT)
+#define LISTENSOCKET_REUSEPORT
+#include <netdb.h>
+#include <netinet/in.h>
+#endif
 
 #include "common/net/sock.h"
 #include "common/thread/thread.h"
@@ -34,6 +45,17 @@
 #include "logging.h"
 #define CATMODULE "listensocket"
 
+/* An extra socket bound to the same address with SO_REUSEPORT. Each one has
+ * its own kernel accept queue and a thread accepting from it.
+ */
+typedef struct {
+    listensocket_t *socket;
+    /* the socket connections are accepted on behalf of, resolved on open */
+    listensocket_t *effective;
+    sock_t sock;
+    thread_type *thread;
+    volatile int running;
+} listensocket_acceptor_t;
 
 struct listensocket_container_tag {
     refobject_base_t __base;
@@ -53,6 +75,13 @@ struct listensocket_tag {
     listener_t *listener;
     listener_t *listener_update;
     sock_t sock;
+    /* connections accepted, guarded by lock */
+    uint64_t accepted;
+    /* the socket was opened with SO_REUSEPORT, guarded by lock */
+    bool reuseport;
+    /* extra SO_REUSEPORT sockets, guarded by lock */
+    listensocket_acceptor_t **acceptor;
+    size_t acceptor_len;
 };
 
 static int listensocket_container_configure__unlocked(listensocket_container_t *self, const ice_config_t *config);
@@ -62,8 +91,10 @@ static listensocket_t * listensocket_new(const listener_t *listener);
 static int              listensocket_apply_config(listensocket_t *self);
 static int              listensocket_apply_config__unlocked(listensocket_t *self);
 static int              listensocket_set_update(listensocket_t *self, const listener_t *listener);
-static int              listensocket_refsock(listensocket_t *self, bool prefer_inet6);
+static int              listensocket_refsock(listensocket_t *self, listensocket_container_t *container, bool prefer_inet6);
 static int              listensocket_unrefsock(listensocket_t *self);
+static void             listensocket_update_acceptors(listensocket_t *self, listensocket_container_t *container, bool prefer_inet6);
+static listensocket_t * listensocket_container_get_by_id__unlocked(listensocket_container_t *self, const char *id);
 #ifdef HAVE_POLL
 static inline int listensocket__poll_fill(listensocket_t *self, struct pollfd *p);
 #else
@@ -332,12 +363,14 @@ static int listensocket_container_setup__unlocked(listensocket_container_t *self
                 self->sockref[i] = 0;
             }
         } else if (!self->sockref[i] && type != LISTENER_TYPE_VIRTUAL) {
-            if (listensocket_refsock(self->sock[i], self->prefer_inet6) == 0) {
+            if (listensocket_refsock(self->sock[i], self, self->prefer_inet6) == 0) {
                 self->sockref[i] = 1;
             } else {
                 ICECAST_LOG_DEBUG("Can not ref socket.");
                 ret = 1;
             }
+        } else if (self->sockref[i]) {
+            listensocket_update_acceptors(self->sock[i], self, self->prefer_inet6);
         }
     }
 
@@ -346,14 +379,14 @@ static int listensocket_container_setup__unlocked(listensocket_container_t *self
     return ret;
 }
 
-static listensocket_t *       listensocket_container_accept__inner(listensocket_container_t *self, int timeout)
+/* fills ready with up to len sockets that have connections waiting */
+static size_t                 listensocket_container_accept__inner(listensocket_container_t *self, int timeout, listensocket_t **ready, size_t len)
 {
 #ifdef HAVE_POLL
     struct pollfd ufds[self->sock_len];
     listensocket_t *socks[self->sock_len];
-    size_t i, found, p;
+    size_t i, found, p, ret = 0;
     int ok;
-    int ret;
 
     for (i = 0, found = 0; i < self->sock_len; i++) {
         ok = self->sockref[i];
@@ -371,16 +404,17 @@ static listensocket_t *       listensocket_container_accept__inner(listensocket_
 
     if (!found) {
         ICECAST_LOG_ERROR("No sockets found to poll on.");
-        return NULL;
+        return 0;
     }
 
-    ret = poll(ufds, found, timeout);
-    if (ret <= 0)
-        return NULL;
+    if (poll(ufds, found, timeout) <= 0)
+        return 0;
 
     for (i = 0; i < found; i++) {
         if (ufds[i].revents & POLLIN) {
-            return socks[i];
+            if (ret < len)
+                ready[ret++] = socks[i];
+            continue;
         }
 
         if (!(ufds[i].revents & (POLLHUP|POLLERR|POLLNVAL)))
@@ -398,12 +432,11 @@ static listensocket_t *       listensocket_container_accept__inner(listensocket_
         }
     }
 
-    return NULL;
+    return ret;
 #else
     fd_set rfds;
-    size_t i;
+    size_t i, ret = 0;
     struct timeval tv, *p=NULL;
-    int ret;
     int max = -1;
 
     FD_ZERO(&rfds);
@@ -420,36 +453,43 @@ static listensocket_t *       listensocket_container_accept__inner(listensocket_
         }
     }
 
-    ret = select(max+1, &rfds, NULL, NULL, p);
-    if (ret <= 0)
-        return NULL;
+    if (select(max+1, &rfds, NULL, NULL, p) <= 0)
+        return 0;
 
-    for (i = 0; i < self->sock_len; i++) {
+    for (i = 0; i < self->sock_len && ret < len; i++) {
         if (self->sockref[i]) {
-            if (listensocket__select_isset(self->sock[i], &rfds)) {
-                return self->sock[i];
+            if (listensocket__select_isset(self->sock[i], &rfds) > 0) {
+                ready[ret++] = self->sock[i];
             }
         }
     }
 
-    return NULL;
+    return ret;
 #endif
 }
-connection_t *              listensocket_container_accept(listensocket_container_t *self, int timeout)
+size_t                      listensocket_container_accept(listensocket_container_t *self, int timeout, connection_t **cons, size_t len)
 {
-    listensocket_t *ls;
-    connection_t *ret;
+    listensocket_t *ready[LISTENSOCKET_ACCEPT_BATCH];
+    size_t found, i;
+    size_t ret = 0;
 
-    if (!self)
-        return NULL;
+    if (!self || !cons || !len)
+        return 0;
 
     thread_rwlock_rlock(&self->rwlock);
-    ls = listensocket_container_accept__inner(self, timeout);
-    refobject_ref(ls);
+    found = listensocket_container_accept__inner(self, timeout, ready, LISTENSOCKET_ACCEPT_BATCH);
+    for (i = 0; i < found; i++)
+        refobject_ref(ready[i]);
     thread_rwlock_unlock(&self->rwlock);
 
-    ret = listensocket_accept(ls, self);
-    refobject_unref(ls);
+    /* drain every ready socket, sharing the space left evenly between them */
+    for (i = 0; i < found; i++) {
+        size_t share = (len - ret) / (found - i);
+
+        if (share)
+            ret += listensocket_accept(ready[i], self, cons + ret, share);
+        refobject_unref(ready[i]);
+    }
 
     return ret;
 }
@@ -496,11 +536,21 @@ static ssize_t listensocket_container_sockcount__unlocked(listensocket_container
 }
 
 listensocket_t * listensocket_container_get_by_id(listensocket_container_t *self, const char *id)
+{
+    listensocket_t *ret;
+
+    thread_rwlock_rlock(&self->rwlock);
+    ret = listensocket_container_get_by_id__unlocked(self, id);
+    thread_rwlock_unlock(&self->rwlock);
+
+    return ret;
+}
+
+static listensocket_t * listensocket_container_get_by_id__unlocked(listensocket_container_t *self, const char *id)
 {
     size_t i;
     const listener_t *listener;
 
-    thread_rwlock_rlock(&self->rwlock);
     for (i = 0; i < self->sock_len; i++) {
         if (self->sock[i] != NULL) {
             listener = listensocket_get_listener(self->sock[i]);
@@ -508,7 +558,6 @@ listensocket_t * listensocket_container_get_by_id(listensocket_container_t *self
                 if (listener->id != NULL && strcmp(listener->id, id) == 0) {
                     if (refobject_ref(self->sock[i]) == 0) {
                         listensocket_release_listener(self->sock[i]);
-                        thread_rwlock_unlock(&self->rwlock);
                         return self->sock[i];
                     }
                 }
@@ -516,7 +565,6 @@ listensocket_t * listensocket_container_get_by_id(listensocket_container_t *self
             }
         }
     }
-    thread_rwlock_unlock(&self->rwlock);
 
     return NULL;
 }
@@ -617,6 +665,8 @@ static listensocket_t * listensocket_new(const listener_t *listener) {
         return NULL;
 
     self->sock = SOCK_ERROR;
+    self->acceptor = NULL;
+    self->acceptor_len = 0;
 
     thread_mutex_create(&self->lock);
     thread_rwlock_create(&self->listener_rwlock);
@@ -647,6 +697,7 @@ static int              listensocket_apply_config(listensocket_t *self)
 static int              listensocket_apply_config__unlocked(listensocket_t *self)
 {
     const listener_t *listener;
+    size_t i;
 
     if (!self)
         return -1;
@@ -676,6 +727,12 @@ static int              listensocket_apply_config__unlocked(listensocket_t *self
         sock_set_blocking(self->sock, 0);
 
         __socket_listen(self->sock, listener);
+
+        for (i = 0; i < self->acceptor_len; i++) {
+            if (listener->so_sndbuf)
+                sock_set_send_buffer(self->acceptor[i]->sock, listener->so_sndbuf);
+            __socket_listen(self->acceptor[i]->sock, listener);
+        }
     }
 
     if (self->listener_update) {
@@ -707,23 +764,407 @@ static int              listensocket_set_update(listensocket_t *self, const list
     return 0;
 }
 
-static int listensocket_refsock(listensocket_t *self, bool prefer_inet6)
+/* accept() for the sockets opened by us. SOCK_NONBLOCK is taken by
+ * common/net/sock.h, so connection_queue() still sets non-blocking mode. */
+static sock_t listensocket__accept_own(sock_t serversock, char *ip, size_t len)
+{
+#ifdef HAVE_ACCEPT4
+    struct sockaddr_storage sa;
+    socklen_t salen = sizeof(sa);
+    sock_t sock;
+
+    sock = accept4(serversock, (struct sockaddr *)&sa, &salen, SOCK_CLOEXEC);
+    if (sock == SOCK_ERROR)
+        return SOCK_ERROR;
+
+    if (getnameinfo((struct sockaddr *)&sa, salen, ip, len, NULL, 0, NI_NUMERICHOST) != 0) {
+        sock_close(sock);
+        return SOCK_ERROR;
+    }
+
+    return sock;
+#else
+    return sock_accept(serversock, ip, len);
+#endif
+}
+
+/* accepts up to len connections waiting on serversock */
+static size_t listensocket__drain(sock_t serversock, bool own, sock_t *socks, char **ips, size_t len)
+{
+    size_t ret = 0;
+
+    while (ret < len) {
+        char *ip = calloc(MAX_ADDR_LEN, 1);
+        sock_t sock;
+
+        if (!ip)
+            break;
+
+        if (own) {
+            sock = listensocket__accept_own(serversock, ip, MAX_ADDR_LEN);
+        } else {
+            sock = sock_accept(serversock, ip, MAX_ADDR_LEN);
+        }
+
+        if (sock == SOCK_ERROR) {
+            free(ip);
+            break;
+        }
+
+        socks[ret] = sock;
+        ips[ret] = ip;
+        ret++;
+    }
+
+    return ret;
+}
+
+/* Accepts up to len connections into cons, from the acceptor's socket if
+ * one is given, from the main socket otherwise. Returns the number of new
+ * connections.
+ */
+static size_t listensocket__accept_batch(listensocket_t *self, listensocket_container_t *container, listensocket_acceptor_t *acceptor, connection_t **cons, size_t len)
+{
+    sock_t socks[LISTENSOCKET_ACCEPT_BATCH];
+    char *ips[LISTENSOCKET_ACCEPT_BATCH];
+    listensocket_t *effective = NULL;
+    size_t accepted, i;
+    size_t ret = 0;
+
+    if (len > LISTENSOCKET_ACCEPT_BATCH)
+        len = LISTENSOCKET_ACCEPT_BATCH;
+
+    if (acceptor) {
+        accepted = listensocket__drain(acceptor->sock, true, socks, ips, len);
+        thread_mutex_lock(&self->lock);
+    } else {
+        thread_mutex_lock(&self->lock);
+        accepted = listensocket__drain(self->sock, false, socks, ips, len);
+    }
+    self->accepted += accepted;
+    thread_mutex_unlock(&self->lock);
+
+    if (!accepted)
+        return 0;
+
+    if (acceptor) {
+        effective = acceptor->effective;
+        refobject_ref(effective);
+    } else if (self->listener->on_behalf_of) {
+        ICECAST_LOG_DEBUG("This socket is acting on behalf of %#H", self->listener->on_behalf_of);
+        effective = listensocket_container_get_by_id(container, self->listener->on_behalf_of);
+        if (!effective) {
+            ICECAST_LOG_ERROR("Can not find listen socket with ID %#H. Will continue on behalf of myself.", self->listener->on_behalf_of);
+        }
+    }
+
+    if (!effective) {
+        effective = self;
+        refobject_ref(effective);
+    }
+
+    for (i = 0; i < accepted; i++) {
+        connection_t *con;
+
+        ICECAST_LOG_DEBUG("Client (sock=%R, ip=%#H) on socket %p (%#H).", socks[i], ips[i], self, self->listener->id);
+
+        if (strncmp(ips[i], "::ffff:", 7) == 0) {
+            memmove(ips[i], ips[i]+7, strlen(ips[i]+7)+1);
+        }
+
+        con = connection_create(socks[i], self, effective, ips[i]);
+        if (con == NULL) {
+            sock_close(socks[i]);
+            free(ips[i]);
+            continue;
+        }
+
+        cons[ret++] = con;
+    }
+    refobject_unref(effective);
+
+    return ret;
+}
+
+#ifdef LISTENSOCKET_REUSEPORT
+/* Opens a socket bound with SO_REUSEPORT. All sockets opened this way for a
+ * listener share its address and the kernel balances new connections
+ * between their accept queues.
+ */
+static sock_t listensocket__reuseport_socket(const listener_t *listener, bool prefer_inet6)
+{
+    struct addrinfo hints, *res, *ai;
+    char service[12];
+    sock_t sock = SOCK_ERROR;
+    int on = 1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = listener->bind_address ? AF_UNSPEC : (prefer_inet6 ? AF_INET6 : AF_INET);
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE|AI_NUMERICSERV;
+    snprintf(service, sizeof(service), "%i", listener->port);
+
+    if (getaddrinfo(listener->bind_address, service, &hints, &res) != 0)
+        return SOCK_ERROR;
+
+    for (ai = res; ai; ai = ai->ai_next) {
+        sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (sock == SOCK_ERROR)
+            continue;
+
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == 0) {
+#ifdef IPV6_V6ONLY
+            if (ai->ai_family == AF_INET6 && !listener->bind_address) {
+                int off = 0;
+                setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+            }
+#endif
+            if (bind(sock, ai->ai_addr, ai->ai_addrlen) == 0)
+                break;
+        }
+
+        sock_close(sock);
+        sock = SOCK_ERROR;
+    }
+
+    freeaddrinfo(res);
+
+    return sock;
+}
+
+static void *listensocket__acceptor_thread(void *arg)
+{
+    listensocket_acceptor_t *acceptor = arg;
+    connection_t *cons[LISTENSOCKET_ACCEPT_BATCH];
+    struct pollfd ufd;
+    size_t i, len;
+
+    while (acceptor->running) {
+        /* connections stay in the kernel queue until the server is up */
+        if (global.running != ICECAST_RUNNING) {
+            thread_sleep(100000);
+            continue;
+        }
+
+        memset(&ufd, 0, sizeof(ufd));
+        ufd.fd = acceptor->sock;
+        ufd.events = POLLIN;
+        if (poll(&ufd, 1, 800) <= 0)
+            continue;
+
+        if (ufd.revents & (POLLHUP|POLLERR|POLLNVAL)) {
+            ICECAST_LOG_ERROR("Listen socket in error state, stopping its accept thread.");
+            break;
+        }
+
+        len = listensocket__accept_batch(acceptor->socket, NULL, acceptor, cons, LISTENSOCKET_ACCEPT_BATCH);
+        for (i = 0; i < len; i++)
+            connection_queue(cons[i]);
+    }
+
+    return NULL;
+}
+
+/* Resolves on-behalf-of for the accept threads. They can not look it up
+ * themselves as the container is locked while they are stopped. Must be
+ * called without self->lock held.
+ */
+static listensocket_t *listensocket__acceptor_effective(listensocket_t *self, listensocket_container_t *container)
+{
+    const listener_t *listener = listensocket_get_listener(self);
+    listensocket_t *effective = NULL;
+    char *id = NULL;
+
+    if (listener->on_behalf_of)
+        id = strdup(listener->on_behalf_of);
+    listensocket_release_listener(self);
+
+    if (id) {
+        effective = listensocket_container_get_by_id__unlocked(container, id);
+        if (!effective)
+            ICECAST_LOG_ERROR("Can not find listen socket with ID %#H. Will continue on behalf of myself.", id);
+        free(id);
+    }
+
+    return effective;
+}
+
+/* Opens extra sockets and starts their threads until there are as many as
+ * <accept-threads> asks for. Must be called with self->lock held. */
+static void listensocket__start_acceptors(listensocket_t *self, listensocket_t *effective, bool prefer_inet6)
+{
+    const listener_t *listener = self->listener;
+    size_t want = listener->accept_threads - 1;
+    listensocket_acceptor_t **n;
+
+    if (want <= self->acceptor_len)
+        return;
+
+    n = realloc(self->acceptor, want * sizeof(*n));
+    if (!n)
+        return;
+    self->acceptor = n;
+
+    while (self->acceptor_len < want) {
+        listensocket_acceptor_t *acceptor = calloc(1, sizeof(*acceptor));
+
+        if (!acceptor)
+            break;
+
+        acceptor->sock = listensocket__reuseport_socket(listener, prefer_inet6);
+        if (acceptor->sock == SOCK_ERROR) {
+            free(acceptor);
+            break;
+        }
+
+        if (listener->so_sndbuf)
+            sock_set_send_buffer(acceptor->sock, listener->so_sndbuf);
+        sock_set_blocking(acceptor->sock, 0);
+
+        if (__socket_listen(acceptor->sock, listener) == 0) {
+            sock_close(acceptor->sock);
+            free(acceptor);
+            break;
+        }
+
+        acceptor->socket = self;
+        acceptor->effective = effective;
+        acceptor->running = 1;
+        acceptor->thread = thread_create("Accept Thread", listensocket__acceptor_thread, acceptor, THREAD_ATTACHED);
+        if (!acceptor->thread) {
+            sock_close(acceptor->sock);
+            free(acceptor);
+            break;
+        }
+
+        refobject_ref(effective);
+        self->acceptor[self->acceptor_len++] = acceptor;
+    }
+
+    if (self->acceptor_len < want) {
+        ICECAST_LOG_WARN("Only %zu of %i accept threads started for listen socket on %s port %i.", self->acceptor_len + 1, listener->accept_threads, __string_default(listener->bind_address, "<ANY>"), listener->port);
+    }
+}
+
+/* Stops the threads and closes the sockets of acceptor, the array itself is
+ * left to the caller. With requeue the connections still waiting on the
+ * sockets are taken over, otherwise closing drops them.
+ * Must be called without self->lock held as the threads may wait for it.
+ */
+static void listensocket__stop_acceptors(listensocket_acceptor_t **acceptor, size_t len, bool requeue)
+{
+    connection_t *cons[LISTENSOCKET_ACCEPT_BATCH];
+    size_t i, j, accepted;
+
+    for (i = 0; i < len; i++)
+        acceptor[i]->running = 0;
+
+    for (i = 0; i < len; i++) {
+        thread_join(acceptor[i]->thread);
+        if (requeue) {
+            while ((accepted = listensocket__accept_batch(acceptor[i]->socket, NULL, acceptor[i], cons, LISTENSOCKET_ACCEPT_BATCH))) {
+                for (j = 0; j < accepted; j++)
+                    connection_queue(cons[j]);
+            }
+        }
+        sock_close(acceptor[i]->sock);
+        refobject_unref(acceptor[i]->effective);
+        free(acceptor[i]);
+    }
+}
+#endif
+
+/* Starts or stops accept threads after <accept-threads> was changed by a
+ * reload. Going above one needs SO_REUSEPORT, which can only be set when
+ * the socket is opened. Such a change is left to a restart.
+ */
+static void listensocket_update_acceptors(listensocket_t *self, listensocket_container_t *container, bool prefer_inet6)
+{
+#ifdef LISTENSOCKET_REUSEPORT
+    listensocket_acceptor_t **surplus = NULL;
+    listensocket_t *effective;
+    size_t surplus_len = 0;
+    size_t want;
+
+    if (!self)
+        return;
+
+    effective = listensocket__acceptor_effective(self, container);
+
+    thread_mutex_lock(&self->lock);
+    if (self->sock != SOCK_ERROR) {
+        want = self->listener->accept_threads - 1;
+        if (want > self->acceptor_len) {
+            if (self->reuseport) {
+                listensocket__start_acceptors(self, effective ? effective : self, prefer_inet6);
+            } else {
+                ICECAST_LOG_WARN("Listen socket on %s port %i was opened with a single accept thread, <accept-threads> takes effect on restart.", __string_default(self->listener->bind_address, "<ANY>"), self->listener->port);
+            }
+        } else if (want < self->acceptor_len) {
+            surplus_len = self->acceptor_len - want;
+            surplus = malloc(surplus_len * sizeof(*surplus));
+            if (surplus) {
+                memcpy(surplus, self->acceptor + want, surplus_len * sizeof(*surplus));
+                self->acceptor_len = want;
+            }
+        }
+    }
+    thread_mutex_unlock(&self->lock);
+
+    if (surplus) {
+        listensocket__stop_acceptors(surplus, surplus_len, true);
+        free(surplus);
+    }
+    refobject_unref(effective);
+#else
+    (void)self;
+    (void)container;
+    (void)prefer_inet6;
+#endif
+}
+
+static int listensocket_refsock(listensocket_t *self, listensocket_container_t *container, bool prefer_inet6)
 {
+    listensocket_t *effective = NULL;
+#ifdef LISTENSOCKET_REUSEPORT
+    bool reuseport;
+#endif
+
     if (!self)
         return -1;
 
+#ifdef LISTENSOCKET_REUSEPORT
+    reuseport = listensocket_get_listener(self)->accept_threads > 1;
+    listensocket_release_listener(self);
+    if (reuseport)
+        effective = listensocket__acceptor_effective(self, container);
+#endif
+
     thread_mutex_lock(&self->lock);
     if (self->sockrefc) {
         self->sockrefc++;
         thread_mutex_unlock(&self->lock);
+        refobject_unref(effective);
         return 0;
     }
 
     thread_rwlock_rlock(&self->listener_rwlock);
-    self->sock = sock_get_server_socket(self->listener->port, self->listener->bind_address, self->listener->bind_address ? false : prefer_inet6);
+#ifdef LISTENSOCKET_REUSEPORT
+    if (reuseport) {
+        self->sock = listensocket__reuseport_socket(self->listener, prefer_inet6);
+        if (self->sock == SOCK_ERROR) {
+            ICECAST_LOG_WARN("Can not use SO_REUSEPORT on %s port %i, using a single accept thread.", __string_default(self->listener->bind_address, "<ANY>"), self->listener->port);
+            reuseport = false;
+        }
+    }
+#endif
+    if (self->sock == SOCK_ERROR)
+        self->sock = sock_get_server_socket(self->listener->port, self->listener->bind_address, self->listener->bind_address ? false : prefer_inet6);
     thread_rwlock_unlock(&self->listener_rwlock);
     if (self->sock == SOCK_ERROR) {
         thread_mutex_unlock(&self->lock);
+        refobject_unref(effective);
         return -1;
     }
 
@@ -744,22 +1185,36 @@ static int listensocket_refsock(listensocket_t *self, bool prefer_inet6)
         ICECAST_LOG_ERROR("Can not listen on socket: %s port %i", __string_default(self->listener->bind_address, "<ANY>"), self->listener->port);
         thread_rwlock_unlock(&self->listener_rwlock);
         thread_mutex_unlock(&self->lock);
+        refobject_unref(effective);
         return -1;
     }
 
     if (listensocket_apply_config__unlocked(self) == -1) {
         thread_mutex_unlock(&self->lock);
+        refobject_unref(effective);
         return -1;
     }
 
+#ifdef LISTENSOCKET_REUSEPORT
+    self->reuseport = reuseport;
+    if (reuseport)
+        listensocket__start_acceptors(self, effective ? effective : self, prefer_inet6);
+#endif
+
     self->sockrefc++;
     thread_mutex_unlock(&self->lock);
+    refobject_unref(effective);
 
     return 0;
 }
 
 static int listensocket_unrefsock(listensocket_t *self)
 {
+#ifdef LISTENSOCKET_REUSEPORT
+    listensocket_acceptor_t **acceptor;
+    size_t acceptor_len;
+#endif
+
     if (!self)
         return -1;
 
@@ -775,65 +1230,32 @@ static int listensocket_unrefsock(listensocket_t *self)
         return 0;
     }
 
+#ifdef LISTENSOCKET_REUSEPORT
+    acceptor = self->acceptor;
+    acceptor_len = self->acceptor_len;
+    self->acceptor = NULL;
+    self->acceptor_len = 0;
+    self->reuseport = false;
+#endif
+
     sock_close(self->sock);
     self->sock = SOCK_ERROR;
     thread_mutex_unlock(&self->lock);
 
+#ifdef LISTENSOCKET_REUSEPORT
+    listensocket__stop_acceptors(acceptor, acceptor_len, false);
+    free(acceptor);
+#endif
+
     return 0;
 }
 
-connection_t *              listensocket_accept(listensocket_t *self, listensocket_container_t *container)
+size_t                      listensocket_accept(listensocket_t *self, listensocket_container_t *container, connection_t **cons, size_t len)
 {
-    connection_t *con;
-    listensocket_t *effective = NULL;
-    sock_t sock;
-    char *ip;
-
-    if (!self)
-        return NULL;
-
-    ip = calloc(MAX_ADDR_LEN, 1);
-    if (!ip)
-        return NULL;
-
-    thread_mutex_lock(&self->lock);
-    sock = sock_accept(self->sock, ip, MAX_ADDR_LEN);
-    thread_mutex_unlock(&self->lock);
-    if (sock == SOCK_ERROR) {
-        free(ip);
-        return NULL;
-    }
-
-    ICECAST_LOG_DEBUG("Client (sock=%R, ip=%#H) on socket %p (%#H).", sock, ip, self, self->listener->id);
-
-    if (strncmp(ip, "::ffff:", 7) == 0) {
-        memmove(ip, ip+7, strlen(ip+7)+1);
-    }
-
-    if (self->listener->on_behalf_of) {
-        ICECAST_LOG_DEBUG("This socket is acting on behalf of %#H", self->listener->on_behalf_of);
-        effective = listensocket_container_get_by_id(container, self->listener->on_behalf_of);
-        if (!effective) {
-            ICECAST_LOG_ERROR("Can not find listen socket with ID %#H. Will continue on behalf of myself.", self->listener->on_behalf_of);
-        }
-    }
-
-    if (!effective) {
-        effective = self;
-        refobject_ref(effective);
-    }
-
-    con = connection_create(sock, self, effective, ip);
-
-    refobject_unref(effective);
-
-    if (con == NULL) {
-        sock_close(sock);
-        free(ip);
-        return NULL;
-    }
+    if (!self || !cons)
+        return 0;
 
-    return con;
+    return listensocket__accept_batch(self, container, NULL, cons, len);
 }
 
 const listener_t *          listensocket_get_listener(listensocket_t *self)
@@ -896,6 +1318,20 @@ sock_family_t               listensocket_get_family(listensocket_t *self)
     return ret;
 }
 
+uint64_t                    listensocket_get_accepted(listensocket_t *self)
+{
+    uint64_t ret;
+
+    if (!self)
+        return 0;
+
+    thread_mutex_lock(&self->lock);
+    ret = self->accepted;
+    thread_mutex_unlock(&self->lock);
+
+    return ret;
+}
+
 #ifdef HAVE_POLL
 static inline int listensocket__poll_fill(listensocket_t *self, struct pollfd *p)
 {
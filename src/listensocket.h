@@ -10,6 +10,7 @@
 #define __LISTENSOCKET_H__
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "common/net/sock.h"
 
@@ -17,13 +18,17 @@
 #include "refobject.h"
 #include "cfgfile.h"
 
+/* maximum number of connections accepted per wakeup */
+#define LISTENSOCKET_ACCEPT_BATCH   64
+
 REFOBJECT_FORWARD_TYPE(listensocket_container_t);
 
 listensocket_container_t *  listensocket_container_new(void);
 int                         listensocket_container_configure(listensocket_container_t *self, const ice_config_t *config);
 int                         listensocket_container_configure_and_setup(listensocket_container_t *self, const ice_config_t *config);
 int                         listensocket_container_setup(listensocket_container_t *self);
-connection_t *              listensocket_container_accept(listensocket_container_t *self, int timeout);
+/* accepts up to len connections from all ready sockets, returns how many */
+size_t                      listensocket_container_accept(listensocket_container_t *self, int timeout, connection_t **cons, size_t len);
 int                         listensocket_container_set_sockcount_cb(listensocket_container_t *self, void (*cb)(size_t count, void *userdata), void *userdata);
 ssize_t                     listensocket_container_sockcount(listensocket_container_t *self);
 listensocket_t *            listensocket_container_get_by_id(listensocket_container_t *self, const char *id);
@@ -33,11 +38,13 @@ bool                        listensocket_container_is_family_included(listensock
 
 REFOBJECT_FORWARD_TYPE(listensocket_t);
 
-connection_t *              listensocket_accept(listensocket_t *self, listensocket_container_t *container);
+size_t                      listensocket_accept(listensocket_t *self, listensocket_container_t *container, connection_t **cons, size_t len);
 const listener_t *          listensocket_get_listener(listensocket_t *self);
 int                         listensocket_release_listener(listensocket_t *self);
 listener_type_t             listensocket_get_type(listensocket_t *self);
 sock_family_t               listensocket_get_family(listensocket_t *self);
+/* number of connections accepted on the socket */
+uint64_t                    listensocket_get_accepted(listensocket_t *self);
 
 const char *                listensocket_type_to_string(listener_type_t type);
 const char *                listensocket_tlsmode_to_string(tlsmode_t mode);
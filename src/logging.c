@@ -169,7 +169,7 @@ void logging_access(client_t *client)
     if (referrer == NULL)
         referrer = "-";
 
-    user_agent = httpp_getvar (client->parser, "user-agent");
+    user_agent = client_get_header(client, HTTPHEAD_USER_AGENT);
     if (user_agent == NULL)
         user_agent = "-";
 
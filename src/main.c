@@ -86,6 +86,7 @@
 #include "logging.h"
 #include "xslt.h"
 #include "fserve.h"
+#include "fanout.h"
 #include "yp.h"
 #include "auth.h"
 #include "event.h"
@@ -177,6 +178,7 @@ static void initialize_subsystems(void)
     client_initialize();
     connection_initialize();
     refbuf_initialize();
+    fanout_initialize();
 
     xslt_initialize();
 #ifdef HAVE_CURL
@@ -191,7 +193,6 @@ static void shutdown_subsystems(void)
     event_stream_shutdown();
     event_shutdown();
     fserve_shutdown();
-    refbuf_shutdown();
     slave_shutdown();
     auth_shutdown();
     yp_shutdown();
@@ -202,6 +203,7 @@ static void shutdown_subsystems(void)
 
     ICECAST_LOG_DEBUG("Shuting down connection related subsystems...");
     connection_shutdown();
+    fanout_shutdown();
     client_shutdown();
     tls_shutdown();
     prng_deconfigure();
@@ -215,6 +217,7 @@ static void shutdown_subsystems(void)
     navigation_shutdown();
     prng_shutdown();
     global_shutdown();
+    refbuf_shutdown();
     thread_shutdown();
 
 #ifdef HAVE_CURL
@@ -750,6 +753,7 @@ int main(int argc, char **argv)
 
     config = config_get_config();
     prng_configure(config);
+    fanout_set_threads(config->listener_threads);
     config_release_config();
 
     stats_initialize(); /* We have to do this later on because of threading */
@@ -21,6 +21,7 @@
 #include "common/avl/avl.h"
 
 #include "module.h"
+#include "json.h"
 #include "global.h"  /* for igloo_instance */
 #include "cfgfile.h" /* for XMLSTR() */
 
@@ -169,6 +170,31 @@ xmlNodePtr                      module_container_get_modulelist_as_xml(module_co
     return root;
 }
 
+void                            module_container_write_modulelist_json(module_container_t *self, json_renderer_t *renderer)
+{
+    avl_node *avlnode;
+
+    if (!self)
+        return;
+
+    /* Same as xml2json renders the result of module_container_get_modulelist_as_xml() */
+    json_renderer_write_key(renderer, "modules", JSON_RENDERER_FLAGS_NONE);
+    json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
+    thread_mutex_lock(&(self->lock));
+    avlnode = avl_get_first(self->module);
+    while (avlnode) {
+        module_t *module = avlnode->key;
+
+        json_renderer_write_key(renderer, module->name, JSON_RENDERER_FLAGS_NONE);
+        json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
+        json_renderer_end(renderer);
+
+        avlnode = avl_get_next(avlnode);
+    }
+    thread_mutex_unlock(&(self->lock));
+    json_renderer_end(renderer);
+}
+
 static void __module_free(igloo_ro_t self)
 {
     module_t *mod = igloo_ro_to_type(self, module_t);
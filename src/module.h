@@ -15,6 +15,7 @@
 
 #include "icecasttypes.h"
 #include "refobject.h"
+#include "json.h"
 
 typedef void (*module_client_handler_function_t)(module_t *self, client_t *client);
 typedef int  (*module_setup_handler_t)(module_t *self, void **userdata);
@@ -31,6 +32,8 @@ int                             module_container_add_module(module_container_t *
 int                             module_container_delete_module(module_container_t *self, const char *name);
 module_t *                      module_container_get_module(module_container_t *self, const char *name);
 xmlNodePtr                      module_container_get_modulelist_as_xml(module_container_t *self);
+/* Writes the "modules" key and list, nothing if there is no container */
+void                            module_container_write_modulelist_json(module_container_t *self, json_renderer_t *renderer);
 
 module_t *                      module_new(const char *name, module_setup_handler_t newcb, module_setup_handler_t freecb, void *userdata);
 
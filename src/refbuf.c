@@ -22,77 +22,483 @@
 #endif
 
 #include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
 
+#include "common/thread/thread.h"
+
 #include "refbuf.h"
 
+/* Per thread free lists need thread specific data and atomic counters,
+ * without them all threads share the free lists of the pool.
+ */
+#if defined(HAVE_PTHREAD) && defined(REFBUF_THREADSAFE)
+#include <pthread.h>
+#define REFBUF_POOL_THREAD_CACHE 1
+#endif
+
 #define CATMODULE "refbuf"
 
 #include "logging.h"
 
+/* The refbuf and its data are allocated as one block. Sizes up to the largest
+ * size class are rounded up to the next class and recycled through free
+ * lists: 1400 byte MP3 blocks, typical Ogg pages and client buffers.
+ */
+static const unsigned int refbuf_pool_sizes[] = {128, 512, 1536, 4096, 8192, 16384};
+#define REFBUF_POOL_CLASSES     (sizeof(refbuf_pool_sizes)/sizeof(*refbuf_pool_sizes))
+/* free blocks a thread keeps per size class, and how many are moved between
+ * a thread and the shared free lists at once */
+#define REFBUF_POOL_CACHE_MAX   64
+#define REFBUF_POOL_CACHE_BATCH 32
+/* limit of idle memory per size class in the shared free lists */
+#define REFBUF_POOL_DEPOT_BYTES (4*1024*1024)
+
+#define REFBUF_INLINE_DATA(refbuf) ((char *)((refbuf) + 1))
+
+typedef struct {
+    spin_t lock;
+    refbuf_t *free;
+    size_t free_len;
+    size_t free_max;
+} refbuf_depot_t;
+
+static refbuf_depot_t refbuf_depots[REFBUF_POOL_CLASSES];
+
+#ifdef REFBUF_THREADSAFE
+typedef atomic_ullong refbuf_stat_t;
+static atomic_bool refbuf_pool_running;
+#define refbuf_stat_add(stat,v) atomic_fetch_add_explicit(&(stat), (v), memory_order_relaxed)
+#define refbuf_stat_get(stat)   atomic_load_explicit(&(stat), memory_order_relaxed)
+#define refbuf_pool_is_running() atomic_load_explicit(&refbuf_pool_running, memory_order_acquire)
+#define refbuf_pool_set_running(v) atomic_store_explicit(&refbuf_pool_running, (v), memory_order_release)
+#else
+typedef unsigned long long refbuf_stat_t;
+static bool refbuf_pool_running;
+static spin_t refbuf_stats_lock;
+#define refbuf_stat_add(stat,v) do { thread_spin_lock(&refbuf_stats_lock); (stat) += (v); thread_spin_unlock(&refbuf_stats_lock); } while (0)
+#define refbuf_stat_get(stat)   (stat)
+#define refbuf_pool_is_running() refbuf_pool_running
+#define refbuf_pool_set_running(v) (refbuf_pool_running = (v))
+#endif
+
+static refbuf_stat_t refbuf_stat_hits;
+static refbuf_stat_t refbuf_stat_misses;
+static refbuf_stat_t refbuf_stat_oversize;
+static refbuf_stat_t refbuf_stat_frees;
+static refbuf_stat_t refbuf_stat_high_water;
+
+#ifdef REFBUF_POOL_THREAD_CACHE
+typedef struct {
+    refbuf_t *free[REFBUF_POOL_CLASSES];
+    size_t free_len[REFBUF_POOL_CLASSES];
+} refbuf_cache_t;
+
+static pthread_key_t refbuf_cache_key;
+#endif
+
+static inline size_t refbuf_pool_block_size(size_t class)
+{
+    return sizeof(refbuf_t) + refbuf_pool_sizes[class];
+}
+
+static void refbuf_free_list(refbuf_t *list)
+{
+    while (list) {
+        refbuf_t *to_go = list;
+        list = to_go->next;
+        free(to_go);
+    }
+}
+
+/* move up to len blocks of list into the shared free list, blocks not
+ * fitting are given back to the system */
+static void refbuf_depot_put(size_t class, refbuf_t *list, size_t len)
+{
+    refbuf_depot_t *depot = &(refbuf_depots[class]);
+
+    thread_spin_lock(&(depot->lock));
+    while (list && len && depot->free_len < depot->free_max) {
+        refbuf_t *block = list;
+        list = block->next;
+        len--;
+        block->next = depot->free;
+        depot->free = block;
+        depot->free_len++;
+    }
+    thread_spin_unlock(&(depot->lock));
+
+    refbuf_free_list(list);
+}
+
+/* take up to max blocks from the shared free list */
+static refbuf_t *refbuf_depot_get(size_t class, size_t max, size_t *len)
+{
+    refbuf_depot_t *depot = &(refbuf_depots[class]);
+    refbuf_t *list = NULL;
+
+    *len = 0;
+    thread_spin_lock(&(depot->lock));
+    while (depot->free && *len < max) {
+        refbuf_t *block = depot->free;
+        depot->free = block->next;
+        depot->free_len--;
+        block->next = list;
+        list = block;
+        (*len)++;
+    }
+    thread_spin_unlock(&(depot->lock));
+
+    return list;
+}
+
+#ifdef REFBUF_POOL_THREAD_CACHE
+/* called on thread exit and on shutdown for the main thread */
+static void refbuf_cache_destroy(void *arg)
+{
+    refbuf_cache_t *cache = arg;
+    size_t class;
+
+    for (class = 0; class < REFBUF_POOL_CLASSES; class++) {
+        if (refbuf_pool_is_running()) {
+            refbuf_depot_put(class, cache->free[class], cache->free_len[class]);
+        } else {
+            refbuf_free_list(cache->free[class]);
+        }
+    }
+    free(cache);
+}
+
+static refbuf_cache_t *refbuf_cache_get(void)
+{
+    refbuf_cache_t *cache = pthread_getspecific(refbuf_cache_key);
+
+    if (cache == NULL) {
+        cache = calloc(1, sizeof(*cache));
+        if (cache && pthread_setspecific(refbuf_cache_key, cache) != 0) {
+            free(cache);
+            cache = NULL;
+        }
+    }
+
+    return cache;
+}
+#endif
+
+static refbuf_t *refbuf_pool_get(size_t class)
+{
+    refbuf_t *block;
+#ifdef REFBUF_POOL_THREAD_CACHE
+    refbuf_cache_t *cache = refbuf_cache_get();
+
+    if (cache) {
+        if (cache->free[class] == NULL)
+            cache->free[class] = refbuf_depot_get(class, REFBUF_POOL_CACHE_BATCH, &(cache->free_len[class]));
+
+        block = cache->free[class];
+        if (block) {
+            cache->free[class] = block->next;
+            cache->free_len[class]--;
+        }
+    } else
+#endif
+    {
+        size_t len;
+        block = refbuf_depot_get(class, 1, &len);
+    }
+
+    if (block) {
+        refbuf_stat_add(refbuf_stat_hits, 1);
+    } else {
+        refbuf_stat_add(refbuf_stat_misses, 1);
+        block = malloc(refbuf_pool_block_size(class));
+    }
+
+    return block;
+}
+
+static void refbuf_pool_put(refbuf_t *block)
+{
+    size_t class = block->_pool - 1;
+#ifdef REFBUF_POOL_THREAD_CACHE
+    refbuf_cache_t *cache = refbuf_cache_get();
+#endif
+
+    refbuf_stat_add(refbuf_stat_frees, 1);
+    block->next = NULL;
+
+#ifdef REFBUF_POOL_THREAD_CACHE
+    if (cache) {
+        if (cache->free_len[class] >= REFBUF_POOL_CACHE_MAX) {
+            /* hand the older half over to the other threads */
+            refbuf_t *keep = cache->free[class];
+            refbuf_t *give;
+            size_t i;
+
+            for (i = 1; i < (REFBUF_POOL_CACHE_MAX - REFBUF_POOL_CACHE_BATCH); i++)
+                keep = keep->next;
+            give = keep->next;
+            keep->next = NULL;
+            cache->free_len[class] -= REFBUF_POOL_CACHE_BATCH;
+            refbuf_depot_put(class, give, REFBUF_POOL_CACHE_BATCH);
+        }
+        block->next = cache->free[class];
+        cache->free[class] = block;
+        cache->free_len[class]++;
+        return;
+    }
+#endif
+
+    refbuf_depot_put(class, block, 1);
+}
+
+static void refbuf_pool_update_high_water(void)
+{
+    unsigned long long in_use = refbuf_stat_get(refbuf_stat_hits) + refbuf_stat_get(refbuf_stat_misses) - refbuf_stat_get(refbuf_stat_frees);
+#ifdef REFBUF_THREADSAFE
+    unsigned long long high = atomic_load_explicit(&refbuf_stat_high_water, memory_order_relaxed);
+
+    while (in_use > high && !atomic_compare_exchange_weak_explicit(&refbuf_stat_high_water, &high, in_use, memory_order_relaxed, memory_order_relaxed));
+#else
+    thread_spin_lock(&refbuf_stats_lock);
+    if (in_use > refbuf_stat_high_water)
+        refbuf_stat_high_water = in_use;
+    thread_spin_unlock(&refbuf_stats_lock);
+#endif
+}
 
 void refbuf_initialize(void)
 {
+    size_t class;
+
+    for (class = 0; class < REFBUF_POOL_CLASSES; class++) {
+        refbuf_depot_t *depot = &(refbuf_depots[class]);
+
+        thread_spin_create(&(depot->lock));
+        depot->free = NULL;
+        depot->free_len = 0;
+        depot->free_max = REFBUF_POOL_DEPOT_BYTES / refbuf_pool_block_size(class);
+    }
+
+#ifdef REFBUF_POOL_THREAD_CACHE
+    if (pthread_key_create(&refbuf_cache_key, refbuf_cache_destroy) != 0) {
+        ICECAST_LOG_ERROR("Can not create thread specific data, buffer pool disabled.");
+        for (class = 0; class < REFBUF_POOL_CLASSES; class++)
+            thread_spin_destroy(&(refbuf_depots[class].lock));
+        return;
+    }
+#endif
+#ifndef REFBUF_THREADSAFE
+    thread_spin_create(&refbuf_stats_lock);
+#endif
+
+    refbuf_pool_set_running(true);
 }
 
 void refbuf_shutdown(void)
 {
+    size_t class;
+#ifdef REFBUF_POOL_THREAD_CACHE
+    refbuf_cache_t *cache;
+#endif
+
+    if (!refbuf_pool_is_running())
+        return;
+
+#ifdef REFBUF_POOL_THREAD_CACHE
+    cache = pthread_getspecific(refbuf_cache_key);
+    if (cache) {
+        pthread_setspecific(refbuf_cache_key, NULL);
+        refbuf_cache_destroy(cache);
+    }
+#endif
+
+    /* from now on blocks are given back to the system directly */
+    refbuf_pool_set_running(false);
+
+#ifdef REFBUF_POOL_THREAD_CACHE
+    pthread_key_delete(refbuf_cache_key);
+#endif
+
+    for (class = 0; class < REFBUF_POOL_CLASSES; class++) {
+        refbuf_depot_t *depot = &(refbuf_depots[class]);
+
+        refbuf_free_list(depot->free);
+        depot->free = NULL;
+        depot->free_len = 0;
+        thread_spin_destroy(&(depot->lock));
+    }
+#ifndef REFBUF_THREADSAFE
+    thread_spin_destroy(&refbuf_stats_lock);
+#endif
+}
+
+void refbuf_pool_get_stats(refbuf_pool_stats_t *stats)
+{
+    size_t class;
+
+    stats->hits = refbuf_stat_get(refbuf_stat_hits);
+    stats->misses = refbuf_stat_get(refbuf_stat_misses);
+    stats->oversize = refbuf_stat_get(refbuf_stat_oversize);
+    stats->in_use = stats->hits + stats->misses - refbuf_stat_get(refbuf_stat_frees);
+    stats->high_water = refbuf_stat_get(refbuf_stat_high_water);
+    if (stats->high_water < stats->in_use)
+        stats->high_water = stats->in_use;
+    stats->idle = 0;
+
+    if (!refbuf_pool_is_running())
+        return;
+
+    for (class = 0; class < REFBUF_POOL_CLASSES; class++) {
+        thread_spin_lock(&(refbuf_depots[class].lock));
+        stats->idle += refbuf_depots[class].free_len;
+        thread_spin_unlock(&(refbuf_depots[class].lock));
+    }
 }
 
 refbuf_t *refbuf_new (unsigned int size)
 {
-    refbuf_t *refbuf;
+    refbuf_t *refbuf = NULL;
+    unsigned int pool = 0;
 
-    refbuf = (refbuf_t *)malloc(sizeof(refbuf_t));
+    if (size && refbuf_pool_is_running()) {
+        size_t class;
+
+        for (class = 0; class < REFBUF_POOL_CLASSES; class++) {
+            if (size <= refbuf_pool_sizes[class]) {
+                refbuf = refbuf_pool_get(class);
+                pool = class + 1;
+                break;
+            }
+        }
+        if (pool) {
+            refbuf_pool_update_high_water();
+        } else {
+            refbuf_stat_add(refbuf_stat_oversize, 1);
+        }
+    }
+
+    if (pool == 0)
+        refbuf = malloc(sizeof(refbuf_t) + size);
     if (refbuf == NULL)
         abort();
-    refbuf->data = NULL;
-    if (size)
-    {
-        refbuf->data = malloc (size);
-        if (refbuf->data == NULL)
-            abort();
-    }
+
+    refbuf->data = size ? REFBUF_INLINE_DATA(refbuf) : NULL;
     refbuf->len = size;
     refbuf->sync_point = 0;
+    refbuf->_pool = pool;
+#ifdef REFBUF_THREADSAFE
+    atomic_init(&(refbuf->_count), 1);
+#else
     refbuf->_count = 1;
+#endif
     refbuf->next = NULL;
     refbuf->associated = NULL;
 
     return refbuf;
 }
 
+int refbuf_resize(refbuf_t *self, unsigned int size)
+{
+    char *data;
+
+    if (self->data && self->data != REFBUF_INLINE_DATA(self)) {
+        data = realloc(self->data, size);
+        if (data == NULL)
+            return -1;
+    } else if (self->_pool && size <= refbuf_pool_sizes[self->_pool - 1]) {
+        /* still fits into the block */
+        data = REFBUF_INLINE_DATA(self);
+    } else {
+        data = malloc(size);
+        if (data == NULL)
+            return -1;
+        if (self->data)
+            memcpy(data, self->data, self->len < size ? self->len : size);
+    }
+
+    self->data = data;
+    self->len = size;
+
+    return 0;
+}
+
 void refbuf_addref(refbuf_t *self)
 {
+#ifdef REFBUF_THREADSAFE
+    /* the caller already holds a reference, so no ordering is needed */
+    atomic_fetch_add_explicit(&(self->_count), 1, memory_order_relaxed);
+#else
     self->_count++;
+#endif
+}
+
+unsigned int refbuf_get_count(refbuf_t *self)
+{
+#ifdef REFBUF_THREADSAFE
+    return atomic_load_explicit(&(self->_count), memory_order_acquire);
+#else
+    return self->_count;
+#endif
 }
 
+/* drop a reference, returns true if it was the last one */
+static inline bool refbuf_put(refbuf_t *self)
+{
+#ifdef REFBUF_THREADSAFE
+    /* make our use of the buffer visible to whoever frees it ... */
+    if (atomic_fetch_sub_explicit(&(self->_count), 1, memory_order_release) != 1)
+        return false;
+    /* ... and let the freeing thread see all of those */
+    atomic_thread_fence(memory_order_acquire);
+    return true;
+#else
+    return --self->_count == 0;
+#endif
+}
+
+static void refbuf_free(refbuf_t *self);
+
+/* Release a chain of associated buffers. The same chain may be shared by
+ * many owners which are released on different threads at the same time, so
+ * the next pointer is read before our reference is dropped and only the
+ * thread dropping the last reference unlinks the buffer.
+ */
 static void refbuf_release_associated (refbuf_t *ref)
 {
-    if (ref == NULL)
-        return;
     while (ref)
     {
         refbuf_t *to_go = ref;
         ref = to_go->next;
-        if ( to_go->_count == 1 )
+        if (refbuf_put(to_go))
+        {
             to_go->next = NULL;
-        refbuf_release (to_go);
+            refbuf_free(to_go);
+        }
     }
 }
 
-void refbuf_release(refbuf_t *self)
+static void refbuf_free(refbuf_t *self)
 {
-    if (self == NULL)
-        return;
-    self->_count--;
-    if (self->_count == 0)
-    {
-        refbuf_release_associated (self->associated);
-        if (self->next)
-            ICECAST_LOG_ERROR("next not null");
+    refbuf_release_associated (self->associated);
+    if (self->next)
+        ICECAST_LOG_ERROR("next not null");
+    if (self->data != REFBUF_INLINE_DATA(self))
         free(self->data);
+    if (self->_pool && refbuf_pool_is_running()) {
+        refbuf_pool_put(self);
+    } else {
+        if (self->_pool)
+            refbuf_stat_add(refbuf_stat_frees, 1);
         free(self);
     }
 }
 
+void refbuf_release(refbuf_t *self)
+{
+    if (self == NULL)
+        return;
+
+    if (refbuf_put(self))
+        refbuf_free(self);
+}
@@ -18,23 +18,56 @@
 #ifndef __REFBUF_H__
 #define __REFBUF_H__
 
+/* With C11 atomics reference counts may be changed from any thread.
+ * Without them all references to a refbuf must be taken and dropped
+ * under the same lock, REFBUF_THREADSAFE tells which one we got.
+ */
+#if defined(HAVE_STDATOMIC_H) && !defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+#define REFBUF_THREADSAFE 1
+typedef atomic_uint refbuf_count_t;
+#else
+typedef unsigned int refbuf_count_t;
+#endif
+
 typedef struct _refbuf_tag
 {
     unsigned int len;
-    unsigned int _count;
+    refbuf_count_t _count;
     char *data;
     struct _refbuf_tag *associated;
     struct _refbuf_tag *next;
     int sync_point;
+    /* size class + 1 if allocated from the pool, 0 otherwise */
+    unsigned int _pool;
 
 } refbuf_t;
 
+typedef struct {
+    unsigned long long hits;        /* served from a free list */
+    unsigned long long misses;      /* pooled size, but no free block */
+    unsigned long long oversize;    /* too large to be pooled */
+    unsigned long long in_use;      /* pooled blocks currently allocated */
+    unsigned long long high_water;  /* maximum of in_use */
+    unsigned long long idle;        /* blocks waiting in the shared free lists */
+} refbuf_pool_stats_t;
+
 void refbuf_initialize(void);
 void refbuf_shutdown(void);
 
 refbuf_t *refbuf_new(unsigned int size);
 void refbuf_addref(refbuf_t *self);
 void refbuf_release(refbuf_t *self);
+/* current number of references, only meaningful if no other thread can
+ * take a new reference at the same time */
+unsigned int refbuf_get_count(refbuf_t *self);
+/* Change the size of self->data, keeping its contents. Must be used instead
+ * of realloc() as the data may be part of the refbuf's own allocation.
+ * Returns 0 on success and -1 on failure, leaving the buffer untouched.
+ */
+int refbuf_resize(refbuf_t *self, unsigned int size);
+
+void refbuf_pool_get_stats(refbuf_pool_stats_t *stats);
 
 #define PER_CLIENT_REFBUF_SIZE  4096
 
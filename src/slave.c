@@ -357,16 +357,13 @@ static client_t *open_relay_connection (relay_t *relay, relay_config_upstream_t
                         httpp_getvar(parser, HTTPP_VAR_ERROR_MESSAGE));
                 break;
             }
-            global_lock();
             if (client_create(&client, con, parser) < 0) {
-                global_unlock();
                 /* make sure only the client_destroy frees these */
                 con = NULL;
                 parser = NULL;
                 client_destroy(client);
                 break;
             }
-            global_unlock();
             sock_set_blocking(streamsock, 0);
             client_set_queue(client, NULL);
             client_complete(client);
@@ -39,6 +39,10 @@
 #define snprintf _snprintf
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
 #include <igloo/uuid.h>
 #include <igloo/sp.h>
 #include <igloo/error.h>
@@ -65,16 +69,41 @@
 #include "slave.h"
 #include "acl.h"
 #include "navigation.h"
+#include "fanout.h"
 
 #undef CATMODULE
 #define CATMODULE "source"
 
 #define MAX_FALLBACK_DEPTH 10
 
+/* don't bother other threads unless each gets at least this many listeners */
+#define SOURCE_SHARD_MIN_LISTENERS  32
+#define SOURCE_SHARD_MAX            64
+
+/* epoll tag for the source socket, listeners are tagged with their id */
+#define SOURCE_IO_SOURCE_TAG        ((uint64_t)-1)
+#define SOURCE_IO_MAX_EVENTS        64
+
+typedef struct source_shard_tag {
+    source_t *source;
+    client_t **clients;
+    size_t clients_len;
+    size_t clients_alloc;
+    int deletion_expected;
+    /* results, merged by the source thread */
+    uint64_t sent_bytes;
+    int short_delay;
+    uint64_t cpu;
+    uint64_t latency_sum;
+    uint64_t latency_count;
+    uint64_t latency_max;
+} source_shard_t;
+
 mutex_t move_clients_mutex;
 
 /* avl tree helper */
 static int _free_client(void *key);
+static void source_free_pending(source_t *source);
 static void _parse_audio_info (source_t *source, const char *s);
 static void source_shutdown (source_t *source);
 
@@ -111,7 +140,9 @@ source_t *source_reserve (const char *mount)
         }
 
         src->client_tree = avl_tree_new(client_compare, NULL);
-        src->pending_tree = avl_tree_new(client_compare, NULL);
+#ifndef SOURCE_PENDING_LOCKFREE
+        thread_spin_create(&src->pending_lock);
+#endif
         src->history = playlist_new(10 /* DOCUMENT: default is max_tracks=10. */);
 
         /* make duplicates for strings or similar */
@@ -120,6 +151,8 @@ source_t *source_reserve (const char *mount)
         src->max_listeners = -1;
         src->allow_direct_access = true;
         thread_mutex_create(&src->lock);
+        thread_mutex_create(&src->intro_lock);
+        src->epoll_fd = -1;
 
         avl_insert(global.source_tree, src);
 
@@ -225,18 +258,29 @@ int source_compare_sources(void *arg, void *a, void *b)
 }
 
 
+/* the headers are rebuilt for the next listener, called with the lock held */
+static void source_drop_listener_headers(source_t *source)
+{
+    refbuf_release(source->listener_headers);
+    source->listener_headers = NULL;
+    source->listener_headers_generation++;
+}
+
 void source_clear_source (source_t *source)
 {
     int c;
 
     ICECAST_LOG_DEBUG("clearing source %#H", source->mount);
 
-    avl_tree_wlock (source->pending_tree);
     client_destroy(source->client);
     source->client = NULL;
     source->parser = NULL;
     source->con = NULL;
 
+    thread_mutex_lock(&source->lock);
+    source_drop_listener_headers(source);
+    thread_mutex_unlock(&source->lock);
+
     if (source->format) {
         if (igloo_sp_unref(&(source->format->contenttype), igloo_instance) != igloo_ERROR_NONE) {
             ICECAST_LOG_ERROR("Cannot unref content type for source %#H", source->mount);
@@ -275,11 +319,7 @@ void source_clear_source (source_t *source)
     }
     avl_tree_unlock (source->client_tree);
 
-    while (avl_get_first (source->pending_tree))
-    {
-        avl_delete (source->pending_tree,
-                avl_get_first(source->pending_tree)->key, _free_client);
-    }
+    source_free_pending(source);
 
     if (source->format && source->format->free_plugin)
         source->format->free_plugin (source->format);
@@ -292,7 +332,7 @@ void source_clear_source (source_t *source)
         source->stream_data = p->next;
         p->next = NULL;
         /* can be referenced by burst handler as well */
-        while (p->_count > 1)
+        while (refbuf_get_count(p) > 1)
             refbuf_release (p);
         refbuf_release (p);
     }
@@ -328,9 +368,20 @@ void source_clear_source (source_t *source)
         fclose (source->intro_file);
         source->intro_file = NULL;
     }
+    fserve_map_release(source->intro_map);
+    source->intro_map = NULL;
+
+#ifdef HAVE_SYS_EPOLL_H
+    if (source->epoll_fd >= 0)
+        close(source->epoll_fd);
+#endif
+    source->epoll_fd = -1;
+    free(source->io_ready);
+    source->io_ready = NULL;
+    source->io_ready_len = 0;
+    source->io_ready_alloc = 0;
 
     source->on_demand_req = 0;
-    avl_tree_unlock (source->pending_tree);
 }
 
 
@@ -342,14 +393,22 @@ void source_free_source (source_t *source)
     avl_delete (global.source_tree, source, NULL);
     avl_tree_unlock (global.source_tree);
 
-    avl_tree_free(source->pending_tree, _free_client);
+    source_free_pending(source);
     avl_tree_free(source->client_tree, _free_client);
+    refbuf_release(source->listener_headers);
 
     /* make sure all YP entries have gone */
     yp_remove (source->mount);
 
     refobject_unref(source->identifier);
     igloo_sp_unref(&source->instance_uuid, igloo_instance);
+    thread_mutex_destroy(&source->intro_lock);
+#ifndef SOURCE_PENDING_LOCKFREE
+    thread_spin_destroy(&source->pending_lock);
+#endif
+    while (source->shards_len)
+        free(source->shards[--source->shards_len].clients);
+    free (source->shards);
     free (source->mount);
     free (source);
 
@@ -377,14 +436,98 @@ client_t *source_find_client(source_t *source, connection_id_t id)
     return NULL;
 }
 
-static inline int source_move_clients__single(source_t *source, source_t *dest, avl_tree *from, avl_tree *to, client_t *client, navigation_direction_t direction) {
+/* Hand a listener over to the source thread. This can be called from any
+ * thread and does not take a lock when atomics are available.
+ */
+void source_add_pending(source_t *source, client_t *client)
+{
+#ifdef SOURCE_PENDING_LOCKFREE
+    client_t *head = atomic_load_explicit(&source->pending, memory_order_relaxed);
+
+    do {
+        client->pending_next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&source->pending, &head, client, memory_order_release, memory_order_relaxed));
+#else
+    thread_spin_lock(&source->pending_lock);
+    client->pending_next = source->pending;
+    source->pending = client;
+    thread_spin_unlock(&source->pending_lock);
+#endif
+}
+
+client_t *source_get_pending(source_t *source)
+{
+#ifdef SOURCE_PENDING_LOCKFREE
+    return atomic_load_explicit(&source->pending, memory_order_acquire);
+#else
+    client_t *head;
+
+    thread_spin_lock(&source->pending_lock);
+    head = source->pending;
+    thread_spin_unlock(&source->pending_lock);
+
+    return head;
+#endif
+}
+
+/* Take all pending listeners at once, oldest first. The caller must hold
+ * the client_tree write lock as readers walk the list under the read lock.
+ */
+static client_t *source_take_pending(source_t *source)
+{
+    client_t *list, *ordered = NULL;
+
+#ifdef SOURCE_PENDING_LOCKFREE
+    /* do not take the cache line for writing when there is nothing to do */
+    if (atomic_load_explicit(&source->pending, memory_order_relaxed) == NULL)
+        return NULL;
+    list = atomic_exchange_explicit(&source->pending, NULL, memory_order_acquire);
+#else
+    thread_spin_lock(&source->pending_lock);
+    list = source->pending;
+    source->pending = NULL;
+    thread_spin_unlock(&source->pending_lock);
+#endif
+
+    while (list) {
+        client_t *next = list->pending_next;
+
+        list->pending_next = ordered;
+        ordered = list;
+        list = next;
+    }
+
+    return ordered;
+}
+
+static void source_free_pending(source_t *source)
+{
+    client_t *client;
+
+    avl_tree_wlock(source->client_tree);
+    client = source_take_pending(source);
+    avl_tree_unlock(source->client_tree);
+
+    while (client) {
+        client_t *next = client->pending_next;
+
+        client->pending_next = NULL;
+        _free_client(client);
+        client = next;
+    }
+}
+
+/* move client to the pending listeners of dest, from is the tree holding
+ * it or NULL if it was taken off the pending list of source */
+static inline int source_move_clients__single(source_t *source, source_t *dest, avl_tree *from, client_t *client, navigation_direction_t direction) {
     if (navigation_history_navigate_to(&(client->history), dest->identifier, direction) != 0) {
         ICECAST_LOG_DWARN("Can not change history: navigation of client=%p{.con->id=%llu, ...} from source=%p{.mount=%#H, ...} to dest=%p{.mount=%#H, ...} with direction %s failed",
                 client, (unsigned long long int)client->con->id, source, source->mount, dest, dest->mount, navigation_direction_to_str(direction));
         return -1;
     }
 
-    avl_delete(from, client, NULL);
+    if (from)
+        avl_delete(from, client, NULL);
 
     /* when switching a client to a different queue, be wary of the
      * refbuf it's referring to, if it's http headers then we need
@@ -397,7 +540,7 @@ static inline int source_move_clients__single(source_t *source, source_t *dest,
             client->intro_offset = -1;
     }
 
-    avl_insert(to, (void *)client);
+    source_add_pending(dest, client);
     return 0;
 }
 
@@ -417,18 +560,13 @@ void source_move_clients(source_t *source, source_t *dest, connection_id_t *id,
     thread_mutex_lock(&move_clients_mutex);
 
     /* if the destination is not running then we can't move clients */
-
-    avl_tree_wlock(dest->pending_tree);
     if (dest->running == 0 && dest->on_demand == 0) {
         ICECAST_LOG_WARN("destination mount %s not running, unable to move clients ", dest->mount);
-        avl_tree_unlock(dest->pending_tree);
         thread_mutex_unlock(&move_clients_mutex);
         return;
     }
 
-    /* we need to move the client and pending trees - we must take the
-     * locks in this order to avoid deadlocks */
-    avl_tree_wlock(source->pending_tree);
+    /* the clients go onto the pending list of dest, that needs no lock */
     avl_tree_wlock(source->client_tree);
 
     do {
@@ -453,20 +591,25 @@ void source_move_clients(source_t *source, source_t *dest, connection_id_t *id,
             fakeclient.con->id = *id;
 
             if (avl_get_by_key(source->client_tree, &fakeclient, &result) == 0) {
-                if (source_move_clients__single(source, dest, source->client_tree, dest->pending_tree, result, direction) == 0)
+                if (source_move_clients__single(source, dest, source->client_tree, result, direction) == 0)
                     count++;
             }
         } else {
+            client_t *pending = source_take_pending(source);
             avl_node *next;
 
-            next = avl_get_first(source->pending_tree);
-            while (next) {
-                avl_node *node = next;
+            while (pending) {
+                client_t *client = pending;
 
-                next = avl_get_next(next);
+                pending = client->pending_next;
+                client->pending_next = NULL;
 
-                if (source_move_clients__single(source, dest, source->pending_tree, dest->pending_tree, node->key, direction) == 0)
+                if (source_move_clients__single(source, dest, NULL, client, direction) == 0) {
                     count++;
+                } else {
+                    /* stays with us */
+                    source_add_pending(source, client);
+                }
             }
 
             next = avl_get_first(source->client_tree);
@@ -475,7 +618,7 @@ void source_move_clients(source_t *source, source_t *dest, connection_id_t *id,
 
                 next = avl_get_next(next);
 
-                if (source_move_clients__single(source, dest, source->client_tree, dest->pending_tree, node->key, direction) == 0)
+                if (source_move_clients__single(source, dest, source->client_tree, node->key, direction) == 0)
                     count++;
             }
         }
@@ -486,18 +629,176 @@ void source_move_clients(source_t *source, source_t *dest, connection_id_t *id,
         stats_event_sub(source->mount, "listeners", count);
     } while (0);
 
-    avl_tree_unlock(source->pending_tree);
     avl_tree_unlock(source->client_tree);
 
     /* see if we need to wake up an on-demand relay */
     if (dest->running == 0 && dest->on_demand && count)
         dest->on_demand_req = 1;
 
-    avl_tree_unlock(dest->pending_tree);
     thread_mutex_unlock(&move_clients_mutex);
 }
 
 
+/* Prepare listener I/O for this source. In epoll mode the source socket
+ * and all listeners that could not be sent everything are watched by one
+ * epoll instance, so the source thread wakes as soon as either has
+ * something to do.
+ */
+static void source_io_setup(source_t *source)
+{
+    ice_config_t *config = config_get_config();
+    listener_io_t io = config->listener_io;
+    config_release_config();
+
+    source->data_time = source->send_stats_time = util_time_monotonic_usec();
+    source->send_cpu = 0;
+    source->send_latency_sum = 0;
+    source->send_latency_count = 0;
+    source->send_latency_max = 0;
+
+    if (io == LISTENER_IO_EPOLL) {
+#ifdef HAVE_SYS_EPOLL_H
+        source->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (source->epoll_fd < 0) {
+            ICECAST_LOG_WARN("Can not create epoll instance for %#H, falling back to poll", source->mount);
+        } else if (source->client) {
+            struct epoll_event ev;
+
+            ev.events = EPOLLIN;
+            ev.data.u64 = SOURCE_IO_SOURCE_TAG;
+            if (epoll_ctl(source->epoll_fd, EPOLL_CTL_ADD, source->con->sock, &ev) != 0) {
+                ICECAST_LOG_WARN("Can not watch source socket of %#H, falling back to poll", source->mount);
+                close(source->epoll_fd);
+                source->epoll_fd = -1;
+            }
+        }
+#else
+        ICECAST_LOG_WARN("epoll is not supported on this system, using poll for %#H", source->mount);
+#endif
+    }
+
+    stats_event(source->mount, "listener_io", source->epoll_fd >= 0 ? "epoll" : "poll");
+}
+
+/* wait for the source or a listener, returns 1 if the source has data,
+ * 0 on timeout or if only listeners are ready and -1 on error.
+ */
+static int source_io_wait(source_t *source, int delay)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event events[SOURCE_IO_MAX_EVENTS];
+    int source_ready = 0;
+    int ret;
+    int i;
+
+    ret = epoll_wait(source->epoll_fd, events, SOURCE_IO_MAX_EVENTS, delay);
+    if (ret < 0)
+        return -1;
+
+    for (i = 0; i < ret; i++) {
+        if (events[i].data.u64 == SOURCE_IO_SOURCE_TAG) {
+            source_ready = 1;
+            continue;
+        }
+
+        if (source->io_ready_len == source->io_ready_alloc) {
+            size_t len = source->io_ready_alloc ? source->io_ready_alloc*2 : SOURCE_IO_MAX_EVENTS;
+            connection_id_t *n = realloc(source->io_ready, sizeof(*n)*len);
+            if (!n) {
+                /* the listener stays flagged and is retried with new data */
+                ICECAST_LOG_ERROR("Can not allocate ready list for %#H", source->mount);
+                continue;
+            }
+            source->io_ready = n;
+            source->io_ready_alloc = len;
+        }
+        source->io_ready[source->io_ready_len++] = (connection_id_t)events[i].data.u64;
+    }
+
+    return source_ready;
+#else
+    (void)source, (void)delay;
+    return -1;
+#endif
+}
+
+/* wait for the listener's socket to become writable, may be called from
+ * fan-out threads.
+ */
+static void source_io_want_write(source_t *source, client_t *client)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event ev;
+
+    ev.events = EPOLLOUT|EPOLLONESHOT;
+    ev.data.u64 = client->con->id;
+
+    /* the socket stays registered after the first time, just re-arm it */
+    if (epoll_ctl(source->epoll_fd, EPOLL_CTL_MOD, client->con->sock, &ev) != 0) {
+        if (errno != ENOENT || epoll_ctl(source->epoll_fd, EPOLL_CTL_ADD, client->con->sock, &ev) != 0) {
+            /* keep the listener in the normal rotation */
+            return;
+        }
+    }
+    client->wait_writable = true;
+#else
+    (void)source, (void)client;
+#endif
+}
+
+/* mark listeners reported by epoll as ready again.
+ * Must be called with the client_tree write lock held.
+ */
+static void source_io_collect(source_t *source)
+{
+    client_t fakeclient;
+    connection_t fakecon;
+    size_t i;
+
+    fakeclient.con = &fakecon;
+
+    for (i = 0; i < source->io_ready_len; i++) {
+        void *result;
+
+        fakeclient.con->id = source->io_ready[i];
+        /* it may have been moved or removed in the meantime */
+        if (avl_get_by_key(source->client_tree, &fakeclient, &result) == 0)
+            ((client_t *)result)->wait_writable = false;
+    }
+    source->io_ready_len = 0;
+}
+
+/* report CPU per listener and delivery latency of the last interval */
+static void source_io_stats(source_t *source)
+{
+    uint64_t now = util_time_monotonic_usec();
+    uint64_t interval = now - source->send_stats_time;
+
+    if (interval == 0)
+        return;
+
+    if (source->listeners) {
+        /* CPU microseconds per listener per second */
+        stats_event_args(source->mount, "listener_cpu_usec", "%"PRIu64,
+                (source->send_cpu * 1000000 / interval) / source->listeners);
+    } else {
+        stats_event(source->mount, "listener_cpu_usec", "0");
+    }
+
+    if (source->send_latency_count) {
+        stats_event_args(source->mount, "listener_latency_avg_usec", "%"PRIu64,
+                source->send_latency_sum / source->send_latency_count);
+        stats_event_args(source->mount, "listener_latency_max_usec", "%"PRIu64, source->send_latency_max);
+    }
+
+    source->send_stats_time = now;
+    source->send_cpu = 0;
+    source->send_latency_sum = 0;
+    source->send_latency_count = 0;
+    source->send_latency_max = 0;
+}
+
+
 /* get some data from the source. The stream data is placed in a refbuf
  * and sent back, however NULL is also valid as in the case of a short
  * timeout and there's no data pending.
@@ -514,7 +815,11 @@ static refbuf_t *get_next_buffer (source_t *source)
         int fds = 0;
         time_t current = time(NULL);
 
-        if (source->client) {
+        if (source->epoll_fd >= 0) {
+            fds = source_io_wait(source, delay);
+            if (!source->client)
+                source->last_read = current;
+        } else if (source->client) {
             fds = util_timed_wait_for_fd(source->con->sock, delay);
         } else {
             thread_sleep(delay*1000);
@@ -526,9 +831,12 @@ static refbuf_t *get_next_buffer (source_t *source)
 
             stats_event_args(source->mount, "total_bytes_read", "%"PRIu64, source->format->read_bytes);
             stats_event_args(source->mount, "total_bytes_sent", "%"PRIu64, source->format->sent_bytes);
+            stats_event_args(source->mount, "queue_size", "%u", source->queue_size);
+            stats_event_args(source->mount, "queue_size_limit", "%u", source->queue_size_limit);
             if (source->dumpfile) {
                 stats_event_args(source->mount, "dumpfile_written", "%"PRIu64, source->dumpfile_written);
             }
+            source_io_stats(source);
 
             if (age > 30) { /* TODO: Should this be configurable? */
                 source_set_flags(source, SOURCE_FLAG_AGED);
@@ -575,24 +883,27 @@ static refbuf_t *get_next_buffer (source_t *source)
 /* general send routine per listener.  The deletion_expected tells us whether
  * the last in the queue is about to disappear, so if this client is still
  * referring to it after writing then drop the client as it's fallen too far
- * behind
+ * behind. This may run on several threads at once, so it only touches the
+ * client and reports its results in the shard passed.
  */
-static void send_to_listener (source_t *source, client_t *client, int deletion_expected)
+static void send_to_listener (source_t *source, client_t *client, source_shard_t *shard)
 {
     int bytes;
     int loop = 10;   /* max number of iterations in one go */
     int total_written = 0;
+    bool capped = false;
 
-    while (1)
-    {
-        /* check for limited listener time */
-        if (client->con->discon_time)
-            if (time(NULL) >= client->con->discon_time)
-            {
-                ICECAST_LOG_INFO("time limit reached for client #%lu", client->con->id);
-                client->con->error = 1;
-            }
+    /* check for limited listener time */
+    if (client->con->discon_time)
+        if (time(NULL) >= client->con->discon_time)
+        {
+            ICECAST_LOG_INFO("time limit reached for client #%lu", client->con->id);
+            client->con->error = 1;
+        }
 
+    /* nothing to write until epoll reports the socket as writable */
+    while (!client->wait_writable)
+    {
         /* jump out if client connection has died */
         if (client->con->error)
             break;
@@ -602,7 +913,7 @@ static void send_to_listener (source_t *source, client_t *client, int deletion_e
         if (total_written > 20000 || loop == 0)
         {
             if (client->check_buffer != format_check_file_buffer)
-                source->short_delay = 1;
+                capped = true;
             break;
         }
 
@@ -617,17 +928,138 @@ static void send_to_listener (source_t *source, client_t *client, int deletion_e
 
         total_written += bytes;
     }
-    source->format->sent_bytes += total_written;
+    shard->sent_bytes += total_written;
 
     /* the refbuf referenced at head (last in queue) may be marked for deletion
      * if so, check to see if this client is still referring to it */
-    if (deletion_expected && client->refbuf && client->refbuf == source->stream_data)
+    if (shard->deletion_expected && client->refbuf && client->refbuf == source->stream_data)
     {
         ICECAST_LOG_INFO("Client %lu (%s) has fallen too far behind, removing",
                 client->con->id, client->con->ip);
         stats_event_inc (source->mount, "slow_listeners");
         client->con->error = 1;
     }
+
+    if (client->con->error || client->wait_writable)
+        return;
+
+    if (client->refbuf && (client->pos < client->refbuf->len || client->refbuf->next)) {
+        /* more to send, either capped or the socket is full */
+        if (source->epoll_fd >= 0) {
+            if (client->check_buffer != format_check_file_buffer)
+                source_io_want_write(source, client);
+        } else if (capped) {
+            shard->short_delay = 1;
+        }
+    } else if (total_written) {
+        /* caught up, the newest block has been delivered */
+        uint64_t latency = util_time_monotonic_usec() - source->data_time;
+
+        shard->latency_sum += latency;
+        shard->latency_count++;
+        if (latency > shard->latency_max)
+            shard->latency_max = latency;
+    }
+}
+
+
+static void source_shard_reset(source_shard_t *shard, source_t *source, int deletion_expected)
+{
+    shard->source = source;
+    shard->deletion_expected = deletion_expected;
+    shard->sent_bytes = 0;
+    shard->short_delay = 0;
+    shard->cpu = 0;
+    shard->latency_sum = 0;
+    shard->latency_count = 0;
+    shard->latency_max = 0;
+}
+
+
+static void source_shard_merge(source_t *source, source_shard_t *shard)
+{
+    source->format->sent_bytes += shard->sent_bytes;
+    if (shard->short_delay)
+        source->short_delay = 1;
+    source->send_cpu += shard->cpu;
+    source->send_latency_sum += shard->latency_sum;
+    source->send_latency_count += shard->latency_count;
+    if (shard->latency_max > source->send_latency_max)
+        source->send_latency_max = shard->latency_max;
+}
+
+
+static void source_shard_send(void *arg)
+{
+    source_shard_t *shard = arg;
+    uint64_t cpu = util_time_thread_cpu_usec();
+    size_t i;
+
+    for (i = 0; i < shard->clients_len; i++)
+        send_to_listener(shard->source, shard->clients[i], shard);
+
+    shard->cpu = util_time_thread_cpu_usec() - cpu;
+}
+
+
+/* split the listeners into shards and send to them in parallel, returns
+ * false if the source is not worth splitting. Listeners stay on the same
+ * shard by connection id as long as the shard count does not change.
+ * Must be called with the client_tree write lock held.
+ */
+static bool source_send_sharded(source_t *source, int deletion_expected)
+{
+    void *args[SOURCE_SHARD_MAX];
+    size_t shards = fanout_get_threads();
+    size_t i;
+    avl_node *node;
+
+    if (shards > SOURCE_SHARD_MAX)
+        shards = SOURCE_SHARD_MAX;
+    if (shards > (source->listeners / SOURCE_SHARD_MIN_LISTENERS))
+        shards = source->listeners / SOURCE_SHARD_MIN_LISTENERS;
+    if (shards < 2)
+        return false;
+
+    if (source->shards_len < shards) {
+        source_shard_t *n = realloc(source->shards, sizeof(*n)*shards);
+        if (!n)
+            return false;
+        memset(n + source->shards_len, 0, sizeof(*n)*(shards - source->shards_len));
+        source->shards = n;
+        source->shards_len = shards;
+    }
+
+    for (i = 0; i < shards; i++) {
+        source_shard_reset(&(source->shards[i]), source, deletion_expected);
+        source->shards[i].clients_len = 0;
+        args[i] = &(source->shards[i]);
+    }
+
+    for (node = avl_get_first(source->client_tree); node; node = avl_get_next(node)) {
+        client_t *client = node->key;
+        source_shard_t *shard = &(source->shards[client->con->id % shards]);
+
+        if (shard->clients_len == shard->clients_alloc) {
+            size_t len = shard->clients_alloc ? shard->clients_alloc*2 : SOURCE_SHARD_MIN_LISTENERS;
+            client_t **n = realloc(shard->clients, sizeof(*n)*len);
+            if (!n) {
+                ICECAST_LOG_ERROR("Can not allocate listener shard for %#H, dropping client %lu", source->mount, client->con->id);
+                client->con->error = 1;
+                continue;
+            }
+            shard->clients = n;
+            shard->clients_alloc = len;
+        }
+        shard->clients[shard->clients_len++] = client;
+    }
+
+    fanout_run(source_shard_send, args, shards);
+
+    for (i = 0; i < shards; i++)
+        source_shard_merge(source, &(source->shards[i]));
+
+    return true;
 }
 
 
@@ -757,6 +1189,8 @@ static void source_init (source_t *source)
     source->last_read = now;
     source->create_time = now;
 
+    source_io_setup(source);
+
     ICECAST_LOG_DEBUG("Source creation complete");
     source->prev_listeners = -1;
     source->running = 1;
@@ -801,6 +1235,7 @@ void source_main (source_t *source)
 {
     refbuf_t *refbuf;
     avl_node *client_node;
+    client_t *pending;
 
     source_init (source);
 
@@ -825,6 +1260,7 @@ void source_main (source_t *source)
                 source->stream_data_tail->next = refbuf;
             source->stream_data_tail = refbuf;
             source->queue_size += refbuf->len;
+            source->data_time = util_time_monotonic_usec();
             /* new buffer is referenced for burst */
             refbuf_addref(refbuf);
 
@@ -854,18 +1290,28 @@ void source_main (source_t *source)
             remove_from_q = 1;
         thread_mutex_unlock(&source->lock);
 
-        /* acquire write lock on pending_tree */
-        avl_tree_wlock(source->pending_tree);
-
         /* acquire write lock on client_tree */
         avl_tree_wlock(source->client_tree);
 
+        if (source->io_ready_len)
+            source_io_collect(source);
+
+        if (!source_send_sharded(source, remove_from_q)) {
+            source_shard_t all;
+
+            source_shard_reset(&all, source, remove_from_q);
+            all.cpu = util_time_thread_cpu_usec();
+            for (client_node = avl_get_first(source->client_tree); client_node; client_node = avl_get_next(client_node))
+                send_to_listener(source, (client_t *) client_node->key, &all);
+            all.cpu = util_time_thread_cpu_usec() - all.cpu;
+            source_shard_merge(source, &all);
+        }
+
+        /* drop clients that failed or fell behind */
         client_node = avl_get_first(source->client_tree);
         while (client_node) {
             client_t *client = (client_t *) client_node->key;
 
-            send_to_listener(source, client, remove_from_q);
-
             if (client->con->error) {
                 client_node = avl_get_next(client_node);
                 if (client->respcode == 200)
@@ -879,10 +1325,13 @@ void source_main (source_t *source)
         }
 
         /** add pending clients **/
-        client_node = avl_get_first(source->pending_tree);
+        pending = source_take_pending(source);
         old_flags = source->flags;
-        while (client_node) {
-            client_t *client = (client_t *)client_node->key;
+        while (pending) {
+            client_t *client = pending;
+
+            pending = client->pending_next;
+            client->pending_next = NULL;
 
             if(source->max_listeners != -1 &&
                     source->listeners >= (unsigned long)source->max_listeners)
@@ -892,8 +1341,7 @@ void source_main (source_t *source)
                  * and doesn't give the listening client any information about
                  * why they were disconnected
                  */
-                client_node = avl_get_next(client_node);
-                avl_delete(source->pending_tree, (void *)client, _free_client);
+                _free_client(client);
 
                 ICECAST_LOG_INFO("Client deleted, exceeding maximum listeners for this "
                         "mountpoint (%s).", source->mount);
@@ -901,7 +1349,8 @@ void source_main (source_t *source)
             }
 
             /* Otherwise, the client is accepted, add it */
-            avl_insert(source->client_tree, client_node->key);
+            client->wait_writable = false;
+            avl_insert(source->client_tree, client);
 
             source->listeners++;
             ICECAST_LOG_DEBUG("Client added for mountpoint (%s)", source->mount);
@@ -912,7 +1361,7 @@ void source_main (source_t *source)
                 http_parser_t *parser = client->parser;
                 const char *protocol = httpp_getvar(parser, HTTPP_VAR_PROTOCOL);
                 const char *version = httpp_getvar(parser, HTTPP_VAR_VERSION);
-                const char *http_host = httpp_getvar(parser, "host");
+                const char *http_host = client_get_header(client, HTTPHEAD_HOST);
 
                 if (protocol && version) {
                     if (strcasecmp(protocol, "HTTP") == 0 && strcmp(version, "1.0") == 0) {
@@ -923,22 +1372,10 @@ void source_main (source_t *source)
                 if (!http_host || !strchr(http_host, ':'))
                     source->flags |= SOURCE_FLAG_NOHOST_LISTENER;
             }
-
-            client_node = avl_get_next(client_node);
         }
         if (old_flags != source->flags)
             event_emit_va("source-flags-changed", EVENT_EXTRA_SOURCE, source, EVENT_EXTRA_LIST_END);
 
-        /** clear pending tree **/
-        while (avl_get_first(source->pending_tree)) {
-            avl_delete(source->pending_tree,
-                    avl_get_first(source->pending_tree)->key,
-                    source_remove_client);
-        }
-
-        /* release write lock on pending_tree */
-        avl_tree_unlock(source->pending_tree);
-
         /* update the stats if need be */
         if (source->listeners != source->prev_listeners)
         {
@@ -967,7 +1404,7 @@ void source_main (source_t *source)
             /* normal unreferenced queue data will have a refcount 1, but
              * burst queue data will be at least 2, active clients will also
              * increase refcount */
-            while (source->stream_data->_count == 1)
+            while (refbuf_get_count(source->stream_data) == 1)
             {
                 refbuf_t *to_go = source->stream_data;
 
@@ -1056,11 +1493,6 @@ static void source_shutdown (source_t *source)
 }
 
 
-int source_remove_client(void *key)
-{
-    return 1;
-}
-
 static int _free_client(void *key)
 {
     client_t *client = (client_t *)key;
@@ -1319,11 +1751,14 @@ static void source_apply_mount (ice_config_t *config, source_t *source, mount_pr
     }
 
 
+    thread_mutex_lock(&source->intro_lock);
     if (source->intro_file)
     {
         fclose (source->intro_file);
         source->intro_file = NULL;
     }
+    fserve_map_release(source->intro_map);
+    source->intro_map = NULL;
     if (mountinfo && mountinfo->intro_filename)
     {
         ice_config_t *config = config_get_config_unlocked ();
@@ -1337,13 +1772,16 @@ static void source_apply_mount (ice_config_t *config, source_t *source, mount_pr
                     mountinfo->intro_filename);
 
             f = fopen (path, "rb");
-            if (f)
+            if (f) {
                 source->intro_file = f;
-            else
+                source->intro_map = fserve_map_get(path, NULL);
+            } else {
                 ICECAST_LOG_WARN("Cannot open intro file \"%s\": %s", path, strerror(errno));
+            }
             free (path);
         }
     }
+    thread_mutex_unlock(&source->intro_lock);
 
     if (mountinfo && mountinfo->queue_size_limit)
         source->queue_size_limit = mountinfo->queue_size_limit;
@@ -1374,6 +1812,7 @@ static void source_apply_mount (ice_config_t *config, source_t *source, mount_pr
 void source_update_settings (ice_config_t *config, source_t *source, mount_proxy *mountinfo)
 {
     thread_mutex_lock(&source->lock);
+    source_drop_listener_headers(source);
     /*  skip if source is a fallback to file */
     if (source->running && source->client == NULL)
     {
@@ -1466,7 +1905,7 @@ void source_client_callback (client_t *client, void *arg)
     client->refbuf->len = 0;
 
     stats_event (source->mount, "source_ip", source->client->con->ip);
-    agent = httpp_getvar (source->client->parser, "user-agent");
+    agent = client_get_header(source->client, HTTPHEAD_USER_AGENT);
     if (agent)
         stats_event (source->mount, "user_agent", agent);
 
@@ -1506,13 +1945,16 @@ static void *source_fallback_file (void *arg)
             free (path);
             break;
         }
-        free (path);
         source = source_reserve (mount);
         if (source == NULL)
         {
             ICECAST_LOG_WARN("mountpoint \"%s\" already reserved", mount);
+            free (path);
             break;
         }
+        /* the fallback file is played in a loop, keep it in memory if we can */
+        source->intro_map = fserve_map_get(path, NULL);
+        free (path);
         ICECAST_LOG_INFO("mountpoint %s is reserved", mount);
         type = fserve_content_type (mount);
         parser = httpp_create_parser();
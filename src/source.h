@@ -41,6 +41,17 @@ typedef uint_least32_t source_flags_t;
 #define SOURCE_FLAGS_CLEARABLE          (SOURCE_FLAG_LEGACY_METADATA|SOURCE_FLAG_HTTP_1_0_LISTENER|SOURCE_FLAG_NOHOST_LISTENER)
 #define SOURCE_FLAGS_GOOD               (SOURCE_FLAG_GOT_DATA|SOURCE_FLAG_AGED)
 
+/* With C11 atomics listeners are handed to the source thread without a
+ * lock, otherwise source->pending_lock protects the list head.
+ */
+#if defined(HAVE_STDATOMIC_H) && !defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+#define SOURCE_PENDING_LOCKFREE 1
+typedef _Atomic(client_t *) source_pending_t;
+#else
+typedef client_t *source_pending_t;
+#endif
+
 struct source_tag {
     mutex_t lock;
     client_t *client;
@@ -64,14 +75,30 @@ struct source_tag {
     source_flags_t flags;
 
     struct _format_plugin_tag *format;
+    /* listener response headers taken from the source headers and the
+     * mount, see format.c. Protected by lock, the generation is bumped
+     * whenever they are dropped.
+     */
+    refbuf_t *listener_headers;
+    unsigned int listener_headers_generation;
 
     avl_tree *client_tree;
-    avl_tree *pending_tree;
+    /* listeners waiting for the source thread, newest first and linked by
+     * client->pending_next. They are only taken off while holding the
+     * client_tree write lock. */
+    source_pending_t pending;
+#ifndef SOURCE_PENDING_LOCKFREE
+    spin_t pending_lock;
+#endif
 
     rwlock_t *shutdown_rwlock;
     util_dict *audio_info;
 
     FILE *intro_file;
+    /* intro_file in the file cache, if it is kept there */
+    fserve_map_t *intro_map;
+    /* serialises reads from intro_file by the listener fan-out threads */
+    mutex_t intro_lock;
 
     /* Dumpfile related data */
     /* Config */
@@ -112,6 +139,25 @@ struct source_tag {
     refbuf_t *stream_data;
     refbuf_t *stream_data_tail;
 
+    /* per shard listener lists used by the fan-out, see fanout.h */
+    struct source_shard_tag *shards;
+    size_t shards_len;
+
+    /* epoll instance for <listener-io>epoll</listener-io>, -1 otherwise */
+    int epoll_fd;
+    /* ids of listeners reported writable since the last send */
+    connection_id_t *io_ready;
+    size_t io_ready_len;
+    size_t io_ready_alloc;
+
+    /* listener send statistics, all times in microseconds */
+    uint64_t data_time;     /* when the newest block was queued */
+    uint64_t send_stats_time;
+    uint64_t send_cpu;
+    uint64_t send_latency_sum;
+    uint64_t send_latency_count;
+    uint64_t send_latency_max;
+
     playlist_t *history;
 };
 
@@ -127,7 +173,12 @@ client_t *source_find_client(source_t *source, connection_id_t id);
 int source_compare_sources(void *arg, void *a, void *b);
 void source_free_source(source_t *source);
 void source_move_clients(source_t *source, source_t *dest, connection_id_t *id, navigation_direction_t direction);
-int source_remove_client(void *key);
+/* hand a listener over to the source thread, callable from any thread */
+void source_add_pending(source_t *source, client_t *client);
+/* Newest pending listener, walk on with client->pending_next. The caller must
+ * hold a lock on client_tree while walking the list.
+ */
+client_t *source_get_pending(source_t *source);
 void source_main(source_t *source);
 void source_recheck_mounts (int update_all);
 
@@ -20,6 +20,11 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <ctype.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
 
 #include <libxml/xmlmemory.h>
 #include <libxml/parser.h>
@@ -40,6 +45,11 @@
 #include "xslt.h"
 #include "util.h"
 #include "auth.h"
+#include "fserve.h"
+#include "listensocket.h"
+#include "tls.h"
+#include "json.h"
+#include "xml2json.h"
 #define CATMODULE "stats"
 #include "logging.h"
 
@@ -57,6 +67,42 @@
 #define STATS_EVENT_REMOVE  5
 #define STATS_EVENT_HIDDEN  6
 
+/* seconds between updates of the buffer pool statistics */
+#define STATS_POOL_INTERVAL 5
+
+/* longest the stats thread waits for events, in milliseconds */
+#define STATS_WAIT_TIME 1000
+
+/* counters changed in place are sent to stats clients at most this often,
+ * in milliseconds, so a burst of changes is sent once */
+#define STATS_PUBLISH_INTERVAL 100
+
+/* number of rendered status pages kept */
+#define STATS_RENDER_CACHE_SIZE 32
+
+/* large enough for any number or time a stat is rendered as */
+#define STATS_VALUE_LEN 256
+
+/* number of rendered events kept for stats clients, a client falling
+ * further behind is dropped */
+#define STATS_EVENT_RING_SIZE 8192
+
+/* stats clients are woken up every so many events during large batches */
+#define STATS_EVENT_RING_WAKE 256
+
+/* number of removed stats remembered for stats_get_xml_delta() */
+#define STATS_REMOVED_RING_SIZE 1024
+
+/* events waiting for a stats client are sent in writes of up to this size */
+#define STATS_CLIENT_BUFFER 16384
+
+/* ms a stats client blocked on a full socket is waited for at a time */
+#define STATS_CLIENT_WAIT   500
+
+/* block size and longest name of metrics rendered by stats_get_metrics() */
+#define STATS_METRICS_BLKSIZE   4096
+#define STATS_METRICS_NAME_LEN  128
+
 typedef struct _event_queue_tag
 {
     volatile stats_event_t *head;
@@ -67,10 +113,18 @@ typedef struct _event_queue_tag
 
 typedef struct _event_listener_tag
 {
-    event_queue_t queue;
-    mutex_t mutex;
-
-    struct _event_listener_tag *next;
+    /* the stats at the time the client connected, rendered for it alone */
+    refbuf_t *snapshot;
+    /* sequence number of the next event of _event_ring to send */
+    uint64_t cursor;
+    /* events taken from the ring but not sent yet: buffer[offset..len),
+     * then held from held_offset on. An event too large for the rest of
+     * the buffer is held by reference. */
+    char buffer[STATS_CLIENT_BUFFER];
+    size_t offset;
+    size_t len;
+    refbuf_t *held;
+    size_t held_offset;
 } event_listener_t;
 
 static volatile int _stats_running = 0;
@@ -78,12 +132,87 @@ static thread_type *_stats_thread_id;
 static volatile int _stats_threads = 0;
 
 static stats_t _stats;
-static mutex_t _stats_mutex;
+/* The trees are changed under the write lock. Counters are changed in
+ * place under the read lock, see _stats_counter_update().
+ */
+static rwlock_t _stats_rwlock;
 
 static event_queue_t _global_event_queue;
-mutex_t _global_event_mutex;
-
-static volatile event_listener_t *_event_listeners;
+/* plain pthread so the stats thread can wait for the queue to fill
+ * under the same mutex it is filled under */
+static pthread_mutex_t _global_event_mutex;
+/* number of events in _global_event_queue */
+static size_t _global_event_count;
+/* signalled when _global_event_queue gets its first event, and on shutdown */
+static pthread_cond_t _global_event_cond;
+
+/* number of queued events that counters changed in place have to wait
+ * for, see _stats_event_orders_counters() */
+static stats_counter_t _stats_counter_events;
+/* set under _global_event_mutex when a counter was changed in place while
+ * stats clients are connected, cleared by the stats thread */
+static stats_counter_t _stats_publish_wanted;
+
+/* for the stats_queue_* stats, only used by the stats thread */
+static size_t _queue_depth_max;
+static uint64_t _queue_latency_sum;
+static uint64_t _queue_latency_max;
+static uint64_t _queue_events;
+
+/* Events rendered for stats clients. Each event is rendered once and
+ * sent by reference to all clients, which follow the ring at their own pace.
+ */
+static refbuf_t *_event_ring[STATS_EVENT_RING_SIZE];
+/* sequence number of the next event, the slot is taken modulo the size */
+static uint64_t _event_ring_next;
+/* also held when _stats_running is cleared */
+static mutex_t _event_ring_mutex;
+/* signalled when events were added */
+static cond_t _event_ring_cond;
+
+/* bumped for every change to the stats, changed nodes keep the new value as seq */
+static stats_counter_t _stats_generation;
+/* number of counters being changed in place whose seq is not set yet */
+static stats_counter_t _stats_counters_changing;
+/* the last generation all changes up to are known to be seen */
+static stats_counter_t _stats_generation_settled;
+/* set on start, sequence numbers are rendered along with it so that those
+ * of an earlier process are recognised */
+static uint64_t _stats_epoch;
+
+/* A stat or a whole source that was removed */
+typedef struct {
+    uint64_t seq;
+    /* NULL for global stats */
+    char *source;
+    /* NULL if the whole source was removed */
+    char *name;
+    int hidden;
+} stats_removed_t;
+
+/* changed under the write lock, the slot is taken modulo the size */
+static stats_removed_t _removed_ring[STATS_REMOVED_RING_SIZE];
+static uint64_t _removed_next;
+/* seq of the last removal dropped from _removed_ring */
+static uint64_t _removed_lost;
+
+/* A rendered status page. Entries are not changed once stored, clients
+ * being sent one hold a reference so it can be replaced meanwhile.
+ */
+typedef struct {
+    char *key;
+    uint64_t generation;
+    /* for replacing the least recently used entry */
+    uint64_t used;
+    size_t refcount;
+    stats_page_t page;
+} stats_render_entry_t;
+
+static stats_render_entry_t *_render_cache[STATS_RENDER_CACHE_SIZE];
+static uint64_t _render_cache_used;
+static uint64_t _render_cache_hits;
+static uint64_t _render_cache_misses;
+static mutex_t _render_cache_mutex;
 
 
 static void *_stats_thread(void *arg);
@@ -97,7 +226,225 @@ static stats_source_t *_find_source(avl_tree *tree, const char *source);
 static void _free_event(stats_event_t *event);
 static stats_event_t *_get_event_from_queue(event_queue_t *queue);
 static void __add_metadata(xmlNodePtr node, const char *tag);
+static void _render_entry_release(stats_render_entry_t *entry);
+static bool _stats_counter_update(const char *source, const char *name, int action, stats_type_t type, uint64_t value);
+
+#ifdef STATS_COUNTER_ATOMIC
+static inline uint64_t _counter_get(stats_counter_t *counter)
+{
+    return atomic_load(counter);
+}
+
+static inline void _counter_set(stats_counter_t *counter, uint64_t value)
+{
+    atomic_store(counter, value);
+}
+
+static inline uint64_t _counter_add(stats_counter_t *counter, uint64_t delta)
+{
+    return atomic_fetch_add(counter, delta) + delta;
+}
+
+static inline void _counter_raise(stats_counter_t *counter, uint64_t value)
+{
+    uint64_t old = atomic_load(counter);
+
+    while (old < value && !atomic_compare_exchange_weak(counter, &old, value));
+}
+#else
+static mutex_t _stats_counter_mutex;
+
+static inline uint64_t _counter_get(stats_counter_t *counter)
+{
+    uint64_t ret;
+
+    thread_mutex_lock(&_stats_counter_mutex);
+    ret = *counter;
+    thread_mutex_unlock(&_stats_counter_mutex);
+
+    return ret;
+}
+
+static inline void _counter_set(stats_counter_t *counter, uint64_t value)
+{
+    thread_mutex_lock(&_stats_counter_mutex);
+    *counter = value;
+    thread_mutex_unlock(&_stats_counter_mutex);
+}
+
+static inline uint64_t _counter_add(stats_counter_t *counter, uint64_t delta)
+{
+    uint64_t ret;
+
+    thread_mutex_lock(&_stats_counter_mutex);
+    ret = *counter += delta;
+    thread_mutex_unlock(&_stats_counter_mutex);
+
+    return ret;
+}
+
+static inline void _counter_raise(stats_counter_t *counter, uint64_t value)
+{
+    thread_mutex_lock(&_stats_counter_mutex);
+    if (*counter < value)
+        *counter = value;
+    thread_mutex_unlock(&_stats_counter_mutex);
+}
+#endif
+
+
+/* NOTE: implicit %z is added to format string. */
+static inline void __format_time(char * buffer, size_t len, const char * format, time_t now) {
+    struct tm local;
+    char tzbuffer[32];
+    char timebuffer[128];
+#ifdef _WIN32
+    struct tm *thetime;
+    int time_days, time_hours, time_tz;
+    int tempnum1, tempnum2;
+    char sign;
+#endif
+
+    localtime_r (&now, &local);
+#ifndef _WIN32
+    strftime (tzbuffer, sizeof(tzbuffer), "%z", &local);
+#else
+    thetime = gmtime (&now);
+    time_days = local.tm_yday - thetime->tm_yday;
+
+    if (time_days < -1) {
+        tempnum1 = 24;
+    } else {
+        tempnum1 = 1;
+    }
+
+    if (tempnum1 < time_days) {
+        tempnum2 = -24;
+    } else {
+        tempnum2 = time_days*24;
+    }
+
+    time_hours = (tempnum2 + local.tm_hour - thetime->tm_hour);
+    time_tz = time_hours * 60 + local.tm_min - thetime->tm_min;
+
+    if (time_tz < 0) {
+        sign = '-';
+        time_tz = -time_tz;
+    } else {
+        sign = '+';
+    }
+
+    snprintf(tzbuffer, sizeof(tzbuffer), "%c%.2d%.2d", sign, time_tz / 60, time_tz % 60);
+#endif
+    strftime(timebuffer, sizeof(timebuffer), format, &local);
+
+    snprintf(buffer, len, "%s%s", timebuffer, tzbuffer);
+}
+
+/* Stats kept as numbers when set to an integer. Others stay text even if
+ * they look like a number, e.g. a stream named "1984".
+ */
+static const char *_stats_numeric[] = {
+    /* global */
+    "client_connections", "clients", "connections", "file_cache_bytes", "file_cache_files",
+    "file_cache_hits", "file_cache_misses", "file_connections", "file_not_modified",
+    "listener_connections", "listeners", "refbuf_pool_high_water", "refbuf_pool_hits",
+    "refbuf_pool_idle", "refbuf_pool_in_use", "refbuf_pool_misses", "refbuf_pool_oversize",
+    "source_client_connections", "source_relay_connections", "source_total_connections",
+    "sources", "stats", "stats_connections", "stats_queue_depth", "stats_queue_latency",
+    "stats_queue_latency_max", "stats_render_cache_hits", "stats_render_cache_misses",
+    "stats_slow_clients", "tls_cpu_usec", "tls_handshake_failures", "tls_handshakes",
+    "tls_handshakes_resumed", "tls_ktls_connections",
+    /* sources */
+    "audio_bitrate", "audio_bits", "audio_channels", "audio_samplerate", "dumpfile_written",
+    "ice-bitrate", "listener_cpu_usec", "listener_latency_avg_usec", "listener_latency_max_usec",
+    "listener_peak", "max_listeners", "public", "queue_size", "queue_size_limit",
+    "slow_listeners", "total_bytes_read", "total_bytes_sent", "video_bitrate", "video_quality",
+    NULL
+};
+
+static inline int __is_in_list(const char *key, const char *list[])
+{
+    size_t i;
+    for (i = 0; list[i]; i++)
+        if (strcmp(key, list[i]) == 0)
+            return 1;
+    return 0;
+}
+
+/* Checks if str is an integer written the way it would be rendered, so
+ * keeping it as a number does not change what the stat looks like.
+ */
+static bool _parse_number(const char *str, stats_type_t *type, uint64_t *number)
+{
+    const char *p = str;
+    bool negative = false;
+    uint64_t value = 0;
+
+    if (*p == '-') {
+        negative = true;
+        p++;
+    }
+
+    /* no leading zeros, no "-0" */
+    if (*p < '0' || *p > '9' || (*p == '0' && (p[1] || negative)))
+        return false;
+
+    for (; *p >= '0' && *p <= '9'; p++) {
+        unsigned int digit = *p - '0';
+
+        if (value > (UINT64_MAX - digit) / 10)
+            return false;
+        value = value * 10 + digit;
+    }
+
+    if (*p)
+        return false;
+
+    if (negative) {
+        if (value > (uint64_t)INT64_MAX + 1)
+            return false;
+        *type = STATS_TYPE_INT;
+        *number = 0 - value;
+    } else {
+        *type = value > INT64_MAX ? STATS_TYPE_UINT : STATS_TYPE_INT;
+        *number = value;
+    }
+
+    return true;
+}
+
+/* Renders the value of node, buffer is used for all but strings.
+ * number is set to the value rendered if not NULL.
+ */
+static const char *_node_value(stats_node_t *node, uint64_t *number, char *buffer, size_t len)
+{
+    uint64_t value;
+
+    if (node->type == STATS_TYPE_STRING)
+        return node->value;
+
+    value = _counter_get(&node->counter);
+    if (number)
+        *number = value;
 
+    switch (node->type) {
+        case STATS_TYPE_INT:
+            snprintf(buffer, len, "%" PRId64, (int64_t)value);
+            break;
+        case STATS_TYPE_UINT:
+            snprintf(buffer, len, "%" PRIu64, value);
+            break;
+        case STATS_TYPE_TIME:
+            __format_time(buffer, len, node->time_format, (time_t)(int64_t)value);
+            break;
+        default:
+            buffer[0] = 0;
+            break;
+    }
+
+    return buffer;
+}
 
 /* simple helper function for creating an event */
 static stats_event_t *build_event (const char *source, const char *name, const char *value)
@@ -119,27 +466,63 @@ static stats_event_t *build_event (const char *source, const char *name, const c
     return event;
 }
 
+/* Counters are changed in place only while no event for a counter or a
+ * whole source is queued. Otherwise a change made in place could overtake
+ * an earlier SET, or the removal of the source, still in the queue.
+ */
+static inline bool _stats_event_orders_counters(const stats_event_t *event)
+{
+    return event->name == NULL || __is_in_list(event->name, _stats_numeric);
+}
+
 static void queue_global_event (stats_event_t *event)
 {
-    thread_mutex_lock(&_global_event_mutex);
+    bool wake;
+
+    event->queued = util_time_monotonic_usec();
+
+    pthread_mutex_lock(&_global_event_mutex);
+    /* counted before the stats thread can see it */
+    if (_stats_event_orders_counters(event))
+        _counter_add(&_stats_counter_events, 1);
+    /* the stats thread takes all events at once, so it is waiting if there are none */
+    wake = _global_event_queue.head == NULL;
     _add_event_to_queue (event, &_global_event_queue);
-    thread_mutex_unlock(&_global_event_mutex);
+    _global_event_count++;
+    pthread_mutex_unlock(&_global_event_mutex);
+
+    if (wake)
+        pthread_cond_signal(&_global_event_cond);
 }
 
 void stats_initialize(void)
 {
-    _event_listeners = NULL;
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    _stats_epoch = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+
+    _event_ring_next = 0;
+    _removed_next = 0;
+    _removed_lost = 0;
+    thread_mutex_create(&_event_ring_mutex);
+    thread_cond_create(&_event_ring_cond);
 
     /* set up global struct */
     _stats.global_tree = avl_tree_new(_compare_stats, NULL);
     _stats.source_tree = avl_tree_new(_compare_source_stats, NULL);
 
-    /* set up global mutex */
-    thread_mutex_create(&_stats_mutex);
+    /* set up global lock */
+    thread_rwlock_create(&_stats_rwlock);
+#ifndef STATS_COUNTER_ATOMIC
+    thread_mutex_create(&_stats_counter_mutex);
+#endif
+    thread_mutex_create(&_render_cache_mutex);
 
     /* set up stats queues */
     event_queue_init(&_global_event_queue);
-    thread_mutex_create(&_global_event_mutex);
+    pthread_mutex_init(&_global_event_mutex, NULL);
+    pthread_cond_init(&_global_event_cond, NULL);
 
     /* fire off the stats thread */
     _stats_running = 1;
@@ -154,28 +537,58 @@ void stats_shutdown(void)
         return;
 
     /* wait for thread to exit */
-    thread_mutex_lock(&_stats_mutex);
+    thread_rwlock_wlock(&_stats_rwlock);
+    thread_mutex_lock(&_event_ring_mutex);
     _stats_running = 0;
-    thread_mutex_unlock(&_stats_mutex);
+    thread_mutex_unlock(&_event_ring_mutex);
+    thread_rwlock_unlock(&_stats_rwlock);
+    /* the stats thread checks _stats_running under this mutex before it waits */
+    pthread_mutex_lock(&_global_event_mutex);
+    pthread_cond_broadcast(&_global_event_cond);
+    pthread_mutex_unlock(&_global_event_mutex);
+    thread_cond_broadcast(&_event_ring_cond);
     thread_join(_stats_thread_id);
 
     /* wait for other threads to shut down */
     do {
         thread_sleep(300000);
-        thread_mutex_lock(&_stats_mutex);
+        thread_rwlock_rlock(&_stats_rwlock);
         n = _stats_threads;
-        thread_mutex_unlock(&_stats_mutex);
+        thread_rwlock_unlock(&_stats_rwlock);
     } while (n > 0);
     ICECAST_LOG_INFO("stats thread finished");
 
     /* free the queues */
 
     /* destroy the queue mutexes */
-    thread_mutex_destroy(&_global_event_mutex);
+    pthread_mutex_destroy(&_global_event_mutex);
+    pthread_cond_destroy(&_global_event_cond);
 
-    thread_mutex_destroy(&_stats_mutex);
+    for (n = 0; n < STATS_EVENT_RING_SIZE; n++) {
+        refbuf_release(_event_ring[n]);
+        _event_ring[n] = NULL;
+    }
+    thread_cond_destroy(&_event_ring_cond);
+    thread_mutex_destroy(&_event_ring_mutex);
+
+    thread_rwlock_destroy(&_stats_rwlock);
+    for (n = 0; n < STATS_RENDER_CACHE_SIZE; n++) {
+        if (_render_cache[n]) {
+            _render_entry_release(_render_cache[n]);
+            _render_cache[n] = NULL;
+        }
+    }
+    thread_mutex_destroy(&_render_cache_mutex);
+    for (n = 0; n < STATS_REMOVED_RING_SIZE; n++) {
+        free(_removed_ring[n].source);
+        free(_removed_ring[n].name);
+    }
+    memset(_removed_ring, 0, sizeof(_removed_ring));
     avl_tree_free(_stats.source_tree, _free_source_stats);
     avl_tree_free(_stats.global_tree, _free_stats);
+#ifndef STATS_COUNTER_ATOMIC
+    thread_mutex_destroy(&_stats_counter_mutex);
+#endif
 
     while (1)
     {
@@ -214,6 +627,13 @@ void stats_event(const char *source, const char *name, const char *value)
         ICECAST_LOG_WARN("seen non-UTF8 data, probably incorrect metadata (%s, %s)", name, value);
         return;
     }
+    if (name && value && __is_in_list(name, _stats_numeric)) {
+        stats_type_t type;
+        uint64_t number;
+
+        if (_parse_number(value, &type, &number) && _stats_counter_update(source, name, STATS_EVENT_SET, type, number))
+            return;
+    }
     event = build_event(source, name, value);
     if (event)
         queue_global_event(event);
@@ -286,26 +706,38 @@ void stats_event_args(const char *source, char *name, char *format, ...)
     stats_event(source, name, buf);
 }
 
+/* note: you must have _stats_rwlock locked here */
+static stats_node_t *_find_node_by_source(const char *source, const char *name)
+{
+    stats_source_t *src;
+
+    if (source == NULL)
+        return _find_node(_stats.global_tree, name);
+
+    src = _find_source(_stats.source_tree, source);
+    if (src)
+        return _find_node(src->stats_tree, name);
+
+    return NULL;
+}
+
 static char *_get_stats(const char *source, const char *name)
 {
-    stats_node_t *stats = NULL;
-    stats_source_t *src = NULL;
+    stats_node_t *stats;
+    char buffer[STATS_VALUE_LEN];
     char *value = NULL;
 
-    thread_mutex_lock(&_stats_mutex);
+    thread_rwlock_rlock(&_stats_rwlock);
 
-    if (source == NULL) {
-        stats = _find_node(_stats.global_tree, name);
-    } else {
-        src = _find_source(_stats.source_tree, source);
-        if (src) {
-            stats = _find_node(src->stats_tree, name);
-        }
-    }
+    stats = _find_node_by_source(source, name);
+    if (stats) {
+        const char *str = _node_value(stats, NULL, buffer, sizeof(buffer));
 
-    if (stats) value = (char *)strdup(stats->value);
+        if (str)
+            value = strdup(str);
+    }
 
-    thread_mutex_unlock(&_stats_mutex);
+    thread_rwlock_unlock(&_stats_rwlock);
 
     return value;
 }
@@ -315,53 +747,104 @@ char *stats_get_value(const char *source, const char *name)
     return(_get_stats(source, name));
 }
 
-/* increase the value in the provided stat by 1 */
-void stats_event_inc(const char *source, const char *name)
+/* Sets or changes a counter in place, without going through the stats
+ * thread. Returns false if there is no such counter yet, it is not a
+ * number of the given type, or an earlier event for a counter is still
+ * queued. The caller queues the change then.
+ */
+/* wakes the stats thread to send counters changed in place to stats clients */
+static void _stats_want_publish(void)
 {
-    stats_event_t *event = build_event (source, name, NULL);
-    /* ICECAST_LOG_DEBUG("%s on %s", name, source==NULL?"global":source); */
-    if (event)
-    {
-        event->action = STATS_EVENT_INC;
-        queue_global_event (event);
+    if (_counter_get(&_stats_publish_wanted))
+        return;
+
+    pthread_mutex_lock(&_global_event_mutex);
+    _counter_set(&_stats_publish_wanted, 1);
+    pthread_cond_signal(&_global_event_cond);
+    pthread_mutex_unlock(&_global_event_mutex);
+}
+
+static bool _stats_counter_update(const char *source, const char *name, int action, stats_type_t type, uint64_t value)
+{
+    stats_node_t *node;
+    bool ret = false;
+    bool publish = false;
+
+    thread_rwlock_rlock(&_stats_rwlock);
+    /* queued events are applied under the write lock, so this stays true
+     * until we unlock */
+    if (_counter_get(&_stats_counter_events)) {
+        thread_rwlock_unlock(&_stats_rwlock);
+        return false;
+    }
+    node = _find_node_by_source(source, name);
+    if (node && node->in_place && (node->type == STATS_TYPE_INT || node->type == STATS_TYPE_UINT) &&
+            (action != STATS_EVENT_SET || node->type == type)) {
+        /* others may change the same node meanwhile, so seq is only raised */
+        _counter_add(&_stats_counters_changing, 1);
+        if (action == STATS_EVENT_SET) {
+            _counter_set(&node->counter, value);
+        } else {
+            _counter_add(&node->counter, value);
+        }
+        _counter_raise(&node->seq, _counter_add(&_stats_generation, 1));
+        _counter_add(&_stats_counters_changing, (uint64_t)-1);
+        ret = true;
+        publish = _stats_threads > 0;
     }
+    thread_rwlock_unlock(&_stats_rwlock);
+
+    if (publish)
+        _stats_want_publish();
+
+    return ret;
 }
 
-void stats_event_add(const char *source, const char *name, unsigned long value)
+static void _stats_event_change(const char *source, const char *name, int action, uint64_t value)
 {
-    stats_event_t *event = build_event (source, name, NULL);
-    /* ICECAST_LOG_DEBUG("%s on %s", name, source==NULL?"global":source); */
+    stats_event_t *event;
+    uint64_t delta = value;
+
+    if (name == NULL)
+        return;
+
+    if (action == STATS_EVENT_DEC || action == STATS_EVENT_SUB)
+        delta = 0 - value;
+
+    if (_stats_counter_update(source, name, action, STATS_TYPE_INT, delta))
+        return;
+
+    /* the stats thread creates the counter, or applies the change after
+     * the events queued before it */
+    event = build_event(source, name, NULL);
     if (event)
     {
-        event->value = malloc (16);
-        snprintf(event->value, 16, "%lu", value);
-        event->action = STATS_EVENT_ADD;
-        queue_global_event (event);
+        event->action = action;
+        event->number = value;
+        queue_global_event(event);
     }
 }
 
+/* increase the value in the provided stat by 1 */
+void stats_event_inc(const char *source, const char *name)
+{
+    _stats_event_change(source, name, STATS_EVENT_INC, 1);
+}
+
+void stats_event_add(const char *source, const char *name, unsigned long value)
+{
+    _stats_event_change(source, name, STATS_EVENT_ADD, value);
+}
+
 void stats_event_sub(const char *source, const char *name, unsigned long value)
 {
-    stats_event_t *event = build_event (source, name, NULL);
-    if (event)
-    {
-        event->value = malloc (16);
-        snprintf(event->value, 16, "%lu", value);
-        event->action = STATS_EVENT_SUB;
-        queue_global_event (event);
-    }
+    _stats_event_change(source, name, STATS_EVENT_SUB, value);
 }
 
 /* decrease the value in the provided stat by 1 */
 void stats_event_dec(const char *source, const char *name)
 {
-    /* ICECAST_LOG_DEBUG("%s on %s", name, source==NULL?"global":source); */
-    stats_event_t *event = build_event (source, name, NULL);
-    if (event)
-    {
-        event->action = STATS_EVENT_DEC;
-        queue_global_event (event);
-    }
+    _stats_event_change(source, name, STATS_EVENT_DEC, 1);
 }
 
 /* note: you must call this function only when you have exclusive access
@@ -417,31 +900,87 @@ static stats_source_t *_find_source(avl_tree *source_tree, const char *source)
     return NULL;
 }
 
-static stats_event_t *_copy_event(stats_event_t *event)
+/* stores the value of a SET event, numbers are kept as such */
+static void _node_set(stats_node_t *node, stats_event_t *event)
+{
+    stats_type_t type = event->type;
+    uint64_t number = event->number;
+
+    if (type == STATS_TYPE_STRING && (!__is_in_list(event->name, _stats_numeric) || !_parse_number(event->value, &type, &number))) {
+        char *str = strdup(event->value);
+
+        if (!str)
+            return;
+        free(node->value);
+        node->value = str;
+        node->type = STATS_TYPE_STRING;
+        return;
+    }
+
+    free(node->value);
+    node->value = NULL;
+    node->type = type;
+    node->time_format = event->time_format;
+    _counter_set(&node->counter, number);
+}
+
+static void _node_change(stats_node_t *node, stats_event_t *event)
+{
+    uint64_t delta = event->number;
+
+    if (event->action == STATS_EVENT_DEC || event->action == STATS_EVENT_SUB)
+        delta = 0 - delta;
+
+    if (node->type == STATS_TYPE_STRING) {
+        /* some text that was set before, count on from the number it starts with */
+        int64_t value = node->value ? strtoll(node->value, NULL, 10) : 0;
+
+        free(node->value);
+        node->value = NULL;
+        _counter_set(&node->counter, (uint64_t)value);
+    }
+    if (node->type != STATS_TYPE_UINT)
+        node->type = STATS_TYPE_INT;
+
+    _counter_add(&node->counter, delta);
+}
+
+/* stats clients get the value as text */
+static void _event_set_value(stats_event_t *event, stats_node_t *node)
 {
-    stats_event_t *copy = (stats_event_t *)calloc(1, sizeof(stats_event_t));
-    if (event->source)
-        copy->source = (char *)strdup(event->source);
-    else
-        copy->source = NULL;
-    if (event->name)
-        copy->name = (char *)strdup(event->name);
-    if (event->value)
-        copy->value = (char *)strdup(event->value);
-    else
-        copy->value = NULL;
-    copy->hidden = event->hidden;
-    copy->next = NULL;
+    char buffer[STATS_VALUE_LEN];
+    const char *value;
+
+    if (node->type == STATS_TYPE_STRING)
+        return;
 
-    return copy;
+    value = _node_value(node, &node->published, buffer, sizeof(buffer));
+    free(event->value);
+    event->value = strdup(value);
 }
 
+static stats_node_t *_new_node(stats_event_t *event)
+{
+    stats_node_t *node = (stats_node_t *)calloc(1, sizeof(stats_node_t));
+
+    if (node == NULL)
+        return NULL;
+
+    node->name = (char *)strdup(event->name);
+    node->in_place = __is_in_list(event->name, _stats_numeric);
+    if (event->action == STATS_EVENT_SET) {
+        _node_set(node, event);
+    } else {
+        _node_change(node, event);
+    }
+    _event_set_value(event, node);
+
+    return node;
+}
 
 /* helper to apply specialised changes to a stats node */
 static void modify_node_event(stats_node_t *node, stats_event_t *event)
 {
-    char *str;
-
     if (event->action == STATS_EVENT_HIDDEN) {
         if (event->value)
             node->hidden = 1;
@@ -450,70 +989,78 @@ static void modify_node_event(stats_node_t *node, stats_event_t *event)
         return;
     }
 
-    if (event->action != STATS_EVENT_SET) {
-        int64_t value = 0;
-
-        switch (event->action)
-        {
-            case STATS_EVENT_INC:
-                value = atoi (node->value)+1;
-                break;
-            case STATS_EVENT_DEC:
-                value = atoi (node->value)-1;
-                break;
-            case STATS_EVENT_ADD:
-                value = atoi (node->value)+atoi (event->value);
-                break;
-            case STATS_EVENT_SUB:
-                value = atoll (node->value) - atoll (event->value);
-                break;
-            default:
-                ICECAST_LOG_WARN("unhandled event (%d) for %s", event->action, event->source);
-                break;
-        }
-        str = malloc(16);
-        snprintf(str, 16, "%" PRId64, value);
-        if (event->value == NULL)
-            event->value = strdup(str);
-    } else {
-        str = (char *)strdup(event->value);
+    switch (event->action)
+    {
+        case STATS_EVENT_SET:
+            _node_set(node, event);
+            break;
+        case STATS_EVENT_INC:
+        case STATS_EVENT_DEC:
+        case STATS_EVENT_ADD:
+        case STATS_EVENT_SUB:
+            _node_change(node, event);
+            break;
+        default:
+            ICECAST_LOG_WARN("unhandled event (%d) for %s", event->action, event->source);
+            return;
     }
-    free(node->value);
-    node->value = str;
+    _event_set_value(event, node);
+
     if (event->source) {
-        ICECAST_LOG_DEBUG("update \"%s\" %s (%s)", event->source, node->name, node->value);
+        ICECAST_LOG_DEBUG("update \"%s\" %s (%s)", event->source, node->name, event->value ? event->value : "");
     } else {
-        ICECAST_LOG_DEBUG("update global %s (%s)", node->name, node->value);
+        ICECAST_LOG_DEBUG("update global %s (%s)", node->name, event->value ? event->value : "");
     }
 }
 
 
-static void process_global_event (stats_event_t *event)
+/* remembers a removal for stats_get_xml_delta(), called with the write lock held */
+static void _record_removal(uint64_t seq, const char *source, const char *name, int hidden)
 {
-    stats_node_t *node;
+    stats_removed_t *removed = &(_removed_ring[_removed_next % STATS_REMOVED_RING_SIZE]);
+
+    if (_removed_next >= STATS_REMOVED_RING_SIZE)
+        _removed_lost = removed->seq;
+    free(removed->source);
+    free(removed->name);
+
+    removed->seq = seq;
+    removed->source = source ? strdup(source) : NULL;
+    removed->name = name ? strdup(name) : NULL;
+    removed->hidden = hidden;
+    _removed_next++;
+}
+
+static void process_global_event (stats_event_t *event)
+{
+    stats_node_t *node;
+    uint64_t seq = _counter_add(&_stats_generation, 1);
 
     /* ICECAST_LOG_DEBUG("global event %s %s %d", event->name, event->value, event->action); */
     if (event->action == STATS_EVENT_REMOVE)
     {
         /* we're deleting */
         node = _find_node(_stats.global_tree, event->name);
-        if (node != NULL)
+        if (node != NULL) {
+            _record_removal(seq, NULL, node->name, node->hidden);
             avl_delete(_stats.global_tree, (void *)node, _free_stats);
+        }
         return;
     }
     node = _find_node(_stats.global_tree, event->name);
     if (node)
     {
         modify_node_event (node, event);
+        _counter_set(&node->seq, seq);
     }
-    else
+    else if (event->action != STATS_EVENT_HIDDEN)
     {
         /* add node */
-        node = (stats_node_t *)calloc(1, sizeof(stats_node_t));
-        node->name = (char *)strdup(event->name);
-        node->value = (char *)strdup(event->value);
-
-        avl_insert(_stats.global_tree, (void *)node);
+        node = _new_node(event);
+        if (node) {
+            _counter_set(&node->seq, seq);
+            avl_insert(_stats.global_tree, (void *)node);
+        }
     }
 }
 
@@ -521,6 +1068,8 @@ static void process_global_event (stats_event_t *event)
 static void process_source_event (stats_event_t *event)
 {
     stats_source_t *snode = _find_source(_stats.source_tree, event->source);
+    uint64_t seq = _counter_add(&_stats_generation, 1);
+
     if (snode == NULL)
     {
         if (event->action == STATS_EVENT_REMOVE)
@@ -545,12 +1094,13 @@ static void process_source_event (stats_event_t *event)
             if (event->action == STATS_EVENT_REMOVE)
                 return;
             /* adding node */
-            if (event->value) {
+            if (event->action != STATS_EVENT_HIDDEN) {
+                node = _new_node(event);
+                if (node == NULL)
+                    return;
                 ICECAST_LOG_DEBUG("new node %H on %#H (% H)", event->name, event->source, event->value);
-                node = (stats_node_t *)calloc(1,sizeof(stats_node_t));
-                node->name = (char *)strdup(event->name);
-                node->value = (char *)strdup(event->value);
                 node->hidden = snode->hidden;
+                _counter_set(&node->seq, seq);
 
                 avl_insert(snode->stats_tree, (void *)node);
             }
@@ -559,10 +1109,12 @@ static void process_source_event (stats_event_t *event)
 
         if (event->action == STATS_EVENT_REMOVE) {
             ICECAST_LOG_DEBUG("delete node %s", event->name);
+            _record_removal(seq, snode->source, node->name, node->hidden);
             avl_delete(snode->stats_tree, (void *)node, _free_stats);
             return;
         }
         modify_node_event(node, event);
+        _counter_set(&node->seq, seq);
         return;
     }
 
@@ -578,6 +1130,7 @@ static void process_source_event (stats_event_t *event)
         while (node) {
             stats_node_t *stats = (stats_node_t*)node->key;
             stats->hidden = snode->hidden;
+            _counter_set(&stats->seq, seq);
             node = avl_get_next(node);
         }
 
@@ -586,79 +1139,43 @@ static void process_source_event (stats_event_t *event)
 
     if (event->action == STATS_EVENT_REMOVE) {
         ICECAST_LOG_DEBUG("delete source node %s", event->source);
+        _record_removal(seq, snode->source, NULL, snode->hidden);
         avl_delete(_stats.source_tree, (void *)snode, _free_source_stats);
     }
 }
 
-/* NOTE: implicit %z is added to format string. */
-static inline void __format_time(char * buffer, size_t len, const char * format) {
-    time_t now = time(NULL);
-    struct tm local;
-    char tzbuffer[32];
-    char timebuffer[128];
-#ifdef _WIN32
-    struct tm *thetime;
-    int time_days, time_hours, time_tz;
-    int tempnum1, tempnum2;
-    char sign;
-#endif
-
-    localtime_r (&now, &local);
-#ifndef _WIN32
-    strftime (tzbuffer, sizeof(tzbuffer), "%z", &local);
-#else
-    thetime = gmtime (&now);
-    time_days = local.tm_yday - thetime->tm_yday;
-
-    if (time_days < -1) {
-        tempnum1 = 24;
-    } else {
-        tempnum1 = 1;
-    }
-
-    if (tempnum1 < time_days) {
-        tempnum2 = -24;
-    } else {
-        tempnum2 = time_days*24;
-    }
-
-    time_hours = (tempnum2 + local.tm_hour - thetime->tm_hour);
-    time_tz = time_hours * 60 + local.tm_min - thetime->tm_min;
+/* times are kept as time_t and formatted when rendered */
+static void _stats_event_time(const char *mount, const char *name, const char *format)
+{
+    stats_event_t *event = build_event(mount, name, NULL);
 
-    if (time_tz < 0) {
-        sign = '-';
-        time_tz = -time_tz;
-    } else {
-        sign = '+';
+    if (event)
+    {
+        event->action = STATS_EVENT_SET;
+        event->type = STATS_TYPE_TIME;
+        event->number = (uint64_t)(int64_t)time(NULL);
+        event->time_format = format;
+        queue_global_event(event);
     }
-
-    snprintf(tzbuffer, sizeof(tzbuffer), "%c%.2d%.2d", sign, time_tz / 60, time_tz % 60);
-#endif
-    strftime(timebuffer, sizeof(timebuffer), format, &local);
-
-    snprintf(buffer, len, "%s%s", timebuffer, tzbuffer);
 }
 
 void stats_event_time (const char *mount, const char *name)
 {
-    char buffer[256];
-
-    __format_time(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S ");
-    stats_event(mount, name, buffer);
+    _stats_event_time(mount, name, "%a, %d %b %Y %H:%M:%S ");
 }
 
 
 void stats_event_time_iso8601 (const char *mount, const char *name)
 {
-    char buffer[256];
-
-    __format_time(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S");
-    stats_event(mount, name, buffer);
+    _stats_event_time(mount, name, "%Y-%m-%dT%H:%M:%S");
 }
 
 
 void stats_global (ice_config_t *config)
 {
+    /* pages show parts of the configuration, such as the auth stacks */
+    _counter_add(&_stats_generation, 1);
+
     stats_event(NULL, "server_id", config->server_id);
     stats_event(NULL, "host", config->hostname);
     stats_event(NULL, "location", config->location);
@@ -667,11 +1184,240 @@ void stats_global (ice_config_t *config)
 }
 
 
+static void _update_pool_stats(void)
+{
+    refbuf_pool_stats_t pool;
+
+    refbuf_pool_get_stats(&pool);
+    stats_event_args(NULL, "refbuf_pool_hits", "%llu", pool.hits);
+    stats_event_args(NULL, "refbuf_pool_misses", "%llu", pool.misses);
+    stats_event_args(NULL, "refbuf_pool_oversize", "%llu", pool.oversize);
+    stats_event_args(NULL, "refbuf_pool_in_use", "%llu", pool.in_use);
+    stats_event_args(NULL, "refbuf_pool_high_water", "%llu", pool.high_water);
+    stats_event_args(NULL, "refbuf_pool_idle", "%llu", pool.idle);
+}
+
+/* updated along with the pool stats, as every update invalidates the
+ * cached pages */
+static void _update_render_cache_stats(void)
+{
+    static uint64_t hits, misses;
+    uint64_t new_hits, new_misses;
+
+    thread_mutex_lock(&_render_cache_mutex);
+    new_hits = _render_cache_hits;
+    new_misses = _render_cache_misses;
+    thread_mutex_unlock(&_render_cache_mutex);
+
+    if (new_hits == hits && new_misses == misses)
+        return;
+
+    hits = new_hits;
+    misses = new_misses;
+    stats_event_args(NULL, "stats_render_cache_hits", "%llu", (unsigned long long int)hits);
+    stats_event_args(NULL, "stats_render_cache_misses", "%llu", (unsigned long long int)misses);
+}
+
+/* renders an event the way it is sent to stats clients */
+static refbuf_t *_render_event(const char *source, const char *name, const char *value)
+{
+    refbuf_t *refbuf;
+    int len;
+
+    if (source == NULL)
+        source = "global";
+    if (name == NULL)
+        name = "null";
+    if (value == NULL)
+        value = "null";
+
+    len = snprintf(NULL, 0, "EVENT %s %s %s\n", source, name, value);
+    if (len < 0)
+        return NULL;
+
+    refbuf = refbuf_new(len + 1);
+    if (refbuf == NULL)
+        return NULL;
+    snprintf(refbuf->data, len + 1, "EVENT %s %s %s\n", source, name, value);
+    refbuf->len = len;
+
+    return refbuf;
+}
+
+static refbuf_t *_render_node(stats_node_t *node, const char *source, uint64_t *number)
+{
+    char buffer[STATS_VALUE_LEN];
+
+    return _render_event(source, node->name, _node_value(node, number, buffer, sizeof(buffer)));
+}
+
+static void _event_ring_add(refbuf_t *refbuf)
+{
+    refbuf_t *old;
+    bool wake;
+
+    if (refbuf == NULL)
+        return;
+
+    thread_mutex_lock(&_event_ring_mutex);
+    old = _event_ring[_event_ring_next % STATS_EVENT_RING_SIZE];
+    _event_ring[_event_ring_next % STATS_EVENT_RING_SIZE] = refbuf;
+    _event_ring_next++;
+    wake = (_event_ring_next % STATS_EVENT_RING_WAKE) == 0;
+    thread_mutex_unlock(&_event_ring_mutex);
+
+    refbuf_release(old);
+
+    /* do not let clients wait for the end of a long batch */
+    if (wake)
+        thread_cond_broadcast(&_event_ring_cond);
+}
+
+/* Returns false if there are no stats clients.
+ * you must have the _stats_rwlock locked here */
+static bool _send_event_to_listeners(stats_event_t *event)
+{
+    if (!_stats_threads)
+        return false;
+
+    _event_ring_add(_render_event(event->source, event->name, event->value));
+    return true;
+}
+
+/* Counters change in place without an event, stats clients are sent the
+ * ones that changed since they were last sent.
+ * you must have the _stats_rwlock locked here, only the stats thread may
+ * call this
+ */
+static void _publish_tree(avl_tree *tree, const char *source)
+{
+    avl_node *avlnode = avl_get_first(tree);
+
+    while (avlnode) {
+        stats_node_t *node = avlnode->key;
+
+        if ((node->type == STATS_TYPE_INT || node->type == STATS_TYPE_UINT) &&
+                _counter_get(&node->counter) != node->published) {
+            _event_ring_add(_render_node(node, source, &node->published));
+        }
+        avlnode = avl_get_next(avlnode);
+    }
+}
+
+static void _publish_counters(void)
+{
+    avl_node *avlnode;
+
+    _publish_tree(_stats.global_tree, NULL);
+
+    avlnode = avl_get_first(_stats.source_tree);
+    while (avlnode) {
+        stats_source_t *source = (stats_source_t *)avlnode->key;
+
+        _publish_tree(source->stats_tree, source->source);
+        avlnode = avl_get_next(avlnode);
+    }
+}
+
+/* updated along with the pool stats, for the events handled since */
+static void _update_queue_stats(void)
+{
+    static uint64_t depth = (uint64_t)-1, latency = (uint64_t)-1, latency_max = (uint64_t)-1;
+    uint64_t new_latency = _queue_events ? _queue_latency_sum / _queue_events : 0;
+
+    if (depth != _queue_depth_max) {
+        depth = _queue_depth_max;
+        stats_event_args(NULL, "stats_queue_depth", "%llu", (unsigned long long int)depth);
+    }
+    if (latency != new_latency || latency_max != _queue_latency_max) {
+        latency = new_latency;
+        latency_max = _queue_latency_max;
+        stats_event_args(NULL, "stats_queue_latency", "%llu", (unsigned long long int)latency);
+        stats_event_args(NULL, "stats_queue_latency_max", "%llu", (unsigned long long int)latency_max);
+    }
+
+    _queue_depth_max = 0;
+    _queue_latency_sum = 0;
+    _queue_latency_max = 0;
+    _queue_events = 0;
+}
+
+/* updated along with the pool stats, only if there was TLS traffic since */
+static void _update_tls_stats(void)
+{
+    static tls_stats_t last;
+    tls_stats_t tls;
+
+    tls_get_stats(&tls);
+    if (memcmp(&tls, &last, sizeof(tls)) == 0)
+        return;
+    last = tls;
+
+    stats_event_args(NULL, "tls_handshakes", "%llu", tls.handshakes);
+    stats_event_args(NULL, "tls_handshakes_resumed", "%llu", tls.handshakes_resumed);
+    stats_event_args(NULL, "tls_handshake_failures", "%llu", tls.handshake_failures);
+    stats_event_args(NULL, "tls_resumption_ratio", "%.3f", tls.handshakes ? (double)tls.handshakes_resumed / tls.handshakes : 0.);
+    stats_event_args(NULL, "tls_ktls_connections", "%llu", tls.ktls);
+    stats_event_args(NULL, "tls_cpu_usec", "%llu", tls.cpu_usec);
+}
+
+/* Applies a batch of events taken from the global queue in one go, so
+ * the stats are locked once per batch rather than once per event.
+ */
+static void _process_events(stats_event_t *events, size_t count)
+{
+    uint64_t now;
+    uint64_t counter_events = 0;
+    bool sent = false;
+
+    if (count > _queue_depth_max)
+        _queue_depth_max = count;
+
+    thread_rwlock_wlock(&_stats_rwlock);
+    now = util_time_monotonic_usec();
+    while (events) {
+        stats_event_t *event = events;
+        uint64_t latency = now > event->queued ? now - event->queued : 0;
+
+        events = event->next;
+        event->next = NULL;
+
+        if (_stats_event_orders_counters(event))
+            counter_events++;
+
+        _queue_latency_sum += latency;
+        if (latency > _queue_latency_max)
+            _queue_latency_max = latency;
+        _queue_events++;
+
+        /* check if we are dealing with a global or source event */
+        if (event->source == NULL)
+            process_global_event(event);
+        else
+            process_source_event(event);
+
+        /* now we have an event that's been processed into the running stats */
+        /* this event should be sent to the stats clients */
+        if (_send_event_to_listeners(event))
+            sent = true;
+
+        /* now we need to destroy the event */
+        _free_event(event);
+    }
+    if (counter_events)
+        _counter_add(&_stats_counter_events, 0 - counter_events);
+    /* nothing is changed in place under the write lock */
+    _counter_raise(&_stats_generation_settled, _counter_get(&_stats_generation));
+    thread_rwlock_unlock(&_stats_rwlock);
+
+    if (sent)
+        thread_cond_broadcast(&_event_ring_cond);
+}
+
 static void *_stats_thread(void *arg)
 {
-    stats_event_t *event;
-    stats_event_t *copy;
-    event_listener_t *listener;
+    time_t pool_stats_time = 0;
+    uint64_t publish_time = 0;
 
     (void)arg;
 
@@ -691,100 +1437,91 @@ static void *_stats_thread(void *arg)
     stats_event(NULL, "source_relay_connections", "0");
     stats_event(NULL, "source_total_connections", "0");
     stats_event(NULL, "stats_connections", "0");
+    stats_event(NULL, "stats_slow_clients", "0");
     stats_event(NULL, "listener_connections", "0");
 
     ICECAST_LOG_INFO("stats thread started");
     while (1) {
-        thread_mutex_lock(&_stats_mutex);
+        stats_event_t *events;
+        size_t count;
+        uint64_t now;
+        uint64_t wait_time;
+        bool wanted;
+
+        thread_rwlock_rlock(&_stats_rwlock);
         if (!_stats_running) {
-            thread_mutex_unlock(&_stats_mutex);
+            thread_rwlock_unlock(&_stats_rwlock);
             break;
         }
-        thread_mutex_unlock(&_stats_mutex);
-
-        thread_mutex_lock(&_global_event_mutex);
-        if (_global_event_queue.head != NULL) {
-            /* grab the next event from the queue */
-            event = _get_event_from_queue (&_global_event_queue);
-            thread_mutex_unlock(&_global_event_mutex);
+        thread_rwlock_unlock(&_stats_rwlock);
+
+        if ((time(NULL) - pool_stats_time) >= STATS_POOL_INTERVAL) {
+            pool_stats_time = time(NULL);
+            _update_pool_stats();
+            _update_render_cache_stats();
+            _update_queue_stats();
+            _update_tls_stats();
+        }
 
-            if (event == NULL)
-                continue;
-            event->next = NULL;
-
-            thread_mutex_lock(&_stats_mutex);
-
-            /* check if we are dealing with a global or source event */
-            if (event->source == NULL)
-                process_global_event(event);
-            else
-                process_source_event(event);
-
-            /* now we have an event that's been processed into the running stats */
-            /* this event should get copied to event listeners' queues */
-            listener = (event_listener_t *)_event_listeners;
-            while (listener) {
-                copy = _copy_event(event);
-                thread_mutex_lock (&listener->mutex);
-                _add_event_to_queue (copy, &listener->queue);
-                thread_mutex_unlock (&listener->mutex);
-
-                listener = listener->next;
+        /* counters changed in place, sent no more often than
+         * STATS_PUBLISH_INTERVAL */
+        now = util_time_monotonic_usec();
+        wait_time = STATS_WAIT_TIME;
+        wanted = _counter_get(&_stats_publish_wanted) != 0;
+        if (wanted && (now - publish_time) < (uint64_t)STATS_PUBLISH_INTERVAL * 1000) {
+            wait_time = (STATS_PUBLISH_INTERVAL * 1000 - (now - publish_time) + 999) / 1000;
+        } else if (wanted) {
+            bool sent = false;
+
+            publish_time = now;
+            /* changes from now on need another round */
+            _counter_set(&_stats_publish_wanted, 0);
+            wanted = false;
+            thread_rwlock_rlock(&_stats_rwlock);
+            if (_stats_threads) {
+                _publish_counters();
+                sent = true;
             }
+            thread_rwlock_unlock(&_stats_rwlock);
 
-            /* now we need to destroy the event */
-            _free_event(event);
-
-            thread_mutex_unlock(&_stats_mutex);
-            continue;
-        }
-        else
-        {
-            thread_mutex_unlock(&_global_event_mutex);
+            if (sent)
+                thread_cond_broadcast(&_event_ring_cond);
         }
 
-        thread_sleep(300000);
-    }
-
-    return NULL;
-}
+        /* take all pending events at once, waiting up to wait_time for
+         * some or for a counter to be changed. Both are checked under the
+         * mutex they are set under, so a wakeup can not get lost in
+         * between. */
+        pthread_mutex_lock(&_global_event_mutex);
+        if (_global_event_queue.head == NULL && _stats_running && (wanted || !_counter_get(&_stats_publish_wanted))) {
+            struct timespec deadline;
+
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += wait_time / 1000;
+            deadline.tv_nsec += (long)(wait_time % 1000) * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
 
-/* you must have the _stats_mutex locked here */
-static void _unregister_listener(event_listener_t *listener)
-{
-    event_listener_t **prev = (event_listener_t **)&_event_listeners,
-                     *current = *prev;
-    while (current)
-    {
-        if (current == listener)
-        {
-            *prev = current->next;
-            break;
+            while (_global_event_queue.head == NULL && _stats_running && (wanted || !_counter_get(&_stats_publish_wanted))) {
+                if (pthread_cond_timedwait(&_global_event_cond, &_global_event_mutex, &deadline) == ETIMEDOUT)
+                    break;
+            }
         }
-        prev = &current->next;
-        current = *prev;
+        events = (stats_event_t *)_global_event_queue.head;
+        count = _global_event_count;
+        event_queue_init(&_global_event_queue);
+        _global_event_count = 0;
+        pthread_mutex_unlock(&_global_event_mutex);
+
+        if (events)
+            _process_events(events, count);
     }
-}
-
-
-static stats_event_t *_make_event_from_node(stats_node_t *node, char *source)
-{
-    stats_event_t *event = (stats_event_t *)malloc(sizeof(stats_event_t));
-
-    if (source != NULL)
-        event->source = (char *)strdup(source);
-    else
-        event->source = NULL;
-    event->name = (char *)strdup(node->name);
-    event->value = (char *)strdup(node->value);
-    event->hidden = node->hidden;
-    event->action = STATS_EVENT_SET;
-    event->next = NULL;
 
-    return event;
+    return NULL;
 }
 
-
 static void _add_event_to_queue(stats_event_t *event, event_queue_t *queue)
 {
     *queue->tail = event;
@@ -807,25 +1544,6 @@ static stats_event_t *_get_event_from_queue (event_queue_t *queue)
     return event;
 }
 
-static int _send_event_to_client(stats_event_t *event, client_t *client)
-{
-    int len;
-    char buf [200];
-
-    /* send data to the client!!!! */
-    len = snprintf (buf, sizeof (buf), "EVENT %s %s %s\n",
-            (event->source != NULL) ? event->source : "global",
-            event->name ? event->name : "null",
-            event->value ? event->value : "null");
-    if (len > 0 && len < (int)sizeof (buf))
-    {
-        client_send_bytes (client, buf, len);
-        if (client->con->error)
-            return -1;
-    }
-    return 0;
-}
-
 void stats_add_authstack(auth_stack_t *stack, xmlNodePtr parent)
 {
     xmlNodePtr authentication;
@@ -841,45 +1559,165 @@ void stats_add_authstack(auth_stack_t *stack, xmlNodePtr parent)
    }
 }
 
-static inline int __is_in_list(const char *key, const char *list[])
-{
-    size_t i;
-    for (i = 0; list[i]; i++)
-        if (strcmp(key, list[i]) == 0)
-            return 1;
-    return 0;
-}
+/* the stats shown in the public view */
+static const char *_public_keys_global[] = {"admin", "location", "host", "server_id", "server_start_iso8601", NULL};
+static const char *_public_keys_source[] = {"listeners", "server_name", "server_description", "stream_start_iso8601", "subtype", "content-type", "listenurl", "genre", "display-title", NULL};
 
 static inline int __include_node(unsigned int flags, const char *key, const char *list[])
 {
     return !(flags & STATS_XML_FLAG_PUBLIC_VIEW) || __is_in_list(key, list);
 }
 
-static xmlNodePtr _dump_stats_to_doc (xmlNodePtr root, unsigned int flags, const char *show_mount, client_t *client) {
-    static const char *public_keys_global[] = {"admin", "location", "host", "server_id", "server_start_iso8601", NULL};
-    static const char *public_keys_source[] = {"listeners", "server_name", "server_description", "stream_start_iso8601", "subtype", "content-type", "listenurl", "genre", "display-title", NULL};
+/* The sequence number up to which all changes can be seen. While counters
+ * are changed in place their seq may not be set yet, then the last number
+ * known to be complete is used. Clients may get some changes twice that way
+ * but do not miss any. Called with the lock held.
+ */
+static uint64_t _stats_sequence(void)
+{
+    uint64_t seq = _counter_get(&_stats_generation);
+
+    /* a change that got its seq before seq was read is counted here */
+    if (_counter_get(&_stats_counters_changing))
+        return _counter_get(&_stats_generation_settled);
+
+    _counter_raise(&_stats_generation_settled, seq);
+    return seq;
+}
+
+static void _sequence_to_string(char *buf, size_t len, uint64_t seq)
+{
+    snprintf(buf, len, "%" PRIu64 "-%" PRIu64, _stats_epoch, seq);
+}
+
+bool stats_parse_sequence(const char *str, uint64_t *since)
+{
+    uint64_t epoch, seq;
+    char *end;
+
+    if (strcmp(str, "0") == 0) {
+        *since = 0;
+        return true;
+    }
+
+    epoch = strtoull(str, &end, 10);
+    if (end == str || *end != '-')
+        return false;
+    str = end + 1;
+    seq = strtoull(str, &end, 10);
+    if (end == str || *end)
+        return false;
+
+    /* one of another process is after all we know, that gives all stats */
+    *since = epoch == _stats_epoch ? seq : UINT64_MAX;
+
+    return true;
+}
+
+/* Adds what is not a stat to the node of a source: the history, metadata,
+ * content type, listeners and authentication. Called with the lock held.
+ */
+static void _add_source_extras(xmlNodePtr xmlnode, const char *mount, unsigned int flags, client_t *client)
+{
+    xmlNodePtr metadata, history;
+    source_t *source_real;
+    mount_proxy *mountproxy;
+    ice_config_t *config;
+    int i;
+
+    avl_tree_rlock(global.source_tree);
+    source_real = source_find_mount_raw(mount);
+    if (source_real) {
+        history = playlist_render_xspf(source_real->history);
+        if (history)
+            xmlAddChild(xmlnode, history);
+
+        metadata = xmlNewTextChild(xmlnode, NULL, XMLSTR("metadata"), NULL);
+        if (source_real->format) {
+            for (i = 0; i < source_real->format->vc.comments; i++)
+                __add_metadata(metadata, source_real->format->vc.user_comments[i]);
+        }
+
+        if (source_real->running)
+            xmlNewTextChild(xmlnode, NULL, XMLSTR("content-type"), XMLSTR(source_real->format->contenttype));
+
+        if (flags & STATS_XML_FLAG_SHOW_LISTENERS) {
+            admin_add_listeners_to_mount(source_real, xmlnode, client->mode);
+            admin_add_geoip_to_mount(source_real, xmlnode, client->mode);
+        }
+    }
+    avl_tree_unlock(global.source_tree);
+
+    if (!(flags & STATS_XML_FLAG_PUBLIC_VIEW)) {
+        config = config_get_config();
+        mountproxy = config_find_mount(config, mount, MOUNT_TYPE_NORMAL);
+        if (mountproxy)
+            stats_add_authstack(mountproxy->authstack, xmlnode);
+        config_release_config();
+    }
+}
+
+/* true if a stat of source changed after seq, hiding a source changes all of its stats */
+static bool _source_changed_after(stats_source_t *source, uint64_t seq)
+{
+    avl_node *avlnode;
+
+    for (avlnode = avl_get_first(source->stats_tree); avlnode; avlnode = avl_get_next(avlnode)) {
+        stats_node_t *stat = avlnode->key;
+
+        if (_counter_get(&stat->seq) > seq)
+            return true;
+    }
+
+    return false;
+}
+
+/* Adds the stats, or with since only those changed after it. */
+static xmlNodePtr _dump_stats_to_doc (xmlNodePtr root, unsigned int flags, const char *show_mount, client_t *client, const uint64_t *since) {
     int hidden = flags & STATS_XML_FLAG_SHOW_HIDDEN ? 1 : 0;
     avl_node *avlnode;
     xmlNodePtr ret = NULL;
     ice_config_t *config;
+    char value[STATS_VALUE_LEN];
+    /* only nodes changed after this are added */
+    uint64_t changed = 0;
+    bool delta = false;
 
     if (flags & STATS_XML_FLAG_PUBLIC_VIEW) {
         /* Ensure those flags are clear when rendering a public view */
         flags &= ~(STATS_XML_FLAG_SHOW_LISTENERS|STATS_XML_FLAG_SHOW_HIDDEN);
-    } else {
+    } else if (!since) {
         config = config_get_config();
         stats_add_authstack(config->authstack, root);
         config_release_config();
     }
 
-    thread_mutex_lock(&_stats_mutex);
+    thread_rwlock_rlock(&_stats_rwlock);
+    if (since) {
+        uint64_t sequence = _stats_sequence();
+
+        /* a since from the future is from another process */
+        if (*since <= sequence && *since >= _removed_lost) {
+            changed = *since;
+            delta = true;
+        }
+
+        _sequence_to_string(value, sizeof(value), sequence);
+        xmlNewTextChild(root, NULL, XMLSTR("sequence"), XMLSTR(value));
+        if (delta) {
+            _sequence_to_string(value, sizeof(value), changed);
+            xmlNewTextChild(root, NULL, XMLSTR("since"), XMLSTR(value));
+        }
+    }
+
     /* general stats first */
     avlnode = avl_get_first(_stats.global_tree);
 
     while (avlnode) {
         stats_node_t *stat = avlnode->key;
-        if (stat->hidden <=  hidden && __include_node(flags, stat->name, public_keys_global))
-            xmlNewTextChild (root, NULL, XMLSTR(stat->name), XMLSTR(stat->value));
+        if (stat->hidden <=  hidden && __include_node(flags, stat->name, _public_keys_global) &&
+                (!delta || _counter_get(&stat->seq) > changed))
+            xmlNewTextChild (root, NULL, XMLSTR(stat->name), XMLSTR(_node_value(stat, NULL, value, sizeof(value))));
         avlnode = avl_get_next (avlnode);
     }
     /* now per mount stats */
@@ -891,92 +1729,110 @@ static xmlNodePtr _dump_stats_to_doc (xmlNodePtr root, unsigned int flags, const
         if (source->hidden <= hidden &&
                 (show_mount == NULL || strcmp (show_mount, source->source) == 0))
         {
-            xmlNodePtr metadata, history;
-            source_t *source_real;
-            mount_proxy *mountproxy;
-            int i;
-
             avl_node *avlnode2 = avl_get_first (source->stats_tree);
-            xmlNodePtr xmlnode = xmlNewTextChild (root, NULL, XMLSTR("source"), NULL);
+            xmlNodePtr xmlnode = NULL;
 
-            xmlSetProp (xmlnode, XMLSTR("mount"), XMLSTR(source->source));
-            if (ret == NULL)
-                ret = xmlnode;
+            /* with since the source is only added if some of its stats changed */
+            if (!since) {
+                xmlnode = xmlNewTextChild (root, NULL, XMLSTR("source"), NULL);
+                xmlSetProp (xmlnode, XMLSTR("mount"), XMLSTR(source->source));
+            }
             while (avlnode2)
             {
                 stats_node_t *stat = avlnode2->key;
-                if (__include_node(flags, stat->name, public_keys_source)) {
+                if (__include_node(flags, stat->name, _public_keys_source) &&
+                        (!delta || _counter_get(&stat->seq) > changed)) {
+                    if (!xmlnode) {
+                        xmlnode = xmlNewTextChild (root, NULL, XMLSTR("source"), NULL);
+                        xmlSetProp (xmlnode, XMLSTR("mount"), XMLSTR(source->source));
+                    }
                     if (client && strcmp(stat->name, "listenurl") == 0) {
                         char buf[512];
                         client_get_baseurl(client, NULL, buf, sizeof(buf), NULL, NULL, NULL, source->source, NULL);
                         xmlNewTextChild (xmlnode, NULL, XMLSTR(stat->name), XMLSTR(buf));
                     } else {
-                        xmlNewTextChild (xmlnode, NULL, XMLSTR(stat->name), XMLSTR(stat->value));
+                        xmlNewTextChild (xmlnode, NULL, XMLSTR(stat->name), XMLSTR(_node_value(stat, NULL, value, sizeof(value))));
                     }
                 }
                 avlnode2 = avl_get_next (avlnode2);
             }
+            if (ret == NULL)
+                ret = xmlnode;
 
-
-            avl_tree_rlock(global.source_tree);
-            source_real = source_find_mount_raw(source->source);
-            if (source_real) {
-                history = playlist_render_xspf(source_real->history);
-                if (history)
-                    xmlAddChild(xmlnode, history);
-
-                metadata = xmlNewTextChild(xmlnode, NULL, XMLSTR("metadata"), NULL);
-                if (source_real->format) {
-                    for (i = 0; i < source_real->format->vc.comments; i++)
-                        __add_metadata(metadata, source_real->format->vc.user_comments[i]);
-                }
-
-                if (source_real->running)
-                    xmlNewTextChild(xmlnode, NULL, XMLSTR("content-type"), XMLSTR(source_real->format->contenttype));
-
-                if (flags & STATS_XML_FLAG_SHOW_LISTENERS) {
-                    admin_add_listeners_to_mount(source_real, xmlnode, client->mode);
-                    admin_add_geoip_to_mount(source_real, xmlnode, client->mode);
-                }
-            }
-            avl_tree_unlock(global.source_tree);
-
-            if (!(flags & STATS_XML_FLAG_PUBLIC_VIEW)) {
-                config = config_get_config();
-                mountproxy = config_find_mount(config, source->source, MOUNT_TYPE_NORMAL);
-                if (mountproxy)
-                    stats_add_authstack(mountproxy->authstack, xmlnode);
-                config_release_config();
+            /* the rest is not covered by the sequence numbers */
+            if (since) {
+                avlnode = avl_get_next (avlnode);
+                continue;
             }
+
+            _add_source_extras(xmlnode, source->source, flags, client);
         }
         avlnode = avl_get_next (avlnode);
     }
-    thread_mutex_unlock(&_stats_mutex);
-    return ret;
-}
 
+    /* and what was removed */
+    if (delta) {
+        uint64_t n = _removed_next > STATS_REMOVED_RING_SIZE ? _removed_next - STATS_REMOVED_RING_SIZE : 0;
 
-/* factoring out code for stats loops
-** this function copies all stats to queue, and registers
-** the queue for all new events atomically.
-** note: mutex must already be created!
-*/
-static void _register_listener (event_listener_t *listener)
-{
-    avl_node *node;
-    avl_node *node2;
-    stats_event_t *event;
-    stats_source_t *source;
+        for (; n < _removed_next; n++) {
+            stats_removed_t *removed = &(_removed_ring[n % STATS_REMOVED_RING_SIZE]);
+            xmlNodePtr xmlnode;
 
-    thread_mutex_lock(&_stats_mutex);
+            if (removed->seq <= changed || removed->hidden > hidden)
+                continue;
+            if (removed->source && show_mount && strcmp(show_mount, removed->source) != 0)
+                continue;
+            if (removed->name && !__include_node(flags, removed->name, removed->source ? _public_keys_source : _public_keys_global))
+                continue;
+
+            xmlnode = xmlNewChild(root, NULL, XMLSTR("removed"), NULL);
+            if (removed->source)
+                xmlSetProp(xmlnode, XMLSTR("mount"), XMLSTR(removed->source));
+            if (removed->name)
+                xmlSetProp(xmlnode, XMLSTR("name"), XMLSTR(removed->name));
+        }
+
+        /* what got hidden after since is gone for this view */
+        for (avlnode = avl_get_first(_stats.global_tree); avlnode; avlnode = avl_get_next(avlnode)) {
+            stats_node_t *stat = avlnode->key;
+
+            if (stat->hidden > hidden && __include_node(flags, stat->name, _public_keys_global) &&
+                    _counter_get(&stat->seq) > changed)
+                xmlSetProp(xmlNewChild(root, NULL, XMLSTR("removed"), NULL), XMLSTR("name"), XMLSTR(stat->name));
+        }
+        for (avlnode = avl_get_first(_stats.source_tree); avlnode; avlnode = avl_get_next(avlnode)) {
+            stats_source_t *source = avlnode->key;
+
+            if (source->hidden > hidden && (show_mount == NULL || strcmp(show_mount, source->source) == 0) &&
+                    _source_changed_after(source, changed))
+                xmlSetProp(xmlNewChild(root, NULL, XMLSTR("removed"), NULL), XMLSTR("mount"), XMLSTR(source->source));
+        }
+    }
+    thread_rwlock_unlock(&_stats_rwlock);
+    return ret;
+}
+
+
+/* Renders all current stats for a new stats client and sets it to the
+ * events following them, both under the same lock so none is missed.
+ */
+static void _register_listener (event_listener_t *listener)
+{
+    avl_node *node;
+    avl_node *node2;
+    stats_source_t *source;
+    refbuf_t **tail = &listener->snapshot;
 
-    /* first we fill our queue with the current stats */
+    listener->snapshot = NULL;
+
+    thread_rwlock_wlock(&_stats_rwlock);
 
     /* start with the global stats */
     node = avl_get_first(_stats.global_tree);
     while (node) {
-        event = _make_event_from_node((stats_node_t *) node->key, NULL);
-        _add_event_to_queue(event, &listener->queue);
+        *tail = _render_node((stats_node_t *) node->key, NULL, NULL);
+        if (*tail)
+            tail = &(*tail)->next;
 
         node = avl_get_next(node);
     }
@@ -987,8 +1843,9 @@ static void _register_listener (event_listener_t *listener)
         source = (stats_source_t *)node->key;
         node2 = avl_get_first(source->stats_tree);
         while (node2) {
-            event = _make_event_from_node((stats_node_t *)node2->key, source->source);
-            _add_event_to_queue (event, &listener->queue);
+            *tail = _render_node((stats_node_t *)node2->key, source->source, NULL);
+            if (*tail)
+                tail = &(*tail)->next;
 
             node2 = avl_get_next(node2);
         }
@@ -996,61 +1853,173 @@ static void _register_listener (event_listener_t *listener)
         node = avl_get_next(node);
     }
 
-    /* now we register to receive future event notices */
-    listener->next = (event_listener_t *)_event_listeners;
-    _event_listeners = listener;
+    /* events are only added to the ring with the stats locked */
+    thread_mutex_lock(&_event_ring_mutex);
+    listener->cursor = _event_ring_next;
+    thread_mutex_unlock(&_event_ring_mutex);
+
+    thread_rwlock_unlock(&_stats_rwlock);
+}
+
+/* Returns the next event to send to the listener with a reference taken,
+ * NULL if there is none yet. lagging is set if the listener has fallen
+ * too far behind.
+ */
+static refbuf_t *_get_event_for_listener(event_listener_t *listener, bool *lagging)
+{
+    refbuf_t *refbuf = NULL;
+
+    if (listener->snapshot) {
+        refbuf = listener->snapshot;
+        listener->snapshot = refbuf->next;
+        refbuf->next = NULL;
+        return refbuf;
+    }
+
+    thread_mutex_lock(&_event_ring_mutex);
+    if ((_event_ring_next - listener->cursor) > STATS_EVENT_RING_SIZE) {
+        *lagging = true;
+    } else if (listener->cursor != _event_ring_next) {
+        refbuf = _event_ring[listener->cursor % STATS_EVENT_RING_SIZE];
+        refbuf_addref(refbuf);
+        listener->cursor++;
+    }
+    thread_mutex_unlock(&_event_ring_mutex);
+
+    return refbuf;
+}
+
+/* Sends what was taken from the ring but not sent yet. Returns false if
+ * the socket is full or the client is gone.
+ */
+static bool _send_pending(event_listener_t *listener, client_t *client)
+{
+    int ret;
+
+    while (listener->offset < listener->len) {
+        ret = client_send_bytes(client, listener->buffer + listener->offset, listener->len - listener->offset);
+        if (ret <= 0)
+            return false;
+        listener->offset += ret;
+    }
+    listener->offset = listener->len = 0;
+
+    while (listener->held) {
+        ret = client_send_bytes(client, listener->held->data + listener->held_offset, listener->held->len - listener->held_offset);
+        if (ret <= 0)
+            return false;
+        listener->held_offset += ret;
+        if (listener->held_offset == listener->held->len) {
+            refbuf_release(listener->held);
+            listener->held = NULL;
+            listener->held_offset = 0;
+        }
+    }
 
-    thread_mutex_unlock(&_stats_mutex);
+    return true;
+}
+
+/* Sends all events waiting for the listener, coalesced into few writes.
+ * Unsent data is kept and the cursor only moves on as far as the buffer
+ * takes, so a client with a full socket is only dropped once the ring
+ * has overtaken it. Returns false if the client is gone or has fallen too
+ * far behind, blocked is set if the socket is full.
+ */
+static bool _send_events_to_client(event_listener_t *listener, client_t *client, bool *lagging, bool *blocked)
+{
+    refbuf_t *refbuf;
+
+    *blocked = false;
+
+    while (1) {
+        if (!_send_pending(listener, client)) {
+            *blocked = true;
+            /* the ring may move on while the socket is full */
+            thread_mutex_lock(&_event_ring_mutex);
+            if ((_event_ring_next - listener->cursor) > STATS_EVENT_RING_SIZE)
+                *lagging = true;
+            thread_mutex_unlock(&_event_ring_mutex);
+            break;
+        }
+        if (*lagging)
+            break;
+
+        while ((refbuf = _get_event_for_listener(listener, lagging)) != NULL) {
+            if (refbuf->len > (sizeof(listener->buffer) - listener->len)) {
+                listener->held = refbuf;
+                listener->held_offset = 0;
+                break;
+            }
+            memcpy(listener->buffer + listener->len, refbuf->data, refbuf->len);
+            listener->len += refbuf->len;
+            refbuf_release(refbuf);
+        }
+
+        if (!listener->len && !listener->held)
+            break;
+    }
+
+    return !*lagging && !client->con->error;
 }
 
 void *stats_connection(void *arg)
 {
     client_t *client = (client_t *)arg;
-    stats_event_t *event;
     event_listener_t listener;
+    bool lagging = false;
+    bool blocked;
+    bool running;
 
     ICECAST_LOG_INFO("stats client starting");
 
-    event_queue_init (&listener.queue);
     /* increment the thread count */
-    thread_mutex_lock(&_stats_mutex);
+    thread_rwlock_wlock(&_stats_rwlock);
     _stats_threads++;
     stats_event_args (NULL, "stats", "%d", _stats_threads);
-    thread_mutex_unlock(&_stats_mutex);
-
-    thread_mutex_create (&(listener.mutex));
+    thread_rwlock_unlock(&_stats_rwlock);
 
+    listener.offset = listener.len = 0;
+    listener.held = NULL;
+    listener.held_offset = 0;
     _register_listener (&listener);
 
     while (1) {
-        thread_mutex_lock(&_stats_mutex);
-        if (!_stats_running) {
-            thread_mutex_unlock(&_stats_mutex);
+        if (!_send_events_to_client(&listener, client, &lagging, &blocked)) {
+            if (lagging) {
+                ICECAST_LOG_INFO("Stats client %lu (%s) has fallen too far behind, removing",
+                        client->con->id, client->con->ip);
+                stats_event_inc(NULL, "stats_slow_clients");
+            }
             break;
         }
-        thread_mutex_unlock(&_stats_mutex);
-
-        thread_mutex_lock (&listener.mutex);
-        event = _get_event_from_queue (&listener.queue);
-        thread_mutex_unlock (&listener.mutex);
-        if (event != NULL) {
-            if (_send_event_to_client(event, client) < 0) {
-                _free_event(event);
-                break;
-            }
-            _free_event(event);
-            continue;
+
+        /* not the stats lock, so clients keep up during long batches */
+        thread_mutex_lock(&_event_ring_mutex);
+        running = _stats_running;
+        thread_mutex_unlock(&_event_ring_mutex);
+        if (!running)
+            break;
+
+        if (blocked) {
+            util_timed_wait_for_fd_write(client->con->sock, STATS_CLIENT_WAIT);
+        } else {
+            thread_cond_timedwait(&_event_ring_cond, STATS_CLIENT_WAIT);
         }
-        thread_sleep (500000);
     }
 
-    thread_mutex_lock(&_stats_mutex);
-    _unregister_listener (&listener);
+    refbuf_release(listener.held);
+    while (listener.snapshot) {
+        refbuf_t *refbuf = listener.snapshot;
+
+        listener.snapshot = refbuf->next;
+        refbuf_release(refbuf);
+    }
+
+    thread_rwlock_wlock(&_stats_rwlock);
     _stats_threads--;
     stats_event_args (NULL, "stats", "%d", _stats_threads);
-    thread_mutex_unlock(&_stats_mutex);
+    thread_rwlock_unlock(&_stats_rwlock);
 
-    thread_mutex_destroy (&listener.mutex);
     client_destroy (client);
     ICECAST_LOG_INFO("stats client finished");
 
@@ -1086,9 +2055,32 @@ void stats_transform_xslt(client_t *client)
     char *xslpath = util_get_path_from_normalised_uri(client->uri);
     const char *mount = httpp_get_param(client->parser, "mount");
 
+    char *key = stats_render_cache_key(client, "xslt", xslpath, NULL, STATS_XML_FLAG_NONE, mount);
+    uint64_t generation;
+
+    if (key && stats_render_cache_send(client, key, &generation)) {
+        free(key);
+        free(xslpath);
+        return;
+    }
+
     doc = stats_get_xml(STATS_XML_FLAG_NONE, mount, client);
 
-    xslt_transform(doc, xslpath, client, 200, NULL, NULL);
+    if (key) {
+        stats_page_t page;
+        icecast_error_id_t error;
+
+        memset(&page, 0, sizeof(page));
+        if (xslt_render(doc, xslpath, NULL, &page.body, &page.len, &page.mediatype, &page.charset, &error)) {
+            stats_page_send(client, &page);
+            stats_render_cache_store(key, generation, &page);
+        } else {
+            client_send_error_by_id(client, error);
+        }
+        free(key);
+    } else {
+        xslt_transform(doc, xslpath, client, 200, NULL, NULL);
+    }
 
     xmlFreeDoc(doc);
     free(xslpath);
@@ -1130,11 +2122,178 @@ xmlDocPtr stats_get_xml(unsigned int flags, const char *show_mount, client_t *cl
     modules = module_container_get_modulelist_as_xml(global.modulecontainer);
     xmlAddChild(node, modules);
 
-    node = _dump_stats_to_doc(node, flags, show_mount, client);
+    node = _dump_stats_to_doc(node, flags, show_mount, client, NULL);
 
     return doc;
 }
 
+xmlDocPtr stats_get_xml_delta(unsigned int flags, const char *show_mount, client_t *client, uint64_t since)
+{
+    xmlDocPtr doc;
+    xmlNodePtr node;
+
+    doc = xmlNewDoc (XMLSTR("1.0"));
+    node = xmlNewDocNode (doc, NULL, XMLSTR("icestats"), NULL);
+    xmlDocSetRootElement(doc, node);
+
+    _dump_stats_to_doc(node, flags, show_mount, client, &since);
+
+    return doc;
+}
+
+/* Renders the stats as JSON without building a document for them, the
+ * same as xml2json_render_doc_simple() renders stats_get_xml(), or with
+ * since stats_get_xml_delta(). Only what is not a stat still goes through
+ * XML, see _add_source_extras().
+ */
+char *stats_get_json(unsigned int flags, const char *show_mount, client_t *client, const uint64_t *since)
+{
+    int hidden = flags & STATS_XML_FLAG_SHOW_HIDDEN ? 1 : 0;
+    json_renderer_t *renderer;
+    xmlNodePtr extras;
+    avl_node *avlnode;
+    ice_config_t *config;
+    char value[STATS_VALUE_LEN];
+    uint64_t changed = 0;
+    bool delta = false;
+    int sources = 0;
+    int removed_begun = 0;
+
+    renderer = json_renderer_create(JSON_RENDERER_FLAGS_NONE);
+    if (!renderer)
+        return NULL;
+
+    /* the modules and authentication come before the stats in the document */
+    extras = xmlNewNode(NULL, XMLSTR("icestats"));
+    if (!since)
+        xmlAddChild(extras, module_container_get_modulelist_as_xml(global.modulecontainer));
+
+    if (flags & STATS_XML_FLAG_PUBLIC_VIEW) {
+        flags &= ~(STATS_XML_FLAG_SHOW_LISTENERS|STATS_XML_FLAG_SHOW_HIDDEN);
+    } else if (!since) {
+        config = config_get_config();
+        stats_add_authstack(config->authstack, extras);
+        config_release_config();
+    }
+
+    xml2json_render_legacystats_begin(renderer);
+
+    thread_rwlock_rlock(&_stats_rwlock);
+    if (since) {
+        uint64_t sequence = _stats_sequence();
+
+        if (*since <= sequence && *since >= _removed_lost) {
+            changed = *since;
+            delta = true;
+        }
+
+        _sequence_to_string(value, sizeof(value), sequence);
+        xml2json_render_legacystats_value(renderer, 1, "sequence", value);
+        if (delta) {
+            _sequence_to_string(value, sizeof(value), changed);
+            xml2json_render_legacystats_value(renderer, 1, "since", value);
+        }
+    }
+
+    avlnode = avl_get_first(_stats.global_tree);
+    while (avlnode) {
+        stats_node_t *stat = avlnode->key;
+        if (stat->hidden <= hidden && __include_node(flags, stat->name, _public_keys_global) &&
+                (!delta || _counter_get(&stat->seq) > changed))
+            xml2json_render_legacystats_value(renderer, 1, stat->name, _node_value(stat, NULL, value, sizeof(value)));
+        avlnode = avl_get_next(avlnode);
+    }
+
+    xml2json_render_legacystats_children(renderer, extras, 1);
+
+    avlnode = avl_get_first(_stats.source_tree);
+    while (avlnode) {
+        stats_source_t *source = (stats_source_t *)avlnode->key;
+
+        if (source->hidden <= hidden &&
+                (show_mount == NULL || strcmp(show_mount, source->source) == 0)) {
+            avl_node *avlnode2 = avl_get_first(source->stats_tree);
+            bool begun = false;
+
+            if (!since) {
+                xml2json_render_legacystats_begin_source(renderer, source->source, &sources);
+                begun = true;
+            }
+            while (avlnode2) {
+                stats_node_t *stat = avlnode2->key;
+                if (__include_node(flags, stat->name, _public_keys_source) &&
+                        (!delta || _counter_get(&stat->seq) > changed)) {
+                    if (!begun) {
+                        xml2json_render_legacystats_begin_source(renderer, source->source, &sources);
+                        begun = true;
+                    }
+                    if (client && strcmp(stat->name, "listenurl") == 0) {
+                        char buf[512];
+                        client_get_baseurl(client, NULL, buf, sizeof(buf), NULL, NULL, NULL, source->source, NULL);
+                        xml2json_render_legacystats_value(renderer, 0, stat->name, buf);
+                    } else {
+                        xml2json_render_legacystats_value(renderer, 0, stat->name, _node_value(stat, NULL, value, sizeof(value)));
+                    }
+                }
+                avlnode2 = avl_get_next(avlnode2);
+            }
+
+            if (!since) {
+                xmlNodePtr xmlnode = xmlNewNode(NULL, XMLSTR("source"));
+
+                _add_source_extras(xmlnode, source->source, flags, client);
+                xml2json_render_legacystats_children(renderer, xmlnode, 0);
+                xmlFreeNode(xmlnode);
+            }
+            if (begun)
+                json_renderer_end(renderer);
+        }
+        avlnode = avl_get_next(avlnode);
+    }
+    if (sources)
+        json_renderer_end(renderer);
+
+    if (delta) {
+        uint64_t n = _removed_next > STATS_REMOVED_RING_SIZE ? _removed_next - STATS_REMOVED_RING_SIZE : 0;
+
+        for (; n < _removed_next; n++) {
+            stats_removed_t *removed = &(_removed_ring[n % STATS_REMOVED_RING_SIZE]);
+
+            if (removed->seq <= changed || removed->hidden > hidden)
+                continue;
+            if (removed->source && show_mount && strcmp(show_mount, removed->source) != 0)
+                continue;
+            if (removed->name && !__include_node(flags, removed->name, removed->source ? _public_keys_source : _public_keys_global))
+                continue;
+
+            xml2json_render_legacystats_removed(renderer, removed->source, removed->name, &removed_begun);
+        }
+
+        /* what got hidden after since is gone for this view */
+        for (avlnode = avl_get_first(_stats.global_tree); avlnode; avlnode = avl_get_next(avlnode)) {
+            stats_node_t *stat = avlnode->key;
+
+            if (stat->hidden > hidden && __include_node(flags, stat->name, _public_keys_global) &&
+                    _counter_get(&stat->seq) > changed)
+                xml2json_render_legacystats_removed(renderer, NULL, stat->name, &removed_begun);
+        }
+        for (avlnode = avl_get_first(_stats.source_tree); avlnode; avlnode = avl_get_next(avlnode)) {
+            stats_source_t *source = avlnode->key;
+
+            if (source->hidden > hidden && (show_mount == NULL || strcmp(show_mount, source->source) == 0) &&
+                    _source_changed_after(source, changed))
+                xml2json_render_legacystats_removed(renderer, source->source, NULL, &removed_begun);
+        }
+        if (removed_begun)
+            json_renderer_end(renderer);
+    }
+    thread_rwlock_unlock(&_stats_rwlock);
+
+    xmlFreeNode(extras);
+
+    return json_renderer_finish(&renderer);
+}
+
 
 static int _compare_stats(void *arg, void *a, void *b)
 {
@@ -1185,6 +2344,149 @@ static void _free_event(stats_event_t *event)
 }
 
 
+void stats_page_send(client_t *client, const stats_page_t *page)
+{
+    client_send_buffer(client, 200, page->mediatype, page->charset, page->body, page->len, page->extra_headers);
+}
+
+void stats_page_clear(stats_page_t *page)
+{
+    free(page->body);
+    free(page->mediatype);
+    free(page->charset);
+    free(page->extra_headers);
+    memset(page, 0, sizeof(*page));
+}
+
+char *stats_render_cache_key(client_t *client, const char *format, const char *xslfilename, const char *extra, unsigned int flags, const char *show_mount)
+{
+    char baseurl[512] = "";
+    long long int mtime = 0;
+    char *key;
+    size_t len;
+
+    /* listener lists are not covered by the stats generation */
+    if (flags & STATS_XML_FLAG_SHOW_LISTENERS)
+        return NULL;
+
+    if (xslfilename) {
+        struct stat st;
+
+        if (stat(xslfilename, &st) != 0)
+            return NULL;
+        mtime = st.st_mtime;
+    }
+
+    /* listenurl is rendered for the host the client connected to */
+    if (client && client_get_baseurl(client, NULL, baseurl, sizeof(baseurl), NULL, NULL, NULL, NULL, NULL) < 0)
+        return NULL;
+
+    len = strlen(format) + (xslfilename ? strlen(xslfilename) : 0) + (extra ? strlen(extra) : 0) +
+          (show_mount ? strlen(show_mount) : 0) + strlen(baseurl) + 64;
+    key = malloc(len);
+    if (!key)
+        return NULL;
+
+    snprintf(key, len, "%s\n%s\n%lld\n%s\n%x\n%c%s\n%s", format, xslfilename ? xslfilename : "", mtime,
+             extra ? extra : "", flags, show_mount ? '+' : '-', show_mount ? show_mount : "", baseurl);
+
+    return key;
+}
+
+static void _render_entry_release(stats_render_entry_t *entry)
+{
+    size_t refcount;
+
+    thread_mutex_lock(&_render_cache_mutex);
+    refcount = --entry->refcount;
+    thread_mutex_unlock(&_render_cache_mutex);
+
+    if (refcount)
+        return;
+
+    free(entry->key);
+    stats_page_clear(&entry->page);
+    free(entry);
+}
+
+bool stats_render_cache_send(client_t *client, const char *key, uint64_t *generation)
+{
+    stats_render_entry_t *entry = NULL;
+    size_t i;
+
+    *generation = _counter_get(&_stats_generation);
+
+    thread_mutex_lock(&_render_cache_mutex);
+    for (i = 0; i < STATS_RENDER_CACHE_SIZE; i++) {
+        stats_render_entry_t *cur = _render_cache[i];
+
+        if (cur && cur->generation == *generation && strcmp(cur->key, key) == 0) {
+            entry = cur;
+            entry->refcount++;
+            entry->used = ++_render_cache_used;
+            break;
+        }
+    }
+    if (entry) {
+        _render_cache_hits++;
+    } else {
+        _render_cache_misses++;
+    }
+    thread_mutex_unlock(&_render_cache_mutex);
+
+    if (!entry)
+        return false;
+
+    stats_page_send(client, &(entry->page));
+    _render_entry_release(entry);
+
+    return true;
+}
+
+void stats_render_cache_store(const char *key, uint64_t generation, stats_page_t *page)
+{
+    stats_render_entry_t *entry = calloc(1, sizeof(*entry));
+    stats_render_entry_t *old;
+    size_t i, slot = 0;
+
+    if (entry)
+        entry->key = strdup(key);
+    if (!entry || !entry->key) {
+        free(entry);
+        stats_page_clear(page);
+        return;
+    }
+
+    entry->generation = generation;
+    entry->refcount = 1;
+    entry->page = *page;
+    memset(page, 0, sizeof(*page));
+
+    thread_mutex_lock(&_render_cache_mutex);
+    entry->used = ++_render_cache_used;
+    /* take the slot of the same page, an empty one, or the least recently used one */
+    for (i = 0; i < STATS_RENDER_CACHE_SIZE; i++) {
+        old = _render_cache[i];
+        if (!old || strcmp(old->key, key) == 0) {
+            slot = i;
+            break;
+        }
+        if (old->used < _render_cache[slot]->used)
+            slot = i;
+    }
+    old = _render_cache[slot];
+    if (old && old->generation > generation && strcmp(old->key, key) == 0) {
+        /* someone rendered it from newer stats meanwhile */
+        old = entry;
+    } else {
+        _render_cache[slot] = entry;
+    }
+    thread_mutex_unlock(&_render_cache_mutex);
+
+    if (old)
+        _render_entry_release(old);
+}
+
 refbuf_t *stats_get_streams (void)
 {
 #define STREAMLIST_BLKSIZE  4096
@@ -1194,7 +2496,7 @@ refbuf_t *stats_get_streams (void)
     char *buffer = cur->data;
 
     /* now the stats for each source */
-    thread_mutex_lock (&_stats_mutex);
+    thread_rwlock_rlock(&_stats_rwlock);
     node = avl_get_first(_stats.source_tree);
     while (node)
     {
@@ -1220,13 +2522,360 @@ refbuf_t *stats_get_streams (void)
         }
         node = avl_get_next(node);
     }
-    thread_mutex_unlock(&_stats_mutex);
+    thread_rwlock_unlock(&_stats_rwlock);
     cur->len = STREAMLIST_BLKSIZE - remaining;
     return start;
 }
 
 
 
+/* OpenMetrics text is written into a chain of refbufs */
+typedef struct {
+    refbuf_t *head;
+    refbuf_t *cur;
+    size_t size;
+} stats_metrics_t;
+
+typedef struct {
+    char name[STATS_METRICS_NAME_LEN];
+    /* NULL for global stats, points into the stats tree otherwise */
+    const char *mount;
+    /* name of the stat, points into the stats tree */
+    const char *stat;
+    /* the name had to be changed to be a valid metric name */
+    bool renamed;
+    stats_type_t type;
+    uint64_t value;
+    bool counter;
+} stats_metric_t;
+
+typedef struct {
+    stats_metric_t *entries;
+    size_t len;
+    size_t size;
+} stats_metric_list_t;
+
+/* stats exported as counters, all other numeric stats are gauges */
+static const char *_metrics_global_counters[] = {
+    "client_connections", "connections", "file_cache_hits", "file_cache_misses",
+    "file_connections", "file_not_modified", "listener_connections",
+    "refbuf_pool_hits", "refbuf_pool_misses", "refbuf_pool_oversize",
+    "source_client_connections", "source_relay_connections", "source_total_connections",
+    "stats_connections", "stats_render_cache_hits", "stats_render_cache_misses",
+    "stats_slow_clients", "tls_cpu_usec", "tls_handshake_failures", "tls_handshakes",
+    "tls_handshakes_resumed", "tls_ktls_connections", NULL
+};
+static const char *_metrics_source_counters[] = {
+    "connections", "dumpfile_written", "slow_listeners", "total_bytes_read", "total_bytes_sent", NULL
+};
+
+static void _metrics_printf(stats_metrics_t *metrics, const char *format, ...)
+{
+    va_list ap;
+    size_t remaining = metrics->size - metrics->cur->len;
+    int ret;
+
+    va_start(ap, format);
+    ret = vsnprintf(metrics->cur->data + metrics->cur->len, remaining, format, ap);
+    va_end(ap);
+    if (ret < 0)
+        return;
+
+    if ((size_t)ret >= remaining) {
+        size_t size = (size_t)ret >= STATS_METRICS_BLKSIZE ? (size_t)ret + 1 : STATS_METRICS_BLKSIZE;
+        refbuf_t *next = refbuf_new(size);
+
+        next->len = 0;
+        metrics->cur->next = next;
+        metrics->cur = next;
+        metrics->size = size;
+
+        va_start(ap, format);
+        ret = vsnprintf(next->data, size, format, ap);
+        va_end(ap);
+        if (ret < 0)
+            return;
+    }
+
+    metrics->cur->len += ret;
+}
+
+/* returns value quoted as label value, to be free()d if not value itself */
+static const char *_metrics_escape(const char *value)
+{
+    const char *p;
+    char *ret, *q;
+    size_t len = 1;
+
+    if (!strpbrk(value, "\\\"\n"))
+        return value;
+
+    for (p = value; *p; p++)
+        len += (*p == '\\' || *p == '"' || *p == '\n') ? 2 : 1;
+
+    ret = malloc(len);
+    if (!ret)
+        return "";
+
+    for (p = value, q = ret; *p; p++) {
+        if (*p == '\\' || *p == '"') {
+            *q++ = '\\';
+            *q++ = *p;
+        } else if (*p == '\n') {
+            *q++ = '\\';
+            *q++ = 'n';
+        } else {
+            *q++ = *p;
+        }
+    }
+    *q = 0;
+
+    return ret;
+}
+
+static inline void _metrics_escape_free(const char *escaped, const char *value)
+{
+    if (escaped != value && *escaped)
+        free((char *)escaped);
+}
+
+/* Adds the numeric stats of tree. Times are exported in seconds, those kept
+ * in two formats only once.
+ */
+static void _metrics_collect(stats_metric_list_t *list, avl_tree *tree, const char *mount, const char *counters[])
+{
+    avl_node *avlnode;
+
+    for (avlnode = avl_get_first(tree); avlnode; avlnode = avl_get_next(avlnode)) {
+        stats_node_t *node = avlnode->key;
+        size_t len = strlen(node->name);
+        const char *suffix = "";
+        stats_metric_t *metric;
+        char *p;
+
+        if (node->type == STATS_TYPE_STRING)
+            continue;
+
+        if (node->type == STATS_TYPE_TIME) {
+            if (len > 8 && strcmp(node->name + len - 8, "_iso8601") == 0) {
+                len -= 8;
+            } else {
+                char name[STATS_METRICS_NAME_LEN];
+
+                snprintf(name, sizeof(name), "%s_iso8601", node->name);
+                if (_find_node(tree, name))
+                    continue;
+            }
+            suffix = "_seconds";
+        }
+
+        if (list->len == list->size) {
+            size_t size = list->size ? list->size * 2 : 64;
+            stats_metric_t *entries = realloc(list->entries, size * sizeof(*entries));
+
+            if (!entries)
+                return;
+            list->entries = entries;
+            list->size = size;
+        }
+
+        metric = &list->entries[list->len++];
+        snprintf(metric->name, sizeof(metric->name), "icecast_%s%.*s%s", mount ? "mount_" : "", (int)len, node->name, suffix);
+        metric->renamed = *suffix != 0;
+        for (p = metric->name; *p; p++) {
+            if (!isalnum((unsigned char)*p) && *p != '_' && *p != ':') {
+                *p = '_';
+                metric->renamed = true;
+            }
+        }
+        metric->mount = mount;
+        metric->stat = node->name;
+        metric->type = node->type;
+        metric->value = _counter_get(&node->counter);
+        metric->counter = __is_in_list(node->name, counters);
+    }
+}
+
+/* Samples of a metric have to follow each other. Different stats can end
+ * up with the same metric name, e.g. "foo-bar" and "foo_bar". Those of
+ * the stat that did not need renaming, or else the first by name, come
+ * first and are the ones exported.
+ */
+static int _metrics_compare(const void *a, const void *b)
+{
+    const stats_metric_t *ma = a, *mb = b;
+    int ret = strcmp(ma->name, mb->name);
+
+    if (ret)
+        return ret;
+    if (ma->renamed != mb->renamed)
+        return ma->renamed ? 1 : -1;
+    ret = strcmp(ma->stat, mb->stat);
+    if (ret)
+        return ret;
+    if (!ma->mount || !mb->mount)
+        return ma->mount ? 1 : (mb->mount ? -1 : 0);
+    return strcmp(ma->mount, mb->mount);
+}
+
+static void _metrics_add_stats(stats_metrics_t *metrics)
+{
+    stats_metric_list_t list = {NULL, 0, 0};
+    stats_metric_t *family = NULL;
+    avl_node *avlnode;
+    size_t i;
+
+    thread_rwlock_rlock(&_stats_rwlock);
+    _metrics_collect(&list, _stats.global_tree, NULL, _metrics_global_counters);
+    for (avlnode = avl_get_first(_stats.source_tree); avlnode; avlnode = avl_get_next(avlnode)) {
+        stats_source_t *source = avlnode->key;
+
+        _metrics_collect(&list, source->stats_tree, source->source, _metrics_source_counters);
+    }
+
+    if (list.len)
+        qsort(list.entries, list.len, sizeof(*list.entries), _metrics_compare);
+
+    for (i = 0; i < list.len; i++) {
+        stats_metric_t *metric = &list.entries[i];
+        char value[32];
+
+        if (i == 0 || strcmp(metric->name, list.entries[i - 1].name) != 0) {
+            family = metric;
+            _metrics_printf(metrics, "# TYPE %s %s\n", metric->name, metric->counter ? "counter" : "gauge");
+        } else if (strcmp(metric->stat, family->stat) != 0) {
+            ICECAST_LOG_DEBUG("Not exporting stat %H as metric %s, that is used for stat %H", metric->stat, metric->name, family->stat);
+            continue;
+        }
+
+        if (metric->type == STATS_TYPE_UINT) {
+            snprintf(value, sizeof(value), "%" PRIu64, metric->value);
+        } else {
+            snprintf(value, sizeof(value), "%" PRId64, (int64_t)metric->value);
+        }
+
+        if (metric->mount) {
+            const char *mount = _metrics_escape(metric->mount);
+
+            _metrics_printf(metrics, "%s%s{mount=\"%s\"} %s\n", metric->name, metric->counter ? "_total" : "", mount, value);
+            _metrics_escape_free(mount, metric->mount);
+        } else {
+            _metrics_printf(metrics, "%s%s %s\n", metric->name, metric->counter ? "_total" : "", value);
+        }
+    }
+    thread_rwlock_unlock(&_stats_rwlock);
+
+    free(list.entries);
+}
+
+static void _metrics_add_listensockets(stats_metrics_t *metrics)
+{
+    listensocket_t **sockets;
+    size_t i;
+
+    global_lock();
+    sockets = listensocket_container_list_sockets(global.listensockets);
+    global_unlock();
+
+    if (!sockets)
+        return;
+
+    if (sockets[0])
+        _metrics_printf(metrics, "# TYPE icecast_listensocket_accepted counter\n");
+
+    for (i = 0; sockets[i]; i++) {
+        const listener_t *listener = listensocket_get_listener(sockets[i]);
+
+        if (listener) {
+            const char *id = _metrics_escape(listener->id ? listener->id : "");
+            const char *address = _metrics_escape(listener->bind_address ? listener->bind_address : "");
+
+            _metrics_printf(metrics, "icecast_listensocket_accepted_total{id=\"%s\",address=\"%s\",port=\"%d\",family=\"%s\"} %" PRIu64 "\n",
+                            id, address, listener->port, sock_family_to_string(listensocket_get_family(sockets[i])),
+                            listensocket_get_accepted(sockets[i]));
+
+            _metrics_escape_free(id, listener->id);
+            _metrics_escape_free(address, listener->bind_address);
+            listensocket_release_listener(sockets[i]);
+        }
+        refobject_unref(sockets[i]);
+    }
+
+    free(sockets);
+}
+
+static void _metrics_add_histogram(stats_metrics_t *metrics, const char *family, const char *queue, const uint64_t *counts, const uint64_t *bounds, double scale, uint64_t sum)
+{
+    uint64_t count = 0;
+    size_t i;
+
+    for (i = 0; i < CONNECTION_QUEUE_BUCKETS; i++) {
+        count += counts[i];
+        if (i < (CONNECTION_QUEUE_BUCKETS - 1)) {
+            _metrics_printf(metrics, "%s_bucket{queue=\"%s\",le=\"%g\"} %" PRIu64 "\n", family, queue, bounds[i] * scale, count);
+        } else {
+            _metrics_printf(metrics, "%s_bucket{queue=\"%s\",le=\"+Inf\"} %" PRIu64 "\n", family, queue, count);
+        }
+    }
+    _metrics_printf(metrics, "%s_sum{queue=\"%s\"} %g\n", family, queue, sum * scale);
+    _metrics_printf(metrics, "%s_count{queue=\"%s\"} %" PRIu64 "\n", family, queue, count);
+}
+
+/* depth whenever a client was added, and the time spent per visit of a client */
+static void _metrics_add_queue_histograms(stats_metrics_t *metrics)
+{
+    connection_queue_stats_t queue;
+    size_t i;
+
+    _metrics_printf(metrics, "# TYPE icecast_client_queue_threads gauge\n");
+    for (i = 0; connection_get_queue_stats(i, &queue); i++)
+        _metrics_printf(metrics, "icecast_client_queue_threads{queue=\"%s\"} %zu\n", queue.name, queue.threads);
+
+    _metrics_printf(metrics, "# TYPE icecast_client_queue_depth_observed histogram\n");
+    for (i = 0; connection_get_queue_stats(i, &queue); i++)
+        _metrics_add_histogram(metrics, "icecast_client_queue_depth_observed", queue.name, queue.depth, connection_queue_depth_bounds, 1., queue.depth_sum);
+
+    _metrics_printf(metrics, "# TYPE icecast_client_queue_service_seconds histogram\n");
+    for (i = 0; connection_get_queue_stats(i, &queue); i++)
+        _metrics_add_histogram(metrics, "icecast_client_queue_service_seconds", queue.name, queue.service, connection_queue_service_bounds, 1e-6, queue.service_sum);
+}
+
+static void _metrics_add_queues(stats_metrics_t *metrics)
+{
+    unsigned int clients[FSERVE_MAX_WORKERS];
+    unsigned int count;
+    const char *name;
+    size_t depth;
+    size_t i;
+
+    _metrics_printf(metrics, "# TYPE icecast_client_queue_depth gauge\n");
+    for (i = 0; connection_get_queue_depth(i, &name, &depth); i++)
+        _metrics_printf(metrics, "icecast_client_queue_depth{queue=\"%s\"} %zu\n", name, depth);
+
+    _metrics_add_queue_histograms(metrics);
+
+    count = fserve_get_worker_clients(clients, FSERVE_MAX_WORKERS);
+    _metrics_printf(metrics, "# TYPE icecast_fserve_worker_clients gauge\n");
+    for (i = 0; i < count; i++)
+        _metrics_printf(metrics, "icecast_fserve_worker_clients{worker=\"%zu\"} %u\n", i, clients[i]);
+}
+
+refbuf_t *stats_get_metrics(void)
+{
+    stats_metrics_t metrics;
+
+    metrics.head = metrics.cur = refbuf_new(STATS_METRICS_BLKSIZE);
+    metrics.head->len = 0;
+    metrics.size = STATS_METRICS_BLKSIZE;
+
+    _metrics_add_stats(&metrics);
+    _metrics_add_listensockets(&metrics);
+    _metrics_add_queues(&metrics);
+    _metrics_printf(&metrics, "# EOF\n");
+
+    return metrics.head;
+}
+
 /* This removes any source stats from virtual mountpoints, ie mountpoints
  * where no source_t exists. This function requires the global sources lock
  * to be held before calling.
@@ -1235,7 +2884,7 @@ void stats_clear_virtual_mounts (void)
 {
     avl_node *snode;
 
-    thread_mutex_lock (&_stats_mutex);
+    thread_rwlock_wlock(&_stats_rwlock);
     snode = avl_get_first(_stats.source_tree);
     while (snode)
     {
@@ -1247,12 +2896,13 @@ void stats_clear_virtual_mounts (void)
             /* no source_t is reserved so remove them now */
             snode = avl_get_next (snode);
             ICECAST_LOG_DEBUG("releasing %s stats", src->source);
+            _record_removal(_counter_add(&_stats_generation, 1), src->source, NULL, src->hidden);
             avl_delete (_stats.source_tree, src, _free_source_stats);
             continue;
         }
 
         snode = avl_get_next (snode);
     }
-    thread_mutex_unlock (&_stats_mutex);
+    thread_rwlock_unlock(&_stats_rwlock);
 }
 
@@ -14,6 +14,10 @@
 #ifndef __STATS_H__
 #define __STATS_H__
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
 #include <libxml/xmlmemory.h>
 #include <libxml/parser.h>
 #include <libxml/tree.h>
@@ -26,11 +30,55 @@
 #define STATS_XML_FLAG_SHOW_LISTENERS   0x0002U
 #define STATS_XML_FLAG_PUBLIC_VIEW      0x0004U
 
+/* a status page rendered from the stats, all members are free()d by
+ * stats_page_clear() */
+typedef struct {
+    char *body;
+    size_t len;
+    char *mediatype;
+    char *charset;
+    char *extra_headers;
+} stats_page_t;
+
+/* Numeric stats are kept as numbers and only turned into text when they
+ * are rendered. Counters are changed in place by stats_event_inc() and
+ * friends, the value of STATS_TYPE_TIME is a time_t.
+ */
+typedef enum {
+    STATS_TYPE_STRING = 0,
+    STATS_TYPE_INT,
+    STATS_TYPE_UINT,
+    STATS_TYPE_TIME
+} stats_type_t;
+
+/* Without C11 atomics counters are changed under a lock,
+ * STATS_COUNTER_ATOMIC tells which one we got.
+ */
+#if defined(HAVE_STDATOMIC_H) && !defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+#define STATS_COUNTER_ATOMIC 1
+typedef _Atomic(uint64_t) stats_counter_t;
+#else
+typedef uint64_t stats_counter_t;
+#endif
+
 typedef struct _stats_node_tag
 {
     char *name;
+    /* only used by STATS_TYPE_STRING */
     char *value;
     int hidden;
+    stats_type_t type;
+    /* value of all other types, STATS_TYPE_INT is stored two's complement */
+    stats_counter_t counter;
+    /* strftime() format of STATS_TYPE_TIME, %z is appended */
+    const char *time_format;
+    /* counter as last sent to stats clients */
+    uint64_t published;
+    /* sequence number of the last change, see stats_get_xml_delta() */
+    stats_counter_t seq;
+    /* a known numeric stat, its counter may be changed in place */
+    int in_place;
 } stats_node_t;
 
 typedef struct _stats_event_tag
@@ -40,6 +88,12 @@ typedef struct _stats_event_tag
     char *value;
     int  hidden;
     int  action;
+    /* used instead of value by STATS_TYPE_TIME and counter changes */
+    stats_type_t type;
+    uint64_t number;
+    const char *time_format;
+    /* when the event was queued for the stats thread, in microseconds */
+    uint64_t queued;
 
     struct _stats_event_tag *next;
 } stats_event_t;
@@ -81,6 +135,8 @@ void stats_shutdown(void);
 void stats_global(ice_config_t *config);
 stats_t *stats_get_stats(void);
 refbuf_t *stats_get_streams (void);
+/* the numeric stats and a few internal counters in OpenMetrics text format */
+refbuf_t *stats_get_metrics(void);
 void stats_clear_virtual_mounts (void);
 
 void stats_event(const char *source, const char *name, const char *value);
@@ -101,9 +157,38 @@ void stats_callback (client_t *client, void *notused);
 void stats_transform_xslt(client_t *client);
 void stats_sendxml(client_t *client);
 xmlDocPtr stats_get_xml(unsigned int flags, const char *show_mount, client_t *client);
+/* Parses a <sequence> as given back by a client into since for
+ * stats_get_xml_delta(), "0" asks for all stats. A sequence of another
+ * process, e.g. from before a restart, also gives all stats. Returns false
+ * if str is not a sequence.
+ */
+bool stats_parse_sequence(const char *str, uint64_t *since);
+/* Renders the stats changed after the sequence number since, as reported
+ * in <sequence> by an earlier call, together with the stats removed, or
+ * hidden from this view, since.
+ * If the removals are no longer known, all stats are rendered and <since>
+ * is left out. Listeners, metadata and the like are not part of it.
+ */
+xmlDocPtr stats_get_xml_delta(unsigned int flags, const char *show_mount, client_t *client, uint64_t since);
+/* Renders the same as stats_get_xml(), or with since stats_get_xml_delta(),
+ * as JSON without building the document first */
+char *stats_get_json(unsigned int flags, const char *show_mount, client_t *client, const uint64_t *since);
 char *stats_get_value(const char *source, const char *name);
 
 void stats_add_authstack(auth_stack_t *stack, xmlNodePtr parent);
 
+/* Status pages rendered from the stats are kept until the stats change.
+ * A key is built from everything but the stats a page depends on. If
+ * stats_render_cache_send() finds no page for it, the caller renders one
+ * and stores it with the generation returned. Pages showing listeners are
+ * not cached, stats_render_cache_key() returns NULL for them.
+ */
+char *stats_render_cache_key(client_t *client, const char *format, const char *xslfilename, const char *extra, unsigned int flags, const char *show_mount);
+bool stats_render_cache_send(client_t *client, const char *key, uint64_t *generation);
+/* takes over the members of page */
+void stats_render_cache_store(const char *key, uint64_t generation, stats_page_t *page);
+void stats_page_send(client_t *client, const stats_page_t *page);
+void stats_page_clear(stats_page_t *page);
+
 #endif  /* __STATS_H__ */
 
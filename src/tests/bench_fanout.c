@@ -0,0 +1,242 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ */
+
+/* Benchmark for the listener fan-out.
+ *
+ * Every listener is a socketpair. Each round the stream queue is written to
+ * every listener and drained again on the other end, split into one shard
+ * per thread just like source_main() does, and run on the worker pool of
+ * fanout.c. Prints the aggregate throughput for growing listener and
+ * thread counts.
+ *
+ * Usage: bench_fanout [max-listeners [seconds-per-run [max-threads]]]
+ *
+ * max-threads defaults to the number of online CPUs.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#include "common/thread/thread.h"
+
+#include "../refbuf.h"
+#include "../fanout.h"
+
+#define BLOCK_SIZE      1400
+#define QUEUE_BLOCKS    16
+#define MAX_SHARDS      64
+
+typedef struct {
+    int writer;
+    int reader;
+} bench_listener_t;
+
+typedef struct {
+    bench_listener_t *listeners;
+    size_t listeners_len;
+    refbuf_t *queue;
+    unsigned long long bytes;
+} bench_shard_t;
+
+/* the modules under test log through these */
+int errorlog = 0;
+
+void log_write(int log_id, unsigned priority, const char *cat, const char *func, const char *fmt, ...)
+{
+    (void)log_id, (void)priority, (void)cat, (void)func, (void)fmt;
+}
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.;
+}
+
+static void shard_send(void *arg)
+{
+    bench_shard_t *shard = arg;
+    char drain[BLOCK_SIZE * 4];
+    size_t i;
+
+    for (i = 0; i < shard->listeners_len; i++) {
+        bench_listener_t *listener = &(shard->listeners[i]);
+        refbuf_t *refbuf;
+        ssize_t ret;
+
+        for (refbuf = shard->queue; refbuf; refbuf = refbuf->next) {
+            refbuf_addref(refbuf);
+            ret = send(listener->writer, refbuf->data, refbuf->len, MSG_DONTWAIT);
+            refbuf_release(refbuf);
+            if (ret <= 0)
+                break;
+            shard->bytes += ret;
+        }
+
+        do {
+            ret = recv(listener->reader, drain, sizeof(drain), MSG_DONTWAIT);
+        } while (ret > 0);
+    }
+}
+
+static size_t max_listeners_by_fds(size_t wanted)
+{
+    struct rlimit rl;
+    size_t possible;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0)
+        return wanted;
+
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    getrlimit(RLIMIT_NOFILE, &rl);
+
+    possible = rl.rlim_cur / 2;
+    possible = possible > 32 ? possible - 16 : 0;
+    return wanted < possible ? wanted : possible;
+}
+
+static void run(bench_listener_t *listeners, size_t listeners_len, refbuf_t *queue, size_t threads, double seconds)
+{
+    bench_shard_t shards[MAX_SHARDS];
+    void *args[MAX_SHARDS];
+    unsigned long long bytes = 0;
+    unsigned long rounds = 0;
+    double start, elapsed;
+    size_t i;
+
+    if (threads > listeners_len)
+        threads = listeners_len;
+
+    fanout_set_threads(threads);
+
+    /* contiguous slices, each listener sticks to its shard */
+    for (i = 0; i < threads; i++) {
+        size_t first = listeners_len * i / threads;
+        size_t last = listeners_len * (i + 1) / threads;
+
+        shards[i].listeners = listeners + first;
+        shards[i].listeners_len = last - first;
+        shards[i].queue = queue;
+        shards[i].bytes = 0;
+        args[i] = &(shards[i]);
+    }
+
+    start = now();
+    do {
+        fanout_run(shard_send, args, threads);
+        rounds++;
+        elapsed = now() - start;
+    } while (elapsed < seconds);
+
+    for (i = 0; i < threads; i++)
+        bytes += shards[i].bytes;
+
+    printf("%9zu %8zu %10lu %12.1f\n", listeners_len, threads, rounds, bytes / elapsed / (1024. * 1024.));
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t max_listeners = argc > 1 ? (size_t)atol(argv[1]) : 4096;
+    double seconds = argc > 2 ? atof(argv[2]) : 1.;
+    size_t max_threads = 1;
+    bench_listener_t *listeners;
+    refbuf_t *queue = NULL, **tail = &queue;
+    size_t listeners_len, threads, i;
+    long cpus;
+
+#ifdef _SC_NPROCESSORS_ONLN
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > 0)
+        max_threads = cpus;
+#else
+    (void)cpus;
+#endif
+    if (argc > 3 && atol(argv[3]) > 0)
+        max_threads = (size_t)atol(argv[3]);
+    if (max_threads > MAX_SHARDS)
+        max_threads = MAX_SHARDS;
+
+    max_listeners = max_listeners_by_fds(max_listeners);
+    if (max_listeners < 1) {
+        fprintf(stderr, "Not enough file descriptors available.\n");
+        return EXIT_FAILURE;
+    }
+
+    thread_initialize();
+    refbuf_initialize();
+    fanout_initialize();
+
+    for (i = 0; i < QUEUE_BLOCKS; i++) {
+        refbuf_t *refbuf = refbuf_new(BLOCK_SIZE);
+        memset(refbuf->data, 'x', BLOCK_SIZE);
+        *tail = refbuf;
+        tail = &(refbuf->next);
+    }
+
+    listeners = calloc(max_listeners, sizeof(*listeners));
+    if (!listeners)
+        return EXIT_FAILURE;
+
+    for (i = 0; i < max_listeners; i++) {
+        int fds[2];
+
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+            fprintf(stderr, "socketpair() failed after %zu listeners: %s\n", i, strerror(errno));
+            max_listeners = i;
+            break;
+        }
+        listeners[i].writer = fds[0];
+        listeners[i].reader = fds[1];
+    }
+
+    printf("%9s %8s %10s %12s\n", "listeners", "threads", "rounds", "MiB/s");
+    for (listeners_len = 64; ; listeners_len *= 4) {
+        if (listeners_len > max_listeners)
+            listeners_len = max_listeners;
+
+        for (threads = 1; threads <= max_threads; threads *= 2)
+            run(listeners, listeners_len, queue, threads, seconds);
+        if (threads / 2 != max_threads)
+            run(listeners, listeners_len, queue, max_threads, seconds);
+
+        if (listeners_len == max_listeners)
+            break;
+    }
+
+    for (i = 0; i < max_listeners; i++) {
+        close(listeners[i].writer);
+        close(listeners[i].reader);
+    }
+    free(listeners);
+
+    while (queue) {
+        refbuf_t *to_go = queue;
+        queue = to_go->next;
+        to_go->next = NULL;
+        refbuf_release(to_go);
+    }
+
+    fanout_shutdown();
+    refbuf_shutdown();
+    thread_shutdown();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,221 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ */
+
+/* Benchmark for the JSON version of listclients.
+ *
+ * Synthetic listeners are rendered twice: the old way by building the XML
+ * document of command_show_listeners() and passing it to
+ * xml2json_render_doc_simple(), and the new way with
+ * listclients_json_write_source() as admin.c does. Both results are
+ * compared before timing.
+ *
+ * Usage: bench_listclients_json [listeners [rounds]]
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include <libxml/tree.h>
+
+#include "../icecasttypes.h"
+#include "../cfgfile.h"
+#include "../json.h"
+#include "../xml2json.h"
+#include "../listclients.h"
+
+#define MOUNT           "/stream"
+
+typedef struct {
+    unsigned long id;
+    char ip[40];
+    const char *useragent;
+    time_t con_time;
+    int tls;
+    char country[3];
+    const char *history;
+} bench_listener_t;
+
+/* the modules under test log through these */
+int errorlog = 0;
+
+void log_write(int log_id, unsigned priority, const char *cat, const char *func, const char *fmt, ...)
+{
+    (void)log_id, (void)priority, (void)cat, (void)func, (void)fmt;
+}
+
+int util_str_to_bool(const char *str)
+{
+    return str && strcmp(str, "true") == 0;
+}
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.;
+}
+
+static char *render_xml2json(const bench_listener_t *listeners, size_t len)
+{
+    xmlDocPtr doc = xmlNewDoc(XMLSTR("1.0"));
+    xmlNodePtr root = xmlNewDocNode(doc, NULL, XMLSTR("icestats"), NULL);
+    xmlNodePtr srcnode, geoip;
+    time_t now = time(NULL);
+    char buf[22];
+    char *ret;
+    size_t i;
+
+    xmlDocSetRootElement(doc, root);
+    srcnode = xmlNewChild(root, NULL, XMLSTR("source"), NULL);
+    xmlSetProp(srcnode, XMLSTR("mount"), XMLSTR(MOUNT));
+    snprintf(buf, sizeof(buf), "%zu", len);
+    xmlNewTextChild(srcnode, NULL, XMLSTR("listeners"), XMLSTR(buf));
+
+    for (i = 0; i < len; i++) {
+        const bench_listener_t *listener = &(listeners[i]);
+        xmlNodePtr node = xmlNewChild(srcnode, NULL, XMLSTR("listener"), NULL);
+        xmlNodePtr history;
+
+        snprintf(buf, sizeof(buf), "%lu", listener->id);
+        xmlSetProp(node, XMLSTR("id"), XMLSTR(buf));
+        xmlNewTextChild(node, NULL, XMLSTR("id"), XMLSTR(buf));
+        xmlNewTextChild(node, NULL, XMLSTR("ip"), XMLSTR(listener->ip));
+        xmlNewTextChild(node, NULL, XMLSTR("useragent"), XMLSTR(listener->useragent));
+        snprintf(buf, sizeof(buf), "%lu", (unsigned long)(now - listener->con_time));
+        xmlNewTextChild(node, NULL, XMLSTR("connected"), XMLSTR(buf));
+        xmlNewTextChild(node, NULL, XMLSTR("tls"), XMLSTR(listener->tls ? "true" : "false"));
+        xmlNewTextChild(node, NULL, XMLSTR("protocol"), XMLSTR("http"));
+
+        geoip = xmlNewChild(node, NULL, XMLSTR("geoip"), NULL);
+        xmlSetProp(xmlNewChild(geoip, NULL, XMLSTR("country"), NULL), XMLSTR("iso-alpha-2"), XMLSTR(listener->country));
+
+        history = xmlNewChild(node, NULL, XMLSTR("history"), NULL);
+        xmlNewTextChild(history, NULL, XMLSTR("mount"), XMLSTR(listener->history));
+    }
+
+    xmlNewChild(srcnode, NULL, XMLSTR("geoip"), NULL);
+
+    ret = xml2json_render_doc_simple(doc, XMLNS_LEGACY_STATS);
+    xmlFreeDoc(doc);
+
+    return ret;
+}
+
+typedef struct {
+    const bench_listener_t *listeners;
+    size_t len;
+    size_t pos;
+} bench_cursor_t;
+
+/* copies the listeners like admin_listener_copy() does */
+static size_t next_direct(void *userdata, listclients_listener_t *listeners, size_t len)
+{
+    bench_cursor_t *cursor = userdata;
+    size_t fill = 0;
+
+    for (; cursor->pos < cursor->len && fill < len; cursor->pos++, fill++) {
+        const bench_listener_t *listener = &(cursor->listeners[cursor->pos]);
+        listclients_listener_t *copy = &(listeners[fill]);
+
+        memset(copy, 0, sizeof(*copy));
+        copy->id = listener->id;
+        copy->con_time = listener->con_time;
+        copy->ip = strdup(listener->ip);
+        copy->useragent = strdup(listener->useragent);
+        copy->tls = listener->tls;
+        copy->protocol = "http";
+        memcpy(copy->iso_3166_1_alpha_2, listener->country, sizeof(copy->iso_3166_1_alpha_2));
+        copy->history_fill = 1;
+        copy->history[0] = strdup(listener->history);
+    }
+
+    return fill;
+}
+
+static char *render_direct(const bench_listener_t *listeners, size_t len)
+{
+    json_renderer_t *renderer = json_renderer_create(JSON_RENDERER_FLAGS_NONE);
+    bench_cursor_t cursor = {listeners, len, 0};
+    listclients_country_t countries[26][26];
+    listclients_country_t default_country;
+
+    if (!renderer)
+        return NULL;
+
+    memset(countries, 0, sizeof(countries));
+    memset(&default_country, 0, sizeof(default_country));
+
+    xml2json_render_legacystats_begin(renderer);
+    listclients_json_write_source(renderer, MOUNT, len, OMODE_DEFAULT, next_direct, &cursor, countries, &default_country);
+
+    return json_renderer_finish(&renderer);
+}
+
+static double run(char *(*render)(const bench_listener_t *, size_t), const bench_listener_t *listeners, size_t len, unsigned int rounds)
+{
+    double start = now();
+    unsigned int i;
+
+    for (i = 0; i < rounds; i++)
+        free(render(listeners, len));
+
+    return (now() - start) / rounds;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t len = argc > 1 ? (size_t)atol(argv[1]) : 10000;
+    unsigned int rounds = argc > 2 ? (unsigned int)atoi(argv[2]) : 10;
+    bench_listener_t *listeners = calloc(len ? len : 1, sizeof(*listeners));
+    char *a, *b;
+    double xml, direct;
+    size_t i;
+
+    if (!listeners || !rounds)
+        return EXIT_FAILURE;
+
+    for (i = 0; i < len; i++) {
+        bench_listener_t *listener = &(listeners[i]);
+
+        listener->id = 1000 + i;
+        snprintf(listener->ip, sizeof(listener->ip), "192.0.%zu.%zu", (i >> 8) & 0xff, i & 0xff);
+        listener->useragent = i % 2 ? "Mozilla/5.0 (X11; Linux x86_64) \"bench\"" : "VLC/3.0.18 LibVLC/3.0.18";
+        listener->con_time = time(NULL) - i * 7;
+        listener->tls = i % 3 == 0;
+        listener->country[0] = 'a' + i % 26;
+        listener->country[1] = 'a' + (i / 26) % 26;
+        listener->history = "/fallback";
+    }
+
+    a = render_xml2json(listeners, len);
+    b = render_direct(listeners, len);
+    if (!a || !b || strcmp(a, b) != 0) {
+        fprintf(stderr, "Renderings differ.\n");
+        return EXIT_FAILURE;
+    }
+    printf("%zu listeners, %zu bytes of JSON\n", len, strlen(a));
+    free(a);
+    free(b);
+
+    xml = run(render_xml2json, listeners, len, rounds);
+    direct = run(render_direct, listeners, len, rounds);
+
+    printf("%-12s %10.2f ms\n", "xml2json", xml * 1000.);
+    printf("%-12s %10.2f ms\n", "direct", direct * 1000.);
+    printf("%-12s %10.2fx\n", "speedup", xml / direct);
+
+    free(listeners);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,148 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h> /* for EXIT_FAILURE */
+#include <string.h>
+
+#include <igloo/tap.h>
+
+#include "../httphead.h"
+
+static char buffer[16384];
+static httphead_t head;
+
+/* scans request, handing it over in pieces of step bytes */
+static httphead_scan_result_t scan(const char *request, size_t step, unsigned int flags)
+{
+    size_t len = strlen(request);
+    size_t have = 0;
+    httphead_scan_result_t res = HTTPHEAD_SCAN_MORE;
+
+    httphead_init(&head, flags);
+    memcpy(buffer, request, len + 1);
+
+    while (res == HTTPHEAD_SCAN_MORE && have < len) {
+        have += step;
+        if (have > len)
+            have = len;
+        res = httphead_scan(&head, buffer, have);
+    }
+
+    if (res == HTTPHEAD_SCAN_DONE)
+        httphead_terminate(&head, buffer);
+
+    return res;
+}
+
+static bool known_is(httphead_known_t id, const char *expect)
+{
+    const char *value;
+
+    if (!httphead_get_known(&head, buffer, id, &value))
+        return false;
+    if (!expect || !value)
+        return expect == value;
+    return strcmp(value, expect) == 0;
+}
+
+static void test_basic(void)
+{
+    static const char *request =
+        "GET /stream HTTP/1.1\r\n"
+        "Host: example.org:8000\r\n"
+        "User-Agent:  VLC/3.0.18 LibVLC/3.0.18 \r\n"
+        "Icy-MetaData:1\r\n"
+        "X-Other: other\r\n"
+        "\r\n"
+        "body";
+    size_t step;
+
+    for (step = 1; step <= 7; step += 6) {
+        igloo_tap_test("done", scan(request, step, 0) == HTTPHEAD_SCAN_DONE);
+        igloo_tap_test("end", head.end == strlen(request) - 4);
+        igloo_tap_test("request line", strcmp(buffer + head.request_line.offset, "GET /stream HTTP/1.1") == 0);
+        igloo_tap_test("fields", head.fields_len == 4);
+        igloo_tap_test("host", known_is(HTTPHEAD_HOST, "example.org:8000"));
+        igloo_tap_test("user-agent trimmed", known_is(HTTPHEAD_USER_AGENT, "VLC/3.0.18 LibVLC/3.0.18"));
+        igloo_tap_test("icy-metadata", known_is(HTTPHEAD_ICY_METADATA, "1"));
+        igloo_tap_test("range not sent", known_is(HTTPHEAD_RANGE, NULL));
+        igloo_tap_test("other", strcmp(httphead_get(&head, buffer, "x-other"), "other") == 0);
+        igloo_tap_test("missing", httphead_get(&head, buffer, "x-missing") == NULL);
+    }
+}
+
+static void test_line_endings(void)
+{
+    igloo_tap_test("\\n", scan("GET / HTTP/1.0\nHost: a\n\nx", 3, 0) == HTTPHEAD_SCAN_DONE && head.end == 24 && known_is(HTTPHEAD_HOST, "a"));
+    igloo_tap_test("\\r\\r\\n", scan("GET / HTTP/1.0\r\r\nHost: a\r\r\n\r\r\nx", 5, 0) == HTTPHEAD_SCAN_DONE && head.end == 30 && known_is(HTTPHEAD_HOST, "a"));
+    igloo_tap_test("leading empty lines", scan("\r\n\r\nGET / HTTP/1.0\r\n\r\n", 2, 0) == HTTPHEAD_SCAN_DONE && head.start == 4 && head.end == 22);
+    igloo_tap_test("incomplete", scan("GET / HTTP/1.0\r\nHost: a\r\n", 1, 0) == HTTPHEAD_SCAN_MORE);
+    igloo_tap_test("no request line", scan("icy-name: x\r\n\r\n", 4, HTTPHEAD_FLAG_NO_REQUEST_LINE) == HTTPHEAD_SCAN_DONE && strcmp(httphead_get(&head, buffer, "icy-name"), "x") == 0);
+}
+
+static void test_fields(void)
+{
+    igloo_tap_test("repeated known header", scan("GET / HTTP/1.1\r\nHost: a\r\nHost: b\r\n\r\n", 1, 0) == HTTPHEAD_SCAN_DONE && !known_is(HTTPHEAD_HOST, "a") && !known_is(HTTPHEAD_HOST, "b"));
+    igloo_tap_test("folded value", scan("GET / HTTP/1.1\r\nUser-Agent: a\r\n  b\r\n\tc\r\n\r\n", 2, 0) == HTTPHEAD_SCAN_DONE && known_is(HTTPHEAD_USER_AGENT, "a    b   c") && head.fields_len == 1);
+    igloo_tap_test("empty value", scan("GET / HTTP/1.1\r\nRange:\r\n\r\n", 1, 0) == HTTPHEAD_SCAN_DONE && known_is(HTTPHEAD_RANGE, ""));
+    igloo_tap_test("line without colon ignored", scan("GET / HTTP/1.1\r\nnonsense\r\nHost: a\r\n\r\n", 1, 0) == HTTPHEAD_SCAN_DONE && head.fields_len == 1);
+    igloo_tap_test("space before colon", scan("GET / HTTP/1.1\r\nHost : a\r\n\r\n", 1, 0) == HTTPHEAD_SCAN_ERROR);
+    igloo_tap_test("fold without field", scan("GET / HTTP/1.1\r\n a\r\n\r\n", 1, 0) == HTTPHEAD_SCAN_ERROR);
+}
+
+static void test_nul(void)
+{
+    static const char request[] = "GET / HTTP/1.1\r\nHost: a\0b\r\n\r\n";
+
+    httphead_init(&head, 0);
+    memcpy(buffer, request, sizeof(request));
+    igloo_tap_test("nul", httphead_scan(&head, buffer, sizeof(request) - 1) == HTTPHEAD_SCAN_ERROR);
+}
+
+static void test_large(void)
+{
+    char request[12000];
+    size_t i;
+    int len = snprintf(request, sizeof(request), "GET / HTTP/1.1\r\nCookie: ");
+
+    for (i = 0; i < 10000; i++)
+        request[len++] = 'a' + i % 26;
+    len += snprintf(request + len, sizeof(request) - len, "\r\nAuthorization: Basic YTpi\r\n\r\n");
+
+    igloo_tap_test("larger than 4 KiB", scan(request, 1500, 0) == HTTPHEAD_SCAN_DONE && head.end == (size_t)len);
+    igloo_tap_test("value after large field", known_is(HTTPHEAD_AUTHORIZATION, "Basic YTpi"));
+    igloo_tap_test("large field", strlen(httphead_get(&head, buffer, "cookie")) == 10000);
+
+    len = snprintf(request, sizeof(request), "GET / HTTP/1.1\r\n");
+    for (i = 0; i <= HTTPHEAD_MAX_FIELDS; i++)
+        len += snprintf(request + len, sizeof(request) - len, "X-%zu: %zu\r\n", i, i);
+    snprintf(request + len, sizeof(request) - len, "\r\n");
+    igloo_tap_test("too many fields", scan(request, 100, 0) == HTTPHEAD_SCAN_ERROR);
+}
+
+int main (void)
+{
+    igloo_tap_init();
+    igloo_tap_exit_on(igloo_TAP_EXIT_ON_FIN|igloo_TAP_EXIT_ON_BAIL_OUT, NULL);
+
+    igloo_tap_group_run("basic", test_basic);
+    igloo_tap_group_run("line endings", test_line_endings);
+    igloo_tap_group_run("fields", test_fields);
+    igloo_tap_group_run("nul", test_nul);
+    igloo_tap_group_run("large", test_large);
+
+    httphead_clear(&head);
+
+    igloo_tap_fin();
+
+    return EXIT_FAILURE; // return failure as we should never reach this point!
+}
@@ -0,0 +1,262 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stdlib.h> /* for EXIT_FAILURE */
+#include <string.h>
+
+#include <igloo/tap.h>
+
+#include "common/thread/thread.h"
+
+#include "../refbuf.h"
+
+#define STRESS_THREADS      8
+#define STRESS_ROUNDS       20000
+#define STRESS_QUEUE        16
+#define STRESS_HEADERS      4
+
+/* refbuf.c logs through these, we do not want to pull in the logging code */
+int errorlog = 0;
+
+void log_write(int log_id, unsigned priority, const char *cat, const char *func, const char *fmt, ...)
+{
+    (void)log_id, (void)priority, (void)cat, (void)func, (void)fmt;
+}
+
+static refbuf_t *queue;
+static refbuf_t *headers;
+static refbuf_t *shared_owner;
+
+static refbuf_t *make_chain(size_t len)
+{
+    refbuf_t *head = NULL, **tail = &head;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        *tail = refbuf_new(16);
+        tail = &((*tail)->next);
+    }
+
+    return head;
+}
+
+/* release a chain the way source_clear_source() does for its queue */
+static void free_chain(refbuf_t *chain)
+{
+    while (chain) {
+        refbuf_t *to_go = chain;
+        chain = to_go->next;
+        to_go->next = NULL;
+        refbuf_release(to_go);
+    }
+}
+
+static bool chain_counts_are(refbuf_t *chain, unsigned int count)
+{
+    for (; chain; chain = chain->next)
+        if (refbuf_get_count(chain) != count)
+            return false;
+    return true;
+}
+
+/* create an owner holding a reference to each header, like
+ * format_ogg.c:complete_buffer() does */
+static refbuf_t *new_owner(void)
+{
+    refbuf_t *owner = refbuf_new(16);
+    refbuf_t *header;
+
+    for (header = headers; header; header = header->next)
+        refbuf_addref(header);
+    owner->associated = headers;
+
+    return owner;
+}
+
+static void test_single(void)
+{
+    refbuf_t *a = refbuf_new(32);
+
+    igloo_tap_test("created", a != NULL);
+    igloo_tap_test("len set", a->len == 32);
+    igloo_tap_test("count is 1", refbuf_get_count(a) == 1);
+    refbuf_addref(a);
+    igloo_tap_test("count is 2", refbuf_get_count(a) == 2);
+    refbuf_release(a);
+    igloo_tap_test("count is 1 again", refbuf_get_count(a) == 1);
+    refbuf_release(a);
+}
+
+static void test_associated(void)
+{
+    refbuf_t *owner;
+
+    headers = make_chain(STRESS_HEADERS);
+
+    owner = new_owner();
+    igloo_tap_test("headers referenced by owner", chain_counts_are(headers, 2));
+    refbuf_release(owner);
+    igloo_tap_test("headers released by owner", chain_counts_are(headers, 1));
+
+    free_chain(headers);
+    headers = NULL;
+}
+
+static void test_pool(void)
+{
+    refbuf_pool_stats_t before, after;
+    refbuf_t *a, *b;
+
+    refbuf_pool_get_stats(&before);
+
+    a = refbuf_new(1400);
+    igloo_tap_test("pooled", a->_pool != 0);
+    igloo_tap_test("data follows header", a->data == (char *)(a + 1));
+    memset(a->data, 'a', a->len);
+    refbuf_release(a);
+
+    b = refbuf_new(1000);
+    igloo_tap_test("same class reused", a == b);
+
+    refbuf_pool_get_stats(&after);
+    igloo_tap_test("hit counted", after.hits > before.hits);
+    igloo_tap_test("one block in use", after.in_use == before.in_use + 1);
+    igloo_tap_test("high water tracked", after.high_water >= after.in_use);
+
+    igloo_tap_test("resized within block", refbuf_resize(b, 1200) == 0 && b->data == (char *)(b + 1) && b->len == 1200);
+    memset(b->data, 'b', b->len);
+    igloo_tap_test("resized beyond block", refbuf_resize(b, 100000) == 0 && b->data != (char *)(b + 1) && b->len == 100000);
+    igloo_tap_test("contents kept", b->data[0] == 'b' && b->data[1199] == 'b');
+    refbuf_release(b);
+
+    a = refbuf_new(1024 * 1024);
+    refbuf_pool_get_stats(&after);
+    igloo_tap_test("oversize not pooled", a->_pool == 0 && a->data == (char *)(a + 1));
+    igloo_tap_test("oversize counted", after.oversize == before.oversize + 1);
+    refbuf_release(a);
+
+    refbuf_pool_get_stats(&after);
+    igloo_tap_test("all blocks returned", after.in_use == before.in_use);
+}
+
+static void *stress_thread(void *arg)
+{
+    size_t i;
+
+    (void)arg;
+
+    for (i = 0; i < STRESS_ROUNDS; i++) {
+        refbuf_t *refbuf;
+        refbuf_t *owner;
+
+        /* walk the queue like a listener does */
+        for (refbuf = queue; refbuf; refbuf = refbuf->next) {
+            refbuf_addref(refbuf);
+            refbuf_release(refbuf);
+        }
+
+        /* owners sharing one associated chain, released concurrently */
+        owner = new_owner();
+        refbuf_release(owner);
+
+        refbuf_addref(shared_owner);
+        refbuf_release(shared_owner);
+    }
+
+    return NULL;
+}
+
+static void test_stress(void)
+{
+    thread_type *threads[STRESS_THREADS];
+    size_t i;
+
+    queue = make_chain(STRESS_QUEUE);
+    headers = make_chain(STRESS_HEADERS);
+    shared_owner = new_owner();
+
+    for (i = 0; i < STRESS_THREADS; i++)
+        threads[i] = thread_create("refbuf stress", stress_thread, NULL, THREAD_ATTACHED);
+    for (i = 0; i < STRESS_THREADS; i++)
+        thread_join(threads[i]);
+
+    igloo_tap_test("queue counts balanced", chain_counts_are(queue, 1));
+    igloo_tap_test("shared owner count balanced", refbuf_get_count(shared_owner) == 1);
+    igloo_tap_test("header counts balanced", chain_counts_are(headers, 2));
+
+    /* dropping the last owner releases its associated chain */
+    refbuf_release(shared_owner);
+    igloo_tap_test("headers released by last owner", chain_counts_are(headers, 1));
+
+    free_chain(headers);
+    free_chain(queue);
+    headers = queue = NULL;
+}
+
+static void *last_owner_thread(void *arg)
+{
+    refbuf_release(arg);
+    return NULL;
+}
+
+static void test_last_owner_race(void)
+{
+    thread_type *threads[STRESS_THREADS];
+    size_t round, i;
+    bool ok = true;
+
+    headers = make_chain(STRESS_HEADERS);
+
+    /* all threads drop their reference at once, exactly one frees the owner
+     * and walks the associated chain */
+    for (round = 0; round < 200 && ok; round++) {
+        refbuf_t *owner = new_owner();
+
+        for (i = 1; i < STRESS_THREADS; i++)
+            refbuf_addref(owner);
+        for (i = 0; i < STRESS_THREADS; i++)
+            threads[i] = thread_create("refbuf release", last_owner_thread, owner, THREAD_ATTACHED);
+        for (i = 0; i < STRESS_THREADS; i++)
+            thread_join(threads[i]);
+
+        ok = chain_counts_are(headers, 1);
+    }
+    igloo_tap_test("associated chain released exactly once", ok);
+
+    free_chain(headers);
+    headers = NULL;
+}
+
+int main (void)
+{
+    igloo_tap_init();
+    igloo_tap_exit_on(igloo_TAP_EXIT_ON_FIN|igloo_TAP_EXIT_ON_BAIL_OUT, NULL);
+
+    thread_initialize();
+    refbuf_initialize();
+
+    igloo_tap_group_run("single", test_single);
+    igloo_tap_group_run("associated", test_associated);
+    igloo_tap_group_run("pool", test_pool);
+#ifdef REFBUF_THREADSAFE
+    igloo_tap_group_run("stress", test_stress);
+    igloo_tap_group_run("last owner race", test_last_owner_race);
+#else
+    igloo_tap_diagnostic("no atomic operations, skipping concurrent tests");
+#endif
+
+    refbuf_shutdown();
+    thread_shutdown();
+
+    igloo_tap_fin();
+
+    return EXIT_FAILURE; // return failure as we should never reach this point!
+}
@@ -0,0 +1,164 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stdlib.h> /* for EXIT_FAILURE */
+#include <string.h>
+
+#include <igloo/tap.h>
+
+#include "../util_http.h"
+
+#define SIZE    10000
+
+static bool range_is(const char *header, util_http_range_result_t expect, size_t len, ...)
+{
+    util_http_range_t ranges[UTIL_HTTP_RANGE_MAX];
+    size_t count = 0;
+    size_t i;
+    va_list ap;
+    bool ok = true;
+
+    if (util_http_range_parse(header, SIZE, ranges, &count, UTIL_HTTP_RANGE_MAX) != expect || count != len)
+        return false;
+
+    va_start(ap, len);
+    for (i = 0; i < len; i++) {
+        uint64_t start = va_arg(ap, int);
+        uint64_t end = va_arg(ap, int);
+
+        if (ranges[i].start != start || ranges[i].end != end)
+            ok = false;
+    }
+    va_end(ap);
+
+    return ok;
+}
+
+static void test_range_single(void)
+{
+    igloo_tap_test("closed", range_is("bytes=0-499", UTIL_HTTP_RANGE_OK, 1, 0, 499));
+    igloo_tap_test("closed middle", range_is("bytes=500-999", UTIL_HTTP_RANGE_OK, 1, 500, 999));
+    igloo_tap_test("open", range_is("bytes=9500-", UTIL_HTTP_RANGE_OK, 1, 9500, 9999));
+    igloo_tap_test("suffix", range_is("bytes=-500", UTIL_HTTP_RANGE_OK, 1, 9500, 9999));
+    igloo_tap_test("suffix larger than body", range_is("bytes=-20000", UTIL_HTTP_RANGE_OK, 1, 0, 9999));
+    igloo_tap_test("end clipped", range_is("bytes=9000-20000", UTIL_HTTP_RANGE_OK, 1, 9000, 9999));
+    igloo_tap_test("last byte", range_is("bytes=9999-9999", UTIL_HTTP_RANGE_OK, 1, 9999, 9999));
+    igloo_tap_test("unit case", range_is("Bytes=0-0", UTIL_HTTP_RANGE_OK, 1, 0, 0));
+    igloo_tap_test("whitespace", range_is(" bytes = 1-2 ", UTIL_HTTP_RANGE_OK, 1, 1, 2));
+}
+
+static void test_range_multi(void)
+{
+    igloo_tap_test("two", range_is("bytes=0-99,200-299", UTIL_HTTP_RANGE_OK, 2, 0, 99, 200, 299));
+    igloo_tap_test("sorted", range_is("bytes=200-299, 0-99", UTIL_HTTP_RANGE_OK, 2, 0, 99, 200, 299));
+    igloo_tap_test("first and last", range_is("bytes=0-0,-1", UTIL_HTTP_RANGE_OK, 2, 0, 0, 9999, 9999));
+    igloo_tap_test("overlap merged", range_is("bytes=0-150,100-299", UTIL_HTTP_RANGE_OK, 1, 0, 299));
+    igloo_tap_test("adjacent merged", range_is("bytes=0-99,100-199", UTIL_HTTP_RANGE_OK, 1, 0, 199));
+    igloo_tap_test("contained merged", range_is("bytes=0-999,10-20", UTIL_HTTP_RANGE_OK, 1, 0, 999));
+    igloo_tap_test("empty elements", range_is("bytes=,0-1,,4-5,", UTIL_HTTP_RANGE_OK, 2, 0, 1, 4, 5));
+    igloo_tap_test("unsatisfiable dropped", range_is("bytes=0-1,20000-", UTIL_HTTP_RANGE_OK, 1, 0, 1));
+}
+
+static void test_range_invalid(void)
+{
+    util_http_range_t ranges[UTIL_HTTP_RANGE_MAX];
+    char header[512];
+    size_t count;
+    size_t i;
+
+    igloo_tap_test("NULL", range_is(NULL, UTIL_HTTP_RANGE_NONE, 0));
+    igloo_tap_test("empty", range_is("", UTIL_HTTP_RANGE_NONE, 0));
+    igloo_tap_test("no ranges", range_is("bytes=", UTIL_HTTP_RANGE_NONE, 0));
+    igloo_tap_test("other unit", range_is("items=0-1", UTIL_HTTP_RANGE_NONE, 0));
+    igloo_tap_test("unit prefix", range_is("bytesx=0-1", UTIL_HTTP_RANGE_NONE, 0));
+    igloo_tap_test("no dash", range_is("bytes=100", UTIL_HTTP_RANGE_NONE, 0));
+    igloo_tap_test("only dash", range_is("bytes=-", UTIL_HTTP_RANGE_NONE, 0));
+    igloo_tap_test("last before first", range_is("bytes=500-100", UTIL_HTTP_RANGE_NONE, 0));
+    igloo_tap_test("negative", range_is("bytes=--5", UTIL_HTTP_RANGE_NONE, 0));
+    igloo_tap_test("garbage", range_is("bytes=0-1x", UTIL_HTTP_RANGE_NONE, 0));
+    igloo_tap_test("one bad spec", range_is("bytes=0-1,a-b", UTIL_HTTP_RANGE_NONE, 0));
+    igloo_tap_test("overflow", range_is("bytes=99999999999999999999-", UTIL_HTTP_RANGE_NONE, 0));
+
+    header[0] = 0;
+    strcat(header, "bytes=");
+    for (i = 0; i <= UTIL_HTTP_RANGE_MAX; i++)
+        strcat(header, i ? ",0-1" : "0-1");
+    igloo_tap_test("too many ranges", range_is(header, UTIL_HTTP_RANGE_NONE, 0));
+
+    igloo_tap_test("empty body", util_http_range_parse("bytes=0-", 0, ranges, &count, UTIL_HTTP_RANGE_MAX) == UTIL_HTTP_RANGE_UNSATISFIABLE);
+}
+
+static void test_range_unsatisfiable(void)
+{
+    igloo_tap_test("start past end", range_is("bytes=10000-", UTIL_HTTP_RANGE_UNSATISFIABLE, 0));
+    igloo_tap_test("closed past end", range_is("bytes=10000-10010", UTIL_HTTP_RANGE_UNSATISFIABLE, 0));
+    igloo_tap_test("zero suffix", range_is("bytes=-0", UTIL_HTTP_RANGE_UNSATISFIABLE, 0));
+    igloo_tap_test("all past end", range_is("bytes=20000-,30000-", UTIL_HTTP_RANGE_UNSATISFIABLE, 0));
+}
+
+static void test_etag(void)
+{
+    static const char *etag = "\"1a-2b-3c\"";
+
+    igloo_tap_test("single", util_http_etag_match("\"1a-2b-3c\"", etag, false));
+    igloo_tap_test("list", util_http_etag_match("\"x\", \"1a-2b-3c\"", etag, true));
+    igloo_tap_test("star", util_http_etag_match("*", etag, true));
+    igloo_tap_test("other", !util_http_etag_match("\"1a-2b-3d\"", etag, true));
+    igloo_tap_test("prefix", !util_http_etag_match("\"1a-2b-3\"", etag, true));
+    igloo_tap_test("weak, weak comparison", util_http_etag_match("W/\"1a-2b-3c\"", etag, true));
+    igloo_tap_test("weak, strong comparison", !util_http_etag_match("W/\"1a-2b-3c\"", etag, false));
+    igloo_tap_test("unquoted", !util_http_etag_match("1a-2b-3c", etag, true));
+    igloo_tap_test("NULL", !util_http_etag_match(NULL, etag, true));
+}
+
+static void test_date(void)
+{
+    char buf[UTIL_HTTP_DATE_LEN];
+    time_t t = 0;
+
+    igloo_tap_test("IMF-fixdate", util_http_date_parse("Sun, 06 Nov 1994 08:49:37 GMT", &t) && t == 784111777);
+    igloo_tap_test("rfc850-date", util_http_date_parse("Sunday, 06-Nov-94 08:49:37 GMT", &t) && t == 784111777);
+    igloo_tap_test("asctime-date", util_http_date_parse("Sun Nov  6 08:49:37 1994", &t) && t == 784111777);
+    igloo_tap_test("leap day", util_http_date_parse("Tue, 29 Feb 2000 00:00:00 GMT", &t) && t == 951782400);
+    igloo_tap_test("epoch", util_http_date_parse("Thu, 01 Jan 1970 00:00:00 GMT", &t) && t == 0);
+
+    igloo_tap_test("no zone", !util_http_date_parse("Sun, 06 Nov 1994 08:49:37", &t));
+    igloo_tap_test("bad month", !util_http_date_parse("Sun, 06 Foo 1994 08:49:37 GMT", &t));
+    igloo_tap_test("bad hour", !util_http_date_parse("Sun, 06 Nov 1994 24:49:37 GMT", &t));
+    igloo_tap_test("short year", !util_http_date_parse("Sun, 06 Nov 94 08:49:37 GMT", &t));
+    igloo_tap_test("not a date", !util_http_date_parse("\"1a-2b-3c\"", &t));
+    igloo_tap_test("empty", !util_http_date_parse("", &t));
+
+    util_http_date_format(buf, sizeof(buf), 784111777);
+    igloo_tap_test("format", strcmp(buf, "Sun, 06 Nov 1994 08:49:37 GMT") == 0);
+    util_http_date_format(buf, sizeof(buf), 0);
+    igloo_tap_test("format epoch", strcmp(buf, "Thu, 01 Jan 1970 00:00:00 GMT") == 0);
+    util_http_date_format(buf, sizeof(buf), 1700000000);
+    igloo_tap_test("format round trip", util_http_date_parse(buf, &t) && t == 1700000000);
+}
+
+int main (void)
+{
+    igloo_tap_init();
+    igloo_tap_exit_on(igloo_TAP_EXIT_ON_FIN|igloo_TAP_EXIT_ON_BAIL_OUT, NULL);
+
+    igloo_tap_group_run("range single", test_range_single);
+    igloo_tap_group_run("range multi", test_range_multi);
+    igloo_tap_group_run("range invalid", test_range_invalid);
+    igloo_tap_group_run("range unsatisfiable", test_range_unsatisfiable);
+    igloo_tap_group_run("etag", test_etag);
+    igloo_tap_group_run("date", test_date);
+
+    igloo_tap_fin();
+
+    return EXIT_FAILURE; // return failure as we should never reach this point!
+}
@@ -0,0 +1,366 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ */
+
+/* stats_get_json() writes the stats with the xml2json_render_legacystats_*()
+ * functions instead of building the document of stats_get_xml() and passing
+ * it to xml2json_render_doc_simple(). This renders the same stats both ways,
+ * the way stats.c does, and checks the results are the same.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stdlib.h> /* for EXIT_FAILURE */
+#include <string.h>
+
+#include <igloo/tap.h>
+
+#include <libxml/tree.h>
+
+#include "../icecasttypes.h"
+#include "../cfgfile.h"
+#include "../json.h"
+#include "../xml2json.h"
+
+typedef struct {
+    const char *name;
+    const char *value;
+} test_stat_t;
+
+typedef struct {
+    const char *mount;
+    const test_stat_t *stats;
+} test_source_t;
+
+typedef struct {
+    const char *mount;
+    const char *name;
+} test_removed_t;
+
+typedef struct {
+    /* with a sequence this is a delta, without the extras */
+    const char *sequence;
+    const char *since;
+    const test_stat_t *global;
+    const test_source_t *sources;
+    const test_removed_t *removed;
+} test_stats_t;
+
+/* the modules under test log through these */
+int errorlog = 0;
+
+void log_write(int log_id, unsigned priority, const char *cat, const char *func, const char *fmt, ...)
+{
+    (void)log_id, (void)priority, (void)cat, (void)func, (void)fmt;
+}
+
+int util_str_to_bool(const char *str)
+{
+    return str && strcmp(str, "true") == 0;
+}
+
+/* like module_container_get_modulelist_as_xml() */
+static xmlNodePtr add_modules(xmlNodePtr parent)
+{
+    xmlNodePtr modules = xmlNewChild(parent, NULL, XMLSTR("modules"), NULL);
+    xmlNodePtr module = xmlNewChild(modules, NULL, XMLSTR("module"), NULL);
+
+    xmlSetProp(module, XMLSTR("name"), XMLSTR("example"));
+    xmlSetProp(module, XMLSTR("management-url"), XMLSTR("/admin/example"));
+
+    return modules;
+}
+
+/* like stats_add_authstack() */
+static void add_authentication(xmlNodePtr parent, const char *rolename)
+{
+    xmlNodePtr authentication = xmlNewChild(parent, NULL, XMLSTR("authentication"), NULL);
+    xmlNodePtr role = xmlNewChild(authentication, NULL, XMLSTR("role"), NULL);
+    xmlNodePtr users = xmlNewChild(role, NULL, XMLSTR("users"), NULL);
+    xmlNodePtr user = xmlNewChild(users, NULL, XMLSTR("user"), NULL);
+
+    xmlSetProp(role, XMLSTR("type"), XMLSTR("htpasswd"));
+    xmlSetProp(role, XMLSTR("name"), XMLSTR(rolename));
+    xmlSetProp(role, XMLSTR("id"), XMLSTR("1"));
+    xmlSetProp(role, XMLSTR("can-adduser"), XMLSTR("true"));
+    xmlSetProp(role, XMLSTR("can-deleteuser"), XMLSTR("false"));
+    xmlNewTextChild(user, NULL, XMLSTR("username"), XMLSTR("alice"));
+}
+
+/* like _add_source_extras() */
+static void add_source_extras(xmlNodePtr parent)
+{
+    xmlNodePtr playlist = xmlNewChild(parent, NULL, XMLSTR("playlist"), NULL);
+    xmlNodePtr tracklist = xmlNewChild(playlist, NULL, XMLSTR("trackList"), NULL);
+    xmlNodePtr track = xmlNewChild(tracklist, NULL, XMLSTR("track"), NULL);
+    xmlNodePtr metadata;
+
+    xmlSetProp(playlist, XMLSTR("version"), XMLSTR("1"));
+    xmlSetProp(playlist, XMLSTR("xmlns"), XMLSTR(XMLNS_XSPF));
+    xmlNewTextChild(track, NULL, XMLSTR("title"), XMLSTR("Song"));
+    xmlNewTextChild(track, NULL, XMLSTR("creator"), XMLSTR("Band"));
+
+    metadata = xmlNewChild(parent, NULL, XMLSTR("metadata"), NULL);
+    xmlNewTextChild(metadata, NULL, XMLSTR("title"), XMLSTR("Song"));
+    xmlNewTextChild(metadata, NULL, XMLSTR("artist"), XMLSTR("Band"));
+
+    xmlNewTextChild(parent, NULL, XMLSTR("content-type"), XMLSTR("audio/ogg"));
+
+    add_authentication(parent, "listeners");
+}
+
+/* builds the document like stats_get_xml() or stats_get_xml_delta() */
+static char *render_doc(const test_stats_t *stats)
+{
+    xmlDocPtr doc = xmlNewDoc(XMLSTR("1.0"));
+    xmlNodePtr root = xmlNewDocNode(doc, NULL, XMLSTR("icestats"), NULL);
+    const test_stat_t *stat;
+    const test_source_t *source;
+    const test_removed_t *removed;
+    char *ret;
+
+    xmlDocSetRootElement(doc, root);
+
+    if (stats->sequence) {
+        xmlNewTextChild(root, NULL, XMLSTR("sequence"), XMLSTR(stats->sequence));
+        if (stats->since)
+            xmlNewTextChild(root, NULL, XMLSTR("since"), XMLSTR(stats->since));
+    } else {
+        add_modules(root);
+        add_authentication(root, "admin");
+    }
+
+    for (stat = stats->global; stat && stat->name; stat++)
+        xmlNewTextChild(root, NULL, XMLSTR(stat->name), XMLSTR(stat->value));
+
+    for (source = stats->sources; source && source->mount; source++) {
+        xmlNodePtr node = NULL;
+
+        if (!stats->sequence) {
+            node = xmlNewTextChild(root, NULL, XMLSTR("source"), NULL);
+            xmlSetProp(node, XMLSTR("mount"), XMLSTR(source->mount));
+        }
+        for (stat = source->stats; stat && stat->name; stat++) {
+            if (!node) {
+                node = xmlNewTextChild(root, NULL, XMLSTR("source"), NULL);
+                xmlSetProp(node, XMLSTR("mount"), XMLSTR(source->mount));
+            }
+            xmlNewTextChild(node, NULL, XMLSTR(stat->name), XMLSTR(stat->value));
+        }
+        if (!stats->sequence)
+            add_source_extras(node);
+    }
+
+    for (removed = stats->removed; removed && (removed->mount || removed->name); removed++) {
+        xmlNodePtr node = xmlNewChild(root, NULL, XMLSTR("removed"), NULL);
+
+        if (removed->mount)
+            xmlSetProp(node, XMLSTR("mount"), XMLSTR(removed->mount));
+        if (removed->name)
+            xmlSetProp(node, XMLSTR("name"), XMLSTR(removed->name));
+    }
+
+    ret = xml2json_render_doc_simple(doc, XMLNS_LEGACY_STATS);
+    xmlFreeDoc(doc);
+
+    return ret;
+}
+
+/* renders the stats like stats_get_json() */
+static char *render_direct(const test_stats_t *stats)
+{
+    json_renderer_t *renderer = json_renderer_create(JSON_RENDERER_FLAGS_NONE);
+    xmlNodePtr extras = xmlNewNode(NULL, XMLSTR("icestats"));
+    const test_stat_t *stat;
+    const test_source_t *source;
+    const test_removed_t *removed;
+    int sources = 0;
+    int removed_begun = 0;
+
+    if (!stats->sequence) {
+        add_modules(extras);
+        add_authentication(extras, "admin");
+    }
+
+    xml2json_render_legacystats_begin(renderer);
+
+    if (stats->sequence) {
+        xml2json_render_legacystats_value(renderer, 1, "sequence", stats->sequence);
+        if (stats->since)
+            xml2json_render_legacystats_value(renderer, 1, "since", stats->since);
+    }
+
+    for (stat = stats->global; stat && stat->name; stat++)
+        xml2json_render_legacystats_value(renderer, 1, stat->name, stat->value);
+
+    xml2json_render_legacystats_children(renderer, extras, 1);
+
+    for (source = stats->sources; source && source->mount; source++) {
+        bool begun = false;
+
+        if (!stats->sequence) {
+            xml2json_render_legacystats_begin_source(renderer, source->mount, &sources);
+            begun = true;
+        }
+        for (stat = source->stats; stat && stat->name; stat++) {
+            if (!begun) {
+                xml2json_render_legacystats_begin_source(renderer, source->mount, &sources);
+                begun = true;
+            }
+            xml2json_render_legacystats_value(renderer, 0, stat->name, stat->value);
+        }
+        if (!stats->sequence) {
+            xmlNodePtr node = xmlNewNode(NULL, XMLSTR("source"));
+
+            add_source_extras(node);
+            xml2json_render_legacystats_children(renderer, node, 0);
+            xmlFreeNode(node);
+        }
+        if (begun)
+            json_renderer_end(renderer);
+    }
+    if (sources)
+        json_renderer_end(renderer);
+
+    for (removed = stats->removed; removed && (removed->mount || removed->name); removed++)
+        xml2json_render_legacystats_removed(renderer, removed->mount, removed->name, &removed_begun);
+    if (removed_begun)
+        json_renderer_end(renderer);
+
+    xmlFreeNode(extras);
+
+    return json_renderer_finish(&renderer);
+}
+
+static bool renders_same(const test_stats_t *stats)
+{
+    char *doc = render_doc(stats);
+    char *direct = render_direct(stats);
+    bool ret = doc && direct && strcmp(doc, direct) == 0;
+
+    if (!ret) {
+        igloo_tap_diagnostic(doc ? doc : "(null)");
+        igloo_tap_diagnostic(direct ? direct : "(null)");
+    }
+
+    free(doc);
+    free(direct);
+
+    return ret;
+}
+
+static const test_stat_t global_stats[] = {
+    {"admin", "icemaster@localhost"},
+    {"client_connections", "42"},
+    {"clients", "3"},
+    {"host", "localhost"},
+    {"listeners", "2"},
+    {"location", "Earth \"quoted\" \xc3\xa4"},
+    {"server_id", "Icecast 2.5"},
+    {"server_start_iso8601", "2024-01-01T00:00:00+0000"},
+    {"sources", "2"},
+    {"stats", "0"},
+    {NULL, NULL}
+};
+
+static const test_stat_t source_a_stats[] = {
+    {"audio_bitrate", "128000"},
+    {"audio_channels", "2"},
+    {"authenticator", ""},
+    {"genre", "various"},
+    {"ice-bitrate", "128"},
+    {"listener_peak", "5"},
+    {"listeners", "2"},
+    {"listenurl", "http://localhost:8000/a.ogg"},
+    {"max_listeners", "unlimited"},
+    {"public", "true"},
+    {"server_description", ""},
+    {"server_name", "Stream A"},
+    {"slow_listeners", "0"},
+    {"total_bytes_read", "123456789012"},
+    {"total_bytes_sent", "98765"},
+    {NULL, NULL}
+};
+
+static const test_stat_t source_b_stats[] = {
+    {"authenticator", "url"},
+    {"connected", "3600"},
+    {"listeners", "0"},
+    {"max_listeners", "100"},
+    {"public", "false"},
+    {"server_type", "audio/mpeg"},
+    {NULL, NULL}
+};
+
+static const test_source_t all_sources[] = {
+    {"/a.ogg", source_a_stats},
+    {"/b.mp3", source_b_stats},
+    {"/empty", NULL},
+    {NULL, NULL}
+};
+
+static void test_full(void)
+{
+    const test_stats_t empty = {NULL, NULL, NULL, NULL, NULL};
+    const test_stats_t global_only = {NULL, NULL, global_stats, NULL, NULL};
+    const test_stats_t full = {NULL, NULL, global_stats, all_sources, NULL};
+
+    igloo_tap_test("empty", renders_same(&empty));
+    igloo_tap_test("global only", renders_same(&global_only));
+    igloo_tap_test("global and sources", renders_same(&full));
+}
+
+static void test_delta(void)
+{
+    static const test_stat_t changed_global[] = {
+        {"clients", "4"},
+        {"stats", "1"},
+        {NULL, NULL}
+    };
+    static const test_stat_t changed_source[] = {
+        {"listeners", "3"},
+        {"public", "true"},
+        {"total_bytes_sent", "100000"},
+        {NULL, NULL}
+    };
+    static const test_source_t changed_sources[] = {
+        {"/a.ogg", changed_source},
+        {"/unchanged", NULL},
+        {NULL, NULL}
+    };
+    static const test_removed_t removed[] = {
+        {"/gone", NULL},
+        {"/a.ogg", "genre"},
+        {NULL, "location"},
+        {NULL, NULL}
+    };
+    const test_stats_t nothing = {"1f3a-120", "1f3a-120", NULL, NULL, NULL};
+    const test_stats_t all = {"1f3a-120", NULL, global_stats, all_sources, NULL};
+    const test_stats_t changes = {"1f3a-130", "1f3a-120", changed_global, changed_sources, NULL};
+    const test_stats_t removals = {"1f3a-130", "1f3a-120", NULL, NULL, removed};
+    const test_stats_t both = {"1f3a-130", "1f3a-120", changed_global, changed_sources, removed};
+
+    igloo_tap_test("nothing changed", renders_same(&nothing));
+    igloo_tap_test("since too old", renders_same(&all));
+    igloo_tap_test("changes", renders_same(&changes));
+    igloo_tap_test("removals", renders_same(&removals));
+    igloo_tap_test("changes and removals", renders_same(&both));
+}
+
+int main (void)
+{
+    igloo_tap_init();
+    igloo_tap_exit_on(igloo_TAP_EXIT_ON_FIN|igloo_TAP_EXIT_ON_BAIL_OUT, NULL);
+
+    igloo_tap_group_run("full", test_full);
+    igloo_tap_group_run("delta", test_delta);
+
+    igloo_tap_fin();
+
+    return EXIT_FAILURE; // return failure as we should never reach this point!
+}
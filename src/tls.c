@@ -17,10 +17,21 @@
 #ifdef HAVE_OPENSSL
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif
 #endif
 
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
+#include <time.h>
+
+#include "common/thread/thread.h"
 
 #include "tls.h"
 
@@ -43,9 +54,24 @@ int        tls_check_impl(const char *impl)
 }
 
 #ifdef HAVE_OPENSSL
+/* key material for session tickets, see tls_ticket_key_cb() */
+typedef struct {
+    unsigned char name[16];
+    unsigned char aes_key[32];
+    unsigned char hmac_key[32];
+} tls_ticket_key_t;
+
 struct tls_ctx_tag {
     size_t refc;
     SSL_CTX *ctx;
+
+    /* ticket keys: [0] encrypts new tickets, [1] is the previous key that is
+     * still accepted for one more rotation interval */
+    mutex_t ticket_lock;
+    time_t ticket_rotation;
+    time_t ticket_time;
+    tls_ticket_key_t ticket_keys[2];
+    size_t ticket_keys_len;
 };
 
 struct tls_tag {
@@ -54,14 +80,224 @@ struct tls_tag {
     tls_ctx_t *ctx;
     bool error;
     bool no_shutdown;
+    bool handshake_done;
+    bool write_pending;
+    bool resumption;
 };
 
+/* The counters are updated on every read and write, with C11 atomics this
+ * needs no lock shared by all threads.
+ */
+#if defined(HAVE_STDATOMIC_H) && !defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+typedef atomic_ullong tls_stat_t;
+#define tls_stat_add(stat,v) atomic_fetch_add_explicit(&(stat), (v), memory_order_relaxed)
+#define tls_stat_get(stat)   atomic_load_explicit(&(stat), memory_order_relaxed)
+#else
+typedef unsigned long long tls_stat_t;
+static spin_t tls_stats_lock;
+#define TLS_STATS_LOCK 1
+#define tls_stat_add(stat,v) do { thread_spin_lock(&tls_stats_lock); (stat) += (v); thread_spin_unlock(&tls_stats_lock); } while (0)
+#define tls_stat_get(stat)   (stat)
+#endif
+
+static tls_stat_t tls_stat_handshakes;
+static tls_stat_t tls_stat_handshakes_resumed;
+static tls_stat_t tls_stat_handshake_failures;
+static tls_stat_t tls_stat_ktls;
+static tls_stat_t tls_stat_cpu_usec;
+
 void       tls_initialize(void)
 {
+#ifdef TLS_STATS_LOCK
+    thread_spin_create(&tls_stats_lock);
+#endif
 }
 
 void       tls_shutdown(void)
 {
+#ifdef TLS_STATS_LOCK
+    thread_spin_destroy(&tls_stats_lock);
+#endif
+}
+
+void       tls_get_stats(tls_stats_t *stats)
+{
+#ifdef TLS_STATS_LOCK
+    thread_spin_lock(&tls_stats_lock);
+#endif
+    stats->handshakes = tls_stat_get(tls_stat_handshakes);
+    stats->handshakes_resumed = tls_stat_get(tls_stat_handshakes_resumed);
+    stats->handshake_failures = tls_stat_get(tls_stat_handshake_failures);
+    stats->ktls = tls_stat_get(tls_stat_ktls);
+    stats->cpu_usec = tls_stat_get(tls_stat_cpu_usec);
+#ifdef TLS_STATS_LOCK
+    thread_spin_unlock(&tls_stats_lock);
+#endif
+}
+
+/* CPU time of the calling thread, used to account the time spent inside
+ * the TLS library */
+static inline unsigned long long tls_cpu_usec(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_THREAD_CPUTIME_ID)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+        return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+#endif
+    return 0;
+}
+
+/* accounts the CPU time since start and, once the handshake finished,
+ * whether it was a full or a resumed one */
+static void tls_account(tls_t *tls, unsigned long long start, int ret)
+{
+    unsigned long long used = tls_cpu_usec() - start;
+    bool finished = false;
+    bool failed = false;
+
+    if (!tls->handshake_done) {
+        if (SSL_is_init_finished(tls->ssl)) {
+            tls->handshake_done = true;
+            finished = true;
+        } else if (ret <= 0 && tls->error) {
+            tls->handshake_done = true;
+            failed = true;
+        }
+    }
+
+    if (used)
+        tls_stat_add(tls_stat_cpu_usec, used);
+    if (finished) {
+        tls_stat_add(tls_stat_handshakes, 1);
+        if (SSL_session_reused(tls->ssl))
+            tls_stat_add(tls_stat_handshakes_resumed, 1);
+    }
+    if (failed)
+        tls_stat_add(tls_stat_handshake_failures, 1);
+}
+
+/* creates a new ticket key, keeping the current one as the previous key if
+ * it is not older than two rotation intervals */
+static bool tls_ctx_rotate_ticket_keys(tls_ctx_t *ctx, time_t now)
+{
+    tls_ticket_key_t key;
+
+    if (ctx->ticket_keys_len && (now - ctx->ticket_time) < ctx->ticket_rotation)
+        return true;
+
+    if (RAND_bytes(key.name, sizeof(key.name)) != 1 ||
+        RAND_bytes(key.aes_key, sizeof(key.aes_key)) != 1 ||
+        RAND_bytes(key.hmac_key, sizeof(key.hmac_key)) != 1) {
+        ICECAST_LOG_ERROR("Can not generate TLS session ticket key.");
+        return false;
+    }
+
+    if (ctx->ticket_keys_len && (now - ctx->ticket_time) < (2 * ctx->ticket_rotation)) {
+        ctx->ticket_keys[1] = ctx->ticket_keys[0];
+        ctx->ticket_keys_len = 2;
+    } else {
+        ctx->ticket_keys_len = 1;
+    }
+
+    ctx->ticket_keys[0] = key;
+    ctx->ticket_time = now;
+    OPENSSL_cleanse(&key, sizeof(key));
+
+    ICECAST_LOG_DEBUG("Rotated TLS session ticket keys (ctx=%p)", ctx);
+
+    return true;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+typedef EVP_MAC_CTX tls_hmac_ctx_t;
+
+static int tls_ticket_hmac_init(EVP_MAC_CTX *hctx, const unsigned char *key, size_t len)
+{
+    OSSL_PARAM params[2];
+
+    params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, (char *)"SHA256", 0);
+    params[1] = OSSL_PARAM_construct_end();
+
+    return EVP_MAC_init(hctx, key, len, params);
+}
+#else
+typedef HMAC_CTX tls_hmac_ctx_t;
+
+static int tls_ticket_hmac_init(HMAC_CTX *hctx, const unsigned char *key, size_t len)
+{
+    return HMAC_Init_ex(hctx, key, len, EVP_sha256(), NULL);
+}
+#endif
+
+/* Encrypts and decrypts session tickets with our own keys so they can be
+ * rotated. Returns 1 if the key was found, 2 if the ticket should be
+ * renewed as it was encrypted with the previous key, 0 if the ticket is not
+ * accepted or none should be issued, and -1 on error.
+ */
+static int tls_ticket_key_cb(SSL *ssl, unsigned char key_name[16], unsigned char *iv, EVP_CIPHER_CTX *cctx, tls_hmac_ctx_t *hctx, int enc)
+{
+    tls_ctx_t *ctx = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+    const EVP_CIPHER *cipher = EVP_aes_256_cbc();
+    tls_ticket_key_t key;
+    int ret = 0;
+    size_t i;
+
+    if (!ctx)
+        return -1;
+
+    thread_mutex_lock(&(ctx->ticket_lock));
+    if (!tls_ctx_rotate_ticket_keys(ctx, time(NULL))) {
+        thread_mutex_unlock(&(ctx->ticket_lock));
+        return enc ? 0 : -1;
+    }
+
+    if (enc) {
+        key = ctx->ticket_keys[0];
+        ret = 1;
+    } else {
+        for (i = 0; i < ctx->ticket_keys_len; i++) {
+            if (memcmp(key_name, ctx->ticket_keys[i].name, sizeof(ctx->ticket_keys[i].name)) == 0) {
+                key = ctx->ticket_keys[i];
+                ret = i == 0 ? 1 : 2;
+                break;
+            }
+        }
+    }
+    thread_mutex_unlock(&(ctx->ticket_lock));
+
+    if (!ret)
+        return 0;
+
+    if (enc) {
+        memcpy(key_name, key.name, sizeof(key.name));
+        if (RAND_bytes(iv, EVP_CIPHER_iv_length(cipher)) != 1 ||
+            EVP_EncryptInit_ex(cctx, cipher, NULL, key.aes_key, iv) != 1)
+            ret = -1;
+    } else {
+        if (EVP_DecryptInit_ex(cctx, cipher, NULL, key.aes_key, iv) != 1)
+            ret = -1;
+    }
+
+    if (ret > 0 && tls_ticket_hmac_init(hctx, key.hmac_key, sizeof(key.hmac_key)) != 1)
+        ret = -1;
+
+    OPENSSL_cleanse(&key, sizeof(key));
+
+    return ret;
+}
+
+/* sessions of a connection that does not allow resumption are not kept */
+static int tls_new_session_cb(SSL *ssl, SSL_SESSION *session)
+{
+    tls_t *tls = SSL_get_app_data(ssl);
+
+    if (tls && !tls->resumption)
+        SSL_CTX_remove_session(SSL_get_SSL_CTX(ssl), session);
+
+    /* we did not take a reference on the session */
+    return 0;
 }
 
 tls_ctx_t *tls_ctx_new(const char *cert_file, const char *key_file, const char *cipher_list)
@@ -77,9 +313,12 @@ tls_ctx_t *tls_ctx_new(const char *cert_file, const char *key_file, const char *
         return NULL;
 
     ctx->refc = 1;
+    thread_mutex_create(&(ctx->ticket_lock));
 
     ctx->ctx = SSL_CTX_new(TLS_server_method());
+    SSL_CTX_set_app_data(ctx->ctx, ctx);
     SSL_CTX_set_min_proto_version(ctx->ctx, TLS1_2_VERSION);
+    SSL_CTX_sess_set_new_cb(ctx->ctx, tls_new_session_cb);
 
 #ifdef SSL_OP_NO_COMPRESSION
     ssl_opts |= SSL_OP_NO_COMPRESSION;             // Never use compression
@@ -138,9 +377,59 @@ void       tls_ctx_unref(tls_ctx_t *ctx)
     if (ctx->ctx)
         SSL_CTX_free(ctx->ctx);
 
+    OPENSSL_cleanse(ctx->ticket_keys, sizeof(ctx->ticket_keys));
+    thread_mutex_destroy(&(ctx->ticket_lock));
     free(ctx);
 }
 
+void       tls_ctx_set_session_cache(tls_ctx_t *ctx, size_t cache_size, unsigned int timeout, unsigned int ticket_rotation)
+{
+    if (!ctx)
+        return;
+
+    if (cache_size) {
+        SSL_CTX_set_session_cache_mode(ctx->ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(ctx->ctx, cache_size);
+    } else {
+        SSL_CTX_set_session_cache_mode(ctx->ctx, SSL_SESS_CACHE_OFF);
+    }
+
+    if (timeout)
+        SSL_CTX_set_timeout(ctx->ctx, timeout);
+
+    if (ticket_rotation) {
+        ctx->ticket_rotation = ticket_rotation;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx->ctx, tls_ticket_key_cb);
+#else
+        SSL_CTX_set_tlsext_ticket_key_cb(ctx->ctx, tls_ticket_key_cb);
+#endif
+    } else {
+        SSL_CTX_set_options(ctx->ctx, SSL_OP_NO_TICKET);
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+        SSL_CTX_set_num_tickets(ctx->ctx, 0);
+#endif
+    }
+
+    ICECAST_LOG_INFO("TLS session cache: %zu sessions, timeout %us, ticket key rotation %us", cache_size, timeout, ticket_rotation);
+}
+
+void       tls_ctx_take_ticket_keys(tls_ctx_t *ctx, tls_ctx_t *old)
+{
+    if (!ctx || !old || ctx == old || !ctx->ticket_rotation)
+        return;
+
+    /* ctx is not yet used by any connection, old may still be */
+    thread_mutex_lock(&(old->ticket_lock));
+    memcpy(ctx->ticket_keys, old->ticket_keys, sizeof(ctx->ticket_keys));
+    ctx->ticket_keys_len = old->ticket_keys_len;
+    ctx->ticket_time = old->ticket_time;
+    thread_mutex_unlock(&(old->ticket_lock));
+
+    if (ctx->ticket_keys_len)
+        ICECAST_LOG_DEBUG("Took over %zu TLS session ticket keys (ctx=%p, old=%p)", ctx->ticket_keys_len, ctx, old);
+}
+
 tls_t     *tls_new(tls_ctx_t *ctx)
 {
     tls_t *tls;
@@ -164,6 +453,9 @@ tls_t     *tls_new(tls_ctx_t *ctx)
     tls->refc = 1;
     tls->ssl  = ssl;
     tls->ctx  = ctx;
+    tls->resumption = true;
+
+    SSL_set_app_data(ssl, tls);
 
     ICECAST_LOG_DEBUG("tls_new(ctx=%p) = %p", ctx, tls);
 
@@ -187,11 +479,13 @@ void       tls_unref(tls_t *tls)
         return;
 
     if (!tls->no_shutdown) {
+        unsigned long long start = tls_cpu_usec();
         int ret = SSL_shutdown(tls->ssl);
         if (ret < 0) {
             int error = SSL_get_error(tls->ssl, ret);
             ICECAST_LOG_DEBUG("Shutdown unsuccessful: tls=%p, ret=%i, error=%i", tls, ret, error);
         }
+        tls_account(tls, start, 1);
     }
 
     SSL_free(tls->ssl);
@@ -217,6 +511,52 @@ void       tls_set_socket(tls_t *tls, sock_t sock)
     SSL_set_fd(tls->ssl, sock);
 }
 
+void       tls_set_session_options(tls_t *tls, const char *session_id_context, bool resumption, bool ktls)
+{
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int md_len = 0;
+
+    if (!tls)
+        return;
+
+    /* sessions are only resumed on the listen socket that created them */
+    if (session_id_context && EVP_Digest(session_id_context, strlen(session_id_context), md, &md_len, EVP_sha256(), NULL) == 1) {
+        if (md_len > SSL_MAX_SID_CTX_LENGTH)
+            md_len = SSL_MAX_SID_CTX_LENGTH;
+        SSL_set_session_id_context(tls->ssl, md, md_len);
+    }
+
+    tls->resumption = resumption;
+    if (!resumption) {
+        SSL_set_options(tls->ssl, SSL_OP_NO_TICKET);
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+        SSL_set_num_tickets(tls->ssl, 0);
+#endif
+    }
+
+#ifdef SSL_OP_ENABLE_KTLS
+    if (ktls)
+        SSL_set_options(tls->ssl, SSL_OP_ENABLE_KTLS);
+#endif
+}
+
+bool       tls_ktls_send(tls_t *tls)
+{
+#ifdef SSL_OP_ENABLE_KTLS
+    if (!tls || tls->write_pending || !SSL_is_init_finished(tls->ssl))
+        return false;
+
+    if (!BIO_get_ktls_send(SSL_get_wbio(tls->ssl)))
+        return false;
+
+    tls_stat_add(tls_stat_ktls, 1);
+
+    return true;
+#else
+    return false;
+#endif
+}
+
 int        tls_want_io(tls_t *tls)
 {
     int what;
@@ -252,11 +592,13 @@ int        tls_got_shutdown(tls_t *tls)
 
 ssize_t    tls_read(tls_t *tls, void *buffer, size_t len)
 {
+    unsigned long long start;
     int ret;
 
     if (!tls)
         return -1;
 
+    start = tls_cpu_usec();
     ret = SSL_read(tls->ssl, buffer, len);
     ICECAST_LOG_DDEBUG("Read on TLS (tls=%o, ret=%i)", tls, ret);
 
@@ -269,16 +611,21 @@ ssize_t    tls_read(tls_t *tls, void *buffer, size_t len)
             tls->no_shutdown = true;
     }
 
+    tls_account(tls, start, ret);
+
     return ret;
 }
 ssize_t    tls_write(tls_t *tls, const void *buffer, size_t len)
 {
+    unsigned long long start;
     int ret;
 
     if (!tls)
         return -1;
 
+    start = tls_cpu_usec();
     ret = SSL_write(tls->ssl, buffer, len);
+    tls->write_pending = ret <= 0;
 
     if (ret <= 0) {
         switch (SSL_get_error(tls->ssl, ret)) {
@@ -286,14 +633,17 @@ ssize_t    tls_write(tls_t *tls, const void *buffer, size_t len)
                 tls->no_shutdown = true;
                 /* fall thru */
             case SSL_ERROR_SYSCALL:
-                return -1;
+                tls->error = true;
+                ret = -1;
                 break;
             default:
-                return 0;
+                ret = 0;
                 break;
         }
     }
 
+    tls_account(tls, start, ret);
+
     return ret;
 }
 
@@ -311,6 +661,11 @@ void       tls_shutdown(void)
 {
 }
 
+void       tls_get_stats(tls_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
 tls_ctx_t *tls_ctx_new(const char *cert_file, const char *key_file, const char *cipher_list)
 {
     return NULL;
@@ -321,6 +676,12 @@ void       tls_ctx_ref(tls_ctx_t *ctx)
 void       tls_ctx_unref(tls_ctx_t *ctx)
 {
 }
+void       tls_ctx_set_session_cache(tls_ctx_t *ctx, size_t cache_size, unsigned int timeout, unsigned int ticket_rotation)
+{
+}
+void       tls_ctx_take_ticket_keys(tls_ctx_t *ctx, tls_ctx_t *old)
+{
+}
 
 tls_t     *tls_new(tls_ctx_t *ctx)
 {
@@ -339,6 +700,13 @@ void       tls_set_incoming(tls_t *tls)
 void       tls_set_socket(tls_t *tls, sock_t sock)
 {
 }
+void       tls_set_session_options(tls_t *tls, const char *session_id_context, bool resumption, bool ktls)
+{
+}
+bool       tls_ktls_send(tls_t *tls)
+{
+    return false;
+}
 
 int        tls_want_io(tls_t *tls)
 {
@@ -22,15 +22,29 @@
 typedef struct tls_ctx_tag tls_ctx_t;
 typedef struct tls_tag tls_t;
 
+typedef struct {
+    unsigned long long handshakes;          /* completed handshakes */
+    unsigned long long handshakes_resumed;  /* of those, resumed sessions */
+    unsigned long long handshake_failures;
+    unsigned long long ktls;                /* connections moved to kernel TLS */
+    unsigned long long cpu_usec;            /* thread CPU time spent in the TLS library */
+} tls_stats_t;
+
 /* Check for a specific implementation. Returns 0 if supported, 1 if unsupported and -1 on error. */
 int        tls_check_impl(const char *impl);
 
 void       tls_initialize(void);
 void       tls_shutdown(void);
 
+void       tls_get_stats(tls_stats_t *stats);
+
 tls_ctx_t *tls_ctx_new(const char *cert_file, const char *key_file, const char *cipher_list);
 void       tls_ctx_ref(tls_ctx_t *ctx);
 void       tls_ctx_unref(tls_ctx_t *ctx);
+/* cache_size of 0 disables the server side session cache, ticket_rotation of 0 disables session tickets */
+void       tls_ctx_set_session_cache(tls_ctx_t *ctx, size_t cache_size, unsigned int timeout, unsigned int ticket_rotation);
+/* copies the session ticket keys of old to ctx, so tickets issued before a reload stay valid */
+void       tls_ctx_take_ticket_keys(tls_ctx_t *ctx, tls_ctx_t *old);
 
 tls_t     *tls_new(tls_ctx_t *ctx);
 void       tls_ref(tls_t *tls);
@@ -38,6 +52,13 @@ void       tls_unref(tls_t *tls);
 
 void       tls_set_incoming(tls_t *tls);
 void       tls_set_socket(tls_t *tls, sock_t sock);
+/* must be called before the handshake */
+void       tls_set_session_options(tls_t *tls, const char *session_id_context, bool resumption, bool ktls);
+/* Returns true once the kernel encrypts everything sent on the socket, so
+ * plain send() and sendfile() can be used from now on. Reads must still go
+ * through tls_read(). Counted as a kTLS connection, so only ask once per
+ * successful answer. */
+bool       tls_ktls_send(tls_t *tls);
 
 int        tls_want_io(tls_t *tls);
 
@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 
 #ifdef HAVE_SYS_SOCKET_H
 #include <sys/socket.h>
@@ -74,32 +75,75 @@
  *           0 if no activity occurs
  *         < 0 for error.
  */
-int util_timed_wait_for_fd(sock_t fd, int timeout)
+static int __timed_wait_for_fd(sock_t fd, int timeout, bool write)
 {
 #ifdef HAVE_POLL
     struct pollfd ufds;
 
     ufds.fd = fd;
-    ufds.events = POLLIN;
+    ufds.events = write ? POLLOUT : POLLIN;
     ufds.revents = 0;
 
     return poll(&ufds, 1, timeout);
 #else
-    fd_set rfds;
+    fd_set fds;
     struct timeval tv, *p=NULL;
 
-    FD_ZERO(&rfds);
-    FD_SET(fd, &rfds);
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
 
     if(timeout >= 0) {
         tv.tv_sec = timeout/1000;
         tv.tv_usec = (timeout % 1000)*1000;
         p = &tv;
     }
-    return select(fd+1, &rfds, NULL, NULL, p);
+    return select(fd+1, write ? NULL : &fds, write ? &fds : NULL, NULL, p);
 #endif
 }
 
+int util_timed_wait_for_fd(sock_t fd, int timeout)
+{
+    return __timed_wait_for_fd(fd, timeout, false);
+}
+
+/* same as util_timed_wait_for_fd(), waits for fd to become writable */
+int util_timed_wait_for_fd_write(sock_t fd, int timeout)
+{
+    return __timed_wait_for_fd(fd, timeout, true);
+}
+
+/* monotonic time in microseconds, for measuring intervals only */
+uint64_t util_time_monotonic_usec(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+        return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+#ifdef HAVE_GETTIMEOFDAY
+    {
+        struct timeval tv;
+
+        if (gettimeofday(&tv, NULL) == 0)
+            return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+    }
+#endif
+    return (uint64_t)time(NULL) * 1000000;
+}
+
+/* CPU time used by the calling thread in microseconds, 0 if not supported */
+uint64_t util_time_thread_cpu_usec(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_THREAD_CPUTIME_ID)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+        return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+    return 0;
+}
+
 int util_read_header(sock_t sock, char *buff, unsigned long len, int entire)
 {
     int read_bytes, ret;
@@ -17,6 +17,7 @@
 /* for FILE* */
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "common/net/sock.h"
 #include "icecasttypes.h"
@@ -32,6 +33,9 @@
 #define MAX_LINE_LEN 512
 
 int util_timed_wait_for_fd(sock_t fd, int timeout);
+int util_timed_wait_for_fd_write(sock_t fd, int timeout);
+uint64_t util_time_monotonic_usec(void);
+uint64_t util_time_thread_cpu_usec(void);
 int util_read_header(sock_t sock, char *buff, unsigned long len, int entire);
 int util_check_valid_extension(const char *uri);
 char *util_get_extension(const char *path);
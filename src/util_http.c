@@ -0,0 +1,382 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "util_http.h"
+
+static const char *const months[12] = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+static const char *const weekdays[7] = {
+    "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
+};
+
+static inline const char *skip_ows(const char *p)
+{
+    while (*p == ' ' || *p == '\t')
+        p++;
+    return p;
+}
+
+static inline bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+/* reads a non empty run of digits, fails on overflow */
+static bool parse_u64(const char **p, uint64_t *value)
+{
+    const char *c = *p;
+    uint64_t ret = 0;
+
+    if (!is_digit(*c))
+        return false;
+
+    for (; is_digit(*c); c++) {
+        unsigned int digit = *c - '0';
+
+        if (ret > (UINT64_MAX - digit) / 10)
+            return false;
+        ret = ret * 10 + digit;
+    }
+
+    *p = c;
+    *value = ret;
+    return true;
+}
+
+static int compare_ranges(const void *a, const void *b)
+{
+    const util_http_range_t *ra = a, *rb = b;
+
+    if (ra->start < rb->start)
+        return -1;
+    if (ra->start > rb->start)
+        return 1;
+    return 0;
+}
+
+util_http_range_result_t util_http_range_parse(const char *header, uint64_t size, util_http_range_t *ranges, size_t *count, size_t max)
+{
+    const char *p;
+    size_t specs = 0;
+    size_t len = 0;
+    size_t i;
+
+    *count = 0;
+
+    if (!header || !max)
+        return UTIL_HTTP_RANGE_NONE;
+
+    p = skip_ows(header);
+    if (strncasecmp(p, "bytes", 5) != 0)
+        return UTIL_HTTP_RANGE_NONE;
+    p = skip_ows(p + 5);
+    if (*p != '=')
+        return UTIL_HTTP_RANGE_NONE;
+    p++;
+
+    while (1) {
+        uint64_t first, last;
+        bool suffix = false, open = false;
+
+        p = skip_ows(p);
+
+        /* empty list elements are allowed */
+        if (*p == ',') {
+            p++;
+            continue;
+        }
+        if (*p == 0)
+            break;
+
+        if (*p == '-') {
+            p++;
+            suffix = true;
+            if (!parse_u64(&p, &last))
+                return UTIL_HTTP_RANGE_NONE;
+        } else {
+            if (!parse_u64(&p, &first) || *p != '-')
+                return UTIL_HTTP_RANGE_NONE;
+            p++;
+            if (is_digit(*p)) {
+                if (!parse_u64(&p, &last) || last < first)
+                    return UTIL_HTTP_RANGE_NONE;
+            } else {
+                open = true;
+            }
+        }
+
+        p = skip_ows(p);
+        if (*p != ',' && *p != 0)
+            return UTIL_HTTP_RANGE_NONE;
+
+        /* too many ranges, this is not a client trying to seek */
+        if (++specs > max)
+            return UTIL_HTTP_RANGE_NONE;
+
+        if (suffix) {
+            if (last == 0 || size == 0)
+                continue;
+            ranges[len].start = last < size ? size - last : 0;
+            ranges[len].end = size - 1;
+        } else {
+            if (first >= size)
+                continue;
+            ranges[len].start = first;
+            ranges[len].end = (open || last >= size) ? size - 1 : last;
+        }
+        len++;
+    }
+
+    if (!specs)
+        return UTIL_HTTP_RANGE_NONE;
+    if (!len)
+        return UTIL_HTTP_RANGE_UNSATISFIABLE;
+
+    /* merge what overlaps or touches so no byte is sent twice */
+    qsort(ranges, len, sizeof(*ranges), compare_ranges);
+    *count = 1;
+    for (i = 1; i < len; i++) {
+        util_http_range_t *cur = &ranges[*count - 1];
+
+        if (ranges[i].start <= cur->end + 1) {
+            if (ranges[i].end > cur->end)
+                cur->end = ranges[i].end;
+        } else {
+            ranges[(*count)++] = ranges[i];
+        }
+    }
+
+    return UTIL_HTTP_RANGE_OK;
+}
+
+bool util_http_etag_match(const char *list, const char *etag, bool weak)
+{
+    const char *p;
+    size_t etag_len;
+
+    if (!list || !etag)
+        return false;
+
+    p = skip_ows(list);
+    if (*p == '*')
+        return *skip_ows(p + 1) == 0;
+
+    if (strncmp(etag, "W/", 2) == 0) {
+        if (!weak)
+            return false;
+        etag += 2;
+    }
+    etag_len = strlen(etag);
+
+    while (*p) {
+        bool is_weak = false;
+        const char *end;
+
+        if (*p == ',') {
+            p = skip_ows(p + 1);
+            continue;
+        }
+
+        if (strncmp(p, "W/", 2) == 0) {
+            is_weak = true;
+            p += 2;
+        }
+        if (*p != '"')
+            return false;
+        end = strchr(p + 1, '"');
+        if (!end)
+            return false;
+        end++;
+
+        if ((weak || !is_weak) && (size_t)(end - p) == etag_len && strncmp(p, etag, etag_len) == 0)
+            return true;
+
+        p = skip_ows(end);
+    }
+
+    return false;
+}
+
+/* days since 1970-01-01 of a date in the proleptic Gregorian calendar */
+static int64_t days_from_civil(int64_t y, unsigned int m, unsigned int d)
+{
+    int64_t era;
+    unsigned int yoe, doy, doe;
+
+    y -= m <= 2;
+    era = (y >= 0 ? y : y - 399) / 400;
+    yoe = (unsigned int)(y - era * 400);
+    doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + (int64_t)doe - 719468;
+}
+
+static void civil_from_days(int64_t z, int64_t *y, unsigned int *m, unsigned int *d)
+{
+    int64_t era;
+    unsigned int doe, yoe, doy, mp;
+
+    z += 719468;
+    era = (z >= 0 ? z : z - 146096) / 146097;
+    doe = (unsigned int)(z - era * 146097);
+    yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    mp = (5 * doy + 2) / 153;
+    *d = doy - (153 * mp + 2) / 5 + 1;
+    *m = mp < 10 ? mp + 3 : mp - 9;
+    *y = (int64_t)yoe + era * 400 + (*m <= 2);
+}
+
+static bool parse_number(const char **p, unsigned int min_digits, unsigned int max_digits, unsigned int *value)
+{
+    const char *c = *p;
+    unsigned int ret = 0;
+    unsigned int digits = 0;
+
+    while (is_digit(*c) && digits < max_digits) {
+        ret = ret * 10 + (*c - '0');
+        c++;
+        digits++;
+    }
+
+    if (digits < min_digits || is_digit(*c))
+        return false;
+
+    *p = c;
+    *value = ret;
+    return true;
+}
+
+static bool parse_month(const char **p, unsigned int *month)
+{
+    unsigned int i;
+
+    for (i = 0; i < 12; i++) {
+        if (strncmp(*p, months[i], 3) == 0) {
+            *p += 3;
+            *month = i + 1;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool parse_time(const char **p, unsigned int *hour, unsigned int *min, unsigned int *sec)
+{
+    if (!parse_number(p, 2, 2, hour) || **p != ':')
+        return false;
+    (*p)++;
+    if (!parse_number(p, 2, 2, min) || **p != ':')
+        return false;
+    (*p)++;
+    return parse_number(p, 2, 2, sec);
+}
+
+static inline bool expect(const char **p, const char *str)
+{
+    size_t len = strlen(str);
+
+    if (strncmp(*p, str, len) != 0)
+        return false;
+    *p += len;
+    return true;
+}
+
+bool util_http_date_parse(const char *str, time_t *t)
+{
+    const char *p, *name;
+    unsigned int year = 0, month = 0, day = 0, hour = 0, min = 0, sec = 0;
+    int64_t value;
+
+    if (!str)
+        return false;
+
+    /* day name, short in IMF-fixdate and asctime, long in rfc850-date */
+    p = name = skip_ows(str);
+    while ((*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z'))
+        p++;
+    if (p == name)
+        return false;
+
+    if (*p == ',') {
+        p++;
+        if (!expect(&p, " ") || !parse_number(&p, 2, 2, &day))
+            return false;
+
+        if (*p == ' ') {
+            /* Sun, 06 Nov 1994 08:49:37 GMT */
+            p++;
+            if (!parse_month(&p, &month) || !expect(&p, " ") ||
+                !parse_number(&p, 4, 4, &year))
+                return false;
+        } else if (*p == '-') {
+            /* Sunday, 06-Nov-94 08:49:37 GMT */
+            p++;
+            if (!parse_month(&p, &month) || !expect(&p, "-") ||
+                !parse_number(&p, 2, 2, &year))
+                return false;
+            year += year < 70 ? 2000 : 1900;
+        } else {
+            return false;
+        }
+
+        if (!expect(&p, " ") || !parse_time(&p, &hour, &min, &sec) || !expect(&p, " GMT"))
+            return false;
+    } else {
+        /* Sun Nov  6 08:49:37 1994 */
+        if (!expect(&p, " ") || !parse_month(&p, &month) || !expect(&p, " "))
+            return false;
+        if (*p == ' ')
+            p++;
+        if (!parse_number(&p, 1, 2, &day) || !expect(&p, " ") ||
+            !parse_time(&p, &hour, &min, &sec) || !expect(&p, " ") ||
+            !parse_number(&p, 4, 4, &year))
+            return false;
+    }
+
+    if (day < 1 || day > 31 || hour > 23 || min > 59 || sec > 60)
+        return false;
+
+    value = days_from_civil(year, month, day) * 86400 + hour * 3600 + min * 60 + sec;
+    if ((time_t)value != value)
+        return false;
+
+    *t = (time_t)value;
+    return true;
+}
+
+int util_http_date_format(char *buf, size_t len, time_t t)
+{
+    int64_t days = (int64_t)t / 86400;
+    int64_t secs = (int64_t)t % 86400;
+    int64_t year;
+    unsigned int month, day;
+
+    if (secs < 0) {
+        secs += 86400;
+        days--;
+    }
+
+    civil_from_days(days, &year, &month, &day);
+
+    /* 1970-01-01 was a Thursday */
+    return snprintf(buf, len, "%s, %02u %s %04lld %02u:%02u:%02u GMT",
+                    weekdays[((days % 7) + 11) % 7], day, months[month - 1], (long long int)year,
+                    (unsigned int)(secs / 3600), (unsigned int)(secs / 60 % 60), (unsigned int)(secs % 60));
+}
@@ -0,0 +1,58 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ */
+
+/* functions defined in here parse and format HTTP header values and do not
+ * depend on anything but the standard C runtime.
+ */
+
+#ifndef __UTIL_HTTP_H__
+#define __UTIL_HTTP_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+/* upper limit of ranges accepted in one Range header, see RFC 7233 section 6.1 */
+#define UTIL_HTTP_RANGE_MAX     32
+
+/* length of a date as formatted by util_http_date_format() including the \0 */
+#define UTIL_HTTP_DATE_LEN      30
+
+typedef struct {
+    uint64_t start;
+    /* last byte of the range, inclusive */
+    uint64_t end;
+} util_http_range_t;
+
+typedef enum {
+    /* no range, or one to be ignored, send the full body */
+    UTIL_HTTP_RANGE_NONE,
+    /* *count ranges were stored */
+    UTIL_HTTP_RANGE_OK,
+    /* valid but none of the ranges overlaps the body, send a 416 */
+    UTIL_HTTP_RANGE_UNSATISFIABLE
+} util_http_range_result_t;
+
+/* Parses a Range header for a body of size bytes. Satisfiable ranges are
+ * clipped to the body, sorted and overlapping or adjacent ranges are merged.
+ * Headers with syntax errors, other units or more than max ranges are
+ * ignored as RFC 7233 allows.
+ */
+util_http_range_result_t util_http_range_parse(const char *header, uint64_t size, util_http_range_t *ranges, size_t *count, size_t max);
+
+/* Checks if etag is in the comma separated list of entity tags as used by
+ * If-None-Match (weak comparison) and If-Range (strong comparison).
+ * A list of "*" matches any tag.
+ */
+bool util_http_etag_match(const char *list, const char *etag, bool weak);
+
+/* Parses HTTP dates in all three formats of RFC 7231 section 7.1.1.1 */
+bool util_http_date_parse(const char *str, time_t *t);
+/* Formats t as IMF-fixdate, buf should hold UTIL_HTTP_DATE_LEN bytes */
+int util_http_date_format(char *buf, size_t len, time_t t);
+
+#endif  /* __UTIL_HTTP_H__ */
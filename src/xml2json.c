@@ -41,6 +41,7 @@ struct nodelist {
 
 static void render_node(json_renderer_t *renderer, xmlDocPtr doc, xmlNodePtr node, xmlNodePtr parent, struct xml2json_cache *cache);
 static void render_node_generic(json_renderer_t *renderer, xmlDocPtr doc, xmlNodePtr node, xmlNodePtr parent, struct xml2json_cache *cache);
+static void render_node_legacystats(json_renderer_t *renderer, xmlDocPtr doc, xmlNodePtr node, xmlNodePtr parent, struct xml2json_cache *cache);
 
 static void nodelist_init(struct nodelist *list)
 {
@@ -152,16 +153,6 @@ static void handle_textchildnode(json_renderer_t *renderer, xmlDocPtr doc, xmlNo
     }
 }
 
-static void handle_booleanchildnode(json_renderer_t *renderer, xmlDocPtr doc, xmlNodePtr node, xmlNodePtr parent, struct xml2json_cache *cache)
-{
-    xmlChar *value = xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
-    if (value) {
-        json_renderer_write_key(renderer, (const char *)node->name, JSON_RENDERER_FLAGS_NONE);
-        json_renderer_write_boolean(renderer, util_str_to_bool((const char*)value));
-        xmlFree(value);
-    }
-}
-
 static int handle_node_modules(json_renderer_t *renderer, xmlDocPtr doc, xmlNodePtr node, xmlNodePtr parent, struct xml2json_cache *cache)
 {
     if (node->type == XML_ELEMENT_NODE && strcmp((const char *)node->name, "modules") == 0) {
@@ -261,320 +252,367 @@ static void render_node_legacyresponse(json_renderer_t *renderer, xmlDocPtr doc,
         render_node_generic(renderer, doc, node, parent, cache);
 }
 
-static int handle_simple_child(json_renderer_t *renderer, xmlDocPtr doc, xmlNodePtr node, xmlNodePtr parent, struct xml2json_cache *cache, xmlNodePtr child, const char * number_keys[], const char * boolean_keys[])
+static const char * legacystats_number_keys_global[] = {
+    "listeners", "clients", "client_connections", "connections", "file_connections", "listener_connections",
+    "source_client_connections", "source_relay_connections", "source_total_connections", "sources", "stats", "stats_connections",
+    NULL
+};
+static const char * legacystats_boolean_keys_global[] = {
+    NULL
+};
+static const char * legacystats_number_keys_source[] = {
+    "audio_bitrate", "audio_channels", "audio_samplerate", "ice-bitrate", "listener_peak", "listeners", "slow_listeners",
+    "total_bytes_read", "total_bytes_sent", "connected", NULL
+};
+static const char * legacystats_boolean_keys_source[] = {
+    "public", NULL
+};
+
+static int is_in_keys(const char *name, const char * keys[])
 {
-    if (child->type == XML_ELEMENT_NODE && child->name) {
-        const char *childname = (const char *)child->name;
-        size_t i;
+    size_t i;
 
-        for (i = 0; number_keys[i]; i++) {
-            if (strcmp(childname, number_keys[i]) == 0) {
-                xmlChar *value = xmlNodeListGetString(doc, child->xmlChildrenNode, 1);
-                if (value) {
-                    json_renderer_write_key(renderer, childname, JSON_RENDERER_FLAGS_NONE);
-                    json_renderer_write_int(renderer, strtoll((const char*)value, NULL, 10));
-                    xmlFree(value);
-                    return 1;
-                }
-            }
-        }
+    for (i = 0; keys[i]; i++)
+        if (strcmp(name, keys[i]) == 0)
+            return 1;
 
-        for (i = 0; boolean_keys[i]; i++) {
-            if (strcmp(childname, boolean_keys[i]) == 0) {
-                handle_booleanchildnode(renderer, doc, child, node, cache);
-                return 1;
-            }
-        }
+    return 0;
+}
 
-        if (strcmp(childname, "max_listeners") == 0) {
-            xmlChar *value = xmlNodeListGetString(doc, child->xmlChildrenNode, 1);
-            if (value) {
-                json_renderer_write_key(renderer, childname, JSON_RENDERER_FLAGS_NONE);
-                if (strcmp((const char *)value, "unlimited") == 0) {
-                    json_renderer_write_null(renderer);
-                } else {
-                    json_renderer_write_int(renderer, strtoll((const char*)value, NULL, 10));
-                }
-                xmlFree(value);
-                return 1;
-            }
-        }
+/* writes value if name is one of the keys not rendered as string */
+static int write_typed_value(json_renderer_t *renderer, const char *name, const char *value, const char * number_keys[], const char * boolean_keys[])
+{
+    if (is_in_keys(name, number_keys)) {
+        json_renderer_write_key(renderer, name, JSON_RENDERER_FLAGS_NONE);
+        json_renderer_write_int(renderer, strtoll(value, NULL, 10));
+        return 1;
+    }
 
-        if (strcmp(childname, "authenticator") == 0) {
-            xmlChar *value = xmlNodeListGetString(doc, child->xmlChildrenNode, 1);
-            if (value) {
-                json_renderer_write_key(renderer, childname, JSON_RENDERER_FLAGS_NONE);
-                json_renderer_write_boolean(renderer, strlen((const char *)value));
-                xmlFree(value);
-                return 1;
-            }
-        }
+    if (is_in_keys(name, boolean_keys)) {
+        json_renderer_write_key(renderer, name, JSON_RENDERER_FLAGS_NONE);
+        json_renderer_write_boolean(renderer, util_str_to_bool(value));
+        return 1;
+    }
 
-        if (child->xmlChildrenNode && !child->xmlChildrenNode->next && child->xmlChildrenNode->type == XML_TEXT_NODE) {
-            handle_textchildnode(renderer, doc, child, node, cache);
-            return 1;
+    if (strcmp(name, "max_listeners") == 0) {
+        json_renderer_write_key(renderer, name, JSON_RENDERER_FLAGS_NONE);
+        if (strcmp(value, "unlimited") == 0) {
+            json_renderer_write_null(renderer);
+        } else {
+            json_renderer_write_int(renderer, strtoll(value, NULL, 10));
         }
+        return 1;
+    }
+
+    if (strcmp(name, "authenticator") == 0) {
+        json_renderer_write_key(renderer, name, JSON_RENDERER_FLAGS_NONE);
+        json_renderer_write_boolean(renderer, strlen(value));
+        return 1;
     }
 
     return 0;
 }
 
-static void render_node_legacystats(json_renderer_t *renderer, xmlDocPtr doc, xmlNodePtr node, xmlNodePtr parent, struct xml2json_cache *cache)
+static int handle_simple_child(json_renderer_t *renderer, xmlDocPtr doc, xmlNodePtr node, xmlNodePtr parent, struct xml2json_cache *cache, xmlNodePtr child, const char * number_keys[], const char * boolean_keys[])
 {
-    static const char * number_keys_global[] = {
-        "listeners", "clients", "client_connections", "connections", "file_connections", "listener_connections",
-        "source_client_connections", "source_relay_connections", "source_total_connections", "sources", "stats", "stats_connections", NULL
-    };
-    static const char * boolean_keys_global[] = {
-        NULL
-    };
-    static const char * number_keys_source[] = {
-        "audio_bitrate", "audio_channels", "audio_samplerate", "ice-bitrate", "listener_peak", "listeners", "slow_listeners",
-        "total_bytes_read", "total_bytes_sent", "connected", NULL
-    };
-    static const char * boolean_keys_source[] = {
-        "public", NULL
-    };
+    if (child->type == XML_ELEMENT_NODE && child->name) {
+        const char *childname = (const char *)child->name;
+        xmlChar *value = xmlNodeListGetString(doc, child->xmlChildrenNode, 1);
+        int handled = 0;
+
+        if (!value)
+            return is_in_keys(childname, boolean_keys);
+
+        if (write_typed_value(renderer, childname, (const char *)value, number_keys, boolean_keys)) {
+            handled = 1;
+        } else if (child->xmlChildrenNode && !child->xmlChildrenNode->next && child->xmlChildrenNode->type == XML_TEXT_NODE) {
+            json_renderer_write_key(renderer, childname, JSON_RENDERER_FLAGS_NONE);
+            json_renderer_write_string(renderer, (const char*)value, JSON_RENDERER_FLAGS_NONE);
+            handled = 1;
+        }
 
-    int handled = 0;
+        xmlFree(value);
+        return handled;
+    }
 
-    if (node->type == XML_ELEMENT_NODE) {
-        const char *nodename = (const char *)node->name;
-        handled = 1;
-        if (strcmp(nodename, "icestats") == 0 || strcmp(nodename, "source") == 0 || strcmp(nodename, "listener") == 0) {
-            int is_icestats = strcmp(nodename, "icestats") == 0;
-            struct nodelist nodelist;
-            size_t i;
-            size_t len;
+    return 0;
+}
 
-            nodelist_init(&nodelist);
+/* renders the children of an icestats, source or listener node as members
+ * of the object already begun */
+static void render_legacystats_children(json_renderer_t *renderer, xmlDocPtr doc, xmlNodePtr node, xmlNodePtr parent, struct xml2json_cache *cache, int is_icestats)
+{
+    struct nodelist nodelist;
+    size_t i;
+    size_t len;
 
-            if (is_icestats) {
-                json_renderer_begin(renderer, JSON_ELEMENT_TYPE_ARRAY);
-                handle_node_identification(renderer, "icestats", XMLNS_LEGACY_STATS, NULL, NULL, NULL);
+    nodelist_init(&nodelist);
+
+    if (node->xmlChildrenNode) {
+        xmlNodePtr cur = node->xmlChildrenNode;
+        do {
+            if (!handle_simple_child(renderer, doc, node, parent, cache, cur,
+                        is_icestats ? legacystats_number_keys_global : legacystats_number_keys_source,
+                        is_icestats ? legacystats_boolean_keys_global : legacystats_boolean_keys_source
+                        )) {
+                nodelist_push(&nodelist, cur);
             }
-            json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
-            if (node->xmlChildrenNode) {
-                xmlNodePtr cur = node->xmlChildrenNode;
-                do {
-                    if (!handle_simple_child(renderer, doc, node, parent, cache, cur,
-                                is_icestats ? number_keys_global : number_keys_source,
-                                is_icestats ? boolean_keys_global : boolean_keys_source
-                                )) {
-                        nodelist_push(&nodelist, cur);
+            cur = cur->next;
+        } while (cur);
+    }
+
+    len = nodelist_fill(&nodelist);
+    for (i = 0; i < len; i++) {
+        xmlNodePtr cur = nodelist_get(&nodelist, i);
+        if (cur == NULL)
+            continue;
+
+        if (cur->type == XML_ELEMENT_NODE && cur->name) {
+            if (strcmp((const char *)cur->name, "modules") == 0) {
+                json_renderer_write_key(renderer, (const char *)cur->name, JSON_RENDERER_FLAGS_NONE);
+                handle_node_modules(renderer, doc, cur, node, cache);
+                nodelist_unset(&nodelist, i);
+            } else if (strcmp((const char *)cur->name, "source") == 0 || strcmp((const char *)cur->name, "role") == 0) {
+                const char *key = "id";
+                size_t j;
+
+                if (strcmp((const char *)cur->name, "source") == 0)
+                    key = "mount";
+
+                json_renderer_write_key(renderer, (const char *)cur->name, JSON_RENDERER_FLAGS_NONE);
+                json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
+
+                for (j = i; j < len; j++) {
+                    xmlNodePtr subcur = nodelist_get(&nodelist, j);
+                    if (subcur == NULL)
+                        continue;
+
+                    if (subcur->type == XML_ELEMENT_NODE && subcur->name && strcmp((const char *)cur->name, (const char *)subcur->name) == 0) {
+                        xmlChar *keyval = xmlGetProp(subcur, XMLSTR(key));
+                        if (keyval) {
+                            json_renderer_write_key(renderer, (const char *)keyval, JSON_RENDERER_FLAGS_NONE);
+                            xmlFree(keyval);
+                            nodelist_unset(&nodelist, j);
+                            render_node_legacystats(renderer, doc, subcur, cur, cache);
+                        }
                     }
-                    cur = cur->next;
-                } while (cur);
-            }
+                }
 
-            len = nodelist_fill(&nodelist);
-            for (i = 0; i < len; i++) {
-                xmlNodePtr cur = nodelist_get(&nodelist, i);
-                if (cur == NULL)
-                    continue;
-
-                if (cur->type == XML_ELEMENT_NODE && cur->name) {
-                    if (strcmp((const char *)cur->name, "modules") == 0) {
-                        json_renderer_write_key(renderer, (const char *)cur->name, JSON_RENDERER_FLAGS_NONE);
-                        handle_node_modules(renderer, doc, cur, node, cache);
-                        nodelist_unset(&nodelist, i);
-                    } else if (strcmp((const char *)cur->name, "source") == 0 || strcmp((const char *)cur->name, "role") == 0) {
-                        const char *key = "id";
-                        size_t j;
-
-                        if (strcmp((const char *)cur->name, "source") == 0)
-                            key = "mount";
-
-                        json_renderer_write_key(renderer, (const char *)cur->name, JSON_RENDERER_FLAGS_NONE);
-                        json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
+                json_renderer_end(renderer);
+            } else if (strcmp((const char *)cur->name, "listener") == 0) {
+                size_t j;
 
-                        for (j = i; j < len; j++) {
-                            xmlNodePtr subcur = nodelist_get(&nodelist, j);
-                            if (subcur == NULL)
-                                continue;
+                json_renderer_write_key(renderer, (const char *)cur->name, JSON_RENDERER_FLAGS_NONE);
+                json_renderer_begin(renderer, JSON_ELEMENT_TYPE_ARRAY);
 
-                            if (subcur->type == XML_ELEMENT_NODE && subcur->name && strcmp((const char *)cur->name, (const char *)subcur->name) == 0) {
-                                xmlChar *keyval = xmlGetProp(subcur, XMLSTR(key));
-                                if (keyval) {
-                                    json_renderer_write_key(renderer, (const char *)keyval, JSON_RENDERER_FLAGS_NONE);
-                                    xmlFree(keyval);
-                                    nodelist_unset(&nodelist, j);
-                                    render_node_legacystats(renderer, doc, subcur, cur, cache);
-                                }
-                            }
-                        }
+                for (j = i; j < len; j++) {
+                    xmlNodePtr subcur = nodelist_get(&nodelist, j);
+                    if (subcur == NULL)
+                        continue;
 
-                        json_renderer_end(renderer);
-                    } else if (strcmp((const char *)cur->name, "listener") == 0) {
-                        size_t j;
+                    if (subcur->type == XML_ELEMENT_NODE && subcur->name && strcmp((const char *)cur->name, (const char *)subcur->name) == 0) {
+                        nodelist_unset(&nodelist, j);
+                        render_node_legacystats(renderer, doc, subcur, cur, cache);
+                    }
+                }
 
-                        json_renderer_write_key(renderer, (const char *)cur->name, JSON_RENDERER_FLAGS_NONE);
-                        json_renderer_begin(renderer, JSON_ELEMENT_TYPE_ARRAY);
+                json_renderer_end(renderer);
+            } else if (strcmp((const char *)cur->name, "metadata") == 0) {
+                size_t j;
+
+                json_renderer_write_key(renderer, (const char *)cur->name, JSON_RENDERER_FLAGS_NONE);
+                json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
+                for (j = i; j < len; j++) {
+                    xmlNodePtr subcur = nodelist_get(&nodelist, j);
+                    if (subcur == NULL)
+                        continue;
 
-                        for (j = i; j < len; j++) {
-                            xmlNodePtr subcur = nodelist_get(&nodelist, j);
-                            if (subcur == NULL)
-                                continue;
+                    if (subcur->type == XML_ELEMENT_NODE && subcur->name && strcmp((const char *)cur->name, (const char *)subcur->name) == 0) {
+                        xmlNodePtr child = subcur->xmlChildrenNode;
+                        while (child) {
+                            handle_textchildnode(renderer, doc, child, subcur, cache);
+                            child = child->next;
+                        }
+                        nodelist_unset(&nodelist, j);
+                    }
+                }
+                json_renderer_end(renderer);
+            } else if (strcmp((const char *)cur->name, "authentication") == 0) {
+                size_t j;
 
-                            if (subcur->type == XML_ELEMENT_NODE && subcur->name && strcmp((const char *)cur->name, (const char *)subcur->name) == 0) {
-                                nodelist_unset(&nodelist, j);
-                                render_node_legacystats(renderer, doc, subcur, cur, cache);
-                            }
+                json_renderer_write_key(renderer, (const char *)cur->name, JSON_RENDERER_FLAGS_NONE);
+                json_renderer_begin(renderer, JSON_ELEMENT_TYPE_ARRAY);
+                for (j = i; j < len; j++) {
+                    xmlNodePtr subcur = nodelist_get(&nodelist, j);
+                    if (subcur == NULL)
+                        continue;
+
+                    if (subcur->type == XML_ELEMENT_NODE && subcur->name && strcmp((const char *)cur->name, (const char *)subcur->name) == 0) {
+                        xmlNodePtr child = subcur->xmlChildrenNode;
+                        while (child) {
+                            render_node_legacystats(renderer, doc, child, subcur, cache);
+                            child = child->next;
                         }
+                        nodelist_unset(&nodelist, j);
+                    }
+                }
+                json_renderer_end(renderer);
+            } else if (strcmp((const char *)cur->name, "removed") == 0) {
+                static const char * keys[] = {"mount", "name", NULL};
+                size_t j;
 
-                        json_renderer_end(renderer);
-                    } else if (strcmp((const char *)cur->name, "metadata") == 0) {
-                        size_t j;
+                json_renderer_write_key(renderer, (const char *)cur->name, JSON_RENDERER_FLAGS_NONE);
+                json_renderer_begin(renderer, JSON_ELEMENT_TYPE_ARRAY);
+                for (j = i; j < len; j++) {
+                    xmlNodePtr subcur = nodelist_get(&nodelist, j);
+                    if (subcur == NULL)
+                        continue;
 
-                        json_renderer_write_key(renderer, (const char *)cur->name, JSON_RENDERER_FLAGS_NONE);
+                    if (subcur->type == XML_ELEMENT_NODE && subcur->name && strcmp((const char *)cur->name, (const char *)subcur->name) == 0) {
                         json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
-                        for (j = i; j < len; j++) {
-                            xmlNodePtr subcur = nodelist_get(&nodelist, j);
-                            if (subcur == NULL)
-                                continue;
-
-                            if (subcur->type == XML_ELEMENT_NODE && subcur->name && strcmp((const char *)cur->name, (const char *)subcur->name) == 0) {
-                                xmlNodePtr child = subcur->xmlChildrenNode;
-                                while (child) {
-                                    handle_textchildnode(renderer, doc, child, subcur, cache);
-                                    child = child->next;
-                                }
-                                nodelist_unset(&nodelist, j);
-                            }
-                        }
-                        json_renderer_end(renderer);
-                    } else if (strcmp((const char *)cur->name, "authentication") == 0) {
-                        size_t j;
+                        for (const char **p = keys; *p; p++) {
+                            xmlChar *keyval = xmlGetProp(subcur, XMLSTR(*p));
 
-                        json_renderer_write_key(renderer, (const char *)cur->name, JSON_RENDERER_FLAGS_NONE);
-                        json_renderer_begin(renderer, JSON_ELEMENT_TYPE_ARRAY);
-                        for (j = i; j < len; j++) {
-                            xmlNodePtr subcur = nodelist_get(&nodelist, j);
-                            if (subcur == NULL)
-                                continue;
-
-                            if (subcur->type == XML_ELEMENT_NODE && subcur->name && strcmp((const char *)cur->name, (const char *)subcur->name) == 0) {
-                                xmlNodePtr child = subcur->xmlChildrenNode;
-                                while (child) {
-                                    render_node_legacystats(renderer, doc, child, subcur, cache);
-                                    child = child->next;
-                                }
-                                nodelist_unset(&nodelist, j);
+                            if (keyval) {
+                                json_renderer_write_key(renderer, *p, JSON_RENDERER_FLAGS_NONE);
+                                json_renderer_write_string(renderer, (const char *)keyval, JSON_RENDERER_FLAGS_NONE);
+                                xmlFree(keyval);
                             }
                         }
                         json_renderer_end(renderer);
-                    } else if (strcmp((const char *)cur->name, "playlist") == 0) {
-                        json_renderer_write_key(renderer, (const char *)cur->name, JSON_RENDERER_FLAGS_NONE);
-                        render_node(renderer, doc, cur, node, cache);
-                        nodelist_unset(&nodelist, i);
-                    } else if (strcmp((const char *)cur->name, "geoip") == 0) {
-                        xmlNodePtr geoip = NULL;
-
-                        for (size_t j = i; j < len; j++) {
-                            xmlNodePtr subcur = nodelist_get(&nodelist, j);
-                            if (subcur == NULL)
-                                continue;
-
-                            if (subcur->type == XML_ELEMENT_NODE && subcur->name && strcmp((const char *)cur->name, (const char *)subcur->name) == 0) {
-                                nodelist_unset(&nodelist, j);
-                                geoip = subcur;
-                            }
-                        }
+                        nodelist_unset(&nodelist, j);
+                    }
+                }
+                json_renderer_end(renderer);
+            } else if (strcmp((const char *)cur->name, "playlist") == 0) {
+                json_renderer_write_key(renderer, (const char *)cur->name, JSON_RENDERER_FLAGS_NONE);
+                render_node(renderer, doc, cur, node, cache);
+                nodelist_unset(&nodelist, i);
+            } else if (strcmp((const char *)cur->name, "geoip") == 0) {
+                xmlNodePtr geoip = NULL;
+
+                for (size_t j = i; j < len; j++) {
+                    xmlNodePtr subcur = nodelist_get(&nodelist, j);
+                    if (subcur == NULL)
+                        continue;
 
-                        if (geoip) {
-                            json_renderer_write_key(renderer, (const char *)cur->name, JSON_RENDERER_FLAGS_NONE);
-                            json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
+                    if (subcur->type == XML_ELEMENT_NODE && subcur->name && strcmp((const char *)cur->name, (const char *)subcur->name) == 0) {
+                        nodelist_unset(&nodelist, j);
+                        geoip = subcur;
+                    }
+                }
 
-                            {
-                                xmlNodePtr child = geoip->xmlChildrenNode;
+                if (geoip) {
+                    json_renderer_write_key(renderer, (const char *)cur->name, JSON_RENDERER_FLAGS_NONE);
+                    json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
 
-                                json_renderer_write_key(renderer, "country", JSON_RENDERER_FLAGS_NONE);
-                                json_renderer_begin(renderer, JSON_ELEMENT_TYPE_ARRAY);
-                                while (child) {
-                                    if (child->type == XML_ELEMENT_NODE && child->name && strcmp((const char *)child->name, "country") == 0) {
-                                        xmlChar *keyval = xmlGetProp(child, XMLSTR("iso-alpha-2"));
+                    {
+                        xmlNodePtr child = geoip->xmlChildrenNode;
 
-                                        json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
+                        json_renderer_write_key(renderer, "country", JSON_RENDERER_FLAGS_NONE);
+                        json_renderer_begin(renderer, JSON_ELEMENT_TYPE_ARRAY);
+                        while (child) {
+                            if (child->type == XML_ELEMENT_NODE && child->name && strcmp((const char *)child->name, "country") == 0) {
+                                xmlChar *keyval = xmlGetProp(child, XMLSTR("iso-alpha-2"));
 
-                                        if (keyval) {
-                                            json_renderer_write_key(renderer, "iso-alpha-2", JSON_RENDERER_FLAGS_NONE);
-                                            json_renderer_write_string(renderer, (const char *)keyval, JSON_RENDERER_FLAGS_NONE);
-                                            xmlFree(keyval);
-                                        }
+                                json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
 
-                                        for (xmlNodePtr subchild = child->xmlChildrenNode; subchild; subchild = subchild->next) {
-                                            if (subchild->type == XML_ELEMENT_NODE && subchild->name) {
-                                                xmlChar *value = xmlNodeListGetString(doc, subchild->xmlChildrenNode, 1);
-                                                if (value) {
-                                                    json_renderer_write_key(renderer, (const char*)subchild->name, JSON_RENDERER_FLAGS_NONE);
-                                                    json_renderer_write_int(renderer, strtoll((const char*)value, NULL, 10));
-                                                    xmlFree(value);
-                                                }
-                                            }
-                                        }
+                                if (keyval) {
+                                    json_renderer_write_key(renderer, "iso-alpha-2", JSON_RENDERER_FLAGS_NONE);
+                                    json_renderer_write_string(renderer, (const char *)keyval, JSON_RENDERER_FLAGS_NONE);
+                                    xmlFree(keyval);
+                                }
 
-                                        json_renderer_end(renderer);
+                                for (xmlNodePtr subchild = child->xmlChildrenNode; subchild; subchild = subchild->next) {
+                                    if (subchild->type == XML_ELEMENT_NODE && subchild->name) {
+                                        xmlChar *value = xmlNodeListGetString(doc, subchild->xmlChildrenNode, 1);
+                                        if (value) {
+                                            json_renderer_write_key(renderer, (const char*)subchild->name, JSON_RENDERER_FLAGS_NONE);
+                                            json_renderer_write_int(renderer, strtoll((const char*)value, NULL, 10));
+                                            xmlFree(value);
+                                        }
                                     }
-                                    child = child->next;
                                 }
+
                                 json_renderer_end(renderer);
                             }
+                            child = child->next;
+                        }
+                        json_renderer_end(renderer);
+                    }
 
-                            {
-                                xmlNodePtr child = geoip->xmlChildrenNode;
-
-                                json_renderer_write_key(renderer, "location", JSON_RENDERER_FLAGS_NONE);
-                                json_renderer_begin(renderer, JSON_ELEMENT_TYPE_ARRAY);
-                                while (child) {
-                                    ICECAST_LOG_INFO("child->name=<%s>", child->name);
-                                    if (child->type == XML_ELEMENT_NODE && child->name && strcmp((const char *)child->name, "location") == 0) {
-                                        static const char * keys[] = {"latitude", "longitude", NULL};
+                    {
+                        xmlNodePtr child = geoip->xmlChildrenNode;
 
-                                        json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
-                                        for (const char **p = keys; *p; p++) {
-                                            xmlChar *keyval = xmlGetProp(child, XMLSTR(*p));
+                        json_renderer_write_key(renderer, "location", JSON_RENDERER_FLAGS_NONE);
+                        json_renderer_begin(renderer, JSON_ELEMENT_TYPE_ARRAY);
+                        while (child) {
+                            ICECAST_LOG_INFO("child->name=<%s>", child->name);
+                            if (child->type == XML_ELEMENT_NODE && child->name && strcmp((const char *)child->name, "location") == 0) {
+                                static const char * keys[] = {"latitude", "longitude", NULL};
 
+                                json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
+                                for (const char **p = keys; *p; p++) {
+                                    xmlChar *keyval = xmlGetProp(child, XMLSTR(*p));
 
-                                            if (keyval) {
-                                                json_renderer_write_key(renderer, *p, JSON_RENDERER_FLAGS_NONE);
-                                                json_renderer_write_string(renderer, (const char *)keyval, JSON_RENDERER_FLAGS_NONE);
-                                                xmlFree(keyval);
-                                            }
 
-                                        }
-                                        json_renderer_end(renderer);
+                                    if (keyval) {
+                                        json_renderer_write_key(renderer, *p, JSON_RENDERER_FLAGS_NONE);
+                                        json_renderer_write_string(renderer, (const char *)keyval, JSON_RENDERER_FLAGS_NONE);
+                                        xmlFree(keyval);
                                     }
-                                    child = child->next;
+
                                 }
                                 json_renderer_end(renderer);
                             }
-
-                            json_renderer_end(renderer);
+                            child = child->next;
                         }
+                        json_renderer_end(renderer);
                     }
+
+                    json_renderer_end(renderer);
                 }
-                //render_node_generic(renderer, doc, node, parent, cache);
             }
+        }
+        //render_node_generic(renderer, doc, node, parent, cache);
+    }
 
-            if (!nodelist_is_empty(&nodelist)) {
-                json_renderer_write_key(renderer, "unhandled-child", JSON_RENDERER_FLAGS_NONE);
-                json_renderer_begin(renderer, JSON_ELEMENT_TYPE_ARRAY);
-                len = nodelist_fill(&nodelist);
-                for (i = 0; i < len; i++) {
-                    xmlNodePtr cur = nodelist_get(&nodelist, i);
-                    if (cur == NULL)
-                        continue;
+    if (!nodelist_is_empty(&nodelist)) {
+        json_renderer_write_key(renderer, "unhandled-child", JSON_RENDERER_FLAGS_NONE);
+        json_renderer_begin(renderer, JSON_ELEMENT_TYPE_ARRAY);
+        len = nodelist_fill(&nodelist);
+        for (i = 0; i < len; i++) {
+            xmlNodePtr cur = nodelist_get(&nodelist, i);
+            if (cur == NULL)
+                continue;
 
-                    render_node(renderer, doc, cur, node, cache);
-                }
-                json_renderer_end(renderer);
-            }
+            render_node(renderer, doc, cur, node, cache);
+        }
+        json_renderer_end(renderer);
+    }
+
+    nodelist_free(&nodelist);
+}
+
+static void render_node_legacystats(json_renderer_t *renderer, xmlDocPtr doc, xmlNodePtr node, xmlNodePtr parent, struct xml2json_cache *cache)
+{
+    int handled = 0;
+
+    if (node->type == XML_ELEMENT_NODE) {
+        const char *nodename = (const char *)node->name;
+        handled = 1;
+        if (strcmp(nodename, "icestats") == 0 || strcmp(nodename, "source") == 0 || strcmp(nodename, "listener") == 0) {
+            int is_icestats = strcmp(nodename, "icestats") == 0;
 
+            if (is_icestats) {
+                json_renderer_begin(renderer, JSON_ELEMENT_TYPE_ARRAY);
+                handle_node_identification(renderer, "icestats", XMLNS_LEGACY_STATS, NULL, NULL, NULL);
+            }
+            json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
+            render_legacystats_children(renderer, doc, node, parent, cache, is_icestats);
             json_renderer_end(renderer);
             if (is_icestats)
                 json_renderer_end(renderer);
-
-            nodelist_free(&nodelist);
         } else if (strcmp(nodename, "role") == 0) {
             json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
             if (node->properties) {
@@ -941,3 +979,61 @@ char * xml2json_render_doc_simple(xmlDocPtr doc, const char *default_namespace)
 
     return json_renderer_finish(&renderer);
 }
+
+void xml2json_render_legacystats_value(json_renderer_t *renderer, int global, const char *name, const char *value)
+{
+    if (write_typed_value(renderer, name, value,
+                global ? legacystats_number_keys_global : legacystats_number_keys_source,
+                global ? legacystats_boolean_keys_global : legacystats_boolean_keys_source))
+        return;
+
+    json_renderer_write_key(renderer, name, JSON_RENDERER_FLAGS_NONE);
+    json_renderer_write_string(renderer, value, JSON_RENDERER_FLAGS_NONE);
+}
+
+void xml2json_render_legacystats_children(json_renderer_t *renderer, xmlNodePtr node, int global)
+{
+    struct xml2json_cache cache;
+
+    memset(&cache, 0, sizeof(cache));
+    cache.default_namespace = XMLNS_LEGACY_STATS;
+
+    render_legacystats_children(renderer, NULL, node, NULL, &cache, global);
+}
+
+void xml2json_render_legacystats_begin(json_renderer_t *renderer)
+{
+    json_renderer_begin(renderer, JSON_ELEMENT_TYPE_ARRAY);
+    handle_node_identification(renderer, "icestats", XMLNS_LEGACY_STATS, NULL, NULL, NULL);
+    json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
+}
+
+void xml2json_render_legacystats_begin_source(json_renderer_t *renderer, const char *mount, int *sources)
+{
+    if (!*sources) {
+        json_renderer_write_key(renderer, "source", JSON_RENDERER_FLAGS_NONE);
+        json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
+        *sources = 1;
+    }
+    json_renderer_write_key(renderer, mount, JSON_RENDERER_FLAGS_NONE);
+    json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
+}
+
+void xml2json_render_legacystats_removed(json_renderer_t *renderer, const char *mount, const char *name, int *removed)
+{
+    if (!*removed) {
+        json_renderer_write_key(renderer, "removed", JSON_RENDERER_FLAGS_NONE);
+        json_renderer_begin(renderer, JSON_ELEMENT_TYPE_ARRAY);
+        *removed = 1;
+    }
+    json_renderer_begin(renderer, JSON_ELEMENT_TYPE_OBJECT);
+    if (mount) {
+        json_renderer_write_key(renderer, "mount", JSON_RENDERER_FLAGS_NONE);
+        json_renderer_write_string(renderer, mount, JSON_RENDERER_FLAGS_NONE);
+    }
+    if (name) {
+        json_renderer_write_key(renderer, "name", JSON_RENDERER_FLAGS_NONE);
+        json_renderer_write_string(renderer, name, JSON_RENDERER_FLAGS_NONE);
+    }
+    json_renderer_end(renderer);
+}
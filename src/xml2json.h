@@ -13,6 +13,26 @@
 
 #include <libxml/tree.h>
 
+#include "json.h"
+
 char * xml2json_render_doc_simple(xmlDocPtr doc, const char *default_namespace);
 
+/* Used to render stats without building a document for them first:
+ * xml2json_render_legacystats_begin() writes the icestats head and begins
+ * its object. xml2json_render_legacystats_value() writes a stat of the
+ * global stats or of a source the same way xml2json_render_doc_simple()
+ * does, and xml2json_render_legacystats_children() the children of node
+ * into the object begun for the icestats or a source.
+ * xml2json_render_legacystats_begin_source() begins the object of a source,
+ * and that of all sources if *sources is not yet set, the caller ends the
+ * source. xml2json_render_legacystats_removed() writes a <removed> entry,
+ * beginning the list if *removed is not yet set. Both lists are ended by
+ * the caller.
+ */
+void xml2json_render_legacystats_begin(json_renderer_t *renderer);
+void xml2json_render_legacystats_value(json_renderer_t *renderer, int global, const char *name, const char *value);
+void xml2json_render_legacystats_children(json_renderer_t *renderer, xmlNodePtr node, int global);
+void xml2json_render_legacystats_begin_source(json_renderer_t *renderer, const char *mount, int *sources);
+void xml2json_render_legacystats_removed(json_renderer_t *renderer, const char *mount, const char *name, int *removed);
+
 #endif
@@ -16,7 +16,10 @@
 #endif
 
 #include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
+#include <ctype.h>
 #include <libxml/xmlmemory.h>
 #include <libxml/debugXML.h>
 #include <libxml/HTMLtree.h>
@@ -60,11 +63,22 @@
 
 #include "logging.h"
 
-typedef struct {
+/* A compiled stylesheet. It is only read once compiled, so any number of
+ * threads can transform with it at the same time. Entries are freed when
+ * the last reference is gone, the cache holding one while it lists them.
+ * All members but stylesheet are guarded by xsltlock.
+ */
+typedef struct stylesheet_cache_tag {
     char *filename;
+    uint32_t hash;
     time_t last_modified;
-    time_t cache_age;
     xsltStylesheetPtr stylesheet;
+    size_t refcount;
+    /* chain of the hash bucket */
+    struct stylesheet_cache_tag *next;
+    /* least recently used list, head is the most recently used */
+    struct stylesheet_cache_tag *lru_prev;
+    struct stylesheet_cache_tag *lru_next;
 } stylesheet_cache_t;
 
 #ifndef HAVE_XSLTSAVERESULTTOSTRING
@@ -93,10 +107,13 @@ int xsltSaveResultToString(xmlChar **doc_txt_ptr, int * doc_txt_len, xmlDocPtr r
 }
 #endif
 
-/* Keep it small... */
-#define CACHESIZE 3
+/* number of hash buckets, a power of two */
+#define CACHE_BUCKETS 256
 
-static stylesheet_cache_t cache[CACHESIZE];
+static stylesheet_cache_t *cache[CACHE_BUCKETS];
+static stylesheet_cache_t *cache_lru_head;
+static stylesheet_cache_t *cache_lru_tail;
+static size_t cache_len;
 static mutex_t xsltlock;
 
 /* Reference to the original xslt loader func */
@@ -104,15 +121,20 @@ static xsltDocLoaderFunc xslt_loader;
 /* Admin URI cache */
 static xmlChar *admin_URI = NULL;
 
+static xmlDocPtr custom_loader(const xmlChar *URI, xmlDictPtr dict, int options, void *ctxt, xsltLoadType type);
+
 void xslt_initialize(void)
 {
-    memset(cache, 0, sizeof(stylesheet_cache_t) * CACHESIZE);
+    memset(cache, 0, sizeof(cache));
     thread_mutex_create(&xsltlock);
     xmlInitParser();
     LIBXML_TEST_VERSION
     xmlSubstituteEntitiesDefault(1);
     xmlLoadExtDtdDefaultValue = 1;
     xslt_loader = xsltDocDefaultLoader;
+    /* these are global to libxslt, set them before transforms can run */
+    xsltSetGenericErrorFunc("", log_parse_failure);
+    xsltSetLoaderFunc(custom_loader);
 }
 
 void xslt_shutdown(void) {
@@ -126,24 +148,111 @@ void xslt_shutdown(void) {
         xmlFree(admin_URI);
 }
 
-static void clear_cache_entry(size_t idx) {
-    free(cache[idx].filename);
-    cache[idx].filename = NULL;
-    if (cache[idx].stylesheet)
-        xsltFreeStylesheet(cache[idx].stylesheet);
-    cache[idx].stylesheet = NULL;
+static uint32_t cache_hash(const char *fn)
+{
+    uint32_t hash = 2166136261U;
+
+    for (; *fn; fn++) {
+#ifdef _WIN32
+        hash ^= (unsigned char)tolower((unsigned char)*fn);
+#else
+        hash ^= (unsigned char)*fn;
+#endif
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+/* drops a reference, must be called with xsltlock held. Returns the
+ * stylesheet to free outside the lock, if any. */
+static xsltStylesheetPtr cache_entry_unref(stylesheet_cache_t *entry)
+{
+    xsltStylesheetPtr ret;
+
+    if (--entry->refcount)
+        return NULL;
+
+    ret = entry->stylesheet;
+    free(entry->filename);
+    free(entry);
+    return ret;
+}
+
+static void cache_entry_release(stylesheet_cache_t *entry)
+{
+    xsltStylesheetPtr stylesheet;
+
+    thread_mutex_lock(&xsltlock);
+    stylesheet = cache_entry_unref(entry);
+    thread_mutex_unlock(&xsltlock);
+
+    if (stylesheet)
+        xsltFreeStylesheet(stylesheet);
+}
+
+/* removes entry from the cache, must be called with xsltlock held */
+static xsltStylesheetPtr cache_remove(stylesheet_cache_t *entry)
+{
+    stylesheet_cache_t **cur;
+
+    for (cur = &cache[entry->hash & (CACHE_BUCKETS - 1)]; *cur; cur = &(*cur)->next) {
+        if (*cur == entry) {
+            *cur = entry->next;
+            break;
+        }
+    }
+
+    if (entry->lru_prev) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        cache_lru_head = entry->lru_next;
+    }
+    if (entry->lru_next) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        cache_lru_tail = entry->lru_prev;
+    }
+
+    cache_len--;
+
+    return cache_entry_unref(entry);
+}
+
+static inline void cache_lru_push(stylesheet_cache_t *entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = cache_lru_head;
+    if (cache_lru_head) {
+        cache_lru_head->lru_prev = entry;
+    } else {
+        cache_lru_tail = entry;
+    }
+    cache_lru_head = entry;
 }
 
 void xslt_clear_cache(void)
 {
+    xsltStylesheetPtr *unused;
+    size_t count = 0;
     size_t i;
 
     ICECAST_LOG_DEBUG("Clearing stylesheet cache.");
 
     thread_mutex_lock(&xsltlock);
 
-    for (i = 0; i < CACHESIZE; i++)
-        clear_cache_entry(i);
+    unused = calloc(cache_len ? cache_len : 1, sizeof(*unused));
+    while (cache_lru_head) {
+        xsltStylesheetPtr stylesheet = cache_remove(cache_lru_head);
+
+        if (stylesheet) {
+            if (unused) {
+                unused[count++] = stylesheet;
+            } else {
+                xsltFreeStylesheet(stylesheet);
+            }
+        }
+    }
 
     if (admin_URI) {
         xmlFree(admin_URI);
@@ -151,27 +260,26 @@ void xslt_clear_cache(void)
     }
 
     thread_mutex_unlock(&xsltlock);
-}
-
-static int evict_cache_entry(void) {
-    int i, age=0, oldest=0;
-
-    for(i=0; i < CACHESIZE; i++) {
-        if(cache[i].cache_age > age) {
-            age = cache[i].cache_age;
-            oldest = i;
-        }
-    }
-
-    clear_cache_entry(oldest);
 
-    return oldest;
+    /* sheets still in use are freed by the last transform using them */
+    for (i = 0; i < count; i++)
+        xsltFreeStylesheet(unused[i]);
+    free(unused);
 }
 
-static xsltStylesheetPtr xslt_get_stylesheet(const char *fn) {
-    int i;
-    int empty = -1;
+/* Looks up the stylesheet in the cache, compiling it if it is missing or
+ * its file changed. The returned entry must be released with
+ * cache_entry_release(). Only compiling is done with xsltlock held, as
+ * includes are resolved using admin_URI.
+ */
+static stylesheet_cache_t *xslt_get_stylesheet(const char *fn, size_t cache_size)
+{
+    stylesheet_cache_t *entry;
+    /* replaced and evicted sheets, freed once xsltlock is released */
+    xsltStylesheetPtr unused[2] = {NULL, NULL};
+    size_t i;
     struct stat file;
+    uint32_t hash;
 
     ICECAST_LOG_DEBUG("Looking up stylesheet file \"%s\".", fn);
 
@@ -181,43 +289,87 @@ static xsltStylesheetPtr xslt_get_stylesheet(const char *fn) {
         return NULL;
     }
 
-    for (i = 0; i < CACHESIZE; i++) {
-        if(cache[i].filename) {
+    hash = cache_hash(fn);
+
+    thread_mutex_lock(&xsltlock);
+    for (entry = cache[hash & (CACHE_BUCKETS - 1)]; entry; entry = entry->next) {
 #ifdef _WIN32
-            if(!stricmp(fn, cache[i].filename)) {
+        if (entry->hash == hash && !stricmp(fn, entry->filename))
 #else
-            if(!strcmp(fn, cache[i].filename)) {
+        if (entry->hash == hash && !strcmp(fn, entry->filename))
 #endif
-                if(file.st_mtime > cache[i].last_modified) {
-                    ICECAST_LOG_DEBUG("Source file newer than cached copy. Reloading slot %i", i);
-                    xsltFreeStylesheet(cache[i].stylesheet);
+            break;
+    }
 
-                    cache[i].last_modified = file.st_mtime;
-                    cache[i].stylesheet = xsltParseStylesheetFile(XMLSTR(fn));
-                    cache[i].cache_age = time(NULL);
+    if (entry) {
+        if (file.st_mtime > entry->last_modified) {
+            ICECAST_LOG_DEBUG("Source file newer than cached copy. Reloading \"%s\"", fn);
+            /* transforms running with the old one keep it until done */
+            unused[0] = cache_remove(entry);
+            entry = NULL;
+        } else {
+            ICECAST_LOG_DEBUG("Using cached sheet \"%s\"", fn);
+            if (entry != cache_lru_head) {
+                entry->lru_prev->lru_next = entry->lru_next;
+                if (entry->lru_next) {
+                    entry->lru_next->lru_prev = entry->lru_prev;
+                } else {
+                    cache_lru_tail = entry->lru_prev;
                 }
-                ICECAST_LOG_DEBUG("Using cached sheet %i", i);
-                return cache[i].stylesheet;
+                cache_lru_push(entry);
             }
-        } else {
-            empty = i;
+            entry->refcount++;
+            thread_mutex_unlock(&xsltlock);
+            return entry;
         }
     }
 
-    if (empty >= 0) {
-        i = empty;
-        ICECAST_LOG_DEBUG("Using empty slot %i", i);
-    } else {
-        i = evict_cache_entry();
-        ICECAST_LOG_DEBUG("Using evicted slot %i", i);
+    entry = calloc(1, sizeof(*entry));
+    if (entry)
+        entry->filename = strdup(fn);
+    if (!entry || !entry->filename) {
+        thread_mutex_unlock(&xsltlock);
+        free(entry);
+        for (i = 0; i < 2; i++)
+            if (unused[i])
+                xsltFreeStylesheet(unused[i]);
+        return NULL;
     }
 
-    cache[i].last_modified = file.st_mtime;
-    cache[i].filename = strdup(fn);
-    cache[i].stylesheet = xsltParseStylesheetFile(XMLSTR(fn));
-    cache[i].cache_age = time(NULL);
+    entry->hash = hash;
+    entry->last_modified = file.st_mtime;
+    entry->stylesheet = xsltParseStylesheetFile(XMLSTR(fn));
+    if (!entry->stylesheet) {
+        thread_mutex_unlock(&xsltlock);
+        free(entry->filename);
+        free(entry);
+        for (i = 0; i < 2; i++)
+            if (unused[i])
+                xsltFreeStylesheet(unused[i]);
+        return NULL;
+    }
+
+    /* one reference for the caller and one for the cache, if enabled */
+    entry->refcount = 1;
+    if (cache_size) {
+        if (cache_len >= cache_size && cache_lru_tail) {
+            ICECAST_LOG_DEBUG("Evicting sheet \"%s\"", cache_lru_tail->filename);
+            unused[1] = cache_remove(cache_lru_tail);
+        }
+
+        entry->refcount++;
+        entry->next = cache[hash & (CACHE_BUCKETS - 1)];
+        cache[hash & (CACHE_BUCKETS - 1)] = entry;
+        cache_lru_push(entry);
+        cache_len++;
+    }
+    thread_mutex_unlock(&xsltlock);
+
+    for (i = 0; i < 2; i++)
+        if (unused[i])
+            xsltFreeStylesheet(unused[i]);
 
-    return cache[i].stylesheet;
+    return entry;
 }
 
 /* Custom xslt loader */
@@ -321,73 +473,112 @@ static inline void _send_error(client_t *client, icecast_error_id_t id, int old_
     client_send_error_by_id(client, id);
 }
 
-void xslt_transform(xmlDocPtr doc, const char *xslfilename, client_t *client, int status, const char *location, const char **params)
+bool xslt_render(xmlDocPtr doc, const char *xslfilename, const char **params, char **body, size_t *len, char **mediatype, char **charset, icecast_error_id_t *error)
 {
     xmlDocPtr res;
+    stylesheet_cache_t *entry;
     xsltStylesheetPtr cur;
-    xmlChar *string;
-    int len, problem = 0;
-    const char *mediatype = NULL;
-    const char *charset = NULL;
+    xmlChar *string = NULL;
+    int string_len = 0, problem = 0;
+    const char *type;
+    ice_config_t *config;
+    size_t cache_size;
 
+    /* per thread in libxml2 */
     xmlSetGenericErrorFunc("", log_parse_failure);
-    xsltSetGenericErrorFunc("", log_parse_failure);
-    xsltSetLoaderFunc(custom_loader);
 
-    thread_mutex_lock(&xsltlock);
-    cur = xslt_get_stylesheet(xslfilename);
+    config = config_get_config();
+    cache_size = config->xslt_cache_size;
+    config_release_config();
+
+    entry = xslt_get_stylesheet(xslfilename, cache_size);
 
-    if (cur == NULL)
+    if (entry == NULL)
     {
-        thread_mutex_unlock(&xsltlock);
         ICECAST_LOG_ERROR("problem reading stylesheet \"%s\"", xslfilename);
-        _send_error(client, ICECAST_ERROR_XSLT_PARSE, status);
-        return;
+        *error = ICECAST_ERROR_XSLT_PARSE;
+        return false;
     }
 
+    /* the reference keeps the sheet alive, no lock needed from here on */
+    cur = entry->stylesheet;
     res = xsltApplyStylesheet(cur, doc, params);
     if (res != NULL) {
-        if (xsltSaveResultToString(&string, &len, res, cur) < 0)
+        if (xsltSaveResultToString(&string, &string_len, res, cur) < 0)
             problem = 1;
     } else {
         problem = 1;
     }
 
-    /* lets find out the content type and character encoding to use */
-    if (cur->encoding)
-       charset = (char *)cur->encoding;
-
-    if (cur->mediaType) {
-        mediatype = (char *)cur->mediaType;
-    } else {
-        /* check method for the default, a missing method assumes xml */
-        if (cur->method && xmlStrcmp(cur->method, XMLSTR("html")) == 0) {
-            mediatype = "text/html";
-        } else if (cur->method && xmlStrcmp(cur->method, XMLSTR("text")) == 0) {
-            mediatype = "text/plain";
-        } else {
-            mediatype = "text/xml";
-        }
-    }
-
     if (problem == 0) {
-        char extra_header[512] = "";
-
-        if (location) {
-            int res = snprintf(extra_header, sizeof(extra_header), "Location: %s\r\n", location);
-            if (res < 0 || res >= (ssize_t)sizeof(extra_header)) {
-                client_send_error_by_id(client, ICECAST_ERROR_GEN_HEADER_GEN_FAILED);
-                return;
+        /* lets find out the content type and character encoding to use */
+        if (cur->mediaType) {
+            type = (char *)cur->mediaType;
+        } else {
+            /* check method for the default, a missing method assumes xml */
+            if (cur->method && xmlStrcmp(cur->method, XMLSTR("html")) == 0) {
+                type = "text/html";
+            } else if (cur->method && xmlStrcmp(cur->method, XMLSTR("text")) == 0) {
+                type = "text/plain";
+            } else {
+                type = "text/xml";
             }
         }
 
-        client_send_buffer(client, status, mediatype, charset, (const char *)string, len, extra_header);
-        xmlFree(string);
+        /* the result outlives the reference to the sheet */
+        *len = string_len;
+        *body = malloc(*len + 1);
+        *mediatype = strdup(type);
+        *charset = cur->encoding ? strdup((const char *)cur->encoding) : NULL;
+        if (*body && *mediatype && (*charset || !cur->encoding)) {
+            if (*len)
+                memcpy(*body, string, *len);
+            (*body)[*len] = 0;
+        } else {
+            free(*body);
+            free(*mediatype);
+            free(*charset);
+            *error = ICECAST_ERROR_GEN_MEMORY_EXHAUSTED;
+            problem = 1;
+        }
     } else {
         ICECAST_LOG_WARN("problem applying stylesheet \"%s\"", xslfilename);
-        _send_error(client, ICECAST_ERROR_XSLT_problem, status);
+        *error = ICECAST_ERROR_XSLT_problem;
     }
-    thread_mutex_unlock (&xsltlock);
+
+    if (string)
+        xmlFree(string);
+    cache_entry_release(entry);
     xmlFreeDoc(res);
+
+    return problem == 0;
 }
 
+void xslt_transform(xmlDocPtr doc, const char *xslfilename, client_t *client, int status, const char *location, const char **params)
+{
+    char *string, *mediatype, *charset;
+    size_t len;
+    icecast_error_id_t error;
+    char extra_header[512] = "";
+
+    if (!xslt_render(doc, xslfilename, params, &string, &len, &mediatype, &charset, &error)) {
+        _send_error(client, error, status);
+        return;
+    }
+
+    if (location) {
+        int ret = snprintf(extra_header, sizeof(extra_header), "Location: %s\r\n", location);
+        if (ret < 0 || ret >= (ssize_t)sizeof(extra_header)) {
+            client_send_error_by_id(client, ICECAST_ERROR_GEN_HEADER_GEN_FAILED);
+            free(string);
+            free(mediatype);
+            free(charset);
+            return;
+        }
+    }
+
+    client_send_buffer(client, status, mediatype, charset, string, len, extra_header);
+    free(string);
+    free(mediatype);
+    free(charset);
+}
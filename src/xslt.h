@@ -11,12 +11,21 @@
  * Copyright 2018-2020, Philipp "ph3-der-loewe" Schafft <lion@lion.leolix.org>,
  */
 
+#include <stdbool.h>
+#include <stddef.h>
+
 #include <libxml/xmlmemory.h>
 #include <libxml/parser.h>
 #include <libxml/tree.h>
 
 #include "icecasttypes.h"
+#include "errors.h"
 
+/* Applies the stylesheet to doc and returns the result in *body, which is
+ * \0 terminated, and the media type and charset to send it with. All of
+ * them are to be free()d. Returns false and sets *error on failure.
+ */
+bool xslt_render(xmlDocPtr doc, const char *xslfilename, const char **params, char **body, size_t *len, char **mediatype, char **charset, icecast_error_id_t *error);
 void xslt_transform(xmlDocPtr doc, const char *xslfilename, client_t *client, int status, const char *location, const char **params);
 void xslt_initialize(void);
 void xslt_shutdown(void);